@@ -0,0 +1,303 @@
+/*
+ * Build the bare metal RISC-V benchmark images
+ *
+ * Copyright (c) 2026 TinyEMU contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+
+/* The images are generated here so that the benchmarks do not need a
+   RISC-V toolchain. They run in M mode from the start of the RAM and
+   power off through HTIF. The end of each phase is signaled to
+   'temu -bench' with the HTIF benchmark device. */
+
+#define HTIF_BASE_ADDR 0x40008000
+#define HTIF_DEV_BENCH 3
+#define VIRTIO_BASE_ADDR 0x40010000 /* virtio console */
+#define VIRTIO_MMIO_QUEUE_NOTIFY 0x050
+
+enum {
+    R_ZERO = 0,
+    R_T0 = 5,
+    R_T1 = 6,
+    R_T2 = 7,
+    R_A0 = 10,
+    R_A1 = 11,
+    R_A2 = 12,
+    R_A3 = 13,
+};
+
+#define CODE_SIZE_MAX 4096
+
+static uint32_t code_buf[CODE_SIZE_MAX];
+static int code_len;
+
+static void emit(uint32_t insn)
+{
+    assert(code_len < CODE_SIZE_MAX);
+    code_buf[code_len++] = insn;
+}
+
+static void emit_lui(int rd, uint32_t imm)
+{
+    emit((imm & 0xfffff000) | (rd << 7) | 0x37);
+}
+
+static void emit_addi(int rd, int rs1, int imm)
+{
+    emit(((imm & 0xfff) << 20) | (rs1 << 15) | (rd << 7) | 0x13);
+}
+
+static void emit_auipc(int rd, uint32_t imm)
+{
+    emit((imm & 0xfffff000) | (rd << 7) | 0x17);
+}
+
+/* funct3: 1 = slli, 5 = srli, 7 = andi */
+static void emit_op_imm(int funct3, int rd, int rs1, int imm)
+{
+    emit(((imm & 0xfff) << 20) | (rs1 << 15) | (funct3 << 12) |
+         (rd << 7) | 0x13);
+}
+
+/* funct7 = 1 selects the multiplications */
+static void emit_op(int funct7, int funct3, int rd, int rs1, int rs2)
+{
+    emit((funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) |
+         (rd << 7) | 0x33);
+}
+
+static void emit_load(int funct3, int rd, int rs1, int imm)
+{
+    emit(((imm & 0xfff) << 20) | (rs1 << 15) | (funct3 << 12) |
+         (rd << 7) | 0x03);
+}
+
+static void emit_store(int funct3, int rs2, int rs1, int imm)
+{
+    emit(((imm >> 5) << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) |
+         ((imm & 0x1f) << 7) | 0x23);
+}
+
+/* 'target' is an index in code_buf[] */
+static void emit_branch(int funct3, int rs1, int rs2, int target)
+{
+    int imm = (target - code_len) * 4;
+    emit((((imm >> 12) & 1) << 31) | (((imm >> 5) & 0x3f) << 25) |
+         (rs2 << 20) | (rs1 << 15) | (funct3 << 12) |
+         (((imm >> 1) & 0xf) << 8) | (((imm >> 11) & 1) << 7) | 0x63);
+}
+
+static void emit_beq(int rs1, int rs2, int target)
+{
+    emit_branch(0, rs1, rs2, target);
+}
+
+static void emit_bne(int rs1, int rs2, int target)
+{
+    emit_branch(1, rs1, rs2, target);
+}
+
+/* only positive 31 bit values */
+static void emit_li(int rd, uint32_t val)
+{
+    assert(val < 0x80000000);
+    if ((val + 0x800) >> 12 != 0) {
+        emit_lui(rd, (val + 0x800) & 0xfffff000);
+        emit_addi(rd, rd, (int32_t)(val << 20) >> 20);
+    } else {
+        emit_addi(rd, R_ZERO, val);
+    }
+}
+
+/* end the phase 'id' (cmd = 0) or the benchmark (cmd = 1) */
+static void emit_bench_marker(int cmd, int id)
+{
+    emit_li(R_T0, HTIF_BASE_ADDR);
+    emit_li(R_T1, (HTIF_DEV_BENCH << 8) | cmd);
+    emit_op_imm(1, R_T1, R_T1, 48);
+    emit_addi(R_T1, R_T1, id);
+    emit_store(3, R_T1, R_T0, 0); /* sd t1, 0(t0) */
+}
+
+static void emit_poweroff(void)
+{
+    emit_li(R_T0, HTIF_BASE_ADDR);
+    emit_li(R_T1, 1);
+    emit_store(3, R_T1, R_T0, 0); /* sd t1, 0(t0) */
+    emit(0x0000006f); /* j . */
+}
+
+/* write the QueueNotify register of the virtio console in a loop. The
+   queue is not set up, so each write only costs the MMIO dispatch. */
+static void gen_notify(void)
+{
+    int loop;
+
+    emit_li(R_T0, VIRTIO_BASE_ADDR);
+    emit_li(R_T1, 10000000);
+    loop = code_len;
+    emit_store(2, R_ZERO, R_T0, VIRTIO_MMIO_QUEUE_NOTIFY); /* sw */
+    emit_addi(R_T1, R_T1, -1);
+    emit_bne(R_T1, R_ZERO, loop);
+    emit_poweroff();
+}
+
+/* interpreter loops: phase 1 is arithmetic, phase 2 accesses a 64 KB
+   buffer and phase 3 has unpredictable branches */
+static void gen_cpu(void)
+{
+    int loop, loop1;
+
+    /* a0 = a1 = a2 = 1 */
+    emit_addi(R_A0, R_ZERO, 1);
+    emit_addi(R_A1, R_ZERO, 1);
+    emit_addi(R_A2, R_ZERO, 1);
+    emit_li(R_T1, 10000000);
+    loop = code_len;
+    emit_op(0, 0, R_A0, R_A0, R_A1); /* add a0, a0, a1 */
+    emit_op(1, 0, R_A1, R_A1, R_A0); /* mul a1, a1, a0 */
+    emit_op(0, 4, R_A2, R_A2, R_A1); /* xor a2, a2, a1 */
+    emit_addi(R_A1, R_A1, 3);
+    emit_addi(R_T1, R_T1, -1);
+    emit_bne(R_T1, R_ZERO, loop);
+    emit_bench_marker(0, 1);
+
+    /* the buffer is 1 MB after the code */
+    emit_li(R_T1, 1000);
+    loop = code_len;
+    emit_auipc(R_A0, 0x100000);
+    emit_op_imm(7, R_A0, R_A0, -16); /* andi a0, a0, -16 */
+    emit_li(R_A3, 4096);
+    loop1 = code_len;
+    emit_load(3, R_A1, R_A0, 0); /* ld a1, 0(a0) */
+    emit_addi(R_A1, R_A1, 1);
+    emit_store(3, R_A1, R_A0, 8); /* sd a1, 8(a0) */
+    emit_addi(R_A0, R_A0, 16);
+    emit_addi(R_A3, R_A3, -1);
+    emit_bne(R_A3, R_ZERO, loop1);
+    emit_addi(R_T1, R_T1, -1);
+    emit_bne(R_T1, R_ZERO, loop);
+    emit_bench_marker(0, 2);
+
+    /* xorshift random generator in a0, a1 counts the odd values */
+    emit_addi(R_A0, R_ZERO, 1);
+    emit_addi(R_A1, R_ZERO, 0);
+    emit_li(R_T1, 10000000);
+    loop = code_len;
+    emit_op_imm(1, R_A2, R_A0, 13); /* slli a2, a0, 13 */
+    emit_op(0, 4, R_A0, R_A0, R_A2); /* xor a0, a0, a2 */
+    emit_op_imm(5, R_A2, R_A0, 7); /* srli a2, a0, 7 */
+    emit_op(0, 4, R_A0, R_A0, R_A2);
+    emit_op_imm(1, R_A2, R_A0, 17);
+    emit_op(0, 4, R_A0, R_A0, R_A2);
+    emit_op_imm(7, R_A2, R_A0, 1); /* andi a2, a0, 1 */
+    emit_beq(R_A2, R_ZERO, code_len + 2);
+    emit_addi(R_A1, R_A1, 1);
+    emit_addi(R_T1, R_T1, -1);
+    emit_bne(R_T1, R_ZERO, loop);
+    emit_bench_marker(0, 3);
+
+    emit_poweroff();
+}
+
+typedef struct {
+    const char *name;
+    void (*gen)(void);
+} BenchDef;
+
+static const BenchDef bench_defs[] = {
+    { "cpu", gen_cpu },
+    { "notify", gen_notify },
+    { NULL },
+};
+
+static void help(void)
+{
+    const BenchDef *b;
+    printf("usage: build_bench name prefix\n"
+           "\n"
+           "Build the benchmark 'name' into prefix.bin with the temu\n"
+           "configuration file prefix.cfg. The benchmarks are:\n");
+    for(b = bench_defs; b->name != NULL; b++)
+        printf("  %s\n", b->name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const BenchDef *b;
+    const char *name, *prefix, *p;
+    char filename[1024];
+    uint8_t buf[4];
+    FILE *f;
+    int i;
+
+    if (argc != 3)
+        help();
+    name = argv[1];
+    prefix = argv[2];
+    for(b = bench_defs; b->name != NULL; b++) {
+        if (!strcmp(b->name, name))
+            break;
+    }
+    if (!b->name)
+        help();
+    b->gen();
+
+    snprintf(filename, sizeof(filename), "%s.bin", prefix);
+    f = fopen(filename, "wb");
+    if (!f) {
+        perror(filename);
+        exit(1);
+    }
+    for(i = 0; i < code_len; i++) {
+        /* little endian */
+        buf[0] = code_buf[i];
+        buf[1] = code_buf[i] >> 8;
+        buf[2] = code_buf[i] >> 16;
+        buf[3] = code_buf[i] >> 24;
+        fwrite(buf, 1, 4, f);
+    }
+    fclose(f);
+
+    /* the path of the image is relative to the configuration file */
+    p = strrchr(prefix, '/');
+    p = p ? p + 1 : prefix;
+    snprintf(filename, sizeof(filename), "%s.cfg", prefix);
+    f = fopen(filename, "wb");
+    if (!f) {
+        perror(filename);
+        exit(1);
+    }
+    fprintf(f, "/* VM configuration file */\n"
+            "{\n"
+            "    version: 1,\n"
+            "    machine: \"riscv64\",\n"
+            "    memory_size: 16,\n"
+            "    bios: \"%s.bin\",\n"
+            "}\n", p);
+    fclose(f);
+    return 0;
+}
@@ -28,6 +28,7 @@
 #include <assert.h>
 #include <stdarg.h>
 #include <sys/time.h>
+#include <time.h>
 #include <ctype.h>
 
 #include "cutils.h"
@@ -84,6 +85,13 @@ int strstart(const char *str, const char *val, const char **ptr)
     return 1;
 }
 
+int64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 void dbuf_init(DynBuf *s)
 {
     memset(s, 0, sizeof(*s));
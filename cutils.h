@@ -82,6 +82,22 @@ static inline int min_int(int a, int b)
         return b;
 }
 
+static inline int64_t max_int64(int64_t a, int64_t b)
+{
+    if (a > b)
+        return a;
+    else
+        return b;
+}
+
+static inline int64_t min_int64(int64_t a, int64_t b)
+{
+    if (a < b)
+        return a;
+    else
+        return b;
+}
+
 void *mallocz(size_t size);
 
 #if defined(_WIN32)
@@ -90,6 +106,11 @@ static inline uint32_t bswap_32(uint32_t v)
     return ((v & 0xff000000) >> 24) | ((v & 0x00ff0000) >>  8) |
         ((v & 0x0000ff00) <<  8) | ((v & 0x000000ff) << 24);
 }
+
+static inline uint64_t bswap_64(uint64_t v)
+{
+    return ((uint64_t)bswap_32(v) << 32) | bswap_32(v >> 32);
+}
 #else
 #include <byteswap.h>
 #endif
@@ -160,17 +181,42 @@ static inline uint32_t cpu_to_be32(uint32_t v)
 }
 #endif
 
-/* XXX: optimize */
+static inline int clz32(uint32_t a)
+{
+    if (a == 0)
+        return 32;
+    return __builtin_clz(a);
+}
+
+static inline int clz64(uint64_t a)
+{
+    if (a == 0)
+        return 64;
+    return __builtin_clzll(a);
+}
+
 static inline int ctz32(uint32_t a)
 {
-    int i;
     if (a == 0)
         return 32;
-    for(i = 0; i < 32; i++) {
-        if ((a >> i) & 1)
-            return i;
-    }
-    return 32;
+    return __builtin_ctz(a);
+}
+
+static inline int ctz64(uint64_t a)
+{
+    if (a == 0)
+        return 64;
+    return __builtin_ctzll(a);
+}
+
+static inline int popcount32(uint32_t a)
+{
+    return __builtin_popcount(a);
+}
+
+static inline int popcount64(uint64_t a)
+{
+    return __builtin_popcountll(a);
 }
 
 
@@ -178,6 +224,7 @@ void *mallocz(size_t size);
 void pstrcpy(char *buf, int buf_size, const char *str);
 char *pstrcat(char *buf, int buf_size, const char *s);
 int strstart(const char *str, const char *val, const char **ptr);
+int64_t get_time_ns(void); /* monotonic clock */
 
 typedef struct {
     uint8_t *buf;
@@ -283,8 +283,8 @@ void fs_net_set_fdset(int *pfd_max, fd_set *rfds, fd_set *wfds, fd_set *efds,
     curl_multi_fdset(curl_multi_ctx, rfds, wfds, efds, &fd_max);
     *pfd_max = max_int(*pfd_max, fd_max);
     curl_multi_timeout(curl_multi_ctx, &timeout);
-    if (timeout >= 0)
-        *ptimeout = min_int(*ptimeout, timeout);
+    if (timeout >= 0 && (*ptimeout < 0 || timeout < *ptimeout))
+        *ptimeout = timeout;
 }
 
 void fs_net_event_loop(FSNetEventLoopCompletionFunc *cb, void *opaque)
@@ -27,6 +27,11 @@
 #include <string.h>
 #include <inttypes.h>
 #include <assert.h>
+#if !defined(_WIN32) && !defined(EMSCRIPTEN)
+#include <unistd.h>
+#include <sys/mman.h>
+#define USE_MMAP
+#endif
 
 #include "cutils.h"
 #include "iomem.h"
@@ -53,28 +58,131 @@ void phys_mem_map_end(PhysMemoryMap *s)
 {
     int i;
     PhysMemoryRange *pr;
+    PhysMemoryRangeTable *t;
 
     for(i = 0; i < s->n_phys_mem_range; i++) {
-        pr = &s->phys_mem_range[i];
+        pr = s->phys_mem_range[i];
         if (pr->is_ram) {
             s->free_ram(s, pr);
         }
+        free(pr->regs);
+        free(pr);
+    }
+    free(s->phys_mem_range);
+    /* no CPU can use the tables any more */
+    while (s->range_table) {
+        t = s->range_table;
+        s->range_table = t->prev;
+        free(t);
     }
     free(s);
 }
 
-/* return NULL if not found */
-/* XXX: optimize */
-PhysMemoryRange *get_phys_mem_range(PhysMemoryMap *s, uint64_t paddr)
+/* must be called when a range is added, moved, enabled or disabled.
+   The CPU threads may be doing lookups in the previous table, so it
+   is kept until phys_mem_map_end(). */
+static void phys_mem_map_update(PhysMemoryMap *s)
 {
+    PhysMemoryRangeTable *t;
+    PhysMemoryRangeEntry *e, *e1;
     PhysMemoryRange *pr;
-    int i;
+    int i, j, n;
+
+    t = mallocz(sizeof(*t) + s->n_phys_mem_range * sizeof(t->tab[0]));
+    /* insertion sort: the maps only have a few ranges */
+    n = 0;
     for(i = 0; i < s->n_phys_mem_range; i++) {
-        pr = &s->phys_mem_range[i];
-        if (paddr >= pr->addr && paddr < pr->addr + pr->size)
-            return pr;
+        pr = s->phys_mem_range[i];
+        if (pr->size == 0)
+            continue;
+        for(j = n; j > 0 && t->tab[j - 1].addr > pr->addr; j--)
+            t->tab[j] = t->tab[j - 1];
+        e = &t->tab[j];
+        e->addr = pr->addr;
+        e->size = pr->size;
+        e->pr = pr;
+        n++;
+    }
+    t->n = n;
+    t->has_overlap = FALSE;
+    for(i = 1; i < n; i++) {
+        e = &t->tab[i - 1];
+        e1 = &t->tab[i];
+        if (e1->addr - e->addr < e->size)
+            t->has_overlap = TRUE;
+    }
+    if (t->has_overlap) {
+        /* the first registered range has the priority */
+        n = 0;
+        for(i = 0; i < s->n_phys_mem_range; i++) {
+            pr = s->phys_mem_range[i];
+            if (pr->size == 0)
+                continue;
+            e = &t->tab[n++];
+            e->addr = pr->addr;
+            e->size = pr->size;
+            e->pr = pr;
+        }
+    }
+    t->prev = s->range_table;
+    /* the entries must be visible before the table */
+    __atomic_store_n(&s->range_table, t, __ATOMIC_RELEASE);
+    __atomic_store_n(&s->last_range, NULL, __ATOMIC_RELAXED);
+}
+
+/* return NULL if not found. May be called by several CPU threads. */
+PhysMemoryRange *get_phys_mem_range_slow(PhysMemoryMap *s, uint64_t paddr)
+{
+    PhysMemoryRangeTable *t;
+    PhysMemoryRangeEntry *e;
+    int i, a, b;
+
+    t = __atomic_load_n(&s->range_table, __ATOMIC_ACQUIRE);
+    if (!t)
+        return NULL;
+    if (unlikely(t->has_overlap)) {
+        /* the last range is not cached because it may hide another
+           one */
+        for(i = 0; i < t->n; i++) {
+            e = &t->tab[i];
+            if ((paddr - e->addr) < e->size)
+                return e->pr;
+        }
+        return NULL;
+    }
+    /* find the last range starting before paddr */
+    a = 0;
+    b = t->n;
+    while (a < b) {
+        i = (a + b) >> 1;
+        if (t->tab[i].addr <= paddr)
+            a = i + 1;
+        else
+            b = i;
+    }
+    if (a == 0)
+        return NULL;
+    e = &t->tab[a - 1];
+    if ((paddr - e->addr) >= e->size)
+        return NULL;
+    __atomic_store_n(&s->last_range, e->pr, __ATOMIC_RELAXED);
+    return e->pr;
+}
+
+static PhysMemoryRange *phys_mem_range_new(PhysMemoryMap *s)
+{
+    PhysMemoryRange *pr;
+
+    if (s->n_phys_mem_range >= s->phys_mem_range_size) {
+        s->phys_mem_range_size = max_int(s->phys_mem_range_size * 2, 16);
+        s->phys_mem_range = realloc(s->phys_mem_range,
+                                    s->phys_mem_range_size *
+                                    sizeof(s->phys_mem_range[0]));
     }
-    return NULL;
+    pr = mallocz(sizeof(*pr));
+    pr->index = s->n_phys_mem_range;
+    s->phys_mem_range[s->n_phys_mem_range++] = pr;
+    return pr;
 }
 
 PhysMemoryRange *register_ram_entry(PhysMemoryMap *s, uint64_t addr,
@@ -82,9 +190,8 @@ PhysMemoryRange *register_ram_entry(PhysMemoryMap *s, uint64_t addr,
 {
     PhysMemoryRange *pr;
 
-    assert(s->n_phys_mem_range < PHYS_MEM_RANGE_MAX);
     assert((size & (DEVRAM_PAGE_SIZE - 1)) == 0 && size != 0);
-    pr = &s->phys_mem_range[s->n_phys_mem_range++];
+    pr = phys_mem_range_new(s);
     pr->map = s;
     pr->is_ram = TRUE;
     pr->devram_flags = devram_flags & ~DEVRAM_FLAG_DISABLED;
@@ -96,9 +203,48 @@ PhysMemoryRange *register_ram_entry(PhysMemoryMap *s, uint64_t addr,
         pr->size = pr->org_size;
     pr->phys_mem = NULL;
     pr->dirty_bits = NULL;
+    phys_mem_map_update(s);
     return pr;
 }
 
+#ifdef USE_MMAP
+
+#define HUGE_PAGE_SIZE (2 << 20)
+
+/* The anonymous mappings are zeroed by the host when the pages are
+   first touched, so the unused RAM costs nothing. */
+static uint8_t *ram_alloc(size_t size, int devram_flags)
+{
+    uint8_t *ptr;
+    size_t page_size, align, map_size, head;
+
+    page_size = getpagesize();
+    size = (size + page_size - 1) & ~(page_size - 1);
+    /* the huge pages must be aligned in the host address space */
+    if (devram_flags & DEVRAM_FLAG_HUGE_PAGES)
+        align = HUGE_PAGE_SIZE;
+    else
+        align = page_size;
+    map_size = size + align - page_size;
+    ptr = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+    head = -(uintptr_t)ptr & (align - 1);
+    if (head != 0)
+        munmap(ptr, head);
+    if (map_size - head - size != 0)
+        munmap(ptr + head + size, map_size - head - size);
+    ptr += head;
+#ifdef MADV_HUGEPAGE
+    if (devram_flags & DEVRAM_FLAG_HUGE_PAGES)
+        madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    return ptr;
+}
+
+#endif /* USE_MMAP */
+
 static PhysMemoryRange *default_register_ram(PhysMemoryMap *s, uint64_t addr,
                                              uint64_t size, int devram_flags)
 {
@@ -106,7 +252,12 @@ static PhysMemoryRange *default_register_ram(PhysMemoryMap *s, uint64_t addr,
 
     pr = register_ram_entry(s, addr, size, devram_flags);
 
+#ifdef USE_MMAP
+    pr->phys_mem = ram_alloc(size, devram_flags);
+    pr->devram_flags |= DEVRAM_FLAG_MMAP;
+#else
     pr->phys_mem = mallocz(size);
+#endif
     if (!pr->phys_mem) {
         fprintf(stderr, "Could not allocate VM memory\n");
         exit(1);
@@ -131,27 +282,20 @@ static const uint32_t *default_get_dirty_bits(PhysMemoryMap *map,
                                               PhysMemoryRange *pr)
 {
     uint32_t *dirty_bits;
-    BOOL has_dirty_bits;
-    size_t n, i;
     
     dirty_bits = pr->dirty_bits;
-
-    has_dirty_bits = FALSE;
-    n = pr->dirty_bits_size / sizeof(uint32_t);
-    for(i = 0; i < n; i++) {
-        if (dirty_bits[i] != 0) {
-            has_dirty_bits = TRUE;
-            break;
-        }
-    }
-    if (has_dirty_bits && pr->size != 0) {
-        /* invalidate the corresponding CPU write TLBs */
-        map->flush_tlb_write_range(map->opaque, pr->phys_mem, pr->org_size);
+    if (pr->size != 0) {
+        /* invalidate the corresponding CPU write TLBs. It is done even
+           if no bit is set because the CPUs running in other threads
+           may flush them later. */
+        map->flush_tlb_write_range(map->opaque, pr, pr->phys_mem,
+                                   pr->org_size);
     }
     
     pr->dirty_bits_index ^= 1;
-    pr->dirty_bits = pr->dirty_bits_tab[pr->dirty_bits_index];
-    memset(pr->dirty_bits, 0, pr->dirty_bits_size);
+    memset(pr->dirty_bits_tab[pr->dirty_bits_index], 0, pr->dirty_bits_size);
+    __atomic_store_n(&pr->dirty_bits, pr->dirty_bits_tab[pr->dirty_bits_index],
+                     __ATOMIC_RELEASE);
     return dirty_bits;
 }
 
@@ -165,11 +309,11 @@ void phys_mem_reset_dirty_bit(PhysMemoryRange *pr, size_t offset)
         page_index = offset >> DEVRAM_PAGE_SIZE_LOG2;
         mask = 1 << (page_index & 0x1f);
         dirty_bits_ptr = pr->dirty_bits + (page_index >> 5);
-        if (*dirty_bits_ptr & mask) {
-            *dirty_bits_ptr &= ~mask;
+        if (__atomic_fetch_and(dirty_bits_ptr, ~mask,
+                               __ATOMIC_RELAXED) & mask) {
             /* invalidate the corresponding CPU write TLBs */
             map = pr->map;
-            map->flush_tlb_write_range(map->opaque,
+            map->flush_tlb_write_range(map->opaque, pr,
                                        pr->phys_mem + (offset & ~(DEVRAM_PAGE_SIZE - 1)),
                                        DEVRAM_PAGE_SIZE);
         }
@@ -178,6 +322,12 @@ void phys_mem_reset_dirty_bit(PhysMemoryRange *pr, size_t offset)
 
 static void default_free_ram(PhysMemoryMap *s, PhysMemoryRange *pr)
 {
+#ifdef USE_MMAP
+    if (pr->devram_flags & DEVRAM_FLAG_MMAP) {
+        munmap(pr->phys_mem, pr->org_size);
+        return;
+    }
+#endif
     free(pr->phys_mem);
 }
 
@@ -187,9 +337,8 @@ PhysMemoryRange *cpu_register_device(PhysMemoryMap *s, uint64_t addr,
                                      int devio_flags)
 {
     PhysMemoryRange *pr;
-    assert(s->n_phys_mem_range < PHYS_MEM_RANGE_MAX);
     assert(size <= 0xffffffff);
-    pr = &s->phys_mem_range[s->n_phys_mem_range++];
+    pr = phys_mem_range_new(s);
     pr->map = s;
     pr->addr = addr;
     pr->org_size = size;
@@ -202,9 +351,28 @@ PhysMemoryRange *cpu_register_device(PhysMemoryMap *s, uint64_t addr,
     pr->read_func = read_func;
     pr->write_func = write_func;
     pr->devio_flags = devio_flags;
+    phys_mem_map_update(s);
     return pr;
 }
 
+/* The register handlers avoid decoding the offset for the hot
+   registers. They are only used for the access sizes in
+   'devio_flags'. */
+void cpu_register_device_reg(PhysMemoryRange *pr, uint32_t offset,
+                             DeviceReadFunc *read_func,
+                             DeviceWriteFunc *write_func, int devio_flags)
+{
+    PhysMemoryReg *r;
+
+    assert(!pr->is_ram && offset < pr->org_size);
+    pr->regs = realloc(pr->regs, (pr->n_regs + 1) * sizeof(pr->regs[0]));
+    r = &pr->regs[pr->n_regs++];
+    r->offset = offset;
+    r->devio_flags = devio_flags;
+    r->read_func = read_func;
+    r->write_func = write_func;
+}
+
 static void default_set_addr(PhysMemoryMap *map,
                              PhysMemoryRange *pr, uint64_t addr, BOOL enabled)
 {
@@ -212,7 +380,7 @@ static void default_set_addr(PhysMemoryMap *map,
         if (pr->size == 0 || pr->addr != addr) {
             /* enable or move mapping */
             if (pr->is_ram) {
-                map->flush_tlb_write_range(map->opaque,
+                map->flush_tlb_write_range(map->opaque, pr,
                                            pr->phys_mem, pr->org_size);
             }
             pr->addr = addr;
@@ -222,7 +390,7 @@ static void default_set_addr(PhysMemoryMap *map,
         if (pr->size != 0) {
             /* disable mapping */
             if (pr->is_ram) {
-                map->flush_tlb_write_range(map->opaque,
+                map->flush_tlb_write_range(map->opaque, pr,
                                            pr->phys_mem, pr->org_size);
             }
             pr->addr = 0;
@@ -237,8 +405,29 @@ void phys_mem_set_addr(PhysMemoryRange *pr, uint64_t addr, BOOL enabled)
     if (!pr->is_ram) {
         default_set_addr(map, pr, addr, enabled);
     } else {
-        return map->set_ram_addr(map, pr, addr, enabled);
+        map->set_ram_addr(map, pr, addr, enabled);
+    }
+    phys_mem_map_update(map);
+}
+
+/* a measure around a short device callback is mostly the time needed
+   to read the clock, so this time is estimated here */
+void phys_mem_set_devio_profile(PhysMemoryMap *s, BOOL enable)
+{
+    int64_t t0, t1, d;
+    int i;
+
+    s->devio_profile = enable;
+    s->devio_clock_cost = 0;
+    if (!enable)
+        return;
+    d = INT64_MAX;
+    for(i = 0; i < 100; i++) {
+        t0 = get_time_ns();
+        t1 = get_time_ns();
+        d = min_int64(d, t1 - t0);
     }
+    s->devio_clock_cost = d;
 }
 
 /* return NULL if no valid RAM page. The access can only be done in the page */
@@ -34,17 +34,31 @@ typedef uint32_t DeviceReadFunc(void *opaque, uint32_t offset, int size_log2);
 /* not supported, could add specific 64 bit callbacks when needed */
 //#define DEVIO_SIZE64 (1 << 3) 
 #define DEVIO_DISABLED (1 << 4)
+/* register handler which may be called without the I/O lock */
+#define DEVIO_LOCKLESS (1 << 5)
 
 #define DEVRAM_FLAG_ROM        (1 << 0) /* not writable */
 #define DEVRAM_FLAG_DIRTY_BITS (1 << 1) /* maintain dirty bits */
 #define DEVRAM_FLAG_DISABLED   (1 << 2) /* allocated but not mapped */
+#define DEVRAM_FLAG_MMAP       (1 << 3) /* phys_mem is mapped with mmap() */
+#define DEVRAM_FLAG_HUGE_PAGES (1 << 4) /* hint: use the host huge pages */
 #define DEVRAM_PAGE_SIZE_LOG2 12
 #define DEVRAM_PAGE_SIZE (1 << DEVRAM_PAGE_SIZE_LOG2)
 
 typedef struct PhysMemoryMap PhysMemoryMap;
 
+/* handlers of a frequently accessed device register, called instead
+   of the handlers of the range */
+typedef struct {
+    uint32_t offset;
+    int devio_flags; /* DEVIO_SIZExx and DEVIO_LOCKLESS */
+    DeviceReadFunc *read_func; /* NULL to use the range handler */
+    DeviceWriteFunc *write_func; /* NULL to use the range handler */
+} PhysMemoryReg;
+
 typedef struct {
     PhysMemoryMap *map;
+    int index; /* in map->phys_mem_range[] */
     uint64_t addr;
     uint64_t org_size; /* original size */
     uint64_t size; /* =org_size or 0 if the mapping is disabled */
@@ -61,13 +75,39 @@ typedef struct {
     DeviceReadFunc *read_func;
     DeviceWriteFunc *write_func;
     int devio_flags;
+    int n_regs;
+    PhysMemoryReg *regs;
 } PhysMemoryRange;
 
-#define PHYS_MEM_RANGE_MAX 32
+typedef struct {
+    uint64_t addr;
+    uint64_t size;
+    PhysMemoryRange *pr;
+} PhysMemoryRangeEntry;
+
+/* immutable snapshot of the enabled ranges */
+typedef struct PhysMemoryRangeTable {
+    struct PhysMemoryRangeTable *prev; /* previously published table */
+    /* if FALSE, the entries are sorted by address. Otherwise they are
+       in registration order. */
+    BOOL has_overlap;
+    int n;
+    PhysMemoryRangeEntry tab[0];
+} PhysMemoryRangeTable;
 
 struct PhysMemoryMap {
+    /* in registration order: it gives the priority of overlapping
+       ranges */
     int n_phys_mem_range;
-    PhysMemoryRange phys_mem_range[PHYS_MEM_RANGE_MAX];
+    int phys_mem_range_size; /* allocated size of phys_mem_range[] */
+    PhysMemoryRange **phys_mem_range;
+    /* table used by the lookups. It is read by the CPU threads without
+       lock, so a new table is published for each update and the
+       previous ones are only freed by phys_mem_map_end(). */
+    PhysMemoryRangeTable *range_table;
+    /* last range found by a lookup. It is shared by the CPU threads,
+       so it is accessed with relaxed atomic operations. */
+    PhysMemoryRange *last_range;
     PhysMemoryRange *(*register_ram)(PhysMemoryMap *s, uint64_t addr,
                                      uint64_t size, int devram_flags);
     void (*free_ram)(PhysMemoryMap *s, PhysMemoryRange *pr);
@@ -75,8 +115,16 @@ struct PhysMemoryMap {
     void (*set_ram_addr)(PhysMemoryMap *s, PhysMemoryRange *pr, uint64_t addr,
                          BOOL enabled);
     void *opaque;
-    void (*flush_tlb_write_range)(void *opaque, uint8_t *ram_addr,
-                                  size_t ram_size);
+    /* 'pr' is the RAM range containing [ram_addr, ram_addr + ram_size) */
+    void (*flush_tlb_write_range)(void *opaque, PhysMemoryRange *pr,
+                                  uint8_t *ram_addr, size_t ram_size);
+    /* if not NULL, called around the device accesses done by the CPUs
+       when they run in several threads */
+    void (*io_lock)(void *opaque, BOOL lock);
+    /* if TRUE, the CPUs measure the time spent in the device
+       callbacks (see phys_mem_set_devio_profile()) */
+    BOOL devio_profile;
+    int64_t devio_clock_cost; /* in ns, subtracted from each measure */
 };
 
 
@@ -93,7 +141,22 @@ PhysMemoryRange *cpu_register_device(PhysMemoryMap *s, uint64_t addr,
                                      uint64_t size, void *opaque,
                                      DeviceReadFunc *read_func, DeviceWriteFunc *write_func,
                                      int devio_flags);
-PhysMemoryRange *get_phys_mem_range(PhysMemoryMap *s, uint64_t paddr);
+void cpu_register_device_reg(PhysMemoryRange *pr, uint32_t offset,
+                             DeviceReadFunc *read_func,
+                             DeviceWriteFunc *write_func, int devio_flags);
+PhysMemoryRange *get_phys_mem_range_slow(PhysMemoryMap *s, uint64_t paddr);
+
+/* return NULL if not found */
+static inline PhysMemoryRange *get_phys_mem_range(PhysMemoryMap *s,
+                                                  uint64_t paddr)
+{
+    PhysMemoryRange *pr = __atomic_load_n(&s->last_range, __ATOMIC_RELAXED);
+    /* a disabled range has a zero size */
+    if (likely(pr && (paddr - pr->addr) < pr->size))
+        return pr;
+    return get_phys_mem_range_slow(s, paddr);
+}
+
 void phys_mem_set_addr(PhysMemoryRange *pr, uint64_t addr, BOOL enabled);
 
 static inline const uint32_t *phys_mem_get_dirty_bits(PhysMemoryRange *pr)
@@ -102,15 +165,17 @@ static inline const uint32_t *phys_mem_get_dirty_bits(PhysMemoryRange *pr)
     return map->get_dirty_bits(map, pr);
 }
 
+/* may be called by several CPU threads */
 static inline void phys_mem_set_dirty_bit(PhysMemoryRange *pr, size_t offset)
 {
     size_t page_index;
-    uint32_t mask, *dirty_bits_ptr;
-    if (pr->dirty_bits) {
+    uint32_t mask, *dirty_bits;
+    dirty_bits = __atomic_load_n(&pr->dirty_bits, __ATOMIC_ACQUIRE);
+    if (dirty_bits) {
         page_index = offset >> DEVRAM_PAGE_SIZE_LOG2;
         mask = 1 << (page_index & 0x1f);
-        dirty_bits_ptr = pr->dirty_bits + (page_index >> 5);
-        *dirty_bits_ptr |= mask;
+        __atomic_fetch_or(dirty_bits + (page_index >> 5), mask,
+                          __ATOMIC_RELAXED);
     }
 }
 
@@ -125,7 +190,27 @@ static inline BOOL phys_mem_is_dirty_bit(PhysMemoryRange *pr, size_t offset)
     return (*dirty_bits_ptr >> (page_index & 0x1f)) & 1;
 }
 
+static inline void phys_mem_io_lock(PhysMemoryMap *s, BOOL lock)
+{
+    if (s->io_lock)
+        s->io_lock(s->opaque, lock);
+}
+
+/* return NULL if the register at 'offset' of the device has no
+   handler of its own */
+static inline PhysMemoryReg *phys_mem_get_reg(PhysMemoryRange *pr,
+                                              uint32_t offset)
+{
+    int i;
+    for(i = 0; i < pr->n_regs; i++) {
+        if (pr->regs[i].offset == offset)
+            return &pr->regs[i];
+    }
+    return NULL;
+}
+
 void phys_mem_reset_dirty_bit(PhysMemoryRange *pr, size_t offset);
+void phys_mem_set_devio_profile(PhysMemoryMap *s, BOOL enable);
 uint8_t *phys_mem_get_ram_ptr(PhysMemoryMap *map, uint64_t paddr, BOOL is_rw);
 
 /* IRQ support */
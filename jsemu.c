@@ -305,7 +305,8 @@ static void init_vm(void *arg)
 void virt_machine_run(void *opaque)
 {
     VirtMachine *m = opaque;
-    int delay, i;
+    int64_t delay;
+    int i;
     FBDevice *fb_dev;
     
     if (m->console_dev && virtio_console_can_write_data(m->console_dev)) {
@@ -333,7 +334,7 @@ void virt_machine_run(void *opaque)
     i = 0;
     for(;;) {
         /* wait for an event: the only asynchronous event is the RTC timer */
-        delay = virt_machine_get_sleep_duration(m, MAX_SLEEP_TIME);
+        delay = virt_machine_get_sleep_duration(m, MAX_SLEEP_TIME * 1000000);
         if (delay != 0 || i >= MAX_EXEC_TOTAL_CYCLE / MAX_EXEC_CYCLE)
             break;
         virt_machine_interp(m, MAX_EXEC_CYCLE);
@@ -261,6 +261,10 @@ static int virt_machine_parse_config(VirtMachineParams *p,
     if (vm_get_int(cfg, tag_name, &val) < 0)
         goto tag_fail;
     p->ram_size = (uint64_t)val << 20;
+
+    tag_name = "cpus";
+    if (vm_get_int_opt(cfg, tag_name, &p->cpu_count, 1) < 0)
+        goto tag_fail;
     
     tag_name = "bios";
     if (vm_get_str_opt(cfg, tag_name, &str) < 0)
@@ -638,3 +642,32 @@ void virt_machine_end(VirtMachine *s)
 {
     s->vmc->virt_machine_end(s);
 }
+
+static int virt_machine_snapshot(VirtMachine *s, const char *filename,
+                                 BOOL is_load)
+{
+    SnapshotFile *f;
+
+    if (!s->vmc->virt_machine_snapshot) {
+        vm_error("snapshots are not supported by this machine\n");
+        return -1;
+    }
+    f = snapshot_open(filename, is_load);
+    if (!f)
+        return -1;
+    s->vmc->virt_machine_snapshot(s, f);
+    return snapshot_close(f);
+}
+
+/* return -1 if error */
+int virt_machine_save_snapshot(VirtMachine *s, const char *filename)
+{
+    return virt_machine_snapshot(s, filename, FALSE);
+}
+
+/* must be called just after virt_machine_init() with the same
+   configuration. Return -1 if error. */
+int virt_machine_load_snapshot(VirtMachine *s, const char *filename)
+{
+    return virt_machine_snapshot(s, filename, TRUE);
+}
@@ -87,6 +87,7 @@ typedef struct {
     const VirtMachineClass *vmc;
     char *machine_name;
     uint64_t ram_size;
+    int cpu_count; /* number of harts (RISC-V machine only) */
     BOOL rtc_real_time;
     BOOL rtc_local_time;
     char *display_device; /* NULL means no display */
@@ -101,6 +102,10 @@ typedef struct {
 
     char *cmdline; /* bios or kernel command line */
     BOOL accel_enable; /* enable acceleration (KVM) */
+    BOOL jit_enable; /* enable the x86_64 JIT (RISC-V machine only) */
+    BOOL dump_stats; /* print the CPU statistics at power off (RISC-V machine only) */
+    BOOL huge_pages; /* back the RAM with the host huge pages (RISC-V machine only) */
+    BOOL devio_profile; /* measure the time spent in the device callbacks (RISC-V machine only) */
     char *input_device; /* NULL means no input */
     
     /* kernel, bios and other auxiliary files */
@@ -116,19 +121,61 @@ typedef struct VirtMachine {
     CharacterDevice *console;
     /* graphics */
     FBDevice *fb_dev;
+    /* fork server: the guest waits at the fork point until it is
+       resumed in a forked child */
+    BOOL fork_server;
+    BOOL fork_pending; /* the guest reached the fork point */
+    /* benchmark mode: if not NULL, called when the guest marks the end
+       of a benchmark phase or of the benchmark and at power off. It
+       may exit. */
+    void (*bench_event)(struct VirtMachine *s, int event, uint32_t id);
 } VirtMachine;
 
+typedef enum {
+    BENCH_EVENT_PHASE, /* end of the phase 'id' */
+    BENCH_EVENT_STOP, /* end of the benchmark */
+    BENCH_EVENT_POWER_OFF,
+} BenchEventEnum;
+
+/* counters since the machine was started, summed over the CPUs */
+typedef struct {
+    uint64_t insn_counter; /* executed instructions */
+    uint64_t code_tlb_miss; /* instruction TLB misses */
+    uint64_t read_slow; /* loads missing the TLB or accessing a device */
+    uint64_t write_slow; /* stores missing the TLB or accessing a device */
+    uint64_t page_walks;
+    uint64_t exceptions;
+    uint64_t interrupts;
+    uint64_t devio_count; /* device accesses done by the CPUs */
+    uint64_t devio_time; /* in ns, sampled only with 'devio_profile' */
+} VirtMachineStats;
+
 struct VirtMachineClass {
     const char *machine_names;
     void (*virt_machine_set_defaults)(VirtMachineParams *p);
     VirtMachine *(*virt_machine_init)(const VirtMachineParams *p);
     void (*virt_machine_end)(VirtMachine *s);
-    int (*virt_machine_get_sleep_duration)(VirtMachine *s, int delay);
+    /* return the time in ns until the next timer event (at most
+       'delay', -1 meaning no limit), 0 if the CPU must run or -1 if it
+       can sleep until an external event */
+    int64_t (*virt_machine_get_sleep_duration)(VirtMachine *s, int64_t delay);
+    /* execute at most 'max_exec_cycle' cycles. The machine can return
+       before to handle its next timer event. */
     void (*virt_machine_interp)(VirtMachine *s, int max_exec_cycle);
     BOOL (*vm_mouse_is_absolute)(VirtMachine *s);
     void (*vm_send_mouse_event)(VirtMachine *s1, int dx, int dy, int dz,
                                 unsigned int buttons);
     void (*vm_send_key_event)(VirtMachine *s1, BOOL is_down, uint16_t key_code);
+    /* optional: serializes the device emulation with the CPU threads */
+    void (*virt_machine_io_lock)(VirtMachine *s, BOOL lock);
+    /* optional: saves or restores the machine state. Called between
+       two virt_machine_interp() calls. */
+    void (*virt_machine_snapshot)(VirtMachine *s, SnapshotFile *f);
+    /* optional: resumes the guest waiting at the fork point */
+    void (*virt_machine_resume_fork)(VirtMachine *s, uint32_t child_id);
+    /* optional. Inside virt_machine_interp(), the instruction counter
+       is only updated at the CSR accesses. */
+    void (*virt_machine_get_stats)(VirtMachine *s, VirtMachineStats *st);
 };
 
 extern const VirtMachineClass riscv_machine_class;
@@ -148,7 +195,10 @@ char *get_file_path(const char *base_filename, const char *filename);
 void virt_machine_free_config(VirtMachineParams *p);
 VirtMachine *virt_machine_init(const VirtMachineParams *p);
 void virt_machine_end(VirtMachine *s);
-static inline int virt_machine_get_sleep_duration(VirtMachine *s, int delay)
+int virt_machine_save_snapshot(VirtMachine *s, const char *filename);
+int virt_machine_load_snapshot(VirtMachine *s, const char *filename);
+static inline int64_t virt_machine_get_sleep_duration(VirtMachine *s,
+                                                      int64_t delay)
 {
     return s->vmc->virt_machine_get_sleep_duration(s, delay);
 }
@@ -156,6 +206,21 @@ static inline void virt_machine_interp(VirtMachine *s, int max_exec_cycle)
 {
     s->vmc->virt_machine_interp(s, max_exec_cycle);
 }
+static inline void virt_machine_io_lock(VirtMachine *s, BOOL lock)
+{
+    if (s->vmc->virt_machine_io_lock)
+        s->vmc->virt_machine_io_lock(s, lock);
+}
+static inline void virt_machine_resume_fork(VirtMachine *s,
+                                            uint32_t child_id)
+{
+    if (s->vmc->virt_machine_resume_fork)
+        s->vmc->virt_machine_resume_fork(s, child_id);
+}
+static inline void virt_machine_get_stats(VirtMachine *s, VirtMachineStats *st)
+{
+    s->vmc->virt_machine_get_stats(s, st);
+}
 static inline BOOL vm_mouse_is_absolute(VirtMachine *s)
 {
     return s->vmc->vm_mouse_is_absolute(s);
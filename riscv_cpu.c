@@ -28,6 +28,10 @@
 #include <inttypes.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <stddef.h>
+#ifndef EMSCRIPTEN
+#include <sys/mman.h>
+#endif
 
 #include "cutils.h"
 #include "iomem.h"
@@ -52,7 +56,32 @@
 
 #if FLEN > 0
 #include "softfp.h"
+
+#ifdef CONFIG_HOST_FPU
+#include <math.h>
+#include <float.h>
+#if FLT_EVAL_METHOD != 0
+/* excess precision (e.g. x87): the results would be rounded twice */
+#undef CONFIG_HOST_FPU
+#endif
+#endif
+
+#define F_SIZE 32
+#include "riscv_cpu_hostfp_template.h"
+#if FLEN >= 64
+#define F_SIZE 64
+#include "riscv_cpu_hostfp_template.h"
+#endif
+#if FLEN >= 128
+/* no fast path for the 128 bit floats */
+#define host_add_sf128 add_sf128
+#define host_sub_sf128 sub_sf128
+#define host_mul_sf128 mul_sf128
+#define host_div_sf128 div_sf128
+#define host_sqrt_sf128 sqrt_sf128
+#define host_fma_sf128 fma_sf128
 #endif
+#endif /* FLEN > 0 */
 
 #ifdef USE_GLOBAL_STATE
 static RISCVCPUState riscv_cpu_global_state;
@@ -61,6 +90,8 @@ static RISCVCPUState riscv_cpu_global_state;
 #define code_ptr s->__code_ptr
 #define code_end s->__code_end
 #define code_to_pc_addend s->__code_to_pc_addend
+#define insn_ptr s->__insn_ptr
+#define insn_end s->__insn_end
 #endif
 
 #ifdef CONFIG_LOGFILE
@@ -149,16 +180,34 @@ static __attribute__((unused)) void cpu_abort(RISCVCPUState *s)
     abort();
 }
 
+static BOOL tb_invalidate_range(RISCVCPUState *s, uint8_t *page_ptr,
+                                uint8_t *ptr, int len);
+
 /* addr must be aligned. Only RAM accesses are supported */
 #define PHYS_MEM_READ_WRITE(size, uint_type) \
 static __maybe_unused inline void phys_write_u ## size(RISCVCPUState *s, target_ulong addr,\
                                         uint_type val)                   \
 {\
     PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, addr);\
+    uint8_t *ptr;\
+    if (!pr || !pr->is_ram)\
+        return;\
+    ptr = pr->phys_mem + (uintptr_t)(addr - pr->addr);\
+    tb_invalidate_range(s, ptr - (addr & PG_MASK), ptr, size / 8);\
+    *(uint_type *)ptr = val;\
+}\
+\
+/* atomic with respect to the other harts */\
+static __maybe_unused inline void phys_or_u ## size(RISCVCPUState *s, target_ulong addr,\
+                                        uint_type val)                   \
+{\
+    PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, addr);\
+    uint8_t *ptr;\
     if (!pr || !pr->is_ram)\
         return;\
-    *(uint_type *)(pr->phys_mem + \
-                 (uintptr_t)(addr - pr->addr)) = val;\
+    ptr = pr->phys_mem + (uintptr_t)(addr - pr->addr);\
+    tb_invalidate_range(s, ptr - (addr & PG_MASK), ptr, size / 8);\
+    __atomic_fetch_or((uint_type *)ptr, val, __ATOMIC_SEQ_CST);\
 }\
 \
 static __maybe_unused inline uint_type phys_read_u ## size(RISCVCPUState *s, target_ulong addr) \
@@ -179,10 +228,92 @@ PHYS_MEM_READ_WRITE(64, uint64_t)
 #define PTE_A_MASK (1 << 6)
 #define PTE_D_MASK (1 << 7)
 
+#if MAX_XLEN == 32
+#define SATP_ASID_SHIFT 22
+#define SATP_ASID_MASK  0x1ff
+#else
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK  0xffff
+#endif
+
 #define ACCESS_READ  0
 #define ACCESS_WRITE 1
 #define ACCESS_CODE  2
 
+static inline PTWEntry *ptw_cache_get(RISCVCPUState *s, int level,
+                                      target_ulong vaddr, int shift)
+{
+    return &s->ptw_cache[level - 1][(vaddr >> shift) & (PTW_CACHE_SIZE - 1)];
+}
+
+/* return the physical address of the page table of level 'level'
+   (> 0) mapping 'vaddr' or -1 if not in the cache. 'shift' is log2
+   of the size mapped by the page table. */
+static inline target_ulong ptw_cache_find(RISCVCPUState *s, int level,
+                                          target_ulong vaddr, int shift)
+{
+    PTWEntry *pe = ptw_cache_get(s, level, vaddr, shift);
+    if (pe->satp == s->satp && pe->vpn == (vaddr >> shift))
+        return pe->table;
+    else
+        return -1;
+}
+
+static void ptw_cache_add(RISCVCPUState *s, int level, target_ulong vaddr,
+                          int shift, target_ulong table)
+{
+    PTWEntry *pe = ptw_cache_get(s, level, vaddr, shift);
+    pe->satp = s->satp;
+    pe->vpn = vaddr >> shift;
+    pe->table = table;
+    pe->shift = shift;
+}
+
+/* return the physical address of 'vaddr' if it is in a superpage
+   translated for the access type 'access', or -1 */
+static inline target_ulong tlb_find_superpage(RISCVCPUState *s,
+                                              target_ulong vaddr, int access)
+{
+    TLBAux *aux = &s->tlb_ctx[s->tlb_cur].aux[access];
+    TLBSuperpage *sp;
+    int i;
+
+    for(i = 0; i < TLB_SP_SIZE; i++) {
+        sp = &aux->sp[i];
+        if (sp->shift != 0 && ((vaddr ^ sp->vaddr) >> sp->shift) == 0) {
+            s->stats.tlb_sp_hit++;
+            return sp->paddr | (vaddr & (((target_ulong)1 << sp->shift) - 1));
+        }
+    }
+    return -1;
+}
+
+/* add the translation of the superpage of size 1 << shift containing
+   'vaddr' for the access type 'access' */
+static void tlb_add_superpage(RISCVCPUState *s, target_ulong vaddr,
+                              target_ulong paddr, int shift, int access)
+{
+    TLBContext *c = &s->tlb_ctx[s->tlb_cur];
+    TLBAux *aux = &c->aux[access];
+    target_ulong mask = ((target_ulong)1 << shift) - 1;
+    TLBSuperpage *sp;
+
+    sp = &aux->sp[aux->sp_next];
+    aux->sp_next = (aux->sp_next + 1) % TLB_SP_SIZE;
+    sp->vaddr = vaddr & ~mask;
+    sp->paddr = paddr & ~mask;
+    sp->shift = shift;
+
+    /* the 4 KB entries in this range must be flushed with the
+       superpage */
+    if ((vaddr & ~mask) < c->sp_start)
+        c->sp_start = vaddr & ~mask;
+    if ((vaddr | mask) > c->sp_last)
+        c->sp_last = vaddr | mask;
+    if (shift > c->sp_shift)
+        c->sp_shift = shift;
+}
+
 /* access = 0: read, 1 = write, 2 = code. Set the exception_pending
    field if necessary. return 0 if OK, -1 if translation error */
 static int get_phys_addr(RISCVCPUState *s,
@@ -238,13 +369,30 @@ static int get_phys_addr(RISCVCPUState *s,
         pte_addr_bits = 44;
     }
 #endif
-    pte_addr = (s->satp & (((target_ulong)1 << pte_addr_bits) - 1)) << PG_SHIFT;
+    paddr = tlb_find_superpage(s, vaddr, access);
+    if (paddr != -1) {
+        *ppaddr = paddr;
+        return 0;
+    }
+    s->stats.page_walks++;
     pte_bits = 12 - pte_size_log2;
     pte_mask = (1 << pte_bits) - 1;
-    for(i = 0; i < levels; i++) {
+    /* start from the deepest page table in the cache */
+    for(i = levels - 1; i > 0; i--) {
+        pte_addr = ptw_cache_find(s, i, vaddr,
+                                  PG_SHIFT + pte_bits * (levels - i));
+        if (pte_addr != -1) {
+            s->stats.ptw_hit++;
+            break;
+        }
+    }
+    if (i == 0)
+        pte_addr = (s->satp & (((target_ulong)1 << pte_addr_bits) - 1)) << PG_SHIFT;
+    for(; i < levels; i++) {
         vaddr_shift = PG_SHIFT + pte_bits * (levels - 1 - i);
         pte_idx = (vaddr >> vaddr_shift) & pte_mask;
         pte_addr += pte_idx << pte_size_log2;
+        s->stats.pte_reads++;
         if (pte_size_log2 == 2)
             pte = phys_read_u32(s, pte_addr);
         else
@@ -278,31 +426,158 @@ static int get_phys_addr(RISCVCPUState *s,
             if (access == ACCESS_WRITE)
                 pte |= PTE_D_MASK;
             if (need_write) {
+                /* only set the A and D bits so that a PTE modified
+                   by another hart is not overwritten */
                 if (pte_size_log2 == 2)
-                    phys_write_u32(s, pte_addr, pte);
+                    phys_or_u32(s, pte_addr, pte & (PTE_A_MASK | PTE_D_MASK));
                 else
-                    phys_write_u64(s, pte_addr, pte);
+                    phys_or_u64(s, pte_addr, pte & (PTE_A_MASK | PTE_D_MASK));
             }
             vaddr_mask = ((target_ulong)1 << vaddr_shift) - 1;
+            if (vaddr_shift > PG_SHIFT)
+                tlb_add_superpage(s, vaddr, paddr, vaddr_shift, access);
             *ppaddr = (vaddr & vaddr_mask) | (paddr  & ~vaddr_mask);
             return 0;
         } else {
             pte_addr = paddr;
+            if (i < levels - 1)
+                ptw_cache_add(s, i + 1, vaddr, vaddr_shift, pte_addr);
         }
     }
     return -1;
 }
 
+static inline TLBEntry *tlb_get(RISCVCPUState *s, int access)
+{
+    if (access == ACCESS_READ)
+        return s->tlb_read;
+    else if (access == ACCESS_WRITE)
+        return s->tlb_write;
+    else
+        return s->tlb_code;
+}
+
+/* insert 'te' in way 0 of the set 'idx'. The entry of the last way
+   goes to the victim buffer. */
+static void tlb_insert(RISCVCPUState *s, int access, int idx,
+                       const TLBEntry *te)
+{
+    TLBEntry *tlb = tlb_get(s, access);
+    TLBAux *aux;
+    int w;
+
+    if (tlb[(TLB_WAYS - 1) * TLB_SIZE + idx].vaddr != -1) {
+        s->stats.tlb_conflict++;
+        aux = &s->tlb_ctx[s->tlb_cur].aux[access];
+        aux->victim[aux->victim_next] = tlb[(TLB_WAYS - 1) * TLB_SIZE + idx];
+        aux->victim_next = (aux->victim_next + 1) % TLB_VICTIM_SIZE;
+    }
+    for(w = TLB_WAYS - 1; w > 0; w--)
+        tlb[w * TLB_SIZE + idx] = tlb[(w - 1) * TLB_SIZE + idx];
+    tlb[idx] = *te;
+}
+
+static inline uint32_t tlb_write_filter_idx(uint8_t *ptr)
+{
+    return ((uintptr_t)ptr >> PG_SHIFT) & (TLB_WRITE_FILTER_BITS - 1);
+}
+
+static inline void tlb_write_filter_set(RISCVCPUState *s, uint8_t *ptr)
+{
+    uint32_t i = tlb_write_filter_idx(ptr);
+    s->tlb_write_filter[i >> 5] |= 1U << (i & 0x1f);
+}
+
+static inline BOOL tlb_write_filter_test(RISCVCPUState *s, uint8_t *ptr)
+{
+    uint32_t i = tlb_write_filter_idx(ptr);
+    return (s->tlb_write_filter[i >> 5] >> (i & 0x1f)) & 1;
+}
+
+static void tlb_add(RISCVCPUState *s, int access, target_ulong addr,
+                    uint8_t *ptr)
+{
+    TLBEntry te;
+    if (access == ACCESS_WRITE)
+        tlb_write_filter_set(s, ptr);
+    te.vaddr = addr & ~PG_MASK;
+    te.mem_addend = (uintptr_t)ptr - addr;
+    tlb_insert(s, access, (addr >> PG_SHIFT) & (TLB_SIZE - 1), &te);
+}
+
+/* look for the aligned address 'addr' in the ways other than way 0
+   and in the victim buffer. If found, the entry is moved to way 0 and
+   the host address is returned, otherwise NULL. */
+static uint8_t *tlb_lookup_slow(RISCVCPUState *s, int access,
+                                target_ulong addr)
+{
+    TLBEntry *tlb, *te, te1;
+    TLBAux *aux;
+    target_ulong vaddr;
+    int idx, w, i;
+
+    tlb = tlb_get(s, access);
+    vaddr = addr & ~PG_MASK;
+    idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
+    for(w = 1; w < TLB_WAYS; w++) {
+        te = &tlb[w * TLB_SIZE + idx];
+        if (te->vaddr == vaddr) {
+            s->stats.tlb_way_hit++;
+            te1 = *te;
+            for(; w > 0; w--)
+                tlb[w * TLB_SIZE + idx] = tlb[(w - 1) * TLB_SIZE + idx];
+            tlb[idx] = te1;
+            return (uint8_t *)(te1.mem_addend + (uintptr_t)addr);
+        }
+    }
+    aux = &s->tlb_ctx[s->tlb_cur].aux[access];
+    for(i = 0; i < TLB_VICTIM_SIZE; i++) {
+        te = &aux->victim[i];
+        if (te->vaddr == vaddr) {
+            s->stats.tlb_victim_hit++;
+            te1 = *te;
+            te->vaddr = -1;
+            tlb_insert(s, access, idx, &te1);
+            return (uint8_t *)(te1.mem_addend + (uintptr_t)addr);
+        }
+    }
+    return NULL;
+}
+
+/* the clock is only read for one device access out of
+   DEVIO_SAMPLE_PERIOD to keep the profiling cheap */
+#define DEVIO_SAMPLE_PERIOD 64
+
+/* return the start time to give to devio_profile_end() or 0 */
+static inline int64_t devio_profile_start(RISCVCPUState *s)
+{
+    if ((s->stats.devio_count++ & (DEVIO_SAMPLE_PERIOD - 1)) != 0 ||
+        !s->mem_map->devio_profile)
+        return 0;
+    return get_time_ns();
+}
+
+static inline void devio_profile_end(RISCVCPUState *s, int64_t start_time)
+{
+    int64_t d;
+    if (start_time == 0)
+        return;
+    d = get_time_ns() - start_time - s->mem_map->devio_clock_cost;
+    if (d > 0)
+        s->stats.devio_time += d * DEVIO_SAMPLE_PERIOD;
+}
+
 /* return 0 if OK, != 0 if exception */
 int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
                      target_ulong addr, int size_log2)
 {
-    int size, tlb_idx, err, al;
+    int size, err, al;
     target_ulong paddr, offset;
     uint8_t *ptr;
     PhysMemoryRange *pr;
     mem_uint_t ret;
 
+    s->stats.read_slow++;
     /* first handle unaligned accesses */
     size = 1 << size_log2;
     al = addr & (size - 1);
@@ -367,6 +642,9 @@ int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
             abort();
         }
     } else {
+        ptr = tlb_lookup_slow(s, ACCESS_READ, addr);
+        if (ptr)
+            goto read_ram;
         if (get_phys_addr(s, &paddr, addr, ACCESS_READ)) {
             s->pending_tval = addr;
             s->pending_exception = CAUSE_LOAD_PAGE_FAULT;
@@ -381,10 +659,9 @@ int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
 #endif
             return 0;
         } else if (pr->is_ram) {
-            tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
             ptr = pr->phys_mem + (uintptr_t)(paddr - pr->addr);
-            s->tlb_read[tlb_idx].vaddr = addr & ~PG_MASK;
-            s->tlb_read[tlb_idx].mem_addend = (uintptr_t)ptr - addr;
+            tlb_add(s, ACCESS_READ, addr, ptr);
+        read_ram:
             switch(size_log2) {
             case 0:
                 ret = *(uint8_t *)ptr;
@@ -409,7 +686,22 @@ int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
                 abort();
             }
         } else {
+            PhysMemoryReg *r;
+            int64_t devio_start;
             offset = paddr - pr->addr;
+            devio_start = devio_profile_start(s);
+            r = phys_mem_get_reg(pr, offset);
+            if (r && r->read_func && ((r->devio_flags >> size_log2) & 1)) {
+                if (r->devio_flags & DEVIO_LOCKLESS) {
+                    ret = r->read_func(pr->opaque, offset, size_log2);
+                } else {
+                    phys_mem_io_lock(s->mem_map, TRUE);
+                    ret = r->read_func(pr->opaque, offset, size_log2);
+                    phys_mem_io_lock(s->mem_map, FALSE);
+                }
+                goto devio_done;
+            }
+            phys_mem_io_lock(s->mem_map, TRUE);
             if (((pr->devio_flags >> size_log2) & 1) != 0) {
                 ret = pr->read_func(pr->opaque, offset, size_log2);
             }
@@ -429,6 +721,9 @@ int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
 #endif
                 ret = 0;
             }
+            phys_mem_io_lock(s->mem_map, FALSE);
+        devio_done:
+            devio_profile_end(s, devio_start);
         }
     }
     *pval = ret;
@@ -439,11 +734,12 @@ int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
 int target_write_slow(RISCVCPUState *s, target_ulong addr,
                       mem_uint_t val, int size_log2)
 {
-    int size, i, tlb_idx, err;
+    int size, i, err;
     target_ulong paddr, offset;
     uint8_t *ptr;
     PhysMemoryRange *pr;
     
+    s->stats.write_slow++;
     /* first handle unaligned accesses */
     size = 1 << size_log2;
     if ((addr & (size - 1)) != 0) {
@@ -454,6 +750,9 @@ int target_write_slow(RISCVCPUState *s, target_ulong addr,
                 return err;
         }
     } else {
+        ptr = tlb_lookup_slow(s, ACCESS_WRITE, addr);
+        if (ptr)
+            goto write_ram;
         if (get_phys_addr(s, &paddr, addr, ACCESS_WRITE)) {
             s->pending_tval = addr;
             s->pending_exception = CAUSE_STORE_PAGE_FAULT;
@@ -468,10 +767,14 @@ int target_write_slow(RISCVCPUState *s, target_ulong addr,
 #endif
         } else if (pr->is_ram) {
             phys_mem_set_dirty_bit(pr, paddr - pr->addr);
-            tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
             ptr = pr->phys_mem + (uintptr_t)(paddr - pr->addr);
-            s->tlb_write[tlb_idx].vaddr = addr & ~PG_MASK;
-            s->tlb_write[tlb_idx].mem_addend = (uintptr_t)ptr - addr;
+            /* the pages containing translated code are never in the
+               write TLB so that their modification is detected */
+            if (!tb_invalidate_range(s, ptr - (paddr & PG_MASK),
+                                     ptr, size)) {
+                tlb_add(s, ACCESS_WRITE, addr, ptr);
+            }
+        write_ram:
             switch(size_log2) {
             case 0:
                 *(uint8_t *)ptr = val;
@@ -496,7 +799,22 @@ int target_write_slow(RISCVCPUState *s, target_ulong addr,
                 abort();
             }
         } else {
+            PhysMemoryReg *r;
+            int64_t devio_start;
             offset = paddr - pr->addr;
+            devio_start = devio_profile_start(s);
+            r = phys_mem_get_reg(pr, offset);
+            if (r && r->write_func && ((r->devio_flags >> size_log2) & 1)) {
+                if (r->devio_flags & DEVIO_LOCKLESS) {
+                    r->write_func(pr->opaque, offset, val, size_log2);
+                } else {
+                    phys_mem_io_lock(s->mem_map, TRUE);
+                    r->write_func(pr->opaque, offset, val, size_log2);
+                    phys_mem_io_lock(s->mem_map, FALSE);
+                }
+                goto devio_done;
+            }
+            phys_mem_io_lock(s->mem_map, TRUE);
             if (((pr->devio_flags >> size_log2) & 1) != 0) {
                 pr->write_func(pr->opaque, offset, val, size_log2);
             }
@@ -516,11 +834,80 @@ int target_write_slow(RISCVCPUState *s, target_ulong addr,
                 printf(" width=%d bits\n", 1 << (3 + size_log2));
 #endif
             }
+            phys_mem_io_lock(s->mem_map, FALSE);
+        devio_done:
+            devio_profile_end(s, devio_start);
         }
     }
     return 0;
 }
 
+/* Return in *pptr the host address of a naturally aligned RAM location
+   for an atomic read-modify-write access or NULL if the access must be
+   done with separate reads and writes (unaligned or I/O access).
+   Return 0 if OK, != 0 if exception. */
+static inline __exception int target_get_rmw_ptr(RISCVCPUState *s,
+                                                 uint8_t **pptr,
+                                                 target_ulong addr,
+                                                 int size_log2)
+{
+    int size, tlb_idx;
+    target_ulong paddr;
+    uint8_t *ptr;
+    PhysMemoryRange *pr;
+
+    size = 1 << size_log2;
+    tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
+    if (likely(s->tlb_write[tlb_idx].vaddr ==
+               (addr & ~(PG_MASK & ~(size - 1))))) {
+        *pptr = (uint8_t *)(s->tlb_write[tlb_idx].mem_addend +
+                            (uintptr_t)addr);
+        return 0;
+    }
+    *pptr = NULL;
+    if ((addr & (size - 1)) != 0)
+        return 0;
+    ptr = tlb_lookup_slow(s, ACCESS_WRITE, addr);
+    if (ptr) {
+        *pptr = ptr;
+        return 0;
+    }
+    if (get_phys_addr(s, &paddr, addr, ACCESS_WRITE)) {
+        s->pending_tval = addr;
+        s->pending_exception = CAUSE_STORE_PAGE_FAULT;
+        return -1;
+    }
+    pr = get_phys_mem_range(s->mem_map, paddr);
+    if (!pr || !pr->is_ram)
+        return 0;
+    phys_mem_set_dirty_bit(pr, paddr - pr->addr);
+    ptr = pr->phys_mem + (uintptr_t)(paddr - pr->addr);
+    if (!tb_invalidate_range(s, ptr - (paddr & PG_MASK), ptr, size))
+        tlb_add(s, ACCESS_WRITE, addr, ptr);
+    *pptr = ptr;
+    return 0;
+}
+
+/* host atomics used for the A extension. Return TRUE if the value was
+   stored, otherwise *pold is updated with the current value. */
+#define ATOMIC_CMPXCHG(size, uint_type)                                 \
+static inline BOOL atomic_cmpxchg_u ## size(uint8_t *ptr, uint_type *pold, \
+                                            uint_type new_val)          \
+{                                                                       \
+    return __atomic_compare_exchange_n((uint_type *)ptr, pold, new_val, \
+                                       FALSE, __ATOMIC_SEQ_CST,         \
+                                       __ATOMIC_SEQ_CST);               \
+}
+
+ATOMIC_CMPXCHG(32, uint32_t)
+#if MLEN >= 64
+ATOMIC_CMPXCHG(64, uint64_t)
+#endif
+#if MLEN >= 128
+/* may be implemented in libatomic (e.g. cmpxchg16b on x86_64) */
+ATOMIC_CMPXCHG(128, uint128_t)
+#endif
+
 struct __attribute__((packed)) unaligned_u32 {
     uint32_t u32;
 };
@@ -540,11 +927,16 @@ static no_inline __exception int target_read_insn_slow(RISCVCPUState *s,
                                                        uint8_t **pptr,
                                                        target_ulong addr)
 {
-    int tlb_idx;
     target_ulong paddr;
     uint8_t *ptr;
     PhysMemoryRange *pr;
     
+    s->stats.code_slow++;
+    ptr = tlb_lookup_slow(s, ACCESS_CODE, addr);
+    if (ptr) {
+        *pptr = ptr;
+        return 0;
+    }
     if (get_phys_addr(s, &paddr, addr, ACCESS_CODE)) {
         s->pending_tval = addr;
         s->pending_exception = CAUSE_FETCH_PAGE_FAULT;
@@ -557,10 +949,8 @@ static no_inline __exception int target_read_insn_slow(RISCVCPUState *s,
         s->pending_exception = CAUSE_FAULT_FETCH;
         return -1;
     }
-    tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
     ptr = pr->phys_mem + (uintptr_t)(paddr - pr->addr);
-    s->tlb_code[tlb_idx].vaddr = addr & ~PG_MASK;
-    s->tlb_code[tlb_idx].mem_addend = (uintptr_t)ptr - addr;
+    tlb_add(s, ACCESS_CODE, addr, ptr);
     *pptr = ptr;
     return 0;
 }
@@ -584,128 +974,668 @@ static inline __exception int target_read_insn_u16(RISCVCPUState *s, uint16_t *p
     return 0;
 }
 
+static void tlb_ctx_flush(TLBContext *c)
+{
+    TLBAux *aux;
+    int i, j;
+
+    for(i = 0; i < TLB_WAYS * TLB_SIZE; i++) {
+        c->tlb_read[i].vaddr = -1;
+        c->tlb_write[i].vaddr = -1;
+        c->tlb_code[i].vaddr = -1;
+    }
+    for(j = 0; j < 3; j++) {
+        aux = &c->aux[j];
+        for(i = 0; i < TLB_VICTIM_SIZE; i++)
+            aux->victim[i].vaddr = -1;
+        aux->victim_next = 0;
+        for(i = 0; i < TLB_SP_SIZE; i++)
+            aux->sp[i].shift = 0;
+        aux->sp_next = 0;
+    }
+    c->sp_start = -1;
+    c->sp_last = 0;
+    c->sp_shift = 0;
+}
+
+static void tlb_select_ctx(RISCVCPUState *s, int idx)
+{
+    TLBContext *c = &s->tlb_ctx[idx];
+    s->tlb_cur = idx;
+    c->last_use = ++s->tlb_use_count;
+    s->tlb_read = c->tlb_read;
+    s->tlb_write = c->tlb_write;
+    s->tlb_code = c->tlb_code;
+}
+
+/* MMU configuration used to fill the TLB entries: privilege of the
+   code and data accesses and mstatus bits changing the permissions */
+static uint32_t get_mmu_mode(RISCVCPUState *s)
+{
+    int data_priv;
+    uint32_t mode;
+
+    if (s->mstatus & MSTATUS_MPRV)
+        data_priv = (s->mstatus >> MSTATUS_MPP_SHIFT) & 3;
+    else
+        data_priv = s->priv;
+    mode = s->priv | (data_priv << 2);
+    if (data_priv == PRV_S && (s->mstatus & MSTATUS_SUM))
+        mode |= 1 << 4;
+    if (s->mstatus & MSTATUS_MXR)
+        mode |= 1 << 5;
+    return mode;
+}
+
+static uint64_t get_tlb_satp(RISCVCPUState *s, uint32_t mmu_mode)
+{
+    /* satp is not used if there is no translation */
+    if ((mmu_mode & 0xf) == (PRV_M | (PRV_M << 2)))
+        return 0;
+    else
+        return s->satp;
+}
+
+static inline int satp_get_asid(uint64_t satp)
+{
+    return (satp >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+}
+
+/* flush the page walk cache entries of the address spaces using
+   'asid' (all if asid < 0) for the page tables mapping 'vaddr' or for
+   all of them if 'all_vaddr' is TRUE */
+static void ptw_cache_flush(RISCVCPUState *s, BOOL all_vaddr,
+                            target_ulong vaddr, int asid)
+{
+    PTWEntry *pe;
+    int i, j;
+
+    for(i = 0; i < PTW_LEVELS; i++) {
+        for(j = 0; j < PTW_CACHE_SIZE; j++) {
+            pe = &s->ptw_cache[i][j];
+            if (pe->satp != -1 &&
+                (asid < 0 || satp_get_asid(pe->satp) == asid) &&
+                (all_vaddr || (vaddr >> pe->shift) == pe->vpn)) {
+                pe->satp = -1;
+            }
+        }
+    }
+}
+
 static void tlb_init(RISCVCPUState *s)
 {
     int i;
-    
-    for(i = 0; i < TLB_SIZE; i++) {
-        s->tlb_read[i].vaddr = -1;
-        s->tlb_write[i].vaddr = -1;
-        s->tlb_code[i].vaddr = -1;
+
+    for(i = 0; i < TLB_CTX_COUNT; i++) {
+        tlb_ctx_flush(&s->tlb_ctx[i]);
+        s->tlb_ctx[i].satp = -1;
+        s->tlb_ctx[i].last_use = 0;
     }
+    s->tlb_ctx[0].mmu_mode = get_mmu_mode(s);
+    s->tlb_ctx[0].satp = get_tlb_satp(s, s->tlb_ctx[0].mmu_mode);
+    tlb_select_ctx(s, 0);
+    ptw_cache_flush(s, TRUE, 0, -1);
 }
 
+/* flush the entries of all the address spaces */
 static void tlb_flush_all(RISCVCPUState *s)
 {
-    tlb_init(s);
+    TLBContext *c;
+    int i;
+
+    for(i = 0; i < TLB_CTX_COUNT; i++) {
+        c = &s->tlb_ctx[i];
+        if (i == s->tlb_cur) {
+            tlb_ctx_flush(c);
+        } else if (c->satp != -1) {
+            tlb_ctx_flush(c);
+            c->satp = -1;
+            c->last_use = 0;
+        }
+    }
+    ptw_cache_flush(s, TRUE, 0, -1);
+}
+
+/* select the entries matching the current satp and MMU mode. Must be
+   called after any change of them. */
+static void tlb_update_ctx(RISCVCPUState *s)
+{
+    TLBContext *c;
+    int i, lru_idx;
+    uint32_t mmu_mode;
+    uint64_t satp;
+
+    mmu_mode = get_mmu_mode(s);
+    satp = get_tlb_satp(s, mmu_mode);
+    c = &s->tlb_ctx[s->tlb_cur];
+    if (c->satp == satp && c->mmu_mode == mmu_mode)
+        return;
+    lru_idx = 0;
+    for(i = 0; i < TLB_CTX_COUNT; i++) {
+        c = &s->tlb_ctx[i];
+        if (c->satp == satp && c->mmu_mode == mmu_mode) {
+            s->stats.tlb_ctx_hit++;
+            tlb_select_ctx(s, i);
+            return;
+        }
+        if (c->last_use < s->tlb_ctx[lru_idx].last_use)
+            lru_idx = i;
+    }
+    s->stats.tlb_ctx_miss++;
+    c = &s->tlb_ctx[lru_idx];
+    if (c->satp != -1)
+        tlb_ctx_flush(c);
+    c->satp = satp;
+    c->mmu_mode = mmu_mode;
+    tlb_select_ctx(s, lru_idx);
+}
+
+/* flush the entries of the address spaces using 'asid' */
+static void tlb_flush_asid(RISCVCPUState *s, int asid)
+{
+    TLBContext *c;
+    int i;
+
+    for(i = 0; i < TLB_CTX_COUNT; i++) {
+        c = &s->tlb_ctx[i];
+        if (c->satp != -1 && satp_get_asid(c->satp) == asid)
+            tlb_ctx_flush(c);
+    }
+    ptw_cache_flush(s, TRUE, 0, asid);
+}
+
+static void tlb_ctx_flush_vaddr(TLBContext *c, target_ulong vaddr)
+{
+    TLBAux *aux;
+    TLBSuperpage *sp;
+    target_ulong mask;
+    int i, j;
+
+    if (vaddr >= c->sp_start && vaddr <= c->sp_last) {
+        /* the page may be part of a superpage whose other pages
+           have their own entries */
+        mask = ~(((target_ulong)1 << c->sp_shift) - 1);
+        vaddr &= mask;
+        for(i = 0; i < TLB_WAYS * TLB_SIZE; i++) {
+            if ((c->tlb_read[i].vaddr & mask) == vaddr)
+                c->tlb_read[i].vaddr = -1;
+            if ((c->tlb_write[i].vaddr & mask) == vaddr)
+                c->tlb_write[i].vaddr = -1;
+            if ((c->tlb_code[i].vaddr & mask) == vaddr)
+                c->tlb_code[i].vaddr = -1;
+        }
+        for(j = 0; j < 3; j++) {
+            aux = &c->aux[j];
+            for(i = 0; i < TLB_SP_SIZE; i++) {
+                sp = &aux->sp[i];
+                if (sp->shift != 0 && ((vaddr ^ sp->vaddr) >> sp->shift) == 0)
+                    sp->shift = 0;
+            }
+        }
+    } else {
+        mask = ~(target_ulong)PG_MASK;
+        vaddr &= mask;
+        i = (vaddr >> PG_SHIFT) & (TLB_SIZE - 1);
+        for(j = 0; j < TLB_WAYS; j++) {
+            c->tlb_read[j * TLB_SIZE + i].vaddr = -1;
+            c->tlb_write[j * TLB_SIZE + i].vaddr = -1;
+            c->tlb_code[j * TLB_SIZE + i].vaddr = -1;
+        }
+    }
+    for(j = 0; j < 3; j++) {
+        aux = &c->aux[j];
+        for(i = 0; i < TLB_VICTIM_SIZE; i++) {
+            if ((aux->victim[i].vaddr & mask) == vaddr)
+                aux->victim[i].vaddr = -1;
+        }
+    }
 }
 
-static void tlb_flush_vaddr(RISCVCPUState *s, target_ulong vaddr)
+/* flush the page containing 'vaddr' in the address spaces using
+   'asid' or in all of them if asid < 0 */
+static void tlb_flush_vaddr(RISCVCPUState *s, target_ulong vaddr, int asid)
 {
-    tlb_flush_all(s);
+    TLBContext *c;
+    int i;
+
+    for(i = 0; i < TLB_CTX_COUNT; i++) {
+        c = &s->tlb_ctx[i];
+        if (c->satp != -1 && (asid < 0 || satp_get_asid(c->satp) == asid))
+            tlb_ctx_flush_vaddr(c, vaddr);
+    }
+    /* the non leaf PTEs are also flushed in case the page tables were
+       modified */
+    ptw_cache_flush(s, FALSE, vaddr, asid);
 }
 
 /* XXX: inefficient but not critical as long as it is seldom used */
-static void glue(riscv_cpu_flush_tlb_write_range_ram,
-                 MAX_XLEN)(RISCVCPUState *s,
-                           uint8_t *ram_ptr, size_t ram_size)
+static void tlb_flush_write_range(RISCVCPUState *s, TLBEntry *te, int n,
+                                  PhysMemoryRange *pr,
+                                  uint8_t *ram_ptr, uint8_t *ram_end)
 {
-    uint8_t *ptr, *ram_end;
+    uint8_t *ptr;
     int i;
-    
-    ram_end = ram_ptr + ram_size;
-    for(i = 0; i < TLB_SIZE; i++) {
-        if (s->tlb_write[i].vaddr != -1) {
-            ptr = (uint8_t *)(s->tlb_write[i].mem_addend +
-                              (uintptr_t)s->tlb_write[i].vaddr);
+
+    for(i = 0; i < n; i++) {
+        if (te[i].vaddr != -1) {
+            ptr = (uint8_t *)(te[i].mem_addend + (uintptr_t)te[i].vaddr);
             if (ptr >= ram_ptr && ptr < ram_end) {
-                s->tlb_write[i].vaddr = -1;
+                te[i].vaddr = -1;
+                if (pr)
+                    phys_mem_set_dirty_bit(pr, ptr - pr->phys_mem);
+            } else {
+                tlb_write_filter_set(s, ptr);
             }
         }
     }
 }
 
+static void glue(riscv_cpu_flush_tlb_write_range_ram,
+                 MAX_XLEN)(RISCVCPUState *s, PhysMemoryRange *pr,
+                           uint8_t *ram_ptr, size_t ram_size)
+{
+    TLBContext *c;
+    int j;
+    
+    /* the filter is rebuilt from the remaining entries */
+    memset(s->tlb_write_filter, 0, sizeof(s->tlb_write_filter));
+    for(j = 0; j < TLB_CTX_COUNT; j++) {
+        c = &s->tlb_ctx[j];
+        if (c->satp == -1)
+            continue;
+        tlb_flush_write_range(s, c->tlb_write, TLB_WAYS * TLB_SIZE, pr,
+                              ram_ptr, ram_ptr + ram_size);
+        tlb_flush_write_range(s, c->aux[ACCESS_WRITE].victim,
+                              TLB_VICTIM_SIZE, pr, ram_ptr,
+                              ram_ptr + ram_size);
+    }
+}
 
-#define SSTATUS_MASK0 (MSTATUS_UIE | MSTATUS_SIE |       \
-                      MSTATUS_UPIE | MSTATUS_SPIE |     \
-                      MSTATUS_SPP | \
-                      MSTATUS_FS | MSTATUS_XS | \
-                      MSTATUS_SUM | MSTATUS_MXR)
-#if MAX_XLEN >= 64
-#define SSTATUS_MASK (SSTATUS_MASK0 | MSTATUS_UXL_MASK)
-#else
-#define SSTATUS_MASK SSTATUS_MASK0
-#endif
-
+/* translated blocks */
 
-#define MSTATUS_MASK (MSTATUS_UIE | MSTATUS_SIE | MSTATUS_MIE |      \
-                      MSTATUS_UPIE | MSTATUS_SPIE | MSTATUS_MPIE |    \
-                      MSTATUS_SPP | MSTATUS_MPP | \
-                      MSTATUS_FS | \
-                      MSTATUS_MPRV | MSTATUS_SUM | MSTATUS_MXR)
+static inline uint32_t tb_hash_func(uint8_t *code_ptr)
+{
+    return ((uintptr_t)code_ptr >> 1) & (TB_HASH_SIZE - 1);
+}
 
-/* cycle and insn counters */
-#define COUNTEREN_MASK ((1 << 0) | (1 << 2))
+static inline uint32_t tb_page_hash_func(uint8_t *page_ptr)
+{
+    return ((uintptr_t)page_ptr >> PG_SHIFT) & (TB_PAGE_HASH_SIZE - 1);
+}
 
-/* return the complete mstatus with the SD bit */
-static target_ulong get_mstatus(RISCVCPUState *s, target_ulong mask)
+static void tb_flush_all(RISCVCPUState *s)
 {
-    target_ulong val;
-    BOOL sd;
-    val = s->mstatus | (s->fs << MSTATUS_FS_SHIFT);
-    val &= mask;
-    sd = ((val & MSTATUS_FS) == MSTATUS_FS) |
-        ((val & MSTATUS_XS) == MSTATUS_XS);
-    if (sd)
-        val |= (target_ulong)1 << (s->cur_xlen - 1);
-    return val;
+    memset(s->tb_hash, 0, sizeof(s->tb_hash));
+    memset(s->tb_page_hash, 0, sizeof(s->tb_page_hash));
+    s->tb_buf_pos = 0;
+    s->tb_jmp_gen++;
+#ifdef CONFIG_JIT
+    s->jit_buf_pos = 0;
+#endif
 }
-                              
-static int get_base_from_xlen(int xlen)
+
+static inline TransBlock *tb_find(RISCVCPUState *s, uint8_t *code_ptr,
+                                  int xlen)
 {
-    if (xlen == 32)
-        return 1;
-    else if (xlen == 64)
-        return 2;
-    else
-        return 3;
+    TransBlock *tb;
+    for(tb = s->tb_hash[tb_hash_func(code_ptr)]; tb != NULL;
+        tb = tb->hash_next) {
+        if (tb->code_ptr == code_ptr && tb->xlen == xlen)
+            return tb;
+    }
+    return NULL;
 }
 
-static void set_mstatus(RISCVCPUState *s, target_ulong val)
+static TBPage *tb_page_find(RISCVCPUState *s, uint8_t *page_ptr)
 {
-    target_ulong mod, mask;
-    
-    /* flush the TLBs if change of MMU config */
-    mod = s->mstatus ^ val;
-    if ((mod & (MSTATUS_MPRV | MSTATUS_SUM | MSTATUS_MXR)) != 0 ||
-        ((s->mstatus & MSTATUS_MPRV) && (mod & MSTATUS_MPP) != 0)) {
-        tlb_flush_all(s);
+    TBPage *p;
+    for(p = s->tb_page_hash[tb_page_hash_func(page_ptr)]; p != NULL;
+        p = p->hash_next) {
+        if (p->page_ptr == page_ptr)
+            return p;
     }
-    s->fs = (val >> MSTATUS_FS_SHIFT) & 3;
+    return NULL;
+}
 
-    mask = MSTATUS_MASK & ~MSTATUS_FS;
-#if MAX_XLEN >= 64
-    {
-        int uxl, sxl;
-        uxl = (val >> MSTATUS_UXL_SHIFT) & 3;
-        if (uxl >= 1 && uxl <= get_base_from_xlen(MAX_XLEN))
-            mask |= MSTATUS_UXL_MASK;
-        sxl = (val >> MSTATUS_UXL_SHIFT) & 3;
-        if (sxl >= 1 && sxl <= get_base_from_xlen(MAX_XLEN))
-            mask |= MSTATUS_SXL_MASK;
+/* return a block with room for TB_MAX_INSNS instructions. It must be
+   added with tb_link(). */
+static TransBlock *tb_alloc(RISCVCPUState *s)
+{
+    if (s->tb_buf_pos + sizeof(TransBlock) +
+        TB_MAX_INSNS * sizeof(DecodedInsn) + sizeof(TBPage) > TB_BUF_SIZE) {
+        tb_flush_all(s);
     }
+#ifdef CONFIG_JIT
+    if (s->jit_buf_pos + JIT_MAX_BLOCK_SIZE > JIT_BUF_SIZE)
+        tb_flush_all(s);
 #endif
-    s->mstatus = (s->mstatus & ~mask) | (val & mask);
+    return (TransBlock *)(s->tb_buf + s->tb_buf_pos);
 }
 
-/* return -1 if invalid CSR. 0 if OK. 'will_write' indicate that the
-   csr will be written after (used for CSR access check) */
-static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr,
-                     BOOL will_write)
+static void tb_link(RISCVCPUState *s, TransBlock *tb, uint8_t *page_ptr)
 {
-    target_ulong val;
-
-    if (((csr & 0xc00) == 0xc00) && will_write)
+    TBPage *p;
+    uint32_t h;
+
+    s->tb_buf_pos += (sizeof(TransBlock) +
+                      tb->n_insns * sizeof(DecodedInsn) + 7) & ~7;
+    tb->jmp_gen = s->tb_jmp_gen;
+    tb->jmp_tb[0] = NULL;
+    tb->jmp_tb[1] = NULL;
+    h = tb_hash_func(tb->code_ptr);
+    tb->hash_next = s->tb_hash[h];
+    s->tb_hash[h] = tb;
+
+    p = tb_page_find(s, page_ptr);
+    if (!p) {
+        p = (TBPage *)(s->tb_buf + s->tb_buf_pos);
+        s->tb_buf_pos += sizeof(TBPage);
+        p->page_ptr = page_ptr;
+        p->first_tb = NULL;
+        h = tb_page_hash_func(page_ptr);
+        p->hash_next = s->tb_page_hash[h];
+        s->tb_page_hash[h] = p;
+    }
+    if (!p->first_tb && tlb_write_filter_test(s, page_ptr)) {
+        /* the writes to the page must now go thru target_write_slow() */
+        glue(riscv_cpu_flush_tlb_write_range_ram, MAX_XLEN)(s, NULL, page_ptr,
+                                                            PG_MASK + 1);
+    }
+    tb->page_next = p->first_tb;
+    p->first_tb = tb;
+}
+
+/* invalidate the blocks overlapping [ptr, ptr + len) in the page
+   starting at 'page_ptr'. Return TRUE if the page still contains
+   translated code. */
+static BOOL tb_invalidate_range(RISCVCPUState *s, uint8_t *page_ptr,
+                                uint8_t *ptr, int len)
+{
+    TBPage *p;
+    TransBlock *tb, **ptb, **ph;
+
+    p = tb_page_find(s, page_ptr);
+    if (!p)
+        return FALSE;
+    ptb = &p->first_tb;
+    while ((tb = *ptb) != NULL) {
+        if (ptr < tb->code_ptr + tb->code_size &&
+            ptr + len > tb->code_ptr) {
+            *ptb = tb->page_next;
+            ph = &s->tb_hash[tb_hash_func(tb->code_ptr)];
+            while (*ph != tb)
+                ph = &(*ph)->hash_next;
+            *ph = tb->hash_next;
+            /* the block may be the successor of any other block */
+            s->tb_jmp_gen++;
+        } else {
+            ptb = &tb->page_next;
+        }
+    }
+    return (p->first_tb != NULL);
+}
+
+static inline uint32_t enc_r(int opcode, int rd, int funct3, int rs1,
+                             int rs2, int funct7)
+{
+    return opcode | (rd << 7) | (funct3 << 12) | (rs1 << 15) |
+        (rs2 << 20) | (funct7 << 25);
+}
+
+static inline uint32_t enc_i(int opcode, int rd, int funct3, int rs1,
+                             int32_t imm)
+{
+    return opcode | (rd << 7) | (funct3 << 12) | (rs1 << 15) |
+        ((uint32_t)imm << 20);
+}
+
+static inline uint32_t enc_s(int opcode, int funct3, int rs1, int rs2,
+                             int32_t imm)
+{
+    return opcode | ((imm & 0x1f) << 7) | (funct3 << 12) | (rs1 << 15) |
+        (rs2 << 20) | ((uint32_t)(imm >> 5) << 25);
+}
+
+static inline uint32_t enc_b(int funct3, int rs1, int rs2, int32_t imm)
+{
+    return 0x63 | (((imm >> 11) & 1) << 7) | (((imm >> 1) & 0xf) << 8) |
+        (funct3 << 12) | (rs1 << 15) | (rs2 << 20) |
+        (((imm >> 5) & 0x3f) << 25) | (((imm >> 12) & 1) << 31);
+}
+
+static inline uint32_t enc_j(int rd, int32_t imm)
+{
+    return 0x6f | (rd << 7) | (imm & 0xff000) | (((imm >> 11) & 1) << 20) |
+        (((imm >> 1) & 0x3ff) << 21) | (((imm >> 20) & 1) << 31);
+}
+
+static inline uint32_t enc_u(int opcode, int rd, int32_t imm)
+{
+    return opcode | (rd << 7) | (imm & 0xfffff000);
+}
+
+static void decode_insn(DecodedInsn *di, uint32_t insn, int len)
+{
+    int32_t imm;
+
+    di->insn = insn;
+    di->len = len;
+    di->op = (insn & 0x7f) | (((insn >> 12) & 7) << 7);
+    di->rd = (insn >> 7) & 0x1f;
+    di->rs1 = (insn >> 15) & 0x1f;
+    di->rs2 = (insn >> 20) & 0x1f;
+    switch(insn & 0x7f) {
+    case 0x37: /* lui */
+    case 0x17: /* auipc */
+        imm = (int32_t)(insn & 0xfffff000);
+        break;
+    case 0x6f: /* jal */
+        imm = ((insn >> (31 - 20)) & (1 << 20)) |
+            ((insn >> (21 - 1)) & 0x7fe) |
+            ((insn >> (20 - 11)) & (1 << 11)) |
+            (insn & 0xff000);
+        imm = (imm << 11) >> 11;
+        break;
+    case 0x63: /* branch */
+        imm = ((insn >> (31 - 12)) & (1 << 12)) |
+            ((insn >> (25 - 5)) & 0x7e0) |
+            ((insn >> (8 - 1)) & 0x1e) |
+            ((insn << (11 - 7)) & (1 << 11));
+        imm = (imm << 19) >> 19;
+        break;
+    case 0x23: /* store */
+    case 0x27: /* fp store */
+        imm = ((insn >> 7) & 0x1f) | ((insn >> (25 - 5)) & 0xfe0);
+        imm = (imm << 20) >> 20;
+        break;
+    case 0x73: /* system: CSR number */
+        imm = insn >> 20;
+        break;
+    case 0x33: /* OP */
+    case 0x3b: /* OP-32 */
+    case 0x7b: /* OP-64 */
+    case 0x53: /* OP-FP */
+        imm = insn >> 25;
+        break;
+    default:
+        imm = (int32_t)insn >> 20;
+        break;
+    }
+    di->imm = imm;
+}
+
+/* return the fused pair type if the instructions 'd0' and 'd1' can be
+   executed as a single operation, -1 otherwise. The second
+   instruction is kept unmodified because the blocks may also be
+   entered at its address. */
+static int fuse_insn_pair(const DecodedInsn *d0, const DecodedInsn *d1,
+                          int xlen)
+{
+    if (d0->rd == 0)
+        return -1;
+    switch(d0->op & 0x7f) {
+    case 0x37: /* lui */
+        if ((d1->op == 0x13 || (d1->op == 0x1b && xlen >= 64)) &&
+            d1->rd == d0->rd && d1->rs1 == d0->rd)
+            return RISCV_FUSE_LUI_ADDI;
+        break;
+    case 0x17: /* auipc */
+        if (d1->rs1 != d0->rd)
+            break;
+        if (d1->op == 0x13 && d1->rd == d0->rd)
+            return RISCV_FUSE_AUIPC_ADDI;
+        else if (d1->op == 0x67)
+            return RISCV_FUSE_AUIPC_JALR;
+        else if (d1->op == (0x03 | (2 << 7)) ||
+                 (d1->op == (0x03 | (3 << 7)) && xlen >= 64))
+            return RISCV_FUSE_AUIPC_LOAD;
+        break;
+    case 0x13:
+        if (d0->op == (0x13 | (1 << 7))) {
+            /* slli */
+            if ((d0->imm & ~(xlen - 1)) == 0 &&
+                d1->op == (0x13 | (5 << 7)) &&
+                (d1->imm & ~((xlen - 1) | 0x400)) == 0 &&
+                d1->rd == d0->rd && d1->rs1 == d0->rd)
+                return RISCV_FUSE_SHIFT;
+        } else if (d0->op == 0x13) {
+            /* addi */
+            if ((d1->op & 0x7f) == 0x63 &&
+                ((d1->op >> 7) & 6) != 2)
+                return RISCV_FUSE_ADDI_BRANCH;
+        }
+        break;
+    }
+    return -1;
+}
+
+#ifdef CONFIG_JIT
+#include "riscv_cpu_jit.h"
+#endif
+
+/* return TRUE if the instruction must be the last one of a block */
+static inline BOOL insn_is_block_end(uint32_t insn)
+{
+    switch(insn & 0x7f) {
+    case 0x63: /* branch */
+    case 0x67: /* jalr */
+    case 0x6f: /* jal */
+    case 0x73: /* system */
+        return TRUE;
+    case 0x0f:
+        return (((insn >> 12) & 7) == 1); /* fence.i */
+    default:
+        return ((insn & 3) != 3); /* illegal compressed instruction */
+    }
+}
+
+
+#define SSTATUS_MASK0 (MSTATUS_UIE | MSTATUS_SIE |       \
+                      MSTATUS_UPIE | MSTATUS_SPIE |     \
+                      MSTATUS_SPP | MSTATUS_VS | \
+                      MSTATUS_FS | MSTATUS_XS | \
+                      MSTATUS_SUM | MSTATUS_MXR)
+#if MAX_XLEN >= 64
+#define SSTATUS_MASK (SSTATUS_MASK0 | MSTATUS_UXL_MASK)
+#else
+#define SSTATUS_MASK SSTATUS_MASK0
+#endif
+
+
+#define MSTATUS_MASK (MSTATUS_UIE | MSTATUS_SIE | MSTATUS_MIE |      \
+                      MSTATUS_UPIE | MSTATUS_SPIE | MSTATUS_MPIE |    \
+                      MSTATUS_SPP | MSTATUS_MPP | \
+                      MSTATUS_FS | \
+                      MSTATUS_MPRV | MSTATUS_SUM | MSTATUS_MXR)
+
+/* cycle and insn counters */
+#define COUNTEREN_MASK ((1 << 0) | (1 << 1) | (1 << 2))
+
+#define MENVCFG_STCE ((uint64_t)1 << 63)
+
+/* return the complete mstatus with the SD bit */
+static target_ulong get_mstatus(RISCVCPUState *s, target_ulong mask)
+{
+    target_ulong val;
+    BOOL sd;
+    val = s->mstatus | (s->fs << MSTATUS_FS_SHIFT) |
+        (s->vs << MSTATUS_VS_SHIFT);
+    val &= mask;
+    sd = ((val & MSTATUS_FS) == MSTATUS_FS) |
+        ((val & MSTATUS_VS) == MSTATUS_VS) |
+        ((val & MSTATUS_XS) == MSTATUS_XS);
+    if (sd)
+        val |= (target_ulong)1 << (s->cur_xlen - 1);
+    return val;
+}
+                              
+static int get_base_from_xlen(int xlen)
+{
+    if (xlen == 32)
+        return 1;
+    else if (xlen == 64)
+        return 2;
+    else
+        return 3;
+}
+
+static void set_mstatus(RISCVCPUState *s, target_ulong val)
+{
+    target_ulong mask;
+    
+    s->fs = (val >> MSTATUS_FS_SHIFT) & 3;
+#ifdef CONFIG_EXT_V
+    s->vs = (val >> MSTATUS_VS_SHIFT) & 3;
+#endif
+
+    mask = MSTATUS_MASK & ~MSTATUS_FS;
+#if MAX_XLEN >= 64
+    {
+        int uxl, sxl;
+        uxl = (val >> MSTATUS_UXL_SHIFT) & 3;
+        if (uxl >= 1 && uxl <= get_base_from_xlen(MAX_XLEN))
+            mask |= MSTATUS_UXL_MASK;
+        sxl = (val >> MSTATUS_UXL_SHIFT) & 3;
+        if (sxl >= 1 && sxl <= get_base_from_xlen(MAX_XLEN))
+            mask |= MSTATUS_SXL_MASK;
+    }
+#endif
+    s->mstatus = (s->mstatus & ~mask) | (val & mask);
+    /* select the TLB entries of the new MMU config */
+    tlb_update_ctx(s);
+}
+
+/* the host clock is not read at each access because the guests may
+   read 'time' very often */
+static uint64_t get_time(RISCVCPUState *s)
+{
+    if ((s->insn_counter - s->time_cache_insn) >= TIME_CACHE_INSNS) {
+        s->time_cache = s->get_time(s->get_time_opaque);
+        s->time_cache_insn = s->insn_counter;
+    }
+    return s->time_cache;
+}
+
+/* Sstc: stimecmp needs the 'time' CSR and is enabled for S mode with
+   mcounteren.TM and menvcfg.STCE */
+static BOOL stimecmp_access_ok(RISCVCPUState *s)
+{
+    if (!s->get_time)
+        return FALSE;
+    if (s->priv < PRV_M &&
+        (!(s->mcounteren & (1 << 1)) || !(s->menvcfg & MENVCFG_STCE)))
+        return FALSE;
+    return TRUE;
+}
+
+/* return -1 if invalid CSR. 0 if OK. 'will_write' indicate that the
+   csr will be written after (used for CSR access check) */
+static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr,
+                     BOOL will_write)
+{
+    target_ulong val;
+
+    if (((csr & 0xc00) == 0xc00) && will_write)
         return -1; /* read-only CSR */
     if (s->priv < ((csr >> 8) & 3))
         return -1; /* not enough priviledge */
@@ -727,8 +1657,49 @@ static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr,
             return -1;
         val = s->fflags | (s->frm << 5);
         break;
+#endif
+#ifdef CONFIG_EXT_V
+    case 0x008: /* vstart */
+        if (s->vs == 0)
+            return -1;
+        val = s->vstart;
+        break;
+    case 0x009: /* vxsat */
+        if (s->vs == 0)
+            return -1;
+        val = s->vxsat;
+        break;
+    case 0x00a: /* vxrm */
+        if (s->vs == 0)
+            return -1;
+        val = s->vxrm;
+        break;
+    case 0x00f: /* vcsr */
+        if (s->vs == 0)
+            return -1;
+        val = s->vxsat | (s->vxrm << 1);
+        break;
+    case 0xc20: /* vl */
+        if (s->vs == 0)
+            return -1;
+        val = s->vl;
+        break;
+    case 0xc21: /* vtype */
+        if (s->vs == 0)
+            return -1;
+        if (s->vtype & VTYPE_VILL)
+            val = (target_ulong)1 << (s->cur_xlen - 1);
+        else
+            val = s->vtype;
+        break;
+    case 0xc22: /* vlenb */
+        if (s->vs == 0)
+            return -1;
+        val = VLENB;
+        break;
 #endif
     case 0xc00: /* ucycle */
+    case 0xc01: /* time */
     case 0xc02: /* uinstret */
         {
             uint32_t counteren;
@@ -741,9 +1712,16 @@ static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr,
                     goto invalid_csr;
             }
         }
-        val = (int64_t)s->insn_counter;
+        if (csr == 0xc01) {
+            if (!s->get_time)
+                goto invalid_csr;
+            val = (int64_t)get_time(s);
+        } else {
+            val = (int64_t)s->insn_counter;
+        }
         break;
     case 0xc80: /* mcycleh */
+    case 0xc81: /* timeh */
     case 0xc82: /* minstreth */
         if (s->cur_xlen != 32)
             goto invalid_csr;
@@ -758,7 +1736,13 @@ static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr,
                     goto invalid_csr;
             }
         }
-        val = s->insn_counter >> 32;
+        if (csr == 0xc81) {
+            if (!s->get_time)
+                goto invalid_csr;
+            val = get_time(s) >> 32;
+        } else {
+            val = s->insn_counter >> 32;
+        }
         break;
         
     case 0x100:
@@ -788,6 +1772,16 @@ static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr,
     case 0x144: /* sip */
         val = s->mip & s->mideleg;
         break;
+    case 0x14d: /* stimecmp */
+        if (!stimecmp_access_ok(s))
+            goto invalid_csr;
+        val = (int64_t)s->stimecmp;
+        break;
+    case 0x15d: /* stimecmph */
+        if (s->cur_xlen != 32 || !stimecmp_access_ok(s))
+            goto invalid_csr;
+        val = s->stimecmp >> 32;
+        break;
     case 0x180:
         val = s->satp;
         break;
@@ -813,6 +1807,14 @@ static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr,
     case 0x306:
         val = s->mcounteren;
         break;
+    case 0x30a:
+        val = (int64_t)s->menvcfg;
+        break;
+    case 0x31a: /* menvcfgh */
+        if (s->cur_xlen != 32)
+            goto invalid_csr;
+        val = s->menvcfg >> 32;
+        break;
     case 0x340:
         val = s->mscratch;
         break;
@@ -844,7 +1846,7 @@ static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr,
     default:
     invalid_csr:
 #ifdef DUMP_INVALID_CSR
-        /* the 'time' counter is usually emulated */
+        /* the 'time' counter is emulated if there is no time function */
         if (csr != 0xc01 && csr != 0xc81) {
             printf("csr_read: invalid CSR=0x%x\n", csr);
         }
@@ -876,6 +1878,933 @@ static int get_insn_rm(RISCVCPUState *s, unsigned int rm)
 }
 #endif
 
+#ifdef CONFIG_EXT_V
+/* vector extension */
+
+static inline BOOL vmask_get(RISCVCPUState *s, int r, uint32_t i)
+{
+    return (((uint8_t *)s->vreg[r])[i >> 3] >> (i & 7)) & 1;
+}
+
+static inline void vmask_set(RISCVCPUState *s, int r, uint32_t i, BOOL v)
+{
+    uint8_t *p = (uint8_t *)s->vreg[r] + (i >> 3);
+    *p = (*p & ~(1 << (i & 7))) | (v << (i & 7));
+}
+
+static uint64_t vmulhu64_helper(uint64_t a, uint64_t b)
+{
+#ifdef HAVE_INT128
+    return ((uint128_t)a * b) >> 64;
+#else
+    uint64_t r00, r01, r10, r11, c;
+    r00 = (uint64_t)(uint32_t)a * (uint32_t)b;
+    r01 = (uint64_t)(uint32_t)a * (b >> 32);
+    r10 = (a >> 32) * (uint64_t)(uint32_t)b;
+    r11 = (a >> 32) * (b >> 32);
+    c = (r00 >> 32) + (uint32_t)r01 + (uint32_t)r10;
+    return r11 + (r01 >> 32) + (r10 >> 32) + (c >> 32);
+#endif
+}
+
+/* rounding increment of 'v >> d' for the fixed point rounding mode
+   'vxrm' */
+static inline uint64_t vround_inc(uint32_t vxrm, uint64_t v, int d)
+{
+    uint64_t half, low;
+
+    if (d == 0)
+        return 0;
+    half = (v >> (d - 1)) & 1;
+    low = v & (((uint64_t)1 << (d - 1)) - 1);
+    switch(vxrm) {
+    case 0: /* rnu */
+        return half;
+    case 1: /* rne */
+        return half & ((low != 0) | ((v >> d) & 1));
+    case 2: /* rdn */
+        return 0;
+    default: /* rod */
+        return !((v >> d) & 1) & ((half | low) != 0);
+    }
+}
+
+/* read the element 'i' of width 2^size_log2 bytes of the register
+   group 'r' */
+static inline uint64_t vec_read_elem(RISCVCPUState *s, int r, uint32_t i,
+                                     int size_log2, BOOL is_signed)
+{
+    uint8_t *p = (uint8_t *)s->vreg[r];
+    switch(size_log2) {
+    case 0:
+        return is_signed ? (int64_t)(int8_t)p[i] : p[i];
+    case 1:
+        return is_signed ? (int64_t)(int16_t)((uint16_t *)p)[i] :
+            ((uint16_t *)p)[i];
+    case 2:
+        return is_signed ? (int64_t)(int32_t)((uint32_t *)p)[i] :
+            ((uint32_t *)p)[i];
+    default:
+        return ((uint64_t *)p)[i];
+    }
+}
+
+/* f32 to 16 bit integer conversion: the out of range values saturate
+   and only raise the invalid flag */
+static uint32_t vcvt_sf32_16(uint32_t a, RoundingModeEnum rm, uint32_t *pf,
+                             BOOL is_signed)
+{
+    uint32_t flags = 0;
+    int64_t r;
+
+    if (is_signed) {
+        r = cvt_sf32_i32(a, rm, &flags);
+        if (r < -0x8000 || r > 0x7fff) {
+            r = r < 0 ? -0x8000 : 0x7fff;
+            flags = FFLAG_INVALID_OP;
+        }
+    } else {
+        r = cvt_sf32_u32(a, rm, &flags);
+        if (r > 0xffff) {
+            r = 0xffff;
+            flags = FFLAG_INVALID_OP;
+        }
+    }
+    *pf |= flags;
+    return r;
+}
+
+/* 7 bit estimates of 1/x and 1/sqrt(x) for vfrec7 and vfrsqrt7 */
+static const uint8_t vfrec7_table[128] = {
+    127, 125, 123, 121, 119, 117, 116, 114,
+    112, 110, 109, 107, 105, 104, 102, 100,
+    99, 97, 96, 94, 93, 91, 90, 88,
+    87, 85, 84, 83, 81, 80, 79, 77,
+    76, 75, 74, 72, 71, 70, 69, 68,
+    66, 65, 64, 63, 62, 61, 60, 59,
+    58, 57, 56, 55, 54, 53, 52, 51,
+    50, 49, 48, 47, 46, 45, 44, 43,
+    42, 41, 40, 40, 39, 38, 37, 36,
+    35, 35, 34, 33, 32, 31, 31, 30,
+    29, 28, 28, 27, 26, 25, 25, 24,
+    23, 23, 22, 21, 21, 20, 19, 19,
+    18, 17, 17, 16, 15, 15, 14, 14,
+    13, 12, 12, 11, 11, 10, 9, 9,
+    8, 8, 7, 7, 6, 5, 5, 4,
+    4, 3, 3, 2, 2, 1, 1, 0,
+};
+
+static const uint8_t vfrsqrt7_table[128] = {
+    52, 51, 50, 48, 47, 46, 44, 43,
+    42, 41, 40, 39, 38, 36, 35, 34,
+    33, 32, 31, 30, 30, 29, 28, 27,
+    26, 25, 24, 23, 23, 22, 21, 20,
+    19, 19, 18, 17, 16, 16, 15, 14,
+    14, 13, 12, 12, 11, 10, 10, 9,
+    9, 8, 7, 7, 6, 6, 5, 4,
+    4, 3, 3, 2, 2, 1, 1, 0,
+    127, 125, 123, 121, 119, 118, 116, 114,
+    113, 111, 109, 108, 106, 105, 103, 102,
+    100, 99, 97, 96, 95, 93, 92, 91,
+    90, 88, 87, 86, 85, 84, 83, 82,
+    80, 79, 78, 77, 76, 75, 74, 73,
+    72, 71, 70, 70, 69, 68, 67, 66,
+    65, 64, 63, 63, 62, 61, 60, 59,
+    59, 58, 57, 56, 56, 55, 54, 53,
+};
+
+/* normalize a subnormal mantissa: '*pexp' becomes <= 0 */
+static void vfrec_normalize(int64_t *pexp, uint64_t *pmant, int mant_size)
+{
+    uint64_t mant = *pmant;
+    int64_t exp = 0;
+    while (!(mant & ((uint64_t)1 << (mant_size - 1)))) {
+        exp--;
+        mant <<= 1;
+    }
+    *pmant = (mant << 1) & (((uint64_t)1 << mant_size) - 1);
+    *pexp = exp;
+}
+
+static uint64_t vfrsqrt7(uint64_t a, int exp_size, int mant_size,
+                         uint32_t *pf)
+{
+    uint64_t sign, mant, exp_mask, qnan, r_mant;
+    int64_t exp, r_exp;
+
+    exp_mask = ((uint64_t)1 << exp_size) - 1;
+    sign = (a >> (exp_size + mant_size)) & 1;
+    exp = (a >> mant_size) & exp_mask;
+    mant = a & (((uint64_t)1 << mant_size) - 1);
+    qnan = (exp_mask << mant_size) | ((uint64_t)1 << (mant_size - 1));
+    if (exp == exp_mask) {
+        if (mant == 0 && !sign)
+            return 0; /* +inf */
+        if (mant == 0 || !(mant >> (mant_size - 1)))
+            *pf |= FFLAG_INVALID_OP;
+        return qnan;
+    } else if (exp == 0 && mant == 0) {
+        *pf |= FFLAG_DIVIDE_ZERO;
+        return (sign << (exp_size + mant_size)) | (exp_mask << mant_size);
+    } else if (sign) {
+        *pf |= FFLAG_INVALID_OP;
+        return qnan;
+    }
+    if (exp == 0)
+        vfrec_normalize(&exp, &mant, mant_size);
+    r_mant = (uint64_t)vfrsqrt7_table[((exp & 1) << 6) |
+                                      (mant >> (mant_size - 6))] <<
+        (mant_size - 7);
+    r_exp = (3 * ((exp_mask >> 1)) - 1 - exp) / 2;
+    return ((uint64_t)r_exp << mant_size) | r_mant;
+}
+
+static uint64_t vfrec7(uint64_t a, int exp_size, int mant_size,
+                       RoundingModeEnum rm, uint32_t *pf)
+{
+    uint64_t sign, mant, exp_mask, r_mant;
+    int64_t exp, r_exp;
+
+    exp_mask = ((uint64_t)1 << exp_size) - 1;
+    sign = a & ((uint64_t)1 << (exp_size + mant_size));
+    exp = (a >> mant_size) & exp_mask;
+    mant = a & (((uint64_t)1 << mant_size) - 1);
+    if (exp == exp_mask) {
+        if (mant == 0)
+            return sign; /* 1/inf = 0 */
+        if (!(mant >> (mant_size - 1)))
+            *pf |= FFLAG_INVALID_OP;
+        return (exp_mask << mant_size) | ((uint64_t)1 << (mant_size - 1));
+    } else if (exp == 0 && mant == 0) {
+        *pf |= FFLAG_DIVIDE_ZERO;
+        return sign | (exp_mask << mant_size);
+    }
+    if (exp == 0) {
+        vfrec_normalize(&exp, &mant, mant_size);
+        if (exp < -1) {
+            /* the result overflows */
+            *pf |= FFLAG_OVERFLOW | FFLAG_INEXACT;
+            if (rm == RM_RTZ || (rm == RM_RDN && !sign) ||
+                (rm == RM_RUP && sign))
+                return sign | ((exp_mask - 1) << mant_size) |
+                    (((uint64_t)1 << mant_size) - 1);
+            else
+                return sign | (exp_mask << mant_size);
+        }
+    }
+    r_mant = (uint64_t)vfrec7_table[mant >> (mant_size - 7)] <<
+        (mant_size - 7);
+    r_exp = 2 * (exp_mask >> 1) - 1 - exp;
+    if (r_exp <= 0) {
+        /* subnormal result */
+        r_mant = (r_mant >> 1) | ((uint64_t)1 << (mant_size - 1));
+        if (r_exp < 0) {
+            r_mant >>= 1;
+            r_exp = 0;
+        }
+    }
+    return sign | ((uint64_t)r_exp << mant_size) | r_mant;
+}
+
+#define SEW 8
+#include "riscv_cpu_vector_template.h"
+#define SEW 16
+#include "riscv_cpu_vector_template.h"
+#define SEW 32
+#include "riscv_cpu_vector_template.h"
+#define SEW 64
+#include "riscv_cpu_vector_template.h"
+
+/* log2(SEW / 8) */
+static inline int vtype_sew_log2(target_ulong vtype)
+{
+    return (vtype >> 3) & 7;
+}
+
+/* log2(LMUL) in [-3, 3] */
+static inline int vtype_lmul_log2(target_ulong vtype)
+{
+    return ((int)(vtype & 7) << 29) >> 29;
+}
+
+/* VLMAX = LMUL * VLEN / SEW */
+static inline uint32_t get_vlmax(int sew_log2, int lmul_log2)
+{
+    return (VLENB << 3) >> (3 + sew_log2 - lmul_log2);
+}
+
+static BOOL vtype_is_valid(target_ulong vtype)
+{
+    int sew_log2, lmul_log2;
+    if ((vtype >> 8) != 0 || (vtype & 7) == 4)
+        return FALSE;
+    sew_log2 = vtype_sew_log2(vtype);
+    lmul_log2 = vtype_lmul_log2(vtype);
+    /* SEW <= LMUL * ELEN */
+    if ((8 << sew_log2) > ELEN || sew_log2 > lmul_log2 + 3)
+        return FALSE;
+    return TRUE;
+}
+
+/* vsetvli, vsetivli, vsetvl: return the new vl */
+static target_ulong vec_setvl(RISCVCPUState *s, target_ulong vtype,
+                              target_ulong avl, BOOL avl_max, BOOL keep_vl)
+{
+    uint32_t vlmax;
+
+    if (!vtype_is_valid(vtype)) {
+        s->vtype = VTYPE_VILL;
+        s->vl = 0;
+    } else {
+        vlmax = get_vlmax(vtype_sew_log2(vtype), vtype_lmul_log2(vtype));
+        s->vtype = vtype;
+        if (avl_max)
+            s->vl = vlmax;
+        else if (!keep_vl)
+            s->vl = avl < vlmax ? avl : vlmax;
+        else if (s->vl > vlmax)
+            s->vl = vlmax;
+    }
+    s->vstart = 0;
+    s->vs = 3;
+    return s->vl;
+}
+
+/* number of registers of a group of EMUL = 2^emul_log2 */
+static inline int vec_group_size(int emul_log2)
+{
+    return emul_log2 > 0 ? 1 << emul_log2 : 1;
+}
+
+/* return TRUE if the register groups [r1, r1 + n1) and [r2, r2 + n2)
+   overlap */
+static inline BOOL vec_overlap(int r1, int n1, int r2, int n2)
+{
+    return r1 < r2 + n2 && r2 < r1 + n1;
+}
+
+/* return TRUE if the source group 'rs' of EMUL = 2^src_emul_log2 cannot
+   be used with the wider destination group 'rd': they may only overlap
+   in the highest part of the destination group if EMUL >= 1 */
+static inline BOOL vec_overlap_widen(int rd, int nd, int rs,
+                                     int src_emul_log2)
+{
+    int ns = vec_group_size(src_emul_log2);
+    return vec_overlap(rd, nd, rs, ns) &&
+        (src_emul_log2 < 0 || rs + ns != rd + nd);
+}
+
+/* return TRUE if the narrower destination group 'rd' overlaps the
+   source group 'rs' elsewhere than in its lowest part */
+static inline BOOL vec_overlap_narrow(int rd, int nd, int rs, int ns)
+{
+    return vec_overlap(rd, nd, rs, ns) && rd != rs;
+}
+
+/* vcpop.m, vfirst.m, vmsbf.m, vmsif.m, vmsof.m and the mask logical
+   instructions. Return -1 if illegal instruction, 1 if the result is
+   written to x[rd]. */
+static int vec_mask_op(RISCVCPUState *s, uint32_t funct6, int vd, int vs2,
+                       int vs1, BOOL vm, target_ulong *pval)
+{
+    uint32_t i, vl = s->vl, count;
+    BOOL a, b, r, found;
+
+    if (funct6 == 0x10) {
+        if (s->vstart != 0)
+            return -1;
+        if (vs1 == 0x10) {
+            /* vcpop.m */
+            count = 0;
+            for(i = 0; i < vl; i++) {
+                if (vm || vmask_get(s, 0, i))
+                    count += vmask_get(s, vs2, i);
+            }
+            *pval = count;
+        } else {
+            /* vfirst.m */
+            *pval = -1;
+            for(i = 0; i < vl; i++) {
+                if ((vm || vmask_get(s, 0, i)) && vmask_get(s, vs2, i)) {
+                    *pval = i;
+                    break;
+                }
+            }
+        }
+        return 1;
+    } else if (funct6 == 0x14) {
+        /* vmsbf.m, vmsof.m, vmsif.m */
+        if (s->vstart != 0 || vd == vs2 || (!vm && vd == 0))
+            return -1;
+        found = FALSE;
+        for(i = 0; i < vl; i++) {
+            if (!vm && !vmask_get(s, 0, i))
+                continue;
+            a = vmask_get(s, vs2, i);
+            switch(vs1) {
+            case 0x01: /* vmsbf */
+                r = !found && !a;
+                break;
+            case 0x02: /* vmsof */
+                r = !found && a;
+                break;
+            default: /* vmsif */
+                r = !found;
+                break;
+            }
+            found |= a;
+            vmask_set(s, vd, i, r);
+        }
+        return 0;
+    } else {
+        /* mask logical instructions are always unmasked */
+        if (!vm)
+            return -1;
+        for(i = s->vstart; i < vl; i++) {
+            a = vmask_get(s, vs2, i);
+            b = vmask_get(s, vs1, i);
+            switch(funct6) {
+            case 0x18: r = a & !b; break; /* vmandn */
+            case 0x19: r = a & b; break; /* vmand */
+            case 0x1a: r = a | b; break; /* vmor */
+            case 0x1b: r = a ^ b; break; /* vmxor */
+            case 0x1c: r = a | !b; break; /* vmorn */
+            case 0x1d: r = !(a & b); break; /* vmnand */
+            case 0x1e: r = !(a | b); break; /* vmnor */
+            default: r = !(a ^ b); break; /* vmxnor */
+            }
+            vmask_set(s, vd, i, r);
+        }
+        return 0;
+    }
+}
+
+#define VEC_CALL(res, func, args) do {                  \
+        switch(sew_log2) {                              \
+        case 0: res = glue(func, 8) args; break;        \
+        case 1: res = glue(func, 16) args; break;       \
+        case 2: res = glue(func, 32) args; break;       \
+        default: res = glue(func, 64) args; break;      \
+        }                                               \
+    } while (0)
+
+/* widening and narrowing operations: SEW < 64 */
+#define VEC_CALL_W(res, func, args) do {                \
+        switch(sew_log2) {                              \
+        case 0: res = glue(func, 8) args; break;        \
+        case 1: res = glue(func, 16) args; break;       \
+        default: res = glue(func, 32) args; break;      \
+        }                                               \
+    } while (0)
+
+/* OP-V major opcode. Return -1 if illegal instruction, 0 if OK and 1
+   if '*pval' must be written to x[rd]. */
+static int vector_exec(RISCVCPUState *s, uint32_t insn, target_ulong *pval)
+{
+    uint32_t funct3, funct6, rd, rs1, rs2, vlmax;
+    int sew_log2, lmul_log2, emul_log2, n, nw, ret, rm;
+    target_ulong vtype, avl;
+    uint64_t x;
+    BOOL vm, is_vv, is_w;
+
+    if (s->vs == 0)
+        return -1;
+    funct3 = (insn >> 12) & 7;
+    rd = (insn >> 7) & 0x1f;
+    rs1 = (insn >> 15) & 0x1f;
+    rs2 = (insn >> 20) & 0x1f;
+    vm = (insn >> 25) & 1;
+    funct6 = insn >> 26;
+
+    if (funct3 == 7) {
+        avl = s->reg[rs1];
+        if (s->cur_xlen == 32)
+            avl = (uint32_t)avl;
+        if (!(insn >> 31)) {
+            /* vsetvli */
+            vtype = (insn >> 20) & 0x7ff;
+        } else if ((insn >> 30) == 3) {
+            /* vsetivli */
+            *pval = vec_setvl(s, (insn >> 20) & 0x3ff, rs1, FALSE, FALSE);
+            return 1;
+        } else if ((insn >> 25) == 0x40) {
+            /* vsetvl */
+            vtype = s->reg[rs2];
+            if (s->cur_xlen == 32)
+                vtype = (uint32_t)vtype;
+        } else {
+            return -1;
+        }
+        *pval = vec_setvl(s, vtype, avl, rs1 == 0 && rd != 0,
+                          rs1 == 0 && rd == 0);
+        return 1;
+    }
+
+    if (s->vtype & VTYPE_VILL)
+        return -1;
+    sew_log2 = vtype_sew_log2(s->vtype);
+    lmul_log2 = vtype_lmul_log2(s->vtype);
+    vlmax = get_vlmax(sew_log2, lmul_log2);
+    n = vec_group_size(lmul_log2);
+    is_vv = (funct3 <= 2);
+
+    /* scalar operand */
+    switch(funct3) {
+    case 3: /* OPIVI */
+        if (funct6 == 0x0c || funct6 == 0x0e || funct6 == 0x0f ||
+            funct6 == 0x25 || (funct6 >= 0x28 && funct6 <= 0x2f))
+            x = rs1;
+        else
+            x = (int32_t)(rs1 << 27) >> 27;
+        break;
+    case 4: /* OPIVX */
+    case 6: /* OPMVX */
+        x = (int64_t)(target_long)s->reg[rs1];
+        if (s->cur_xlen == 32)
+            x = (int32_t)x;
+        break;
+    case 5: /* OPFVF */
+        x = s->fp_reg[rs1];
+        break;
+    default:
+        x = 0;
+        break;
+    }
+
+    /* group size of the double width operands */
+    nw = vec_group_size(lmul_log2 + 1);
+
+    switch(funct3) {
+    case 0: /* OPIVV */
+    case 3: /* OPIVI */
+    case 4: /* OPIVX */
+        if (funct3 == 3 && funct6 == 0x27) {
+            /* vmv<nr>r.v */
+            uint32_t nr = rs1 + 1;
+            if (!vm || (nr & (nr - 1)) || nr > 8 ||
+                (rd & (nr - 1)) || (rs2 & (nr - 1)))
+                return -1;
+            memmove(s->vreg[rd], s->vreg[rs2], nr * VLENB);
+            break;
+        }
+        if (funct3 == 3 &&
+            (funct6 == 0x02 || (funct6 >= 0x04 && funct6 <= 0x07) ||
+             funct6 == 0x12 || funct6 == 0x13 || funct6 == 0x1a ||
+             funct6 == 0x1b || funct6 == 0x22 || funct6 == 0x23))
+            return -1;
+        if (funct6 == 0x30 || funct6 == 0x31) {
+            /* vwredsumu, vwredsum: scalar vd and vs1 */
+            if (funct3 != 0 || sew_log2 == 3 || (rs2 & (n - 1)))
+                return -1;
+            VEC_CALL_W(ret, vec_wredsum, (s, funct6 & 1, rd, rs2, rs1, vm));
+        } else if (funct6 >= 0x2c && funct6 <= 0x2f) {
+            /* narrowing: vs2 has EMUL = 2 * LMUL */
+            if (sew_log2 == 3 || lmul_log2 == 3)
+                return -1;
+            if ((rd & (n - 1)) || (rs2 & (nw - 1)) ||
+                (is_vv && (rs1 & (n - 1))) || (!vm && rd == 0) ||
+                vec_overlap_narrow(rd, n, rs2, nw))
+                return -1;
+            VEC_CALL_W(ret, vec_opn, (s, funct6, rd, rs2, rs1, x, is_vv, vm));
+        } else if ((funct6 >= 0x18 && funct6 <= 0x1f) ||
+                   funct6 == 0x11 || funct6 == 0x13) {
+            /* compares, vmadc and vmsbc: the destination is a mask
+               register */
+            if ((rs2 & (n - 1)) || (is_vv && (rs1 & (n - 1))) ||
+                vec_overlap_narrow(rd, 1, rs2, n) ||
+                (is_vv && vec_overlap_narrow(rd, 1, rs1, n)))
+                return -1;
+            VEC_CALL(ret, vec_cmp, (s, funct6, rd, rs2, rs1, x, is_vv, vm));
+        } else {
+            if ((rd & (n - 1)) || (rs2 & (n - 1)) || (!vm && rd == 0))
+                return -1;
+            if (funct6 == 0x0e && is_vv) {
+                /* vrgatherei16: the indexes have EEW = 16 */
+                emul_log2 = 1 - sew_log2 + lmul_log2;
+                if (emul_log2 < -3 || emul_log2 > 3 ||
+                    (rs1 & (vec_group_size(emul_log2) - 1)) ||
+                    vec_overlap(rd, n, rs1, vec_group_size(emul_log2)))
+                    return -1;
+            } else if (is_vv && (rs1 & (n - 1))) {
+                return -1;
+            }
+            /* vadc and vsbc have no unmasked form */
+            if ((funct6 == 0x10 || funct6 == 0x12) && vm)
+                return -1;
+            /* vrgather and vslideup cannot overlap their sources */
+            if ((funct6 == 0x0c || funct6 == 0x0e) &&
+                (vec_overlap(rd, n, rs2, n) ||
+                 (funct6 == 0x0c && is_vv && vec_overlap(rd, n, rs1, n))))
+                return -1;
+            VEC_CALL(ret, vec_opi, (s, funct6, rd, rs2, rs1, x, is_vv, vm,
+                                    vlmax));
+        }
+        if (ret < 0)
+            return -1;
+        break;
+    case 2: /* OPMVV */
+    case 6: /* OPMVX */
+        if (is_vv && funct6 == 0x10) {
+            if (!vm && rs1 == 0)
+                return -1;
+            if (rs1 == 0) {
+                /* vmv.x.s */
+                uint64_t val;
+                VEC_CALL(val, vec_get_elem, (s, rs2, 0));
+                *pval = val;
+                return 1;
+            } else if (rs1 == 0x10 || rs1 == 0x11) {
+                return vec_mask_op(s, funct6, rd, rs2, rs1, vm, pval);
+            } else {
+                return -1;
+            }
+        } else if (is_vv && ((funct6 == 0x14 && rs1 >= 1 && rs1 <= 3) ||
+                             (funct6 >= 0x18 && funct6 <= 0x1f))) {
+            ret = vec_mask_op(s, funct6, rd, rs2, rs1, vm, pval);
+        } else if (funct6 >= 0x30) {
+            /* widening: vd has EMUL = 2 * LMUL, vs2 too for the .w
+               forms */
+            if (sew_log2 == 3 || lmul_log2 == 3)
+                return -1;
+            is_w = (funct6 >= 0x34 && funct6 <= 0x37);
+            if ((rd & (nw - 1)) || (rs2 & ((is_w ? nw : n) - 1)) ||
+                (is_vv && (rs1 & (n - 1))) || (!vm && rd == 0))
+                return -1;
+            if ((is_vv && vec_overlap_widen(rd, nw, rs1, lmul_log2)) ||
+                (!is_w && vec_overlap_widen(rd, nw, rs2, lmul_log2)))
+                return -1;
+            VEC_CALL_W(ret, vec_opw, (s, funct6, rd, rs2, rs1, x, is_vv, vm));
+        } else {
+            if (funct6 <= 0x07) {
+                /* reductions: scalar vd and vs1 */
+                if (rs2 & (n - 1))
+                    return -1;
+            } else {
+                if ((rd & (n - 1)) || (!vm && rd == 0))
+                    return -1;
+                if (funct6 == 0x10) {
+                    /* vmv.s.x */
+                    if (!vm)
+                        return -1;
+                } else if (funct6 == 0x14) {
+                    /* viota, vid */
+                    if (rs1 == 0x10 && vec_overlap(rd, n, rs2, 1))
+                        return -1;
+                    if (rs1 == 0x11 && rs2 != 0)
+                        return -1;
+                } else if (funct6 == 0x12) {
+                    /* vzext, vsext: vs2 has EMUL = LMUL / 2, LMUL / 4
+                       or LMUL / 8 */
+                    if (rs1 < 2 || rs1 > 7)
+                        return -1;
+                    emul_log2 = lmul_log2 - (4 - (rs1 >> 1));
+                    if (emul_log2 < -3 ||
+                        (rs2 & (vec_group_size(emul_log2) - 1)) ||
+                        vec_overlap_widen(rd, n, rs2, emul_log2))
+                        return -1;
+                } else if (funct6 == 0x17) {
+                    /* vcompress */
+                    if (!vm || (rs2 & (n - 1)) ||
+                        vec_overlap(rd, n, rs2, n) ||
+                        vec_overlap(rd, n, rs1, 1))
+                        return -1;
+                } else {
+                    if ((rs2 & (n - 1)) || (is_vv && (rs1 & (n - 1))))
+                        return -1;
+                    if (funct6 == 0x0e && vec_overlap(rd, n, rs2, n))
+                        return -1;
+                }
+            }
+            VEC_CALL(ret, vec_opm, (s, funct6, rd, rs2, rs1, x, is_vv, vm));
+        }
+        if (ret < 0)
+            return -1;
+        break;
+    case 1: /* OPFVV */
+    case 5: /* OPFVF */
+        if (s->fs == 0)
+            return -1;
+        rm = get_insn_rm(s, 7);
+        if (rm < 0)
+            return -1;
+        if (funct6 == 0x12 && rs1 >= 0x08 && rs1 <= 0x17) {
+            /* widening and narrowing conversions */
+            if (!is_vv || sew_log2 == 0 || sew_log2 == 3 ||
+                lmul_log2 == 3 || (!vm && rd == 0))
+                return -1;
+            if (rs1 < 0x10) {
+                if ((rd & (nw - 1)) || (rs2 & (n - 1)) ||
+                    vec_overlap_widen(rd, nw, rs2, lmul_log2))
+                    return -1;
+            } else {
+                if ((rd & (n - 1)) || (rs2 & (nw - 1)) ||
+                    vec_overlap_narrow(rd, n, rs2, nw))
+                    return -1;
+            }
+            if (sew_log2 == 1)
+                ret = vec_fcvtw16(s, rs1, rd, rs2, vm, rm);
+            else
+                ret = vec_fcvtw32(s, rs1, rd, rs2, vm, rm);
+        } else if (sew_log2 < 2) {
+            return -1;
+        } else if (funct6 >= 0x30) {
+            /* widening: the f32 operands give f64 results */
+            if (sew_log2 != 2 || lmul_log2 == 3)
+                return -1;
+            if (funct6 == 0x31 || funct6 == 0x33) {
+                /* reductions */
+                if (rs2 & (n - 1))
+                    return -1;
+            } else {
+                is_w = (funct6 == 0x34 || funct6 == 0x36);
+                if ((rd & (nw - 1)) || (rs2 & ((is_w ? nw : n) - 1)) ||
+                    (is_vv && (rs1 & (n - 1))) || (!vm && rd == 0))
+                    return -1;
+                if ((is_vv && vec_overlap_widen(rd, nw, rs1, lmul_log2)) ||
+                    (!is_w && vec_overlap_widen(rd, nw, rs2, lmul_log2)))
+                    return -1;
+            }
+            ret = vec_opfw32(s, funct6, rd, rs2, rs1, x, is_vv, vm, rm);
+        } else {
+            if (funct6 >= 0x18 && funct6 <= 0x1f) {
+                if ((rs2 & (n - 1)) || (is_vv && (rs1 & (n - 1))) ||
+                    vec_overlap_narrow(rd, 1, rs2, n) ||
+                    (is_vv && vec_overlap_narrow(rd, 1, rs1, n)))
+                    return -1;
+            } else if (funct6 == 0x10) {
+                /* vfmv.f.s, vfmv.s.f */
+                if (!vm)
+                    return -1;
+            } else if (funct6 <= 0x07 && (funct6 & 1)) {
+                /* reductions */
+                if (rs2 & (n - 1))
+                    return -1;
+            } else {
+                /* vs1 is an opcode field for the unary operations */
+                if ((rd & (n - 1)) || (rs2 & (n - 1)) ||
+                    (is_vv && funct6 != 0x12 && funct6 != 0x13 &&
+                     (rs1 & (n - 1))) || (!vm && rd == 0))
+                    return -1;
+                if (funct6 == 0x0e && vec_overlap(rd, n, rs2, n))
+                    return -1;
+            }
+            if (sew_log2 == 2)
+                ret = vec_opf32(s, funct6, rd, rs2, rs1, x, is_vv, vm, rm);
+            else
+                ret = vec_opf64(s, funct6, rd, rs2, rs1, x, is_vv, vm, rm);
+        }
+        if (ret < 0)
+            return -1;
+        s->fs = 3;
+        break;
+    default:
+        return -1;
+    }
+    s->vstart = 0;
+    s->vs = 3;
+    return 0;
+}
+
+/* return a host pointer to the guest page of 'addr' if it is mapped in
+   the TLB (in any way or in the victim buffer), NULL otherwise */
+static inline uint8_t *vec_get_ram_ptr(RISCVCPUState *s, target_ulong addr,
+                                       BOOL is_store)
+{
+    TLBEntry *te;
+    uint32_t tlb_idx;
+    tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
+    te = is_store ? &s->tlb_write[tlb_idx] : &s->tlb_read[tlb_idx];
+    if (likely(te->vaddr == (addr & ~PG_MASK)))
+        return (uint8_t *)(te->mem_addend + (uintptr_t)addr);
+    return tlb_lookup_slow(s, is_store ? ACCESS_WRITE : ACCESS_READ, addr);
+}
+
+/* return != 0 if exception */
+static int vec_access_elem(RISCVCPUState *s, target_ulong addr, uint8_t *ptr,
+                           int size_log2, BOOL is_store)
+{
+    switch(size_log2) {
+    case 0:
+        if (is_store)
+            return target_write_u8(s, addr, *ptr);
+        else
+            return target_read_u8(s, ptr, addr);
+    case 1:
+        if (is_store)
+            return target_write_u16(s, addr, *(uint16_t *)ptr);
+        else
+            return target_read_u16(s, (uint16_t *)ptr, addr);
+    case 2:
+        if (is_store)
+            return target_write_u32(s, addr, *(uint32_t *)ptr);
+        else
+            return target_read_u32(s, (uint32_t *)ptr, addr);
+    default:
+        if (is_store)
+            return target_write_u64(s, addr, *(uint64_t *)ptr);
+        else
+            return target_read_u64(s, (uint64_t *)ptr, addr);
+    }
+}
+
+/* vector loads and stores (LOAD-FP and STORE-FP major opcodes). Return
+   -1 if illegal instruction, -2 if exception. */
+static int vector_load_store(RISCVCPUState *s, uint32_t insn, BOOL is_store)
+{
+    uint32_t funct3, vd, rs1, rs2, nf, mop, i, f, evl, n, nregs;
+    int eew_log2, data_log2, sew_log2, lmul_log2, emul_log2;
+    target_ulong base, addr, stride, offset;
+    uint8_t *ptr, *p;
+    BOOL vm, fof;
+
+    if (s->vs == 0)
+        return -1;
+    funct3 = (insn >> 12) & 7;
+    vd = (insn >> 7) & 0x1f;
+    rs1 = (insn >> 15) & 0x1f;
+    rs2 = (insn >> 20) & 0x1f;
+    vm = (insn >> 25) & 1;
+    mop = (insn >> 26) & 3;
+    nf = ((insn >> 29) & 7) + 1;
+    if ((insn >> 28) & 1)
+        return -1; /* mew */
+    eew_log2 = (funct3 == 0) ? 0 : funct3 - 4;
+    base = s->reg[rs1];
+    stride = 0;
+    fof = FALSE;
+
+    if (mop == 0 && rs2 == 0x08) {
+        /* whole register load/store */
+        if (!vm || (nf & (nf - 1)) || (vd & (nf - 1)) ||
+            (is_store && eew_log2 != 0))
+            return -1;
+        data_log2 = eew_log2;
+        nregs = nf;
+        nf = 1;
+        evl = (nregs * VLENB) >> data_log2;
+    } else {
+        if (s->vtype & VTYPE_VILL)
+            return -1;
+        sew_log2 = vtype_sew_log2(s->vtype);
+        lmul_log2 = vtype_lmul_log2(s->vtype);
+        evl = s->vl;
+        if (mop == 0 && rs2 == 0x0b) {
+            /* vlm.v, vsm.v */
+            if (!vm || nf != 1 || eew_log2 != 0)
+                return -1;
+            evl = (evl + 7) >> 3;
+            emul_log2 = 0;
+        } else if (mop == 0 && (rs2 == 0 || (rs2 == 0x10 && !is_store))) {
+            fof = (rs2 == 0x10);
+            emul_log2 = eew_log2 - sew_log2 + lmul_log2;
+        } else if (mop == 2) {
+            /* strided */
+            stride = s->reg[rs2];
+            emul_log2 = eew_log2 - sew_log2 + lmul_log2;
+        } else if (mop == 1 || mop == 3) {
+            /* indexed: the data elements have the width SEW */
+            emul_log2 = eew_log2 - sew_log2 + lmul_log2;
+            if (emul_log2 < -3 || emul_log2 > 3 ||
+                (rs2 & (vec_group_size(emul_log2) - 1)))
+                return -1;
+            emul_log2 = lmul_log2;
+        } else {
+            return -1;
+        }
+        if (emul_log2 < -3 || emul_log2 > 3)
+            return -1;
+        data_log2 = (mop & 1) ? sew_log2 : eew_log2;
+        nregs = vec_group_size(emul_log2);
+        if (nf * nregs > 8 || vd + nf * nregs > 32 || (vd & (nregs - 1)) ||
+            (!vm && vd == 0 && !is_store))
+            return -1;
+    }
+
+    for(i = s->vstart; i < evl;) {
+        if (mop == 0 && nf == 1 && vm) {
+            /* copy the elements of the same page at once */
+            addr = base + (i << data_log2);
+            n = ((PG_MASK + 1) - (addr & PG_MASK)) >> data_log2;
+            if (n > evl - i)
+                n = evl - i;
+            if (n > 0) {
+                p = vec_get_ram_ptr(s, addr, is_store);
+                if (p) {
+                    ptr = (uint8_t *)s->vreg[vd] + (i << data_log2);
+                    if (is_store)
+                        memcpy(p, ptr, n << data_log2);
+                    else
+                        memcpy(ptr, p, n << data_log2);
+                    i += n;
+                    continue;
+                }
+            }
+        }
+        if (vm || vmask_get(s, 0, i)) {
+            if (mop & 1) {
+                p = (uint8_t *)s->vreg[rs2];
+                switch(eew_log2) {
+                case 0:
+                    offset = p[i];
+                    break;
+                case 1:
+                    offset = ((uint16_t *)p)[i];
+                    break;
+                case 2:
+                    offset = ((uint32_t *)p)[i];
+                    break;
+                default:
+                    offset = ((uint64_t *)p)[i];
+                    break;
+                }
+            } else if (mop == 2) {
+                offset = i * stride;
+            } else {
+                offset = (i * nf) << data_log2;
+            }
+            for(f = 0; f < nf; f++) {
+                addr = base + offset + (f << data_log2);
+                ptr = (uint8_t *)s->vreg[vd + f * nregs] + (i << data_log2);
+                if (vec_access_elem(s, addr, ptr, data_log2, is_store)) {
+                    if (fof && i > 0) {
+                        /* no trap: vl is reduced */
+                        s->pending_exception = -1;
+                        s->vl = i;
+                        goto done;
+                    }
+                    s->vstart = i;
+                    return -2;
+                }
+            }
+        }
+        i++;
+    }
+ done:
+    s->vstart = 0;
+    if (!is_store)
+        s->vs = 3;
+    return 0;
+}
+#endif /* CONFIG_EXT_V */
+
+/* mip is also modified by the devices and the other harts */
+static void mip_write(RISCVCPUState *s, uint32_t mask, uint32_t val)
+{
+    __atomic_fetch_and(&s->mip, ~(mask & ~val), __ATOMIC_SEQ_CST);
+    __atomic_fetch_or(&s->mip, mask & val, __ATOMIC_SEQ_CST);
+}
+
+/* Sstc: STIP is set when time >= stimecmp */
+static void stimecmp_update(RISCVCPUState *s)
+{
+    if (!(s->menvcfg & MENVCFG_STCE))
+        return;
+    if (get_time(s) >= s->stimecmp)
+        mip_write(s, MIP_STIP, MIP_STIP);
+    else
+        mip_write(s, MIP_STIP, 0);
+}
+
 /* return -1 if invalid CSR, 0 if OK, 1 if the interpreter loop must be
    exited (e.g. XLEN was modified), 2 if TLBs have been flushed. */
 static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
@@ -902,6 +2831,25 @@ static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
         s->fflags = val & 0x1f;
         s->fs = 3;
         break;
+#endif
+#ifdef CONFIG_EXT_V
+    case 0x008: /* vstart */
+        s->vstart = val & (VLEN - 1);
+        s->vs = 3;
+        break;
+    case 0x009: /* vxsat */
+        s->vxsat = val & 1;
+        s->vs = 3;
+        break;
+    case 0x00a: /* vxrm */
+        s->vxrm = val & 3;
+        s->vs = 3;
+        break;
+    case 0x00f: /* vcsr */
+        s->vxsat = val & 1;
+        s->vxrm = (val >> 1) & 3;
+        s->vs = 3;
+        break;
 #endif
     case 0x100: /* sstatus */
         set_mstatus(s, (s->mstatus & ~SSTATUS_MASK) | (val & SSTATUS_MASK));
@@ -930,15 +2878,31 @@ static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
         break;
     case 0x144: /* sip */
         mask = s->mideleg;
-        s->mip = (s->mip & ~mask) | (val & mask);
+        if (s->menvcfg & MENVCFG_STCE)
+            mask &= ~MIP_STIP;
+        mip_write(s, mask, val);
+        break;
+    case 0x14d: /* stimecmp */
+        if (!stimecmp_access_ok(s))
+            return -1;
+        if (s->cur_xlen == 32)
+            s->stimecmp = (s->stimecmp & ~0xffffffff) | (uint32_t)val;
+        else
+            s->stimecmp = val;
+        stimecmp_update(s);
+        break;
+    case 0x15d: /* stimecmph */
+        if (s->cur_xlen != 32 || !stimecmp_access_ok(s))
+            return -1;
+        s->stimecmp = (s->stimecmp & 0xffffffff) | ((uint64_t)val << 32);
+        stimecmp_update(s);
         break;
     case 0x180:
-        /* no ASID implemented */
 #if MAX_XLEN == 32
         {
             int new_mode;
             new_mode = (val >> 31) & 1;
-            s->satp = (val & (((target_ulong)1 << 22) - 1)) |
+            s->satp = (val & (((target_ulong)1 << 31) - 1)) |
                 (new_mode << 31);
         }
 #else
@@ -948,11 +2912,12 @@ static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
             new_mode = (val >> 60) & 0xf;
             if (new_mode == 0 || (new_mode >= 8 && new_mode <= 9))
                 mode = new_mode;
-            s->satp = (val & (((uint64_t)1 << 44) - 1)) |
+            s->satp = (val & (((uint64_t)1 << 60) - 1)) |
                 ((uint64_t)mode << 60);
         }
 #endif
-        tlb_flush_all(s);
+        /* the entries of the previous address space are kept */
+        tlb_update_ctx(s);
         return 2;
         
     case 0x300:
@@ -993,6 +2958,18 @@ static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
     case 0x306:
         s->mcounteren = val & COUNTEREN_MASK;
         break;
+    case 0x30a:
+        if (s->cur_xlen != 32) {
+            s->menvcfg = val & MENVCFG_STCE;
+            stimecmp_update(s);
+        }
+        break;
+    case 0x31a: /* menvcfgh */
+        if (s->cur_xlen != 32)
+            return -1;
+        s->menvcfg = ((uint64_t)val << 32) & MENVCFG_STCE;
+        stimecmp_update(s);
+        break;
     case 0x340:
         s->mscratch = val;
         break;
@@ -1007,7 +2984,10 @@ static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
         break;
     case 0x344:
         mask = MIP_SSIP | MIP_STIP;
-        s->mip = (s->mip & ~mask) | (val & mask);
+        /* with Sstc, STIP is read-only and follows stimecmp */
+        if (s->menvcfg & MENVCFG_STCE)
+            mask &= ~MIP_STIP;
+        mip_write(s, mask, val);
         break;
     default:
 #ifdef DUMP_INVALID_CSR
@@ -1021,7 +3001,6 @@ static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
 static void set_priv(RISCVCPUState *s, int priv)
 {
     if (s->priv != priv) {
-        tlb_flush_all(s);
 #if MAX_XLEN >= 64
         /* change the current xlen */
         {
@@ -1037,6 +3016,8 @@ static void set_priv(RISCVCPUState *s, int priv)
 #endif
         s->priv = priv;
     }
+    /* mstatus.MPP may also have changed */
+    tlb_update_ctx(s);
 }
 
 static void raise_exception2(RISCVCPUState *s, uint32_t cause,
@@ -1080,6 +3061,10 @@ static void raise_exception2(RISCVCPUState *s, uint32_t cause,
     }
 #endif
 
+    if (cause & CAUSE_INTERRUPT)
+        s->stats.interrupts++;
+    else
+        s->stats.exceptions++;
     if (s->priv <= PRV_S) {
         /* delegate the exception to the supervisor priviledge */
         if (cause & CAUSE_INTERRUPT)
@@ -1226,6 +3211,25 @@ static inline uint32_t get_field1(uint32_t val, int src_pos,
 #include "riscv_cpu_template.h"
 #endif
 
+#ifdef CONFIG_EXT_C
+/* the tables are shared by all the CPUs */
+static void rvc_tables_init(void)
+{
+    static BOOL rvc_tables_ok;
+
+    if (rvc_tables_ok)
+        return;
+    rvc_table_init_x32();
+#if MAX_XLEN >= 64
+    rvc_table_init_x64();
+#endif
+#if MAX_XLEN >= 128
+    rvc_table_init_x128();
+#endif
+    rvc_tables_ok = TRUE;
+}
+#endif
+
 static void glue(riscv_cpu_interp, MAX_XLEN)(RISCVCPUState *s, int n_cycles)
 {
 #ifdef USE_GLOBAL_STATE
@@ -1263,17 +3267,19 @@ static uint64_t glue(riscv_cpu_get_cycles, MAX_XLEN)(RISCVCPUState *s)
     return s->insn_counter;
 }
 
+/* can be called from another thread than the one running the CPU */
 static void glue(riscv_cpu_set_mip, MAX_XLEN)(RISCVCPUState *s, uint32_t mask)
 {
-    s->mip |= mask;
+    __atomic_fetch_or(&s->mip, mask, __ATOMIC_SEQ_CST);
     /* exit from power down if an interrupt is pending */
-    if (s->power_down_flag && (s->mip & s->mie) != 0)
+    if (__atomic_load_n(&s->power_down_flag, __ATOMIC_SEQ_CST) &&
+        (s->mip & s->mie) != 0)
         s->power_down_flag = FALSE;
 }
 
 static void glue(riscv_cpu_reset_mip, MAX_XLEN)(RISCVCPUState *s, uint32_t mask)
 {
-    s->mip &= ~mask;
+    __atomic_fetch_and(&s->mip, ~mask, __ATOMIC_SEQ_CST);
 }
 
 static uint32_t glue(riscv_cpu_get_mip, MAX_XLEN)(RISCVCPUState *s)
@@ -1304,6 +3310,11 @@ static RISCVCPUState *glue(riscv_cpu_init, MAX_XLEN)(PhysMemoryMap *mem_map)
     s->mstatus = ((uint64_t)s->mxl << MSTATUS_UXL_SHIFT) |
         ((uint64_t)s->mxl << MSTATUS_SXL_SHIFT);
     s->misa |= MCPUID_SUPER | MCPUID_USER | MCPUID_I | MCPUID_M | MCPUID_A;
+    /* Sstc is disabled at reset: STIP is read-only once it is
+       enabled, so the firmware which does not know Sstc and injects the
+       S mode timer interrupt thru mip.STIP keeps working. */
+    s->menvcfg = 0;
+    s->stimecmp = -1;
 #if FLEN >= 32
     s->misa |= MCPUID_F;
 #endif
@@ -1315,13 +3326,30 @@ static RISCVCPUState *glue(riscv_cpu_init, MAX_XLEN)(PhysMemoryMap *mem_map)
 #endif
 #ifdef CONFIG_EXT_C
     s->misa |= MCPUID_C;
+#endif
+#ifdef CONFIG_EXT_V
+    s->misa |= MCPUID_V;
+    s->vtype = VTYPE_VILL;
+#endif
+#ifdef CONFIG_EXT_C
+    rvc_tables_init();
 #endif
     tlb_init(s);
+    s->tb_buf = malloc(TB_BUF_SIZE);
+    if (!s->tb_buf) {
+        fprintf(stderr, "Could not allocate the translation buffer\n");
+        exit(1);
+    }
     return s;
 }
 
 static void glue(riscv_cpu_end, MAX_XLEN)(RISCVCPUState *s)
 {
+#ifdef CONFIG_JIT
+    if (s->jit_buf)
+        munmap(s->jit_buf, JIT_BUF_SIZE);
+#endif
+    free(s->tb_buf);
 #ifdef USE_GLOBAL_STATE
     free(s);
 #endif
@@ -1332,6 +3360,112 @@ static uint32_t glue(riscv_cpu_get_misa, MAX_XLEN)(RISCVCPUState *s)
     return s->misa;
 }
 
+/* return -1 if the JIT is not supported */
+static int glue(riscv_cpu_set_jit, MAX_XLEN)(RISCVCPUState *s, BOOL enable)
+{
+#ifdef CONFIG_JIT
+    if (enable && !s->jit_buf) {
+        s->jit_buf = mmap(NULL, JIT_BUF_SIZE,
+                          PROT_READ | PROT_WRITE | PROT_EXEC,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (s->jit_buf == MAP_FAILED) {
+            s->jit_buf = NULL;
+            return -1;
+        }
+    }
+    s->jit_enabled = enable;
+    tb_flush_all(s);
+    return 0;
+#else
+    return enable ? -1 : 0;
+#endif
+}
+
+static void glue(riscv_cpu_set_hart_id, MAX_XLEN)(RISCVCPUState *s, int hart_id)
+{
+    s->mhartid = hart_id;
+}
+
+static const RISCVCPUStats *glue(riscv_cpu_get_stats, MAX_XLEN)(RISCVCPUState *s)
+{
+    return &s->stats;
+}
+
+static void glue(riscv_cpu_set_time_func, MAX_XLEN)(RISCVCPUState *s,
+                                                    RISCVGetTimeFunc *get_time,
+                                                    void *opaque)
+{
+    s->get_time = get_time;
+    s->get_time_opaque = opaque;
+    /* force a read at the next access */
+    s->time_cache_insn = s->insn_counter - TIME_CACHE_INSNS;
+}
+
+static uint64_t glue(riscv_cpu_get_stimecmp, MAX_XLEN)(RISCVCPUState *s)
+{
+    if (!s->get_time || !(s->menvcfg & MENVCFG_STCE))
+        return UINT64_MAX;
+    return s->stimecmp;
+}
+
+static void glue(riscv_cpu_snapshot, MAX_XLEN)(RISCVCPUState *s,
+                                               SnapshotFile *f)
+{
+    snapshot_section(f, "cpu");
+    snapshot_check(f, "max_xlen", MAX_XLEN);
+    snapshot_check(f, "misa", s->misa);
+    snapshot_var(f, s->pc);
+    snapshot_var(f, s->reg);
+#if FLEN > 0
+    snapshot_var(f, s->fp_reg);
+    snapshot_var(f, s->fflags);
+    snapshot_var(f, s->frm);
+#endif
+#ifdef CONFIG_EXT_V
+    snapshot_var(f, s->vreg);
+    snapshot_var(f, s->vl);
+    snapshot_var(f, s->vtype);
+    snapshot_var(f, s->vstart);
+    snapshot_var(f, s->vxrm);
+    snapshot_var(f, s->vxsat);
+#endif
+    snapshot_var(f, s->cur_xlen);
+    snapshot_var(f, s->priv);
+    snapshot_var(f, s->fs);
+    snapshot_var(f, s->vs);
+    snapshot_var(f, s->mxl);
+    snapshot_var(f, s->insn_counter);
+    snapshot_var(f, s->power_down_flag);
+    snapshot_var(f, s->mstatus);
+    snapshot_var(f, s->mtvec);
+    snapshot_var(f, s->mscratch);
+    snapshot_var(f, s->mepc);
+    snapshot_var(f, s->mcause);
+    snapshot_var(f, s->mtval);
+    snapshot_var(f, s->mie);
+    snapshot_var(f, s->mip);
+    snapshot_var(f, s->medeleg);
+    snapshot_var(f, s->mideleg);
+    snapshot_var(f, s->mcounteren);
+    snapshot_var(f, s->stvec);
+    snapshot_var(f, s->sscratch);
+    snapshot_var(f, s->sepc);
+    snapshot_var(f, s->scause);
+    snapshot_var(f, s->stval);
+    snapshot_var(f, s->satp);
+    snapshot_var(f, s->scounteren);
+    snapshot_var(f, s->menvcfg);
+    snapshot_var(f, s->stimecmp);
+    snapshot_var(f, s->load_res);
+    snapshot_var(f, s->load_res_val);
+    if (snapshot_is_load(f)) {
+        /* the cached translations refer to the previous RAM */
+        tlb_init(s);
+        tb_flush_all(s);
+        s->time_cache_insn = s->insn_counter - TIME_CACHE_INSNS;
+    }
+}
+
 const RISCVCPUClass glue(riscv_cpu_class, MAX_XLEN) = {
     glue(riscv_cpu_init, MAX_XLEN),
     glue(riscv_cpu_end, MAX_XLEN),
@@ -1343,6 +3477,12 @@ const RISCVCPUClass glue(riscv_cpu_class, MAX_XLEN) = {
     glue(riscv_cpu_get_power_down, MAX_XLEN),
     glue(riscv_cpu_get_misa, MAX_XLEN),
     glue(riscv_cpu_flush_tlb_write_range_ram, MAX_XLEN),
+    glue(riscv_cpu_set_jit, MAX_XLEN),
+    glue(riscv_cpu_set_hart_id, MAX_XLEN),
+    glue(riscv_cpu_get_stats, MAX_XLEN),
+    glue(riscv_cpu_set_time_func, MAX_XLEN),
+    glue(riscv_cpu_get_stimecmp, MAX_XLEN),
+    glue(riscv_cpu_snapshot, MAX_XLEN),
 };
 
 #if CONFIG_RISCV_MAX_XLEN == MAX_XLEN
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include "cutils.h"
 #include "iomem.h"
+#include "snapshot.h"
 
 #define MIP_USIP (1 << 0)
 #define MIP_SSIP (1 << 1)
@@ -43,6 +44,47 @@
 
 typedef struct RISCVCPUState RISCVCPUState;
 
+/* return the machine time in timebase ticks */
+typedef uint64_t RISCVGetTimeFunc(void *opaque);
+
+/* instruction pairs executed as a single operation */
+typedef enum {
+    RISCV_FUSE_LUI_ADDI, /* lui + addi or addiw */
+    RISCV_FUSE_AUIPC_ADDI, /* auipc + addi */
+    RISCV_FUSE_AUIPC_JALR, /* auipc + jalr */
+    RISCV_FUSE_AUIPC_LOAD, /* auipc + lw or ld */
+    RISCV_FUSE_SHIFT, /* slli + srli or srai */
+    RISCV_FUSE_ADDI_BRANCH, /* addi + conditional branch */
+    RISCV_FUSE_COUNT,
+} RISCVFuseEnum;
+
+/* event counters, only updated in the slow paths */
+typedef struct {
+    uint64_t read_slow; /* target_read_slow() calls */
+    uint64_t write_slow; /* target_write_slow() calls */
+    uint64_t code_slow; /* instruction TLB misses */
+    uint64_t page_walks; /* page table walks */
+    uint64_t pte_reads; /* PTEs read by the page table walks */
+    uint64_t ptw_hit; /* page table walks starting below the root */
+    uint64_t tlb_flush_all; /* sfence.vma flushing all the entries */
+    uint64_t tlb_flush_asid; /* sfence.vma flushing one address space */
+    uint64_t tlb_flush_vaddr; /* sfence.vma flushing one page */
+    uint64_t tlb_ctx_hit; /* satp/privilege changes reusing cached entries */
+    uint64_t tlb_ctx_miss; /* satp/privilege changes evicting entries */
+    uint64_t tlb_way_hit; /* fast path misses found in another way */
+    uint64_t tlb_victim_hit; /* fast path misses found in the victim buffer */
+    uint64_t tlb_sp_hit; /* page walks avoided by a superpage entry */
+    uint64_t tlb_conflict; /* valid entries evicted from the last way */
+    uint64_t fuse_decoded[RISCV_FUSE_COUNT]; /* fused pairs in the decoded blocks */
+    uint64_t tb_chain; /* block successors stored in the chains */
+    uint64_t exceptions; /* traps taken, interrupts excluded */
+    uint64_t interrupts; /* interrupts taken */
+    uint64_t devio_count; /* device accesses */
+    /* time spent in the device callbacks in ns, estimated from one
+       access out of DEVIO_SAMPLE_PERIOD if the map has 'devio_profile' */
+    uint64_t devio_time;
+} RISCVCPUStats;
+
 typedef struct {
     RISCVCPUState *(*riscv_cpu_init)(PhysMemoryMap *mem_map);
     void (*riscv_cpu_end)(RISCVCPUState *s);
@@ -54,7 +96,15 @@ typedef struct {
     BOOL (*riscv_cpu_get_power_down)(RISCVCPUState *s);
     uint32_t (*riscv_cpu_get_misa)(RISCVCPUState *s);
     void (*riscv_cpu_flush_tlb_write_range_ram)(RISCVCPUState *s,
+                                                PhysMemoryRange *pr,
                                                 uint8_t *ram_ptr, size_t ram_size);
+    int (*riscv_cpu_set_jit)(RISCVCPUState *s, BOOL enable);
+    void (*riscv_cpu_set_hart_id)(RISCVCPUState *s, int hart_id);
+    const RISCVCPUStats *(*riscv_cpu_get_stats)(RISCVCPUState *s);
+    void (*riscv_cpu_set_time_func)(RISCVCPUState *s,
+                                    RISCVGetTimeFunc *get_time, void *opaque);
+    uint64_t (*riscv_cpu_get_stimecmp)(RISCVCPUState *s);
+    void (*riscv_cpu_snapshot)(RISCVCPUState *s, SnapshotFile *f);
 } RISCVCPUClass;
 
 typedef struct {
@@ -108,11 +158,49 @@ static inline uint32_t riscv_cpu_get_misa(RISCVCPUState *s)
     const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
     return c->riscv_cpu_get_misa(s);
 }
+/* if 'pr' is not NULL, the dirty bits of its pages which were in the
+   write TLB are set */
 static inline void riscv_cpu_flush_tlb_write_range_ram(RISCVCPUState *s,
+                                                       PhysMemoryRange *pr,
                                                        uint8_t *ram_ptr, size_t ram_size)
 {
     const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
-    c->riscv_cpu_flush_tlb_write_range_ram(s, ram_ptr, ram_size);
+    c->riscv_cpu_flush_tlb_write_range_ram(s, pr, ram_ptr, ram_size);
+}
+static inline int riscv_cpu_set_jit(RISCVCPUState *s, BOOL enable)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    return c->riscv_cpu_set_jit(s, enable);
+}
+static inline void riscv_cpu_set_hart_id(RISCVCPUState *s, int hart_id)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    c->riscv_cpu_set_hart_id(s, hart_id);
+}
+static inline const RISCVCPUStats *riscv_cpu_get_stats(RISCVCPUState *s)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    return c->riscv_cpu_get_stats(s);
+}
+/* the 'time' CSR is only implemented if a time function is set */
+static inline void riscv_cpu_set_time_func(RISCVCPUState *s,
+                                           RISCVGetTimeFunc *get_time,
+                                           void *opaque)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    c->riscv_cpu_set_time_func(s, get_time, opaque);
+}
+/* return the Sstc timer compare value or UINT64_MAX if Sstc is disabled */
+static inline uint64_t riscv_cpu_get_stimecmp(RISCVCPUState *s)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    return c->riscv_cpu_get_stimecmp(s);
+}
+/* save or restore the architectural state of the hart */
+static inline void riscv_cpu_snapshot(RISCVCPUState *s, SnapshotFile *f)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    c->riscv_cpu_snapshot(s, f);
 }
 
 #endif /* RISCV_CPU_H */
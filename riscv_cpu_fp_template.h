@@ -40,7 +40,7 @@
                 rm = get_insn_rm(s, rm);
                 if (rm < 0)
                     goto illegal_insn;
-                s->fp_reg[rd] = glue(add_sf, F_SIZE)(s->fp_reg[rs1],
+                s->fp_reg[rd] = glue(host_add_sf, F_SIZE)(s->fp_reg[rs1],
                                          s->fp_reg[rs2],
                                          rm, &s->fflags) | F_HIGH;
                 s->fs = 3;                                             
@@ -49,7 +49,7 @@
                 rm = get_insn_rm(s, rm);
                 if (rm < 0)
                     goto illegal_insn;
-                s->fp_reg[rd] = glue(sub_sf, F_SIZE)(s->fp_reg[rs1],
+                s->fp_reg[rd] = glue(host_sub_sf, F_SIZE)(s->fp_reg[rs1],
                                                s->fp_reg[rs2],
                                                rm, &s->fflags) | F_HIGH;
                 s->fs = 3;                                             
@@ -58,7 +58,7 @@
                 rm = get_insn_rm(s, rm);
                 if (rm < 0)
                     goto illegal_insn;
-                s->fp_reg[rd] = glue(mul_sf, F_SIZE)(s->fp_reg[rs1],
+                s->fp_reg[rd] = glue(host_mul_sf, F_SIZE)(s->fp_reg[rs1],
                                                s->fp_reg[rs2],
                                                rm, &s->fflags) | F_HIGH;
                 s->fs = 3;                                             
@@ -67,7 +67,7 @@
                 rm = get_insn_rm(s, rm);
                 if (rm < 0)
                     goto illegal_insn;
-                s->fp_reg[rd] = glue(div_sf, F_SIZE)(s->fp_reg[rs1],
+                s->fp_reg[rd] = glue(host_div_sf, F_SIZE)(s->fp_reg[rs1],
                                                s->fp_reg[rs2],
                                                rm, &s->fflags) | F_HIGH;
                 s->fs = 3;                                             
@@ -76,7 +76,7 @@
                 rm = get_insn_rm(s, rm);
                 if (rm < 0 || rs2 != 0)
                     goto illegal_insn;
-                s->fp_reg[rd] = glue(sqrt_sf, F_SIZE)(s->fp_reg[rs1],
+                s->fp_reg[rd] = glue(host_sqrt_sf, F_SIZE)(s->fp_reg[rs1],
                                                 rm, &s->fflags) | F_HIGH;
                 s->fs = 3;                                             
                 break;
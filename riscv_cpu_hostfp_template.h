@@ -0,0 +1,241 @@
+/*
+ * RISCV emulator: host FPU fast path
+ *
+ * Copyright (c) 2026 TinyEMU contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* The host FPU is only used with round to nearest even, normal operands
+   and a normal result which is not close to the underflow threshold. In
+   this case the result is identical to softfp and the only possible
+   exception is 'inexact'. It is computed from the exact rounding error
+   because clearing the host exception flags is slow on most CPUs. */
+
+#if F_SIZE == 32
+#define F_UINT uint32_t
+#define F_HOST float
+#define MANT_SIZE 23
+#define EXP_MASK 0xff
+#define HOST_SQRT sqrtf
+#define HOST_FMA fmaf
+#elif F_SIZE == 64
+#define F_UINT uint64_t
+#define F_HOST double
+#define MANT_SIZE 52
+#define EXP_MASK 0x7ff
+#define HOST_SQRT sqrt
+#define HOST_FMA fma
+#else
+#error unsupported F_SIZE
+#endif
+
+#define FSIGN_MASK glue(FSIGN_MASK, F_SIZE)
+
+#ifdef CONFIG_HOST_FPU
+
+typedef union {
+    F_UINT i;
+    F_HOST f;
+} glue(HostFloat, F_SIZE);
+
+static inline F_HOST glue(to_host_f, F_SIZE)(F_UINT a)
+{
+    glue(HostFloat, F_SIZE) u;
+    u.i = a;
+    return u.f;
+}
+
+static inline F_UINT glue(from_host_f, F_SIZE)(F_HOST a)
+{
+    glue(HostFloat, F_SIZE) u;
+    u.f = a;
+    return u.i;
+}
+
+static inline BOOL glue(host_fpu_normal, F_SIZE)(F_UINT a)
+{
+    uint32_t e = (a >> MANT_SIZE) & EXP_MASK;
+    return (e - 1) < (EXP_MASK - 1);
+}
+
+/* finite and large enough so that the rounding errors of the
+   products are representable. It also excludes the underflow cases. */
+static inline BOOL glue(host_fpu_safe, F_SIZE)(F_UINT a)
+{
+    uint32_t e = (a >> MANT_SIZE) & EXP_MASK;
+    return (e - (MANT_SIZE + 2)) < (EXP_MASK - (MANT_SIZE + 2));
+}
+
+static inline BOOL glue(host_fpu_add, F_SIZE)(F_UINT *pr, F_UINT a, F_UINT b,
+                                              uint32_t *pfflags)
+{
+    F_HOST fa, fb, fr, fa1, fb1;
+
+    if (!glue(host_fpu_normal, F_SIZE)(a) || !glue(host_fpu_normal, F_SIZE)(b))
+        return FALSE;
+    fa = glue(to_host_f, F_SIZE)(a);
+    fb = glue(to_host_f, F_SIZE)(b);
+    fr = fa + fb;
+    *pr = glue(from_host_f, F_SIZE)(fr);
+    if (!glue(host_fpu_safe, F_SIZE)(*pr))
+        return FALSE;
+    /* exact rounding error (2Sum) */
+    fb1 = fr - fa;
+    fa1 = fr - fb1;
+    if ((fa - fa1) + (fb - fb1) != 0)
+        *pfflags |= FFLAG_INEXACT;
+    return TRUE;
+}
+
+#endif /* CONFIG_HOST_FPU */
+
+static inline F_UINT glue(host_add_sf, F_SIZE)(F_UINT a, F_UINT b,
+                                               RoundingModeEnum rm,
+                                               uint32_t *pfflags)
+{
+#ifdef CONFIG_HOST_FPU
+    F_UINT r;
+    if (rm == RM_RNE && glue(host_fpu_add, F_SIZE)(&r, a, b, pfflags))
+        return r;
+#endif
+    return glue(add_sf, F_SIZE)(a, b, rm, pfflags);
+}
+
+static inline F_UINT glue(host_sub_sf, F_SIZE)(F_UINT a, F_UINT b,
+                                               RoundingModeEnum rm,
+                                               uint32_t *pfflags)
+{
+#ifdef CONFIG_HOST_FPU
+    F_UINT r;
+    if (rm == RM_RNE &&
+        glue(host_fpu_add, F_SIZE)(&r, a, b ^ FSIGN_MASK, pfflags))
+        return r;
+#endif
+    return glue(sub_sf, F_SIZE)(a, b, rm, pfflags);
+}
+
+static inline F_UINT glue(host_mul_sf, F_SIZE)(F_UINT a, F_UINT b,
+                                               RoundingModeEnum rm,
+                                               uint32_t *pfflags)
+{
+#ifdef CONFIG_HOST_FPU
+    if (rm == RM_RNE && glue(host_fpu_normal, F_SIZE)(a) &&
+        glue(host_fpu_normal, F_SIZE)(b)) {
+        F_HOST fa, fb, fr;
+        F_UINT r;
+        fa = glue(to_host_f, F_SIZE)(a);
+        fb = glue(to_host_f, F_SIZE)(b);
+        fr = fa * fb;
+        r = glue(from_host_f, F_SIZE)(fr);
+        if (glue(host_fpu_safe, F_SIZE)(r)) {
+            if (HOST_FMA(fa, fb, -fr) != 0)
+                *pfflags |= FFLAG_INEXACT;
+            return r;
+        }
+    }
+#endif
+    return glue(mul_sf, F_SIZE)(a, b, rm, pfflags);
+}
+
+static inline F_UINT glue(host_div_sf, F_SIZE)(F_UINT a, F_UINT b,
+                                               RoundingModeEnum rm,
+                                               uint32_t *pfflags)
+{
+#ifdef CONFIG_HOST_FPU
+    if (rm == RM_RNE && glue(host_fpu_safe, F_SIZE)(a) &&
+        glue(host_fpu_normal, F_SIZE)(b)) {
+        F_HOST fa, fb, fr;
+        F_UINT r;
+        fa = glue(to_host_f, F_SIZE)(a);
+        fb = glue(to_host_f, F_SIZE)(b);
+        fr = fa / fb;
+        r = glue(from_host_f, F_SIZE)(fr);
+        if (glue(host_fpu_safe, F_SIZE)(r)) {
+            /* exact remainder */
+            if (HOST_FMA(-fr, fb, fa) != 0)
+                *pfflags |= FFLAG_INEXACT;
+            return r;
+        }
+    }
+#endif
+    return glue(div_sf, F_SIZE)(a, b, rm, pfflags);
+}
+
+static inline F_UINT glue(host_sqrt_sf, F_SIZE)(F_UINT a,
+                                                RoundingModeEnum rm,
+                                                uint32_t *pfflags)
+{
+#ifdef CONFIG_HOST_FPU
+    if (rm == RM_RNE && !(a & FSIGN_MASK) && glue(host_fpu_safe, F_SIZE)(a)) {
+        F_HOST fa, fr;
+        fa = glue(to_host_f, F_SIZE)(a);
+        fr = HOST_SQRT(fa);
+        if (HOST_FMA(-fr, fr, fa) != 0)
+            *pfflags |= FFLAG_INEXACT;
+        return glue(from_host_f, F_SIZE)(fr);
+    }
+#endif
+    return glue(sqrt_sf, F_SIZE)(a, rm, pfflags);
+}
+
+static inline F_UINT glue(host_fma_sf, F_SIZE)(F_UINT a, F_UINT b, F_UINT c,
+                                               RoundingModeEnum rm,
+                                               uint32_t *pfflags)
+{
+#ifdef CONFIG_HOST_FPU
+    if (rm == RM_RNE && glue(host_fpu_normal, F_SIZE)(a) &&
+        glue(host_fpu_normal, F_SIZE)(b) &&
+        glue(host_fpu_normal, F_SIZE)(c)) {
+        F_HOST fa, fb, fc, fr, ph, pl, s1, z, s2, t1, t2, g;
+        F_UINT r;
+        fa = glue(to_host_f, F_SIZE)(a);
+        fb = glue(to_host_f, F_SIZE)(b);
+        fc = glue(to_host_f, F_SIZE)(c);
+        fr = HOST_FMA(fa, fb, fc);
+        ph = fa * fb;
+        r = glue(from_host_f, F_SIZE)(fr);
+        if (glue(host_fpu_safe, F_SIZE)(r) &&
+            glue(host_fpu_safe, F_SIZE)(glue(from_host_f, F_SIZE)(ph))) {
+            /* a * b + c - r is exactly g + z + (a rounding error of
+               g + z) (Boldo and Muller, ErrFma) */
+            pl = HOST_FMA(fa, fb, -ph);
+            s1 = fc + pl;
+            t1 = s1 - fc;
+            z = (fc - (s1 - t1)) + (pl - t1);
+            s2 = ph + s1;
+            t2 = s2 - ph;
+            g = (s2 - fr) + ((ph - (s2 - t2)) + (s1 - t2));
+            if (g + z != 0)
+                *pfflags |= FFLAG_INEXACT;
+            return r;
+        }
+    }
+#endif
+    return glue(fma_sf, F_SIZE)(a, b, c, rm, pfflags);
+}
+
+#undef F_SIZE
+#undef F_UINT
+#undef F_HOST
+#undef MANT_SIZE
+#undef EXP_MASK
+#undef HOST_SQRT
+#undef HOST_FMA
+#undef FSIGN_MASK
@@ -0,0 +1,464 @@
+/*
+ * RISCV emulator: x86_64 code generator for RV64 guests
+ *
+ * Copyright (c) 2026 TinyEMU contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Only the integer instructions and the TLB hit case of the loads and
+   stores are translated. The generated code executes the longest
+   translatable prefix of a block and returns to the interpreter at the
+   first other instruction or at the first TLB miss. The return value is
+   (byte_count << 8) | insn_count. */
+
+typedef int JITFunc(RISCVCPUState *s, target_ulong pc);
+
+enum {
+    JIT_RAX, JIT_RCX, JIT_RDX, JIT_RBX, JIT_RSP, JIT_RBP, JIT_RSI, JIT_RDI,
+    JIT_R8, JIT_R9, JIT_R10, JIT_R11, JIT_R12, JIT_R13, JIT_R14, JIT_R15,
+};
+
+/* RAX, RCX and RDX are scratch registers, RDI contains the CPU state
+   and RSI the PC of the block */
+static const uint8_t jit_alloc_regs[] = {
+    JIT_RBX, JIT_RBP, JIT_R12, JIT_R13, JIT_R14, JIT_R15,
+    JIT_R8, JIT_R9, JIT_R10, JIT_R11,
+};
+
+#define JIT_N_ALLOC_REGS countof(jit_alloc_regs)
+#define JIT_MIN_INSNS 3
+
+typedef struct {
+    uint8_t *code_ptr;
+    int8_t host_reg[32]; /* -1 if the guest register is in memory */
+    uint32_t written_regs; /* guest registers modified by the block */
+    int n_exits;
+    uint8_t *exit_label[TB_MAX_INSNS];
+    int exit_ret[TB_MAX_INSNS];
+} JITContext;
+
+#define REG_OFFSET(r) (offsetof(RISCVCPUState, reg) + (r) * sizeof(target_ulong))
+
+static void jit_emit8(JITContext *j, int v)
+{
+    *j->code_ptr++ = v;
+}
+
+static void jit_emit32(JITContext *j, uint32_t v)
+{
+    memcpy(j->code_ptr, &v, 4);
+    j->code_ptr += 4;
+}
+
+static void jit_opcode(JITContext *j, int w, int opc, int reg, int rm)
+{
+    int rex;
+    rex = (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex)
+        jit_emit8(j, 0x40 | rex);
+    if (opc > 0xff)
+        jit_emit8(j, opc >> 8);
+    jit_emit8(j, opc);
+}
+
+/* register to register operation */
+static void jit_op_rr(JITContext *j, int w, int opc, int reg, int rm)
+{
+    jit_opcode(j, w, opc, reg, rm);
+    jit_emit8(j, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* operation with the memory operand [base + disp] */
+static void jit_op_rm(JITContext *j, int w, int opc, int reg, int base,
+                      int32_t disp)
+{
+    jit_opcode(j, w, opc, reg, base);
+    jit_emit8(j, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == JIT_RSP)
+        jit_emit8(j, 0x24);
+    jit_emit32(j, disp);
+}
+
+/* operation with the memory operand [rcx + rax] */
+static void jit_op_rcx_rax(JITContext *j, int w, int opc, int reg)
+{
+    jit_opcode(j, w, opc, reg, 0);
+    jit_emit8(j, 0x04 | ((reg & 7) << 3));
+    jit_emit8(j, (JIT_RAX << 3) | JIT_RCX);
+}
+
+/* 'opc' is the /digit of the 0x81 opcode */
+static void jit_op_imm(JITContext *j, int w, int opc, int rm, int32_t imm)
+{
+    jit_op_rr(j, w, 0x81, opc, rm);
+    jit_emit32(j, imm);
+}
+
+/* 'opc' is the /digit of the 0xc1 opcode */
+static void jit_shift_imm(JITContext *j, int w, int opc, int rm, int n)
+{
+    jit_op_rr(j, w, 0xc1, opc, rm);
+    jit_emit8(j, n);
+}
+
+static void jit_mov_imm(JITContext *j, int rm, int32_t imm)
+{
+    jit_op_rr(j, 1, 0xc7, 0, rm);
+    jit_emit32(j, imm);
+}
+
+/* set 'hr' to the 0 or 1 result of the condition (setcc opcode) */
+static void jit_setcc(JITContext *j, int opc, int hr)
+{
+    jit_op_rr(j, 0, opc, 0, hr);
+    jit_op_rr(j, 0, 0x0fb6, hr, hr);
+}
+
+static void jit_get_reg(JITContext *j, int hr, int r)
+{
+    if (r == 0)
+        jit_op_rr(j, 0, 0x31, hr, hr);
+    else if (j->host_reg[r] >= 0)
+        jit_op_rr(j, 1, 0x89, j->host_reg[r], hr);
+    else
+        jit_op_rm(j, 1, 0x8b, hr, JIT_RDI, REG_OFFSET(r));
+}
+
+static void jit_set_reg(JITContext *j, int r, int hr)
+{
+    if (r == 0)
+        return;
+    j->written_regs |= 1 << r;
+    if (j->host_reg[r] >= 0)
+        jit_op_rr(j, 1, 0x89, hr, j->host_reg[r]);
+    else
+        jit_op_rm(j, 1, 0x89, hr, JIT_RDI, REG_OFFSET(r));
+}
+
+/* sign extend the low 32 bits of 'hr' */
+static void jit_sext32(JITContext *j, int hr)
+{
+    jit_op_rr(j, 1, 0x63, hr, hr);
+}
+
+/* leave the generated code if the memory access at address RAX
+   misses the TLB whose pointer is at 'tlb_offset' in the CPU
+   state. Otherwise RCX contains the TLB mem_addend. */
+static void jit_tlb_lookup(JITContext *j, int32_t tlb_offset, int size_log2,
+                           int n_insns, int n_bytes)
+{
+    jit_op_rr(j, 1, 0x89, JIT_RAX, JIT_RCX);
+    jit_shift_imm(j, 1, 5, JIT_RCX, PG_SHIFT);
+    jit_op_imm(j, 0, 4, JIT_RCX, TLB_SIZE - 1);
+    jit_shift_imm(j, 0, 4, JIT_RCX, 4);
+    /* add rcx, [rdi + tlb_offset] */
+    jit_op_rm(j, 1, 0x03, JIT_RCX, JIT_RDI, tlb_offset);
+    jit_op_rr(j, 1, 0x89, JIT_RAX, JIT_RDX);
+    /* the low bits are kept to detect the unaligned accesses */
+    jit_op_imm(j, 1, 4, JIT_RDX, ~(PG_MASK & ~((1 << size_log2) - 1)));
+    jit_op_rm(j, 1, 0x3b, JIT_RDX, JIT_RCX, offsetof(TLBEntry, vaddr));
+    /* jne exit */
+    jit_emit8(j, 0x0f);
+    jit_emit8(j, 0x85);
+    jit_emit32(j, 0);
+    j->exit_label[j->n_exits] = j->code_ptr;
+    j->exit_ret[j->n_exits] = (n_bytes << 8) | n_insns;
+    j->n_exits++;
+    jit_op_rm(j, 1, 0x8b, JIT_RCX, JIT_RCX, offsetof(TLBEntry, mem_addend));
+}
+
+/* return FALSE if the instruction cannot be translated */
+static BOOL jit_gen_insn(JITContext *j, DecodedInsn *di,
+                         int n_insns, int n_bytes)
+{
+    uint32_t insn, funct3;
+    int32_t imm;
+    int rd, rs1, rs2;
+
+    insn = di->insn;
+    rd = di->rd;
+    rs1 = di->rs1;
+    rs2 = di->rs2;
+    imm = di->imm;
+    funct3 = (insn >> 12) & 7;
+    switch(insn & 0x7f) {
+    case 0x37: /* lui */
+        jit_mov_imm(j, JIT_RAX, imm);
+        jit_set_reg(j, rd, JIT_RAX);
+        break;
+    case 0x17: /* auipc */
+        jit_op_rr(j, 1, 0x89, JIT_RSI, JIT_RAX);
+        jit_op_imm(j, 1, 0, JIT_RAX, imm + n_bytes);
+        jit_set_reg(j, rd, JIT_RAX);
+        break;
+    case 0x13:
+        jit_get_reg(j, JIT_RAX, rs1);
+        switch(funct3) {
+        case 0: /* addi */
+            if (imm != 0)
+                jit_op_imm(j, 1, 0, JIT_RAX, imm);
+            break;
+        case 1: /* slli */
+            if ((imm & ~63) != 0)
+                return FALSE;
+            jit_shift_imm(j, 1, 4, JIT_RAX, imm);
+            break;
+        case 2: /* slti */
+            jit_op_imm(j, 1, 7, JIT_RAX, imm);
+            jit_setcc(j, 0x0f9c, JIT_RAX);
+            break;
+        case 3: /* sltiu */
+            jit_op_imm(j, 1, 7, JIT_RAX, imm);
+            jit_setcc(j, 0x0f92, JIT_RAX);
+            break;
+        case 4: /* xori */
+            jit_op_imm(j, 1, 6, JIT_RAX, imm);
+            break;
+        case 5: /* srli/srai */
+            if ((imm & ~(63 | 0x400)) != 0)
+                return FALSE;
+            jit_shift_imm(j, 1, (imm & 0x400) ? 7 : 5, JIT_RAX, imm & 63);
+            break;
+        case 6: /* ori */
+            jit_op_imm(j, 1, 1, JIT_RAX, imm);
+            break;
+        default:
+        case 7: /* andi */
+            jit_op_imm(j, 1, 4, JIT_RAX, imm);
+            break;
+        }
+        jit_set_reg(j, rd, JIT_RAX);
+        break;
+    case 0x1b: /* OP-IMM-32 */
+        jit_get_reg(j, JIT_RAX, rs1);
+        switch(funct3) {
+        case 0: /* addiw */
+            jit_op_imm(j, 0, 0, JIT_RAX, imm);
+            break;
+        case 1: /* slliw */
+            if ((imm & ~31) != 0)
+                return FALSE;
+            jit_shift_imm(j, 0, 4, JIT_RAX, imm);
+            break;
+        case 5: /* srliw/sraiw */
+            if ((imm & ~(31 | 0x400)) != 0)
+                return FALSE;
+            jit_shift_imm(j, 0, (imm & 0x400) ? 7 : 5, JIT_RAX, imm & 31);
+            break;
+        default:
+            return FALSE;
+        }
+        jit_sext32(j, JIT_RAX);
+        jit_set_reg(j, rd, JIT_RAX);
+        break;
+    case 0x33:
+    case 0x3b: /* OP-32 */
+        {
+            int w = ((insn & 0x7f) == 0x33);
+            if (imm == 1) {
+                if (funct3 != 0)
+                    return FALSE;
+                funct3 = 0x10; /* mul */
+            } else {
+                if (imm & ~0x20)
+                    return FALSE;
+                funct3 |= (imm >> 2);
+            }
+            jit_get_reg(j, JIT_RAX, rs1);
+            jit_get_reg(j, JIT_RCX, rs2);
+            switch(funct3) {
+            case 0: /* add */
+                jit_op_rr(j, w, 0x01, JIT_RCX, JIT_RAX);
+                break;
+            case 0 | 8: /* sub */
+                jit_op_rr(j, w, 0x29, JIT_RCX, JIT_RAX);
+                break;
+            case 1: /* sll */
+                jit_op_rr(j, w, 0xd3, 4, JIT_RAX);
+                break;
+            case 5: /* srl */
+                jit_op_rr(j, w, 0xd3, 5, JIT_RAX);
+                break;
+            case 5 | 8: /* sra */
+                jit_op_rr(j, w, 0xd3, 7, JIT_RAX);
+                break;
+            case 0x10: /* mul */
+                jit_op_rr(j, w, 0x0faf, JIT_RAX, JIT_RCX);
+                break;
+            default:
+                if (!w)
+                    return FALSE;
+                switch(funct3) {
+                case 2: /* slt */
+                    jit_op_rr(j, 1, 0x39, JIT_RCX, JIT_RAX);
+                    jit_setcc(j, 0x0f9c, JIT_RAX);
+                    break;
+                case 3: /* sltu */
+                    jit_op_rr(j, 1, 0x39, JIT_RCX, JIT_RAX);
+                    jit_setcc(j, 0x0f92, JIT_RAX);
+                    break;
+                case 4: /* xor */
+                    jit_op_rr(j, 1, 0x31, JIT_RCX, JIT_RAX);
+                    break;
+                case 6: /* or */
+                    jit_op_rr(j, 1, 0x09, JIT_RCX, JIT_RAX);
+                    break;
+                case 7: /* and */
+                    jit_op_rr(j, 1, 0x21, JIT_RCX, JIT_RAX);
+                    break;
+                default:
+                    return FALSE;
+                }
+                break;
+            }
+            if (!w)
+                jit_sext32(j, JIT_RAX);
+            jit_set_reg(j, rd, JIT_RAX);
+        }
+        break;
+    case 0x03: /* load */
+        {
+            static const uint16_t load_opc[8] = {
+                0x0fbe, 0x0fbf, 0x63, 0x8b, 0x0fb6, 0x0fb7, 0x8b, 0 };
+            static const uint8_t load_w[8] = { 1, 1, 1, 1, 0, 0, 0, 0 };
+            static const uint8_t load_size_log2[8] = { 0, 1, 2, 3, 0, 1, 2, 0 };
+            if (funct3 == 7)
+                return FALSE;
+            jit_get_reg(j, JIT_RAX, rs1);
+            if (imm != 0)
+                jit_op_imm(j, 1, 0, JIT_RAX, imm);
+            jit_tlb_lookup(j, offsetof(RISCVCPUState, tlb_read),
+                           load_size_log2[funct3],
+                           n_insns, n_bytes);
+            jit_op_rcx_rax(j, load_w[funct3], load_opc[funct3], JIT_RAX);
+            jit_set_reg(j, rd, JIT_RAX);
+        }
+        break;
+    case 0x23: /* store */
+        if (funct3 > 3)
+            return FALSE;
+        jit_get_reg(j, JIT_RAX, rs1);
+        if (imm != 0)
+            jit_op_imm(j, 1, 0, JIT_RAX, imm);
+        jit_tlb_lookup(j, offsetof(RISCVCPUState, tlb_write), funct3,
+                       n_insns, n_bytes);
+        jit_get_reg(j, JIT_RDX, rs2);
+        if (funct3 == 1)
+            jit_emit8(j, 0x66);
+        jit_op_rcx_rax(j, funct3 == 3, funct3 == 0 ? 0x88 : 0x89, JIT_RDX);
+        break;
+    default:
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void jit_gen_exit(JITContext *j, int ret)
+{
+    int r, i;
+
+    for(r = 1; r < 32; r++) {
+        if (j->host_reg[r] >= 0 && (j->written_regs & (1 << r)))
+            jit_op_rm(j, 1, 0x89, j->host_reg[r], JIT_RDI, REG_OFFSET(r));
+    }
+    for(i = 5; i >= 0; i--) {
+        r = jit_alloc_regs[i];
+        jit_opcode(j, 0, 0x58 + (r & 7), 0, r);
+    }
+    jit_emit8(j, 0xb8); /* mov eax, ret */
+    jit_emit32(j, ret);
+    jit_emit8(j, 0xc3); /* ret */
+}
+
+/* translate the longest prefix of 'tb' to host code. Return NULL if
+   it is too short. */
+static void *jit_gen_block(RISCVCPUState *s, TransBlock *tb)
+{
+    JITContext j_s, *j = &j_s;
+    int use_count[32], i, r, best, n, n_bytes;
+    uint8_t *code_start;
+    DecodedInsn *di;
+
+    code_start = s->jit_buf + s->jit_buf_pos;
+
+    /* find the translatable prefix */
+    memset(j, 0, sizeof(*j));
+    memset(j->host_reg, -1, sizeof(j->host_reg));
+    j->code_ptr = code_start;
+    n_bytes = 0;
+    for(n = 0; n < tb->n_insns; n++) {
+        di = &tb->insns[n];
+        if (!jit_gen_insn(j, di, n, n_bytes))
+            break;
+        n_bytes += di->len;
+    }
+    if (n < JIT_MIN_INSNS)
+        return NULL;
+
+    /* the most used guest registers are kept in host registers */
+    memset(use_count, 0, sizeof(use_count));
+    for(i = 0; i < n; i++) {
+        di = &tb->insns[i];
+        use_count[di->rd]++;
+        use_count[di->rs1]++;
+        use_count[di->rs2]++;
+    }
+    use_count[0] = 0;
+    for(i = 0; i < JIT_N_ALLOC_REGS; i++) {
+        best = 0;
+        for(r = 1; r < 32; r++) {
+            if (use_count[r] > use_count[best])
+                best = r;
+        }
+        if (use_count[best] < 2)
+            break;
+        j->host_reg[best] = jit_alloc_regs[i];
+        use_count[best] = 0;
+    }
+
+    /* generate the code */
+    j->code_ptr = code_start;
+    j->n_exits = 0;
+    j->written_regs = 0;
+    for(i = 0; i < 6; i++) {
+        r = jit_alloc_regs[i];
+        jit_opcode(j, 0, 0x50 + (r & 7), 0, r); /* push */
+    }
+    for(r = 1; r < 32; r++) {
+        if (j->host_reg[r] >= 0)
+            jit_op_rm(j, 1, 0x8b, j->host_reg[r], JIT_RDI, REG_OFFSET(r));
+    }
+    n_bytes = 0;
+    for(i = 0; i < n; i++) {
+        di = &tb->insns[i];
+        jit_gen_insn(j, di, i, n_bytes);
+        n_bytes += di->len;
+    }
+    jit_gen_exit(j, (n_bytes << 8) | n);
+    for(i = 0; i < j->n_exits; i++) {
+        uint8_t *label = j->exit_label[i];
+        uint32_t rel = j->code_ptr - label;
+        memcpy(label - 4, &rel, 4);
+        jit_gen_exit(j, j->exit_ret[i]);
+    }
+    assert(j->code_ptr - code_start <= JIT_MAX_BLOCK_SIZE);
+    s->jit_buf_pos += (j->code_ptr - code_start + 15) & ~15;
+    return code_start;
+}
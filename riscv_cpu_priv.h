@@ -38,6 +38,19 @@
 #endif /* !FLEN */
 
 #define CONFIG_EXT_C /* compressed instructions */
+#if FLEN >= 64 && defined(CONFIG_RISCV_V)
+#define CONFIG_EXT_V /* vector instructions (RVV 1.0) */
+#endif
+
+#ifdef CONFIG_EXT_V
+#ifndef VLEN
+#define VLEN 128 /* vector register width in bits */
+#endif
+#define VLENB (VLEN / 8)
+#define ELEN 64 /* maximum element width */
+/* internal vtype value when vill is set */
+#define VTYPE_VILL ((target_ulong)1 << (MAX_XLEN - 1))
+#endif
 
 #if defined(EMSCRIPTEN)
 #define USE_GLOBAL_STATE
@@ -98,7 +111,24 @@ typedef uint128_t mem_uint_t;
 #unsupported MLEN
 #endif
 
+/* The TLBs have TLB_SIZE sets of TLB_WAYS entries. The entry of way
+   w is at index w * TLB_SIZE + set so that the fast paths only look at
+   way 0, which contains the most recently used entries. */
+#ifndef TLB_SIZE
 #define TLB_SIZE 256
+#endif
+#ifndef TLB_WAYS
+#define TLB_WAYS 2
+#endif
+#define TLB_VICTIM_SIZE 8 /* entries evicted from the last way */
+#define TLB_SP_SIZE 8 /* superpage translations */
+/* entries per level of the page table walk cache */
+#define PTW_CACHE_SIZE 64
+#define PTW_LEVELS 3 /* number of non root levels (sv48) */
+/* number of (address space, MMU mode) pairs whose entries are kept */
+#define TLB_CTX_COUNT 16
+/* bits of the filter of the host pages mapped by the write TLBs */
+#define TLB_WRITE_FILTER_BITS 4096
 
 #define CAUSE_MISALIGNED_FETCH    0x0
 #define CAUSE_FAULT_FETCH         0x1
@@ -134,6 +164,7 @@ typedef uint128_t mem_uint_t;
 #define MCPUID_D       (1 << ('D' - 'A'))
 #define MCPUID_Q       (1 << ('Q' - 'A'))
 #define MCPUID_C       (1 << ('C' - 'A'))
+#define MCPUID_V       (1 << ('V' - 'A'))
 
 /* mstatus CSR */
 
@@ -141,6 +172,7 @@ typedef uint128_t mem_uint_t;
 #define MSTATUS_MPIE_SHIFT 7
 #define MSTATUS_SPP_SHIFT 8
 #define MSTATUS_MPP_SHIFT 11
+#define MSTATUS_VS_SHIFT 9
 #define MSTATUS_FS_SHIFT 13
 #define MSTATUS_UXL_SHIFT 32
 #define MSTATUS_SXL_SHIFT 34
@@ -156,6 +188,7 @@ typedef uint128_t mem_uint_t;
 #define MSTATUS_SPP (1 << MSTATUS_SPP_SHIFT)
 #define MSTATUS_HPP (3 << 9)
 #define MSTATUS_MPP (3 << MSTATUS_MPP_SHIFT)
+#define MSTATUS_VS (3 << MSTATUS_VS_SHIFT)
 #define MSTATUS_FS (3 << MSTATUS_FS_SHIFT)
 #define MSTATUS_XS (3 << 15)
 #define MSTATUS_MPRV (1 << 17)
@@ -175,6 +208,99 @@ typedef struct {
     uintptr_t mem_addend;
 } TLBEntry;
 
+typedef struct {
+    target_ulong vaddr;
+    target_ulong paddr;
+    int shift; /* log2 of the superpage size, 0 if unused */
+} TLBSuperpage;
+
+/* fully associative entries of one access type */
+typedef struct {
+    TLBEntry victim[TLB_VICTIM_SIZE];
+    int victim_next;
+    TLBSuperpage sp[TLB_SP_SIZE];
+    int sp_next;
+} TLBAux;
+
+/* page table found by a page walk */
+typedef struct {
+    uint64_t satp; /* -1 if unused */
+    target_ulong vpn; /* virtual address >> shift */
+    target_ulong table; /* physical address of the page table */
+    int shift; /* log2 of the size mapped by the page table */
+} PTWEntry;
+
+/* TLB entries of one address space for a given MMU mode */
+typedef struct {
+    uint64_t satp; /* -1 if unused */
+    uint32_t mmu_mode; /* see get_mmu_mode() */
+    uint32_t last_use; /* for LRU replacement */
+    /* virtual address range containing superpage translations and
+       log2 of the largest superpage size */
+    target_ulong sp_start, sp_last;
+    int sp_shift;
+    TLBEntry tlb_read[TLB_WAYS * TLB_SIZE];
+    TLBEntry tlb_write[TLB_WAYS * TLB_SIZE];
+    TLBEntry tlb_code[TLB_WAYS * TLB_SIZE];
+    TLBAux aux[3]; /* indexed by the access type */
+} TLBContext;
+
+/* decoded instruction cache */
+
+typedef struct {
+    uint32_t insn; /* compressed instructions are expanded to 32 bits */
+    int32_t imm; /* sign extended immediate, funct7 or CSR number */
+    uint8_t rd, rs1, rs2;
+    uint8_t len; /* instruction length in bytes */
+    /* interpreter entry: opcode | (funct3 << 7) or OP_FUSED + fused
+       pair type when the instruction is executed with the next one */
+    uint16_t op;
+} DecodedInsn;
+
+#define OP_FUSED 1024
+
+#if defined(CONFIG_JIT) && (MAX_XLEN != 64 || !defined(__x86_64__))
+#undef CONFIG_JIT
+#endif
+
+#if defined(CONFIG_THREADED_DISPATCH) && !defined(__GNUC__)
+#undef CONFIG_THREADED_DISPATCH
+#endif
+
+typedef struct TransBlock {
+    struct TransBlock *hash_next;
+    struct TransBlock *page_next; /* next block in the same page */
+    uint8_t *code_ptr; /* host address of the first instruction */
+    uint16_t code_size; /* in bytes */
+    uint16_t n_insns;
+    uint8_t xlen;
+    /* last successors reached by a jump (0) and by falling thru
+       (1). Only valid if jmp_gen is equal to tb_jmp_gen. */
+    uint32_t jmp_gen;
+    struct TransBlock *jmp_tb[2];
+#ifdef CONFIG_JIT
+    void *jit_code; /* host code or NULL if not translated */
+#endif
+    DecodedInsn insns[0];
+} TransBlock;
+
+typedef struct TBPage {
+    struct TBPage *hash_next;
+    uint8_t *page_ptr; /* host address of the page */
+    TransBlock *first_tb; /* NULL if no valid block in the page */
+} TBPage;
+
+/* the 'time' CSR reads the machine clock at most once every
+   TIME_CACHE_INSNS instructions */
+#define TIME_CACHE_INSNS 64
+
+#define TB_MAX_INSNS 128
+#define TB_HASH_SIZE 16384
+#define TB_PAGE_HASH_SIZE 4096
+#define TB_BUF_SIZE (8 << 20)
+#define JIT_BUF_SIZE (16 << 20)
+#define JIT_MAX_BLOCK_SIZE (32 << 10)
+
 struct RISCVCPUState {
     RISCVCPUCommonState common; /* must be first */
     
@@ -185,6 +311,7 @@ struct RISCVCPUState {
     /* faster to use global variables with emscripten */
     uint8_t *__code_ptr, *__code_end;
     target_ulong __code_to_pc_addend;
+    DecodedInsn *__insn_ptr, *__insn_end;
 #endif
     
 #if FLEN > 0
@@ -192,10 +319,19 @@ struct RISCVCPUState {
     uint32_t fflags;
     uint8_t frm;
 #endif
+#ifdef CONFIG_EXT_V
+    uint64_t vreg[32][VLENB / 8];
+    target_ulong vl;
+    target_ulong vtype;
+    target_ulong vstart;
+    uint8_t vxrm;
+    uint8_t vxsat;
+#endif
     
     uint8_t cur_xlen;  /* current XLEN value, <= MAX_XLEN */
     uint8_t priv; /* see PRV_x */
     uint8_t fs; /* MSTATUS_FS value */
+    uint8_t vs; /* MSTATUS_VS value */
     uint8_t mxl; /* MXL field in MISA register */
     
     int32_t n_cycles; /* only used inside the CPU loop */
@@ -231,13 +367,46 @@ struct RISCVCPUState {
 #endif
     uint32_t scounteren;
 
+    /* 'time' CSR */
+    RISCVGetTimeFunc *get_time;
+    void *get_time_opaque;
+    uint64_t time_cache; /* last value returned by get_time() */
+    uint64_t time_cache_insn; /* insn_counter when time_cache was read */
+    uint64_t menvcfg;
+    uint64_t stimecmp; /* Sstc */
+
     target_ulong load_res; /* for atomic LR/SC */
+    mem_uint_t load_res_val; /* value read by LR, compared by SC */
 
     PhysMemoryMap *mem_map;
 
-    TLBEntry tlb_read[TLB_SIZE];
-    TLBEntry tlb_write[TLB_SIZE];
-    TLBEntry tlb_code[TLB_SIZE];
+    /* entries of the current address space (tlb_ctx[tlb_cur]) */
+    TLBEntry *tlb_read;
+    TLBEntry *tlb_write;
+    TLBEntry *tlb_code;
+    TLBContext tlb_ctx[TLB_CTX_COUNT];
+    int tlb_cur;
+    /* bit (host page number % TLB_WRITE_FILTER_BITS) is set if a write
+       entry of any context may map the host page. It is rebuilt when
+       all the write entries are scanned. */
+    uint32_t tlb_write_filter[TLB_WRITE_FILTER_BITS / 32];
+    uint32_t tlb_use_count;
+    /* page tables of the levels 1 to PTW_LEVELS, indexed by vpn */
+    PTWEntry ptw_cache[PTW_LEVELS][PTW_CACHE_SIZE];
+
+    RISCVCPUStats stats;
+
+    /* translated blocks, indexed by the host address of their code */
+    TransBlock *tb_hash[TB_HASH_SIZE];
+    TBPage *tb_page_hash[TB_PAGE_HASH_SIZE];
+    uint8_t *tb_buf;
+    size_t tb_buf_pos;
+    uint32_t tb_jmp_gen; /* incremented to invalidate all the chains */
+#ifdef CONFIG_JIT
+    BOOL jit_enabled;
+    uint8_t *jit_buf;
+    size_t jit_buf_pos;
+#endif
 };
 
 #define target_read_slow glue(glue(riscv, MAX_XLEN), _read_slow)
@@ -248,6 +417,17 @@ DLL_PUBLIC int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
 DLL_PUBLIC int target_write_slow(RISCVCPUState *s, target_ulong addr,
                                  mem_uint_t val, int size_log2);
 
+/* return TRUE if the aligned write of (1 << size_log2) bytes at 'addr'
+   hits the write TLB */
+static inline BOOL tlb_write_hit(RISCVCPUState *s, target_ulong addr,
+                                 int size_log2)
+{
+    uint32_t tlb_idx;
+    tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
+    return s->tlb_write[tlb_idx].vaddr ==
+        (addr & ~(PG_MASK & ~((1 << size_log2) - 1)));
+}
+
 /* return 0 if OK, != 0 if exception */
 #define TARGET_READ_WRITE(size, uint_type, size_log2)                   \
 static inline __exception int target_read_u ## size(RISCVCPUState *s, uint_type *pval, target_ulong addr)                              \
@@ -169,32 +169,452 @@ static inline uintx_t glue(mulhsu, XLEN)(intx_t a, uintx_t b)
 
 #endif
 
-#define DUP2(F, n) F(n) F(n+1)
-#define DUP4(F, n) DUP2(F, n) DUP2(F, n + 2)
-#define DUP8(F, n) DUP4(F, n) DUP4(F, n + 4)
-#define DUP16(F, n) DUP8(F, n) DUP8(F, n + 8)
-#define DUP32(F, n) DUP16(F, n) DUP16(F, n + 16)
+#if XLEN <= 64
+static inline uintx_t glue(rol, XLEN)(uintx_t a, int n)
+{
+    return (a << n) | (a >> ((XLEN - n) & (XLEN - 1)));
+}
+
+static inline uintx_t glue(ror, XLEN)(uintx_t a, int n)
+{
+    return (a >> n) | (a << ((XLEN - n) & (XLEN - 1)));
+}
+
+/* each non zero byte is set to 0xff */
+static inline uintx_t glue(orc_b, XLEN)(uintx_t a)
+{
+    uintx_t m = (uintx_t)-1 / 0xff * 0x7f;
+    a = (((a & m) + m) | a) & ~m;
+    return (a >> 7) * 0xff;
+}
+#endif
+
+#ifdef CONFIG_EXT_C
+/* return the 32 bit instruction equivalent to the compressed
+   instruction 'insn' or 'insn' itself if it is illegal */
+static uint32_t glue(expand_rvc_x, XLEN)(uint32_t insn)
+{
+    uint32_t funct3, rd, rs1, rs2;
+    int32_t imm;
+
+    rd = (insn >> 7) & 0x1f;
+    funct3 = (insn >> 13) & 7;
+    switch(insn & 3) {
+    case 0:
+        rd = ((insn >> 2) & 7) | 8;
+        rs1 = ((insn >> 7) & 7) | 8;
+        switch(funct3) {
+        case 0: /* c.addi4spn */
+            imm = get_field1(insn, 11, 4, 5) |
+                get_field1(insn, 7, 6, 9) |
+                get_field1(insn, 6, 2, 2) |
+                get_field1(insn, 5, 3, 3);
+            if (imm == 0)
+                break;
+            return enc_i(0x13, rd, 0, 2, imm);
+#if XLEN >= 128
+        case 1: /* c.lq */
+            imm = get_field1(insn, 11, 4, 5) |
+                get_field1(insn, 10, 8, 8) |
+                get_field1(insn, 5, 6, 7);
+            return enc_i(0x0f, rd, 2, rs1, imm);
+#elif FLEN >= 64
+        case 1: /* c.fld */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 5, 6, 7);
+            return enc_i(0x07, rd, 3, rs1, imm);
+#endif
+        case 2: /* c.lw */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 6, 2, 2) |
+                get_field1(insn, 5, 6, 6);
+            return enc_i(0x03, rd, 2, rs1, imm);
+#if XLEN >= 64
+        case 3: /* c.ld */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 5, 6, 7);
+            return enc_i(0x03, rd, 3, rs1, imm);
+#elif FLEN >= 32
+        case 3: /* c.flw */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 6, 2, 2) |
+                get_field1(insn, 5, 6, 6);
+            return enc_i(0x07, rd, 2, rs1, imm);
+#endif
+#if XLEN >= 128
+        case 5: /* c.sq */
+            imm = get_field1(insn, 11, 4, 5) |
+                get_field1(insn, 10, 8, 8) |
+                get_field1(insn, 5, 6, 7);
+            return enc_s(0x23, 4, rs1, rd, imm);
+#elif FLEN >= 64
+        case 5: /* c.fsd */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 5, 6, 7);
+            return enc_s(0x27, 3, rs1, rd, imm);
+#endif
+        case 6: /* c.sw */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 6, 2, 2) |
+                get_field1(insn, 5, 6, 6);
+            return enc_s(0x23, 2, rs1, rd, imm);
+#if XLEN >= 64
+        case 7: /* c.sd */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 5, 6, 7);
+            return enc_s(0x23, 3, rs1, rd, imm);
+#elif FLEN >= 32
+        case 7: /* c.fsw */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 6, 2, 2) |
+                get_field1(insn, 5, 6, 6);
+            return enc_s(0x27, 2, rs1, rd, imm);
+#endif
+        default:
+            break;
+        }
+        break;
+    case 1:
+        switch(funct3) {
+        case 0: /* c.addi/c.nop */
+            imm = sext(get_field1(insn, 12, 5, 5) |
+                       get_field1(insn, 2, 0, 4), 6);
+            return enc_i(0x13, rd, 0, rd, imm);
+#if XLEN == 32
+        case 1: /* c.jal */
+            imm = sext(get_field1(insn, 12, 11, 11) |
+                       get_field1(insn, 11, 4, 4) |
+                       get_field1(insn, 9, 8, 9) |
+                       get_field1(insn, 8, 10, 10) |
+                       get_field1(insn, 7, 6, 6) |
+                       get_field1(insn, 6, 7, 7) |
+                       get_field1(insn, 3, 1, 3) |
+                       get_field1(insn, 2, 5, 5), 12);
+            return enc_j(1, imm);
+#else
+        case 1: /* c.addiw */
+            imm = sext(get_field1(insn, 12, 5, 5) |
+                       get_field1(insn, 2, 0, 4), 6);
+            return enc_i(0x1b, rd, 0, rd, imm);
+#endif
+        case 2: /* c.li */
+            imm = sext(get_field1(insn, 12, 5, 5) |
+                       get_field1(insn, 2, 0, 4), 6);
+            return enc_i(0x13, rd, 0, 0, imm);
+        case 3:
+            if (rd == 2) {
+                /* c.addi16sp */
+                imm = sext(get_field1(insn, 12, 9, 9) |
+                           get_field1(insn, 6, 4, 4) |
+                           get_field1(insn, 5, 6, 6) |
+                           get_field1(insn, 3, 7, 8) |
+                           get_field1(insn, 2, 5, 5), 10);
+                if (imm == 0)
+                    break;
+                return enc_i(0x13, 2, 0, 2, imm);
+            } else {
+                /* c.lui */
+                imm = sext(get_field1(insn, 12, 17, 17) |
+                           get_field1(insn, 2, 12, 16), 18);
+                return enc_u(0x37, rd, imm);
+            }
+        case 4:
+            funct3 = (insn >> 10) & 3;
+            rd = ((insn >> 7) & 7) | 8;
+            switch(funct3) {
+            case 0: /* c.srli */
+            case 1: /* c.srai */
+                imm = get_field1(insn, 12, 5, 5) |
+                    get_field1(insn, 2, 0, 4);
+#if XLEN == 32
+                if (imm & 0x20)
+                    return insn;
+#elif XLEN == 128
+                if (imm == 0)
+                    imm = 64;
+                else if (imm >= 32)
+                    imm = 128 - imm;
+#endif
+                return enc_i(0x13, rd, 5, rd, imm | (funct3 << 10));
+            case 2: /* c.andi */
+                imm = sext(get_field1(insn, 12, 5, 5) |
+                           get_field1(insn, 2, 0, 4), 6);
+                return enc_i(0x13, rd, 7, rd, imm);
+            case 3:
+                rs2 = ((insn >> 2) & 7) | 8;
+                funct3 = ((insn >> 5) & 3) | ((insn >> (12 - 2)) & 4);
+                switch(funct3) {
+                case 0: /* c.sub */
+                    return enc_r(0x33, rd, 0, rd, rs2, 0x20);
+                case 1: /* c.xor */
+                    return enc_r(0x33, rd, 4, rd, rs2, 0);
+                case 2: /* c.or */
+                    return enc_r(0x33, rd, 6, rd, rs2, 0);
+                case 3: /* c.and */
+                    return enc_r(0x33, rd, 7, rd, rs2, 0);
+#if XLEN >= 64
+                case 4: /* c.subw */
+                    return enc_r(0x3b, rd, 0, rd, rs2, 0x20);
+                case 5: /* c.addw */
+                    return enc_r(0x3b, rd, 0, rd, rs2, 0);
+#endif
+                default:
+                    break;
+                }
+                break;
+            }
+            break;
+        case 5: /* c.j */
+            imm = sext(get_field1(insn, 12, 11, 11) |
+                       get_field1(insn, 11, 4, 4) |
+                       get_field1(insn, 9, 8, 9) |
+                       get_field1(insn, 8, 10, 10) |
+                       get_field1(insn, 7, 6, 6) |
+                       get_field1(insn, 6, 7, 7) |
+                       get_field1(insn, 3, 1, 3) |
+                       get_field1(insn, 2, 5, 5), 12);
+            return enc_j(0, imm);
+        case 6: /* c.beqz */
+        case 7: /* c.bnez */
+            rs1 = ((insn >> 7) & 7) | 8;
+            imm = sext(get_field1(insn, 12, 8, 8) |
+                       get_field1(insn, 10, 3, 4) |
+                       get_field1(insn, 5, 6, 7) |
+                       get_field1(insn, 3, 1, 2) |
+                       get_field1(insn, 2, 5, 5), 9);
+            return enc_b(funct3 & 1, rs1, 0, imm);
+        }
+        break;
+    case 2:
+        rs2 = (insn >> 2) & 0x1f;
+        switch(funct3) {
+        case 0: /* c.slli */
+            imm = get_field1(insn, 12, 5, 5) | rs2;
+#if XLEN == 32
+            if (imm & 0x20)
+                break;
+#elif XLEN == 128
+            if (imm == 0)
+                imm = 64;
+#endif
+            return enc_i(0x13, rd, 1, rd, imm);
+#if XLEN == 128
+        case 1: /* c.lqsp */
+            imm = get_field1(insn, 12, 5, 5) |
+                (rs2 & (1 << 4)) |
+                get_field1(insn, 2, 6, 9);
+            return enc_i(0x0f, rd, 2, 2, imm);
+#elif FLEN >= 64
+        case 1: /* c.fldsp */
+            imm = get_field1(insn, 12, 5, 5) |
+                (rs2 & (3 << 3)) |
+                get_field1(insn, 2, 6, 8);
+            return enc_i(0x07, rd, 3, 2, imm);
+#endif
+        case 2: /* c.lwsp */
+            imm = get_field1(insn, 12, 5, 5) |
+                (rs2 & (7 << 2)) |
+                get_field1(insn, 2, 6, 7);
+            return enc_i(0x03, rd, 2, 2, imm);
+#if XLEN >= 64
+        case 3: /* c.ldsp */
+            imm = get_field1(insn, 12, 5, 5) |
+                (rs2 & (3 << 3)) |
+                get_field1(insn, 2, 6, 8);
+            return enc_i(0x03, rd, 3, 2, imm);
+#elif FLEN >= 32
+        case 3: /* c.flwsp */
+            imm = get_field1(insn, 12, 5, 5) |
+                (rs2 & (7 << 2)) |
+                get_field1(insn, 2, 6, 7);
+            return enc_i(0x07, rd, 2, 2, imm);
+#endif
+        case 4:
+            if (((insn >> 12) & 1) == 0) {
+                if (rs2 == 0) {
+                    /* c.jr */
+                    if (rd == 0)
+                        break;
+                    return enc_i(0x67, 0, 0, rd, 0);
+                } else {
+                    /* c.mv */
+                    return enc_r(0x33, rd, 0, 0, rs2, 0);
+                }
+            } else {
+                if (rs2 == 0) {
+                    if (rd == 0) {
+                        /* c.ebreak */
+                        return 0x00100073;
+                    } else {
+                        /* c.jalr */
+                        return enc_i(0x67, 1, 0, rd, 0);
+                    }
+                } else {
+                    /* c.add */
+                    return enc_r(0x33, rd, 0, rd, rs2, 0);
+                }
+            }
+#if XLEN == 128
+        case 5: /* c.sqsp */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 7, 6, 8);
+            return enc_s(0x23, 4, 2, rs2, imm);
+#elif FLEN >= 64
+        case 5: /* c.fsdsp */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 7, 6, 8);
+            return enc_s(0x27, 3, 2, rs2, imm);
+#endif
+        case 6: /* c.swsp */
+            imm = get_field1(insn, 9, 2, 5) |
+                get_field1(insn, 7, 6, 7);
+            return enc_s(0x23, 2, 2, rs2, imm);
+#if XLEN >= 64
+        case 7: /* c.sdsp */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 7, 6, 8);
+            return enc_s(0x23, 3, 2, rs2, imm);
+#elif FLEN >= 32
+        case 7: /* c.fswsp */
+            imm = get_field1(insn, 9, 2, 5) |
+                get_field1(insn, 7, 6, 7);
+            return enc_s(0x27, 2, 2, rs2, imm);
+#endif
+        default:
+            break;
+        }
+        break;
+    }
+    return insn;
+}
 
-#define C_QUADRANT(n) \
-    case n+(0 << 2): case n+(1 << 2): case n+(2 << 2): case n+(3 << 2): \
-    case n+(4 << 2): case n+(5 << 2): case n+(6 << 2): case n+(7 << 2): \
-    case n+(8 << 2): case n+(9 << 2): case n+(10 << 2): case n+(11 << 2): \
-    case n+(12 << 2): case n+(13 << 2): case n+(14 << 2): case n+(15 << 2): \
-    case n+(16 << 2): case n+(17 << 2): case n+(18 << 2): case n+(19 << 2): \
-    case n+(20 << 2): case n+(21 << 2): case n+(22 << 2): case n+(23 << 2): \
-    case n+(24 << 2): case n+(25 << 2): case n+(26 << 2): case n+(27 << 2): \
-    case n+(28 << 2): case n+(29 << 2): case n+(30 << 2): case n+(31 << 2): 
+/* expanded form of every 16 bit encoding, so that building a
+   translation block does a single lookup per compressed
+   instruction. The entries with (insn & 3) == 3 are not used. */
+static uint32_t glue(rvc_table_x, XLEN)[1 << 16];
+
+static void glue(rvc_table_init_x, XLEN)(void)
+{
+    uint32_t insn;
+    for(insn = 0; insn < (1 << 16); insn++) {
+        if ((insn & 3) != 3)
+            glue(rvc_table_x, XLEN)[insn] = glue(expand_rvc_x, XLEN)(insn);
+    }
+}
+#endif /* CONFIG_EXT_C */
+
+/* decode the instructions at 'code_ptr' up to the first control flow
+   instruction or the end of the page. 'code_end' is the host address
+   of the last 16 bit word of the page. */
+static no_inline TransBlock *glue(tb_gen_x, XLEN)(RISCVCPUState *s,
+                                                  uint8_t *code_ptr,
+                                                  uint8_t *code_end)
+{
+    TransBlock *tb;
+    DecodedInsn *di;
+    uint8_t *ptr;
+    uint32_t insn;
+    int n;
+
+    tb = tb_alloc(s);
+    ptr = code_ptr;
+    n = 0;
+    while (n < TB_MAX_INSNS && ptr <= code_end) {
+        insn = *(uint16_t *)ptr;
+        di = &tb->insns[n];
+        if ((insn & 3) == 3) {
+            /* stop before an instruction crossing the page boundary */
+            if (ptr >= code_end)
+                break;
+            decode_insn(di, get_insn32(ptr), 4);
+        } else {
+#ifdef CONFIG_EXT_C
+            decode_insn(di, glue(rvc_table_x, XLEN)[insn], 2);
+#else
+            decode_insn(di, insn, 2);
+#endif
+        }
+        if (n > 0) {
+            int fuse = fuse_insn_pair(di - 1, di, XLEN);
+            if (fuse >= 0) {
+                di[-1].op = OP_FUSED + fuse;
+                s->stats.fuse_decoded[fuse]++;
+            }
+        }
+        n++;
+        ptr += di->len;
+        if (insn_is_block_end(di->insn))
+            break;
+    }
+    tb->code_ptr = code_ptr;
+    tb->code_size = ptr - code_ptr;
+    tb->n_insns = n;
+    tb->xlen = XLEN;
+#ifdef CONFIG_JIT
+    tb->jit_code = NULL;
+#if XLEN == 64
+    if (s->jit_enabled)
+        tb->jit_code = jit_gen_block(s, tb);
+#endif
+#endif
+    tb_link(s, tb, code_end - (PG_MASK - 1));
+    return tb;
+}
 
 #define GET_PC() (target_ulong)((uintptr_t)code_ptr + code_to_pc_addend)
-#define GET_INSN_COUNTER() (insn_counter_addend - s->n_cycles)
+/* the instructions of a block are charged when entering it. Inside a
+   handler, the current instruction is counted as executed. */
+#define INSN_REMAINING() (insn_end - insn_ptr - 1)
+#define GET_INSN_COUNTER() \
+    (insn_counter_addend - s->n_cycles - INSN_REMAINING())
 
-#define C_NEXT_INSN code_ptr += 2; break
-#define NEXT_INSN code_ptr += 4; break
-#define JUMP_INSN do {   \
-        code_ptr = NULL;           \
-        code_end = NULL;           \
-        code_to_pc_addend = s->pc; \
-        goto jump_insn;            \
+#ifdef CONFIG_THREADED_DISPATCH
+/* each handler jumps directly to the next one through its own
+   indirect branch. The table is indexed by major opcode and funct3,
+   followed by the fused pairs. */
+#define DISPATCH_INSN() do {                                    \
+        insn = insn_ptr->insn;                                  \
+        opcode = insn & 0x7f;                                   \
+        funct3 = (insn >> 12) & 7;                              \
+        rd = insn_ptr->rd;                                      \
+        rs1 = insn_ptr->rs1;                                    \
+        rs2 = insn_ptr->rs2;                                    \
+        imm = insn_ptr->imm;                                    \
+        goto *dispatch_table[insn_ptr->op];                     \
+    } while (0)
+#define NEXT_INSN code_ptr += insn_ptr->len; insn_ptr++;        \
+    if (unlikely(insn_ptr >= insn_end))                         \
+        break;                                                  \
+    DISPATCH_INSN()
+#define CASE_OP(op) case op: glue(op_, op)
+#define CASE_F3(op, f3) case f3: glue(glue(op_, op), glue(_, f3))
+#define CASE_FUSE(type) case OP_FUSED + type: glue(fuse_, type)
+#define OP_ENTRY(op, f3, label) [(op) | ((f3) << 7)] = &&label
+#define OP_ENTRIES(op)                                                  \
+    OP_ENTRY(op, 0, glue(op_, op)), OP_ENTRY(op, 1, glue(op_, op)),     \
+    OP_ENTRY(op, 2, glue(op_, op)), OP_ENTRY(op, 3, glue(op_, op)),     \
+    OP_ENTRY(op, 4, glue(op_, op)), OP_ENTRY(op, 5, glue(op_, op)),     \
+    OP_ENTRY(op, 6, glue(op_, op)), OP_ENTRY(op, 7, glue(op_, op))
+#define FUSE_ENTRY(type) [OP_FUSED + type] = &&glue(fuse_, type)
+#else
+#define NEXT_INSN code_ptr += insn_ptr->len; insn_ptr++; break
+#define CASE_OP(op) case op
+#define CASE_F3(op, f3) case f3
+#define CASE_FUSE(type) case OP_FUSED + type
+#endif
+/* go to the second instruction of a fused pair */
+#define FUSE_NEXT_INSN() do {                   \
+        code_ptr += insn_ptr->len;              \
+        insn_ptr++;                             \
+    } while (0)
+#define JUMP_INSN do {                     \
+        s->n_cycles += INSN_REMAINING();   \
+        code_ptr = NULL;                   \
+        code_end = NULL;                   \
+        code_to_pc_addend = s->pc;         \
+        insn_ptr = NULL;                   \
+        insn_end = NULL;                   \
+        goto jump_insn;                    \
     } while (0)
 
 static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
@@ -206,18 +626,61 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
 #ifndef USE_GLOBAL_VARIABLES
     uint8_t *code_ptr, *code_end;
     target_ulong code_to_pc_addend;
+    DecodedInsn *insn_ptr, *insn_end;
 #endif
+    DecodedInsn insn_tmp;
+    TransBlock *tb;
     uint64_t insn_counter_addend;
 #if FLEN > 0
     uint32_t rs3;
     int32_t rm;
 #endif
+#ifdef CONFIG_THREADED_DISPATCH
+    static const void * const dispatch_table[OP_FUSED + RISCV_FUSE_COUNT] = {
+        [0 ... OP_FUSED + RISCV_FUSE_COUNT - 1] = &&illegal_insn,
+        OP_ENTRIES(0x37), OP_ENTRIES(0x17), OP_ENTRIES(0x6f), OP_ENTRIES(0x67),
+        OP_ENTRY(0x63, 0, op_0x63_0), OP_ENTRY(0x63, 1, op_0x63_0),
+        OP_ENTRY(0x63, 4, op_0x63_2), OP_ENTRY(0x63, 5, op_0x63_2),
+        OP_ENTRY(0x63, 6, op_0x63_3), OP_ENTRY(0x63, 7, op_0x63_3),
+        OP_ENTRIES(0x03), OP_ENTRIES(0x23),
+        OP_ENTRY(0x13, 0, op_0x13_0), OP_ENTRY(0x13, 1, op_0x13_1),
+        OP_ENTRY(0x13, 2, op_0x13_2), OP_ENTRY(0x13, 3, op_0x13_3),
+        OP_ENTRY(0x13, 4, op_0x13_4), OP_ENTRY(0x13, 5, op_0x13_5),
+        OP_ENTRY(0x13, 6, op_0x13_6), OP_ENTRY(0x13, 7, op_0x13_7),
+        OP_ENTRIES(0x33), OP_ENTRIES(0x73), OP_ENTRIES(0x0f), OP_ENTRIES(0x2f),
+#if XLEN >= 64
+        OP_ENTRIES(0x1b), OP_ENTRIES(0x3b),
+#endif
+#if XLEN >= 128
+        OP_ENTRIES(0x5b), OP_ENTRIES(0x7b),
+#endif
+#if FLEN > 0
+        OP_ENTRIES(0x07), OP_ENTRIES(0x27), OP_ENTRIES(0x43), OP_ENTRIES(0x47),
+        OP_ENTRIES(0x4b), OP_ENTRIES(0x4f), OP_ENTRIES(0x53),
+#endif
+#ifdef CONFIG_EXT_V
+        OP_ENTRIES(0x57),
+#endif
+        FUSE_ENTRY(RISCV_FUSE_LUI_ADDI), FUSE_ENTRY(RISCV_FUSE_AUIPC_ADDI),
+        FUSE_ENTRY(RISCV_FUSE_AUIPC_JALR), FUSE_ENTRY(RISCV_FUSE_AUIPC_LOAD),
+        FUSE_ENTRY(RISCV_FUSE_SHIFT), FUSE_ENTRY(RISCV_FUSE_ADDI_BRANCH),
+    };
+#endif
 
     if (n_cycles1 == 0)
         return;
     insn_counter_addend = s->insn_counter + n_cycles1;
     s->n_cycles = n_cycles1;
 
+    s->pending_exception = -1;
+    /* Note: we assume NULL is represented as a zero number */
+    code_ptr = NULL;
+    code_end = NULL;
+    code_to_pc_addend = s->pc;
+    insn_ptr = NULL;
+    insn_end = NULL;
+    tb = NULL;
+
     /* check pending interrupts */
     if (unlikely((s->mip & s->mie) != 0)) {
         if (raise_interrupt(s)) {
@@ -225,68 +688,108 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             goto done_interp;
         }
     }
-
-    s->pending_exception = -1;
-    /* Note: we assume NULL is represented as a zero number */
-    code_ptr = NULL;
-    code_end = NULL;
-    code_to_pc_addend = s->pc;
     
     /* we use a single execution loop to keep a simple control flow
        for emscripten */
     for(;;) {
-        if (unlikely(code_ptr >= code_end)) {
-            uint32_t tlb_idx;
-            uint16_t insn_high;
-            target_ulong addr;
-            uint8_t *ptr;
-            
-            s->pc = GET_PC();
-            /* we test n_cycles only between blocks so that timer
-               interrupts only happen between the blocks. It is
-               important to reduce the translated code size. */
-            if (unlikely(s->n_cycles <= 0))
-                goto the_end;
+        if (unlikely(insn_ptr >= insn_end)) {
+            if (unlikely(code_ptr >= code_end)) {
+                uint32_t tlb_idx;
+                target_ulong addr;
+                uint8_t *ptr;
 
-            /* check pending interrupts */
-            if (unlikely((s->mip & s->mie) != 0)) {
-                if (raise_interrupt(s)) {
-                    s->n_cycles--; 
+                s->pc = GET_PC();
+                /* we test n_cycles only between blocks so that timer
+                   interrupts only happen between the blocks. It is
+                   important to reduce the translated code size. */
+                if (unlikely(s->n_cycles <= 0))
                     goto the_end;
+
+                /* check pending interrupts */
+                if (unlikely((s->mip & s->mie) != 0)) {
+                    if (raise_interrupt(s)) {
+                        s->n_cycles--;
+                        goto the_end;
+                    }
                 }
-            }
-    
-            addr = s->pc;
-            tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
-            if (likely(s->tlb_code[tlb_idx].vaddr == (addr & ~PG_MASK))) {
-                /* TLB match */ 
-                ptr = (uint8_t *)(s->tlb_code[tlb_idx].mem_addend +
-                                  (uintptr_t)addr);
-            } else {
-                if (unlikely(target_read_insn_slow(s, &ptr, addr)))
-                    goto mmu_exception;
-            }
-            code_ptr = ptr;
-            code_end = ptr + (PG_MASK - 1 - (addr & PG_MASK));
-            code_to_pc_addend = addr - (uintptr_t)code_ptr;
-            if (unlikely(code_ptr >= code_end)) {
-                /* instruction is potentially half way between two
-                   pages ? */
-                insn = *(uint16_t *)code_ptr;
-                if ((insn & 3) == 3) {
-                    /* instruction is half way between two pages */
-                    if (unlikely(target_read_insn_u16(s, &insn_high, addr + 2)))
+
+                addr = s->pc;
+                tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
+                if (likely(s->tlb_code[tlb_idx].vaddr == (addr & ~PG_MASK))) {
+                    /* TLB match */
+                    ptr = (uint8_t *)(s->tlb_code[tlb_idx].mem_addend +
+                                      (uintptr_t)addr);
+                } else {
+                    if (unlikely(target_read_insn_slow(s, &ptr, addr)))
                         goto mmu_exception;
-                    insn |= insn_high << 16;
                 }
+                code_ptr = ptr;
+                code_end = ptr + (PG_MASK - 1 - (addr & PG_MASK));
+                code_to_pc_addend = addr - (uintptr_t)code_ptr;
+            }
+            if (unlikely(code_ptr >= code_end) &&
+                (*(uint16_t *)code_ptr & 3) == 3) {
+                /* instruction is half way between two pages: it is
+                   not cached */
+                uint16_t insn_high;
+                insn = *(uint16_t *)code_ptr;
+                if (unlikely(target_read_insn_u16(s, &insn_high,
+                                                  GET_PC() + 2)))
+                    goto mmu_exception;
+                insn |= insn_high << 16;
+                decode_insn(&insn_tmp, insn, 4);
+                insn_ptr = &insn_tmp;
+                insn_end = insn_ptr + 1;
+                s->n_cycles--;
+                tb = NULL;
             } else {
-                insn = get_insn32(code_ptr);
+                TransBlock *prev_tb;
+                uint32_t jmp_gen;
+                int slot;
+
+                /* try the last successor of the previous block */
+                prev_tb = tb;
+                jmp_gen = s->tb_jmp_gen;
+                slot = 0;
+                if (prev_tb) {
+                    slot = (code_ptr == prev_tb->code_ptr +
+                            prev_tb->code_size);
+                    if (prev_tb->jmp_gen == jmp_gen) {
+                        tb = prev_tb->jmp_tb[slot];
+                        if (tb && tb->code_ptr == code_ptr)
+                            goto enter_tb;
+                    }
+                }
+                tb = tb_find(s, code_ptr, XLEN);
+                if (unlikely(!tb))
+                    tb = glue(tb_gen_x, XLEN)(s, code_ptr, code_end);
+                /* no chain if the blocks were flushed */
+                if (prev_tb && s->tb_jmp_gen == jmp_gen) {
+                    if (prev_tb->jmp_gen != jmp_gen) {
+                        prev_tb->jmp_gen = jmp_gen;
+                        prev_tb->jmp_tb[0] = NULL;
+                        prev_tb->jmp_tb[1] = NULL;
+                    }
+                    prev_tb->jmp_tb[slot] = tb;
+                    s->stats.tb_chain++;
+                }
+            enter_tb:
+                insn_ptr = tb->insns;
+                insn_end = insn_ptr + tb->n_insns;
+                s->n_cycles -= tb->n_insns;
+#if defined(CONFIG_JIT) && XLEN == 64
+                if (tb->jit_code) {
+                    int ret;
+                    ret = ((JITFunc *)tb->jit_code)(s, GET_PC());
+                    insn_ptr += ret & 0xff;
+                    code_ptr += ret >> 8;
+                    if (insn_ptr >= insn_end)
+                        continue;
+                }
+#endif
             }
-        } else {
-            /* fast path */
-            insn = get_insn32(code_ptr);
         }
-        s->n_cycles--;
+        insn = insn_ptr->insn;
 #if 0
         if (1) {
 #ifdef CONFIG_LOGFILE
@@ -299,517 +802,48 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
         }
 #endif
         opcode = insn & 0x7f;
-        rd = (insn >> 7) & 0x1f;
-        rs1 = (insn >> 15) & 0x1f;
-        rs2 = (insn >> 20) & 0x1f;
-        switch(opcode) {
-#ifdef CONFIG_EXT_C
-        C_QUADRANT(0)
-            funct3 = (insn >> 13) & 7;
-            rd = ((insn >> 2) & 7) | 8;
-            switch(funct3) {
-            case 0: /* c.addi4spn */
-                imm = get_field1(insn, 11, 4, 5) |
-                    get_field1(insn, 7, 6, 9) |
-                    get_field1(insn, 6, 2, 2) |
-                    get_field1(insn, 5, 3, 3);
-                if (imm == 0)
-                    goto illegal_insn;
-                s->reg[rd] = (intx_t)(s->reg[2] + imm);
-                break;
-#if XLEN >= 128
-            case 1: /* c.lq */
-                imm = get_field1(insn, 11, 4, 5) |
-                    get_field1(insn, 10, 8, 8) |
-                    get_field1(insn, 5, 6, 7);
-                rs1 = ((insn >> 7) & 7) | 8;
-                addr = (intx_t)(s->reg[rs1] + imm);
-                if (target_read_u128(s, &val, addr))
-                    goto mmu_exception;
-                s->reg[rd] = val;
-                break;
-#elif FLEN >= 64
-            case 1: /* c.fld */
-                {
-                    uint64_t rval;
-                    if (s->fs == 0)
-                        goto illegal_insn;
-                    imm = get_field1(insn, 10, 3, 5) |
-                        get_field1(insn, 5, 6, 7);
-                    rs1 = ((insn >> 7) & 7) | 8;
-                    addr = (intx_t)(s->reg[rs1] + imm);
-                    if (target_read_u64(s, &rval, addr))
-                        goto mmu_exception;
-                    s->fp_reg[rd] = rval | F64_HIGH;
-                    s->fs = 3;
-                }
-                break;
-#endif
-            case 2: /* c.lw */
-                {
-                    uint32_t rval;
-                    imm = get_field1(insn, 10, 3, 5) |
-                        get_field1(insn, 6, 2, 2) |
-                        get_field1(insn, 5, 6, 6);
-                    rs1 = ((insn >> 7) & 7) | 8;
-                    addr = (intx_t)(s->reg[rs1] + imm);
-                    if (target_read_u32(s, &rval, addr))
-                        goto mmu_exception;
-                    s->reg[rd] = (int32_t)rval;
-                }
-                break;
-#if XLEN >= 64
-            case 3: /* c.ld */
-                {
-                    uint64_t rval;
-                    imm = get_field1(insn, 10, 3, 5) |
-                        get_field1(insn, 5, 6, 7);
-                    rs1 = ((insn >> 7) & 7) | 8;
-                    addr = (intx_t)(s->reg[rs1] + imm);
-                    if (target_read_u64(s, &rval, addr))
-                        goto mmu_exception;
-                    s->reg[rd] = (int64_t)rval;
-                }
-                break;
-#elif FLEN >= 32
-            case 3: /* c.flw */
-                {
-                    uint32_t rval;
-                    if (s->fs == 0)
-                        goto illegal_insn;
-                    imm = get_field1(insn, 10, 3, 5) |
-                        get_field1(insn, 6, 2, 2) |
-                        get_field1(insn, 5, 6, 6);
-                    rs1 = ((insn >> 7) & 7) | 8;
-                    addr = (intx_t)(s->reg[rs1] + imm);
-                    if (target_read_u32(s, &rval, addr))
-                        goto mmu_exception;
-                    s->fp_reg[rd] = rval | F32_HIGH;
-                    s->fs = 3;
-                }
-                break;
-#endif
-#if XLEN >= 128
-            case 5: /* c.sq */
-                imm = get_field1(insn, 11, 4, 5) |
-                    get_field1(insn, 10, 8, 8) |
-                    get_field1(insn, 5, 6, 7);
-                rs1 = ((insn >> 7) & 7) | 8;
-                addr = (intx_t)(s->reg[rs1] + imm);
-                val = s->reg[rd];
-                if (target_write_u128(s, addr, val))
-                    goto mmu_exception;
-                break;
-#elif FLEN >= 64
-            case 5: /* c.fsd */
-                if (s->fs == 0)
-                    goto illegal_insn;
-                imm = get_field1(insn, 10, 3, 5) |
-                    get_field1(insn, 5, 6, 7);
-                rs1 = ((insn >> 7) & 7) | 8;
-                addr = (intx_t)(s->reg[rs1] + imm);
-                if (target_write_u64(s, addr, s->fp_reg[rd]))
-                    goto mmu_exception;
-                break;
-#endif
-            case 6: /* c.sw */
-                imm = get_field1(insn, 10, 3, 5) |
-                    get_field1(insn, 6, 2, 2) |
-                    get_field1(insn, 5, 6, 6);
-                rs1 = ((insn >> 7) & 7) | 8;
-                addr = (intx_t)(s->reg[rs1] + imm);
-                val = s->reg[rd];
-                if (target_write_u32(s, addr, val))
-                    goto mmu_exception;
-                break;
-#if XLEN >= 64
-            case 7: /* c.sd */
-                imm = get_field1(insn, 10, 3, 5) |
-                    get_field1(insn, 5, 6, 7);
-                rs1 = ((insn >> 7) & 7) | 8;
-                addr = (intx_t)(s->reg[rs1] + imm);
-                val = s->reg[rd];
-                if (target_write_u64(s, addr, val))
-                    goto mmu_exception;
-                break;
-#elif FLEN >= 32
-            case 7: /* c.fsw */
-                if (s->fs == 0)
-                    goto illegal_insn;
-                imm = get_field1(insn, 10, 3, 5) |
-                    get_field1(insn, 6, 2, 2) |
-                    get_field1(insn, 5, 6, 6);
-                rs1 = ((insn >> 7) & 7) | 8;
-                addr = (intx_t)(s->reg[rs1] + imm);
-                if (target_write_u32(s, addr, s->fp_reg[rd]))
-                    goto mmu_exception;
-                break;
-#endif
-            default:
-                goto illegal_insn;
-            }
-            C_NEXT_INSN;
-        C_QUADRANT(1)
-            funct3 = (insn >> 13) & 7;
-            switch(funct3) {
-            case 0: /* c.addi/c.nop */
-                if (rd != 0) {
-                    imm = sext(get_field1(insn, 12, 5, 5) |
-                               get_field1(insn, 2, 0, 4), 6);
-                    s->reg[rd] = (intx_t)(s->reg[rd] + imm);
-                }
-                break;
-#if XLEN == 32
-            case 1: /* c.jal */
-                imm = sext(get_field1(insn, 12, 11, 11) | 
-                           get_field1(insn, 11, 4, 4) |
-                           get_field1(insn, 9, 8, 9) |
-                           get_field1(insn, 8, 10, 10) |
-                           get_field1(insn, 7, 6, 6) |
-                           get_field1(insn, 6, 7, 7) |
-                           get_field1(insn, 3, 1, 3) |
-                           get_field1(insn, 2, 5, 5), 12);
-                s->reg[1] = GET_PC() + 2;
-                s->pc = (intx_t)(GET_PC() + imm);
-                JUMP_INSN;
+        rd = insn_ptr->rd;
+        rs1 = insn_ptr->rs1;
+        rs2 = insn_ptr->rs2;
+        imm = insn_ptr->imm;
+#ifdef CONFIG_THREADED_DISPATCH
+        funct3 = (insn >> 12) & 7;
+        goto *dispatch_table[insn_ptr->op];
 #else
-            case 1: /* c.addiw */
-                if (rd != 0) {
-                    imm = sext(get_field1(insn, 12, 5, 5) |
-                               get_field1(insn, 2, 0, 4), 6);
-                    s->reg[rd] = (int32_t)(s->reg[rd] + imm);
-                }
-                break;
-#endif
-            case 2: /* c.li */
-                if (rd != 0) {
-                    imm = sext(get_field1(insn, 12, 5, 5) |
-                               get_field1(insn, 2, 0, 4), 6);
-                    s->reg[rd] = imm;
-                }
-                break;
-            case 3:
-                if (rd == 2) {
-                    /* c.addi16sp */
-                    imm = sext(get_field1(insn, 12, 9, 9) |
-                               get_field1(insn, 6, 4, 4) |
-                               get_field1(insn, 5, 6, 6) |
-                               get_field1(insn, 3, 7, 8) |
-                               get_field1(insn, 2, 5, 5), 10);
-                    if (imm == 0)
-                        goto illegal_insn;
-                    s->reg[2] = (intx_t)(s->reg[2] + imm);
-                } else if (rd != 0) {
-                    /* c.lui */
-                    imm = sext(get_field1(insn, 12, 17, 17) |
-                               get_field1(insn, 2, 12, 16), 18);
-                    s->reg[rd] = imm;
-                }
-                break;
-            case 4: 
-                funct3 = (insn >> 10) & 3;
-                rd = ((insn >> 7) & 7) | 8;
-                switch(funct3) {
-                case 0: /* c.srli */ 
-                case 1: /* c.srai */ 
-                    imm = get_field1(insn, 12, 5, 5) |
-                        get_field1(insn, 2, 0, 4);
-#if XLEN == 32
-                    if (imm & 0x20)
-                        goto illegal_insn;
-#elif XLEN == 128
-                    if (imm == 0)
-                        imm = 64;
-                    else if (imm >= 32)
-                        imm = 128 - imm;
+        if (insn_ptr->op >= OP_FUSED)
+            opcode = insn_ptr->op;
 #endif
-                    if (funct3 == 0)
-                        s->reg[rd] = (intx_t)((uintx_t)s->reg[rd] >> imm);
-                    else
-                        s->reg[rd] = (intx_t)s->reg[rd] >> imm;
-                    
-                    break;
-                case 2: /* c.andi */
-                    imm = sext(get_field1(insn, 12, 5, 5) |
-                               get_field1(insn, 2, 0, 4), 6);
-                    s->reg[rd] &= imm;
-                    break;
-                case 3: 
-                    rs2 = ((insn >> 2) & 7) | 8;
-                    funct3 = ((insn >> 5) & 3) | ((insn >> (12 - 2)) & 4);
-                    switch(funct3) {
-                    case 0: /* c.sub */
-                        s->reg[rd] = (intx_t)(s->reg[rd] - s->reg[rs2]);
-                        break;
-                    case 1: /* c.xor */
-                        s->reg[rd] = s->reg[rd] ^ s->reg[rs2];
-                        break;
-                    case 2: /* c.or */
-                        s->reg[rd] = s->reg[rd] | s->reg[rs2];
-                        break;
-                    case 3: /* c.and */
-                        s->reg[rd] = s->reg[rd] & s->reg[rs2];
-                        break;
-#if XLEN >= 64
-                    case 4: /* c.subw */
-                        s->reg[rd] = (int32_t)(s->reg[rd] - s->reg[rs2]);
-                        break;
-                    case 5: /* c.addw */
-                        s->reg[rd] = (int32_t)(s->reg[rd] + s->reg[rs2]);
-                        break;
-#endif
-                    default:
-                        goto illegal_insn;
-                    }
-                    break;
-                }
-                break;
-            case 5: /* c.j */
-                imm = sext(get_field1(insn, 12, 11, 11) | 
-                           get_field1(insn, 11, 4, 4) |
-                           get_field1(insn, 9, 8, 9) |
-                           get_field1(insn, 8, 10, 10) |
-                           get_field1(insn, 7, 6, 6) |
-                           get_field1(insn, 6, 7, 7) |
-                           get_field1(insn, 3, 1, 3) |
-                           get_field1(insn, 2, 5, 5), 12);
-                s->pc = (intx_t)(GET_PC() + imm);
-                JUMP_INSN;
-            case 6: /* c.beqz */
-                rs1 = ((insn >> 7) & 7) | 8;
-                imm = sext(get_field1(insn, 12, 8, 8) | 
-                           get_field1(insn, 10, 3, 4) |
-                           get_field1(insn, 5, 6, 7) |
-                           get_field1(insn, 3, 1, 2) |
-                           get_field1(insn, 2, 5, 5), 9);
-                if (s->reg[rs1] == 0) {
-                    s->pc = (intx_t)(GET_PC() + imm);
-                    JUMP_INSN;
-                }
-                break;
-            case 7: /* c.bnez */
-                rs1 = ((insn >> 7) & 7) | 8;
-                imm = sext(get_field1(insn, 12, 8, 8) | 
-                           get_field1(insn, 10, 3, 4) |
-                           get_field1(insn, 5, 6, 7) |
-                           get_field1(insn, 3, 1, 2) |
-                           get_field1(insn, 2, 5, 5), 9);
-                if (s->reg[rs1] != 0) {
-                    s->pc = (intx_t)(GET_PC() + imm);
-                    JUMP_INSN;
-                }
-                break;
-            default:
-                goto illegal_insn;
-            }
-            C_NEXT_INSN;
-        C_QUADRANT(2)
-            funct3 = (insn >> 13) & 7;
-            rs2 = (insn >> 2) & 0x1f;
-            switch(funct3) {
-            case 0: /* c.slli */
-                imm = get_field1(insn, 12, 5, 5) | rs2;
-#if XLEN == 32
-                if (imm & 0x20)
-                    goto illegal_insn;
-#elif XLEN == 128
-                if (imm == 0)
-                    imm = 64;
-#endif
-                if (rd != 0)
-                    s->reg[rd] = (intx_t)(s->reg[rd] << imm);
-                break;
-#if XLEN == 128
-            case 1: /* c.lqsp */
-                imm = get_field1(insn, 12, 5, 5) |
-                    (rs2 & (1 << 4)) |
-                    get_field1(insn, 2, 6, 9);
-                addr = (intx_t)(s->reg[2] + imm);
-                if (target_read_u128(s, &val, addr))
-                    goto mmu_exception;
-                if (rd != 0)
-                    s->reg[rd] = val;
-                break;
-#elif FLEN >= 64
-            case 1: /* c.fldsp */
-                {
-                    uint64_t rval;
-                    if (s->fs == 0)
-                        goto illegal_insn;
-                    imm = get_field1(insn, 12, 5, 5) |
-                        (rs2 & (3 << 3)) |
-                        get_field1(insn, 2, 6, 8);
-                    addr = (intx_t)(s->reg[2] + imm);
-                    if (target_read_u64(s, &rval, addr))
-                        goto mmu_exception;
-                    s->fp_reg[rd] = rval | F64_HIGH;
-                    s->fs = 3;
-                }
-                break;
-#endif
-            case 2: /* c.lwsp */
-                {
-                    uint32_t rval;
-                    imm = get_field1(insn, 12, 5, 5) |
-                        (rs2 & (7 << 2)) |
-                        get_field1(insn, 2, 6, 7);
-                    addr = (intx_t)(s->reg[2] + imm);
-                    if (target_read_u32(s, &rval, addr))
-                        goto mmu_exception;
-                    if (rd != 0)
-                        s->reg[rd] = (int32_t)rval;
-                }
-                break;
-#if XLEN >= 64
-            case 3: /* c.ldsp */
-                {
-                    uint64_t rval;
-                    imm = get_field1(insn, 12, 5, 5) |
-                        (rs2 & (3 << 3)) |
-                        get_field1(insn, 2, 6, 8);
-                    addr = (intx_t)(s->reg[2] + imm);
-                    if (target_read_u64(s, &rval, addr))
-                        goto mmu_exception;
-                    if (rd != 0)
-                        s->reg[rd] = (int64_t)rval;
-                }
-                break;
-#elif FLEN >= 32
-            case 3: /* c.flwsp */
-                {
-                    uint32_t rval;
-                    if (s->fs == 0)
-                        goto illegal_insn;
-                    imm = get_field1(insn, 12, 5, 5) |
-                        (rs2 & (7 << 2)) |
-                        get_field1(insn, 2, 6, 7);
-                    addr = (intx_t)(s->reg[2] + imm);
-                    if (target_read_u32(s, &rval, addr))
-                        goto mmu_exception;
-                    s->fp_reg[rd] = rval | F32_HIGH;
-                    s->fs = 3;
-                }
-                break;
-#endif
-            case 4:
-                if (((insn >> 12) & 1) == 0) {
-                    if (rs2 == 0) {
-                        /* c.jr */
-                        if (rd == 0)
-                            goto illegal_insn;
-                        s->pc = s->reg[rd] & ~1;
-                        JUMP_INSN;
-                    } else {
-                        /* c.mv */
-                        if (rd != 0)
-                            s->reg[rd] = s->reg[rs2];
-                    }
-                } else {
-                    if (rs2 == 0) {
-                        if (rd == 0) {
-                            /* c.ebreak */
-                            s->pending_exception = CAUSE_BREAKPOINT;
-                            goto exception;
-                        } else {
-                            /* c.jalr */
-                            val = GET_PC() + 2;
-                            s->pc = s->reg[rd] & ~1;
-                            s->reg[1] = val;
-                            JUMP_INSN;
-                        }
-                    } else {
-                        if (rd != 0) {
-                            s->reg[rd] = (intx_t)(s->reg[rd] + s->reg[rs2]);
-                        }
-                    }
-                }
-                break;
-#if XLEN == 128
-            case 5: /* c.sqsp */
-                imm = get_field1(insn, 10, 3, 5) |
-                    get_field1(insn, 7, 6, 8);
-                addr = (intx_t)(s->reg[2] + imm);
-                if (target_write_u128(s, addr, s->reg[rs2]))
-                    goto mmu_exception;
-                break;
-#elif FLEN >= 64
-            case 5: /* c.fsdsp */
-                if (s->fs == 0)
-                    goto illegal_insn;
-                imm = get_field1(insn, 10, 3, 5) |
-                    get_field1(insn, 7, 6, 8);
-                addr = (intx_t)(s->reg[2] + imm);
-                if (target_write_u64(s, addr, s->fp_reg[rs2]))
-                    goto mmu_exception;
-                break;
-#endif 
-            case 6: /* c.swsp */
-                imm = get_field1(insn, 9, 2, 5) |
-                    get_field1(insn, 7, 6, 7);
-                addr = (intx_t)(s->reg[2] + imm);
-                if (target_write_u32(s, addr, s->reg[rs2]))
-                    goto mmu_exception;
-                break;
-#if XLEN >= 64
-            case 7: /* c.sdsp */
-                imm = get_field1(insn, 10, 3, 5) |
-                    get_field1(insn, 7, 6, 8);
-                addr = (intx_t)(s->reg[2] + imm);
-                if (target_write_u64(s, addr, s->reg[rs2]))
-                    goto mmu_exception;
-                break;
-#elif FLEN >= 32
-            case 7: /* c.swsp */
-                if (s->fs == 0)
-                    goto illegal_insn;
-                imm = get_field1(insn, 9, 2, 5) |
-                    get_field1(insn, 7, 6, 7);
-                addr = (intx_t)(s->reg[2] + imm);
-                if (target_write_u32(s, addr, s->fp_reg[rs2]))
-                    goto mmu_exception;
-                break;
-#endif
-            default:
-                goto illegal_insn;
-            }
-            C_NEXT_INSN;
-#endif /* CONFIG_EXT_C */
+        switch(opcode) {
 
-        case 0x37: /* lui */
+        CASE_OP(0x37): /* lui */
             if (rd != 0)
-                s->reg[rd] = (int32_t)(insn & 0xfffff000);
+                s->reg[rd] = imm;
             NEXT_INSN;
-        case 0x17: /* auipc */
+        CASE_OP(0x17): /* auipc */
             if (rd != 0)
-                s->reg[rd] = (intx_t)(GET_PC() + (int32_t)(insn & 0xfffff000));
+                s->reg[rd] = (intx_t)(GET_PC() + imm);
             NEXT_INSN;
-        case 0x6f: /* jal */
-            imm = ((insn >> (31 - 20)) & (1 << 20)) |
-                ((insn >> (21 - 1)) & 0x7fe) |
-                ((insn >> (20 - 11)) & (1 << 11)) |
-                (insn & 0xff000);
-            imm = (imm << 11) >> 11;
+        CASE_OP(0x6f): /* jal */
             if (rd != 0)
-                s->reg[rd] = GET_PC() + 4;
+                s->reg[rd] = GET_PC() + insn_ptr->len;
             s->pc = (intx_t)(GET_PC() + imm);
-            JUMP_INSN;
-        case 0x67: /* jalr */
-            imm = (int32_t)insn >> 20;
-            val = GET_PC() + 4;
+            goto chain_jump;
+        CASE_OP(0x67): /* jalr */
+            val = GET_PC() + insn_ptr->len;
             s->pc = (intx_t)(s->reg[rs1] + imm) & ~1;
             if (rd != 0)
                 s->reg[rd] = val;
-            JUMP_INSN;
-        case 0x63:
+            goto chain_jump;
+        case 0x63: /* split by funct3 */
             funct3 = (insn >> 12) & 7;
             switch(funct3 >> 1) {
-            case 0: /* beq/bne */
+            CASE_F3(0x63, 0): /* beq/bne */
                 cond = (s->reg[rs1] == s->reg[rs2]);
                 break;
-            case 2: /* blt/bge */
+            CASE_F3(0x63, 2): /* blt/bge */
                 cond = ((target_long)s->reg[rs1] < (target_long)s->reg[rs2]);
                 break;
-            case 3: /* bltu/bgeu */
+            CASE_F3(0x63, 3): /* bltu/bgeu */
                 cond = (s->reg[rs1] < s->reg[rs2]);
                 break;
             default:
@@ -817,18 +851,12 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             }
             cond ^= (funct3 & 1);
             if (cond) {
-                imm = ((insn >> (31 - 12)) & (1 << 12)) |
-                    ((insn >> (25 - 5)) & 0x7e0) |
-                    ((insn >> (8 - 1)) & 0x1e) |
-                    ((insn << (11 - 7)) & (1 << 11));
-                imm = (imm << 19) >> 19;
                 s->pc = (intx_t)(GET_PC() + imm);
-                JUMP_INSN;
+                goto chain_jump;
             }
             NEXT_INSN;
-        case 0x03: /* load */
+        CASE_OP(0x03): /* load */
             funct3 = (insn >> 12) & 7;
-            imm = (int32_t)insn >> 20;
             addr = s->reg[rs1] + imm;
             switch(funct3) {
             case 0: /* lb */
@@ -905,12 +933,13 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             if (rd != 0)
                 s->reg[rd] = val;
             NEXT_INSN;
-        case 0x23: /* store */
+        CASE_OP(0x23): /* store */
             funct3 = (insn >> 12) & 7;
-            imm = rd | ((insn >> (25 - 5)) & 0xfe0);
-            imm = (imm << 20) >> 20;
             addr = s->reg[rs1] + imm;
             val = s->reg[rs2];
+            /* a device write may read the instruction counter */
+            if (unlikely(!tlb_write_hit(s, addr, funct3)))
+                s->insn_counter = GET_INSN_COUNTER();
             switch(funct3) {
             case 0: /* sb */
                 if (target_write_u8(s, addr, val))
@@ -940,40 +969,106 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             }
             NEXT_INSN;
-        case 0x13:
+        case 0x13: /* split by funct3 */
             funct3 = (insn >> 12) & 7;
-            imm = (int32_t)insn >> 20;
             switch(funct3) {
-            case 0: /* addi */
+            CASE_F3(0x13, 0): /* addi */
                 val = (intx_t)(s->reg[rs1] + imm);
                 break;
-            case 1: /* slli */
-                if ((imm & ~(XLEN - 1)) != 0)
+            CASE_F3(0x13, 1): /* slli */
+                if ((imm & ~(XLEN - 1)) != 0) {
+#if XLEN <= 64
+                    /* Zbb, Zbs */
+                    val = s->reg[rs1];
+                    switch(imm & ~(XLEN - 1)) {
+                    case 0x280: /* bseti */
+                        val = val | ((uintx_t)1 << (imm & (XLEN - 1)));
+                        break;
+                    case 0x480: /* bclri */
+                        val = val & ~((uintx_t)1 << (imm & (XLEN - 1)));
+                        break;
+                    case 0x680: /* binvi */
+                        val = val ^ ((uintx_t)1 << (imm & (XLEN - 1)));
+                        break;
+                    case 0x600:
+                        switch(imm & (XLEN - 1)) {
+                        case 0: /* clz */
+                            val = glue(clz, XLEN)(val);
+                            break;
+                        case 1: /* ctz */
+                            val = glue(ctz, XLEN)(val);
+                            break;
+                        case 2: /* cpop */
+                            val = glue(popcount, XLEN)(val);
+                            break;
+                        case 4: /* sext.b */
+                            val = (int8_t)val;
+                            break;
+                        case 5: /* sext.h */
+                            val = (int16_t)val;
+                            break;
+                        default:
+                            goto illegal_insn;
+                        }
+                        break;
+                    default:
+                        goto illegal_insn;
+                    }
+                    break;
+#else
                     goto illegal_insn;
+#endif
+                }
                 val = (intx_t)(s->reg[rs1] << (imm & (XLEN - 1)));
                 break;
-            case 2: /* slti */
+            CASE_F3(0x13, 2): /* slti */
                 val = (target_long)s->reg[rs1] < (target_long)imm;
                 break;
-            case 3: /* sltiu */
+            CASE_F3(0x13, 3): /* sltiu */
                 val = s->reg[rs1] < (target_ulong)imm;
                 break;
-            case 4: /* xori */
+            CASE_F3(0x13, 4): /* xori */
                 val = s->reg[rs1] ^ imm;
                 break;
-            case 5: /* srli/srai */
-                if ((imm & ~((XLEN - 1) | 0x400)) != 0)
+            CASE_F3(0x13, 5): /* srli/srai */
+                if ((imm & ~((XLEN - 1) | 0x400)) != 0) {
+#if XLEN <= 64
+                    /* Zbb, Zbs */
+                    val = s->reg[rs1];
+                    switch(imm & ~(XLEN - 1)) {
+                    case 0x600: /* rori */
+                        val = (intx_t)glue(ror, XLEN)(val, imm & (XLEN - 1));
+                        break;
+                    case 0x480: /* bexti */
+                        val = (val >> (imm & (XLEN - 1))) & 1;
+                        break;
+                    default:
+                        if (imm == 0x287) {
+                            /* orc.b */
+                            val = glue(orc_b, XLEN)(val);
+                        } else if (imm == (XLEN == 32 ? 0x698 : 0x6b8)) {
+                            /* rev8 */
+                            val = (intx_t)glue(bswap_, XLEN)(val);
+                        } else {
+                            goto illegal_insn;
+                        }
+                        break;
+                    }
+                    break;
+#else
                     goto illegal_insn;
+#endif
+                }
                 if (imm & 0x400)
                     val = (intx_t)s->reg[rs1] >> (imm & (XLEN - 1));
                 else
                     val = (intx_t)((uintx_t)s->reg[rs1] >> (imm & (XLEN - 1)));
                 break;
-            case 6: /* ori */
+            CASE_F3(0x13, 6): /* ori */
                 val = s->reg[rs1] | imm;
                 break;
             default:
-            case 7: /* andi */
+            CASE_F3(0x13, 7): /* andi */
                 val = s->reg[rs1] & imm;
                 break;
             }
@@ -981,22 +1076,48 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 s->reg[rd] = val;
             NEXT_INSN;
 #if XLEN >= 64
-        case 0x1b:/* OP-IMM-32 */
+        CASE_OP(0x1b):/* OP-IMM-32 */
             funct3 = (insn >> 12) & 7;
-            imm = (int32_t)insn >> 20;
             val = s->reg[rs1];
             switch(funct3) {
             case 0: /* addiw */
                 val = (int32_t)(val + imm);
                 break;
             case 1: /* slliw */
-                if ((imm & ~31) != 0)
-                    goto illegal_insn;
+                if ((imm & ~31) != 0) {
+#if XLEN == 64
+                    if ((imm & ~63) == 0x080) {
+                        /* slli.uw */
+                        val = (uint64_t)(uint32_t)val << (imm & 63);
+                    } else if (imm == 0x600) {
+                        /* clzw */
+                        val = clz32(val);
+                    } else if (imm == 0x601) {
+                        /* ctzw */
+                        val = ctz32(val);
+                    } else if (imm == 0x602) {
+                        /* cpopw */
+                        val = popcount32(val);
+                    } else
+#endif
+                    {
+                        goto illegal_insn;
+                    }
+                    break;
+                }
                 val = (int32_t)(val << (imm & 31));
                 break;
             case 5: /* srliw/sraiw */
-                if ((imm & ~(31 | 0x400)) != 0)
+                if ((imm & ~(31 | 0x400)) != 0) {
+#if XLEN == 64
+                    if ((imm & ~31) == 0x600) {
+                        /* roriw */
+                        val = (int32_t)ror32(val, imm & 31);
+                        break;
+                    }
+#endif
                     goto illegal_insn;
+                }
                 if (imm & 0x400)
                     val = (int32_t)val >> (imm & 31);
                 else
@@ -1010,9 +1131,8 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             NEXT_INSN;
 #endif
 #if XLEN >= 128
-        case 0x5b: /* OP-IMM-64 */
+        CASE_OP(0x5b): /* OP-IMM-64 */
             funct3 = (insn >> 12) & 7;
-            imm = (int32_t)insn >> 20;
             val = s->reg[rs1];
             switch(funct3) {
             case 0: /* addid */
@@ -1038,8 +1158,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 s->reg[rd] = val;
             NEXT_INSN;
 #endif
-        case 0x33:
-            imm = insn >> 25;
+        CASE_OP(0x33):
             val = s->reg[rs1];
             val2 = s->reg[rs2];
             if (imm == 1) {
@@ -1072,6 +1191,61 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 default:
                     goto illegal_insn;
                 }
+#if XLEN <= 64
+            } else if (imm & ~0x20) {
+                /* Zba, Zbb, Zbs */
+                funct3 = (insn >> 12) & 7;
+                switch((imm << 3) | funct3) {
+                case (0x10 << 3) | 2: /* sh1add */
+                    val = (intx_t)((val << 1) + val2);
+                    break;
+                case (0x10 << 3) | 4: /* sh2add */
+                    val = (intx_t)((val << 2) + val2);
+                    break;
+                case (0x10 << 3) | 6: /* sh3add */
+                    val = (intx_t)((val << 3) + val2);
+                    break;
+                case (0x05 << 3) | 4: /* min */
+                    val = (intx_t)val < (intx_t)val2 ? val : val2;
+                    break;
+                case (0x05 << 3) | 5: /* minu */
+                    val = (uintx_t)val < (uintx_t)val2 ? val : val2;
+                    break;
+                case (0x05 << 3) | 6: /* max */
+                    val = (intx_t)val > (intx_t)val2 ? val : val2;
+                    break;
+                case (0x05 << 3) | 7: /* maxu */
+                    val = (uintx_t)val > (uintx_t)val2 ? val : val2;
+                    break;
+                case (0x30 << 3) | 1: /* rol */
+                    val = (intx_t)glue(rol, XLEN)(val, val2 & (XLEN - 1));
+                    break;
+                case (0x30 << 3) | 5: /* ror */
+                    val = (intx_t)glue(ror, XLEN)(val, val2 & (XLEN - 1));
+                    break;
+                case (0x14 << 3) | 1: /* bset */
+                    val = val | ((uintx_t)1 << (val2 & (XLEN - 1)));
+                    break;
+                case (0x24 << 3) | 1: /* bclr */
+                    val = val & ~((uintx_t)1 << (val2 & (XLEN - 1)));
+                    break;
+                case (0x34 << 3) | 1: /* binv */
+                    val = val ^ ((uintx_t)1 << (val2 & (XLEN - 1)));
+                    break;
+                case (0x24 << 3) | 5: /* bext */
+                    val = ((uintx_t)val >> (val2 & (XLEN - 1))) & 1;
+                    break;
+#if XLEN == 32
+                case (0x04 << 3) | 4: /* zext.h */
+                    if (rs2 != 0)
+                        goto illegal_insn;
+                    val = (uint16_t)val;
+                    break;
+#endif
+                default:
+                    goto illegal_insn;
+                }
+#endif
             } else {
                 if (imm & ~0x20)
                     goto illegal_insn;
@@ -1107,6 +1281,17 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 case 7: /* and */
                     val = val & val2;
                     break;
+#if XLEN <= 64
+                case 4 | 8: /* xnor */
+                    val = ~(val ^ val2);
+                    break;
+                case 6 | 8: /* orn */
+                    val = val | ~val2;
+                    break;
+                case 7 | 8: /* andn */
+                    val = val & ~val2;
+                    break;
+#endif
                 default:
                     goto illegal_insn;
                 }
@@ -1115,8 +1300,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 s->reg[rd] = val;
             NEXT_INSN;
 #if XLEN >= 64
-        case 0x3b: /* OP-32 */
-            imm = insn >> 25;
+        CASE_OP(0x3b): /* OP-32 */
             val = s->reg[rs1];
             val2 = s->reg[rs2];
             if (imm == 1) {
@@ -1140,6 +1324,38 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 default:
                     goto illegal_insn;
                 }
+#if XLEN == 64
+            } else if (imm & ~0x20) {
+                /* Zba, Zbb */
+                funct3 = (insn >> 12) & 7;
+                switch((imm << 3) | funct3) {
+                case (0x04 << 3) | 0: /* add.uw */
+                    val = (uint64_t)(uint32_t)val + val2;
+                    break;
+                case (0x10 << 3) | 2: /* sh1add.uw */
+                    val = ((uint64_t)(uint32_t)val << 1) + val2;
+                    break;
+                case (0x10 << 3) | 4: /* sh2add.uw */
+                    val = ((uint64_t)(uint32_t)val << 2) + val2;
+                    break;
+                case (0x10 << 3) | 6: /* sh3add.uw */
+                    val = ((uint64_t)(uint32_t)val << 3) + val2;
+                    break;
+                case (0x30 << 3) | 1: /* rolw */
+                    val = (int32_t)rol32(val, val2 & 31);
+                    break;
+                case (0x30 << 3) | 5: /* rorw */
+                    val = (int32_t)ror32(val, val2 & 31);
+                    break;
+                case (0x04 << 3) | 4: /* zext.h */
+                    if (rs2 != 0)
+                        goto illegal_insn;
+                    val = (uint16_t)val;
+                    break;
+                default:
+                    goto illegal_insn;
+                }
+#endif
             } else {
                 if (imm & ~0x20)
                     goto illegal_insn;
@@ -1169,8 +1385,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             NEXT_INSN;
 #endif
 #if XLEN >= 128
-        case 0x7b: /* OP-64 */
-            imm = insn >> 25;
+        CASE_OP(0x7b): /* OP-64 */
             val = s->reg[rs1];
             val2 = s->reg[rs2];
             if (imm == 1) {
@@ -1222,9 +1437,8 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 s->reg[rd] = val;
             NEXT_INSN;
 #endif
-        case 0x73:
+        CASE_OP(0x73):
             funct3 = (insn >> 12) & 7;
-            imm = insn >> 20;
             if (funct3 & 4)
                 val = rs1;
             else
@@ -1319,6 +1533,15 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                        pending */
                     if ((s->mip & s->mie) == 0) {
                         s->power_down_flag = TRUE;
+                        /* insn_counter does not advance while sleeping,
+                           so 'time' must be read again at wake up */
+                        s->time_cache_insn = s->insn_counter -
+                            TIME_CACHE_INSNS;
+                        /* mip may have been set by another thread
+                           (see riscv_cpu_set_mip()) */
+                        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                        if ((s->mip & s->mie) != 0)
+                            s->power_down_flag = FALSE;
                         s->pc = GET_PC() + 4;
                         goto done_interp;
                     }
@@ -1330,10 +1553,23 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                             goto illegal_insn;
                         if (s->priv == PRV_U)
                             goto illegal_insn;
-                        if (rs1 == 0) {
-                            tlb_flush_all(s);
-                        } else {
-                            tlb_flush_vaddr(s, s->reg[rs1]);
+                        {
+                            int asid;
+                            /* rs2 != 0 restricts the flush to one ASID */
+                            if (rs2 != 0)
+                                asid = s->reg[rs2] & SATP_ASID_MASK;
+                            else
+                                asid = -1;
+                            if (rs1 != 0) {
+                                s->stats.tlb_flush_vaddr++;
+                                tlb_flush_vaddr(s, s->reg[rs1], asid);
+                            } else if (asid >= 0) {
+                                s->stats.tlb_flush_asid++;
+                                tlb_flush_asid(s, asid);
+                            } else {
+                                s->stats.tlb_flush_all++;
+                                tlb_flush_all(s);
+                            }
                         }
                         /* the current code TLB may have been flushed */
                         s->pc = GET_PC() + 4;
@@ -1348,20 +1584,23 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             }
             NEXT_INSN;
-        case 0x0f: /* misc-mem */
+        CASE_OP(0x0f): /* misc-mem */
             funct3 = (insn >> 12) & 7;
             switch(funct3) {
             case 0: /* fence */
                 if (insn & 0xf00fff80)
                     goto illegal_insn;
+                /* order the accesses with respect to the other harts */
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
                 break;
             case 1: /* fence.i */
                 if (insn != 0x0000100f)
                     goto illegal_insn;
-                break;
+                tb_flush_all(s);
+                s->pc = GET_PC() + 4;
+                JUMP_INSN;
 #if XLEN >= 128
             case 2: /* lq */
-                imm = (int32_t)insn >> 20;
                 addr = s->reg[rs1] + imm;
                 if (target_read_u128(s, &val, addr))
                     goto mmu_exception;
@@ -1373,11 +1612,12 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             }
             NEXT_INSN;
-        case 0x2f:
+        CASE_OP(0x2f):
             funct3 = (insn >> 12) & 7;
-#define OP_A(size)                                                      \
+#define OP_A(size, size_log2)                                           \
             {                                                           \
                 uint ## size ##_t rval;                                 \
+                uint8_t *ptr;                                           \
                                                                         \
                 addr = s->reg[rs1];                                     \
                 funct3 = insn >> 27;                                    \
@@ -1389,12 +1629,24 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                         goto mmu_exception;                             \
                     val = (int## size ## _t)rval;                       \
                     s->load_res = addr;                                 \
+                    s->load_res_val = rval;                             \
                     break;                                              \
                 case 3: /* sc.w */                                      \
                     if (s->load_res == addr) {                          \
-                        if (target_write_u ## size(s, addr, s->reg[rs2])) \
+                        /* the store is done only if the memory still   \
+                           contains the value read by LR */             \
+                        if (target_get_rmw_ptr(s, &ptr, addr, size_log2)) \
                             goto mmu_exception;                         \
-                        val = 0;                                        \
+                        if (ptr) {                                      \
+                            rval = s->load_res_val;                     \
+                            val = !atomic_cmpxchg_u ## size(ptr, &rval, \
+                                                            s->reg[rs2]); \
+                        } else {                                        \
+                            if (target_write_u ## size(s, addr, s->reg[rs2])) \
+                                goto mmu_exception;                     \
+                            val = 0;                                    \
+                        }                                               \
+                        s->load_res = -1;                               \
                     } else {                                            \
                         val = 1;                                        \
                     }                                                   \
@@ -1408,46 +1660,60 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 case 0x14: /* amomax.w */                               \
                 case 0x18: /* amominu.w */                              \
                 case 0x1c: /* amomaxu.w */                              \
-                    if (target_read_u ## size(s, &rval, addr))          \
+                    if (target_get_rmw_ptr(s, &ptr, addr, size_log2))   \
                         goto mmu_exception;                             \
-                    val = (int## size ## _t)rval;                       \
-                    val2 = s->reg[rs2];                                 \
-                    switch(funct3) {                                    \
-                    case 1: /* amiswap.w */                             \
-                        break;                                          \
-                    case 0: /* amoadd.w */                              \
-                        val2 = (int## size ## _t)(val + val2);          \
-                        break;                                          \
-                    case 4: /* amoxor.w */                              \
-                        val2 = (int## size ## _t)(val ^ val2);          \
-                        break;                                          \
-                    case 0xc: /* amoand.w */                            \
-                        val2 = (int## size ## _t)(val & val2);          \
-                        break;                                          \
-                    case 0x8: /* amoor.w */                             \
-                        val2 = (int## size ## _t)(val | val2);          \
-                        break;                                          \
-                    case 0x10: /* amomin.w */                           \
-                        if ((int## size ## _t)val < (int## size ## _t)val2) \
-                            val2 = (int## size ## _t)val;               \
-                        break;                                          \
-                    case 0x14: /* amomax.w */                           \
-                        if ((int## size ## _t)val > (int## size ## _t)val2) \
-                            val2 = (int## size ## _t)val;               \
-                        break;                                          \
-                    case 0x18: /* amominu.w */                          \
-                        if ((uint## size ## _t)val < (uint## size ## _t)val2) \
-                            val2 = (int## size ## _t)val;               \
-                        break;                                          \
-                    case 0x1c: /* amomaxu.w */                          \
-                        if ((uint## size ## _t)val > (uint## size ## _t)val2) \
-                            val2 = (int## size ## _t)val;               \
-                        break;                                          \
-                    default:                                            \
-                        goto illegal_insn;                              \
+                    if (ptr) {                                          \
+                        rval = *(uint ## size ## _t *)ptr;              \
+                    } else {                                            \
+                        if (target_read_u ## size(s, &rval, addr))      \
+                            goto mmu_exception;                         \
+                    }                                                   \
+                    for(;;) {                                           \
+                        val = (int## size ## _t)rval;                   \
+                        val2 = s->reg[rs2];                             \
+                        switch(funct3) {                                \
+                        case 1: /* amiswap.w */                         \
+                            break;                                      \
+                        case 0: /* amoadd.w */                          \
+                            val2 = (int## size ## _t)(val + val2);      \
+                            break;                                      \
+                        case 4: /* amoxor.w */                          \
+                            val2 = (int## size ## _t)(val ^ val2);      \
+                            break;                                      \
+                        case 0xc: /* amoand.w */                        \
+                            val2 = (int## size ## _t)(val & val2);      \
+                            break;                                      \
+                        case 0x8: /* amoor.w */                         \
+                            val2 = (int## size ## _t)(val | val2);      \
+                            break;                                      \
+                        case 0x10: /* amomin.w */                       \
+                            if ((int## size ## _t)val < (int## size ## _t)val2) \
+                                val2 = (int## size ## _t)val;           \
+                            break;                                      \
+                        case 0x14: /* amomax.w */                       \
+                            if ((int## size ## _t)val > (int## size ## _t)val2) \
+                                val2 = (int## size ## _t)val;           \
+                            break;                                      \
+                        case 0x18: /* amominu.w */                      \
+                            if ((uint## size ## _t)val < (uint## size ## _t)val2) \
+                                val2 = (int## size ## _t)val;           \
+                            break;                                      \
+                        case 0x1c: /* amomaxu.w */                      \
+                            if ((uint## size ## _t)val > (uint## size ## _t)val2) \
+                                val2 = (int## size ## _t)val;           \
+                            break;                                      \
+                        default:                                        \
+                            goto illegal_insn;                          \
+                        }                                               \
+                        if (!ptr) {                                     \
+                            if (target_write_u ## size(s, addr, val2))  \
+                                goto mmu_exception;                     \
+                            break;                                      \
+                        }                                               \
+                        /* retry if modified by another hart */         \
+                        if (atomic_cmpxchg_u ## size(ptr, &rval, val2)) \
+                            break;                                      \
                     }                                                   \
-                    if (target_write_u ## size(s, addr, val2))          \
-                        goto mmu_exception;                             \
                     break;                                              \
                 default:                                                \
                     goto illegal_insn;                                  \
@@ -1456,16 +1722,16 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
 
             switch(funct3) {
             case 2:
-                OP_A(32);
+                OP_A(32, 2);
                 break;
 #if XLEN >= 64
             case 3:
-                OP_A(64);
+                OP_A(64, 3);
                 break;
 #endif
 #if XLEN >= 128
             case 4:
-                OP_A(128);
+                OP_A(128, 4);
                 break;
 #endif
             default:
@@ -1476,11 +1742,20 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             NEXT_INSN;
 #if FLEN > 0
             /* FPU */
-        case 0x07: /* fp load */
+        CASE_OP(0x07): /* fp load */
+            funct3 = (insn >> 12) & 7;
+#ifdef CONFIG_EXT_V
+            if (funct3 == 0 || funct3 >= 5) {
+                err = vector_load_store(s, insn, FALSE);
+                if (err == -1)
+                    goto illegal_insn;
+                else if (err)
+                    goto mmu_exception;
+                NEXT_INSN;
+            }
+#endif
             if (s->fs == 0)
                 goto illegal_insn;
-            funct3 = (insn >> 12) & 7;
-            imm = (int32_t)insn >> 20;
             addr = s->reg[rs1] + imm;
             switch(funct3) {
             case 2: /* flw */
@@ -1516,12 +1791,20 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             }
             s->fs = 3;
             NEXT_INSN;
-        case 0x27: /* fp store */
+        CASE_OP(0x27): /* fp store */
+            funct3 = (insn >> 12) & 7;
+#ifdef CONFIG_EXT_V
+            if (funct3 == 0 || funct3 >= 5) {
+                err = vector_load_store(s, insn, TRUE);
+                if (err == -1)
+                    goto illegal_insn;
+                else if (err)
+                    goto mmu_exception;
+                NEXT_INSN;
+            }
+#endif
             if (s->fs == 0)
                 goto illegal_insn;
-            funct3 = (insn >> 12) & 7;
-            imm = rd | ((insn >> (25 - 5)) & 0xfe0);
-            imm = (imm << 20) >> 20;
             addr = s->reg[rs1] + imm;
             switch(funct3) {
             case 2: /* fsw */
@@ -1544,7 +1827,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             }
             NEXT_INSN;
-        case 0x43: /* fmadd */
+        CASE_OP(0x43): /* fmadd */
             if (s->fs == 0)
                 goto illegal_insn;
             funct3 = (insn >> 25) & 3;
@@ -1554,18 +1837,18 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             switch(funct3) {
             case 0:
-                s->fp_reg[rd] = fma_sf32(s->fp_reg[rs1], s->fp_reg[rs2],
+                s->fp_reg[rd] = host_fma_sf32(s->fp_reg[rs1], s->fp_reg[rs2],
                                          s->fp_reg[rs3], rm, &s->fflags) | F32_HIGH;
                 break;
 #if FLEN >= 64
             case 1:
-                s->fp_reg[rd] = fma_sf64(s->fp_reg[rs1], s->fp_reg[rs2],
+                s->fp_reg[rd] = host_fma_sf64(s->fp_reg[rs1], s->fp_reg[rs2],
                                          s->fp_reg[rs3], rm, &s->fflags) | F64_HIGH;
                 break;
 #endif
 #if FLEN >= 128
             case 3:
-                s->fp_reg[rd] = fma_sf128(s->fp_reg[rs1], s->fp_reg[rs2],
+                s->fp_reg[rd] = host_fma_sf128(s->fp_reg[rs1], s->fp_reg[rs2],
                                           s->fp_reg[rs3], rm, &s->fflags);
                 break;
 #endif
@@ -1574,7 +1857,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             }
             s->fs = 3;
             NEXT_INSN;
-        case 0x47: /* fmsub */
+        CASE_OP(0x47): /* fmsub */
             if (s->fs == 0)
                 goto illegal_insn;
             funct3 = (insn >> 25) & 3;
@@ -1584,14 +1867,14 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             switch(funct3) {
             case 0:
-                s->fp_reg[rd] = fma_sf32(s->fp_reg[rs1],
+                s->fp_reg[rd] = host_fma_sf32(s->fp_reg[rs1],
                                          s->fp_reg[rs2],
                                          s->fp_reg[rs3] ^ FSIGN_MASK32,
                                          rm, &s->fflags) | F32_HIGH;
                 break;
 #if FLEN >= 64
             case 1:
-                s->fp_reg[rd] = fma_sf64(s->fp_reg[rs1],
+                s->fp_reg[rd] = host_fma_sf64(s->fp_reg[rs1],
                                          s->fp_reg[rs2],
                                          s->fp_reg[rs3] ^ FSIGN_MASK64,
                                          rm, &s->fflags) | F64_HIGH;
@@ -1599,7 +1882,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
 #endif
 #if FLEN >= 128
             case 3:
-                s->fp_reg[rd] = fma_sf128(s->fp_reg[rs1],
+                s->fp_reg[rd] = host_fma_sf128(s->fp_reg[rs1],
                                           s->fp_reg[rs2],
                                           s->fp_reg[rs3] ^ FSIGN_MASK128,
                                           rm, &s->fflags);
@@ -1610,7 +1893,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             }
             s->fs = 3;
             NEXT_INSN;
-        case 0x4b: /* fnmsub */
+        CASE_OP(0x4b): /* fnmsub */
             if (s->fs == 0)
                 goto illegal_insn;
             funct3 = (insn >> 25) & 3;
@@ -1620,14 +1903,14 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             switch(funct3) {
             case 0:
-                s->fp_reg[rd] = fma_sf32(s->fp_reg[rs1] ^ FSIGN_MASK32,
+                s->fp_reg[rd] = host_fma_sf32(s->fp_reg[rs1] ^ FSIGN_MASK32,
                                          s->fp_reg[rs2],
                                          s->fp_reg[rs3],
                                          rm, &s->fflags) | F32_HIGH;
                 break;
 #if FLEN >= 64
             case 1:
-                s->fp_reg[rd] = fma_sf64(s->fp_reg[rs1] ^ FSIGN_MASK64,
+                s->fp_reg[rd] = host_fma_sf64(s->fp_reg[rs1] ^ FSIGN_MASK64,
                                          s->fp_reg[rs2],
                                          s->fp_reg[rs3],
                                          rm, &s->fflags) | F64_HIGH;
@@ -1635,7 +1918,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
 #endif
 #if FLEN >= 128
             case 3:
-                s->fp_reg[rd] = fma_sf128(s->fp_reg[rs1] ^ FSIGN_MASK128,
+                s->fp_reg[rd] = host_fma_sf128(s->fp_reg[rs1] ^ FSIGN_MASK128,
                                           s->fp_reg[rs2],
                                           s->fp_reg[rs3],
                                           rm, &s->fflags);
@@ -1646,7 +1929,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             }
             s->fs = 3;
             NEXT_INSN;
-        case 0x4f: /* fnmadd */
+        CASE_OP(0x4f): /* fnmadd */
             if (s->fs == 0)
                 goto illegal_insn;
             funct3 = (insn >> 25) & 3;
@@ -1656,14 +1939,14 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             switch(funct3) {
             case 0:
-                s->fp_reg[rd] = fma_sf32(s->fp_reg[rs1] ^ FSIGN_MASK32,
+                s->fp_reg[rd] = host_fma_sf32(s->fp_reg[rs1] ^ FSIGN_MASK32,
                                          s->fp_reg[rs2],
                                          s->fp_reg[rs3] ^ FSIGN_MASK32,
                                          rm, &s->fflags) | F32_HIGH;
                 break;
 #if FLEN >= 64
             case 1:
-                s->fp_reg[rd] = fma_sf64(s->fp_reg[rs1] ^ FSIGN_MASK64,
+                s->fp_reg[rd] = host_fma_sf64(s->fp_reg[rs1] ^ FSIGN_MASK64,
                                          s->fp_reg[rs2],
                                          s->fp_reg[rs3] ^ FSIGN_MASK64,
                                          rm, &s->fflags) | F64_HIGH;
@@ -1671,7 +1954,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
 #endif
 #if FLEN >= 128
             case 3:
-                s->fp_reg[rd] = fma_sf128(s->fp_reg[rs1] ^ FSIGN_MASK128,
+                s->fp_reg[rd] = host_fma_sf128(s->fp_reg[rs1] ^ FSIGN_MASK128,
                                           s->fp_reg[rs2],
                                           s->fp_reg[rs3] ^ FSIGN_MASK128,
                                           rm, &s->fflags);
@@ -1682,10 +1965,9 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             }
             s->fs = 3;
             NEXT_INSN;
-        case 0x53:
+        CASE_OP(0x53):
             if (s->fs == 0)
                 goto illegal_insn;
-            imm = insn >> 25;
             rm = (insn >> 12) & 7;
             switch(imm) {
 
@@ -1704,6 +1986,93 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             }
             NEXT_INSN;
+#endif
+            /* fused pairs: the first instruction is in 'insn_ptr' */
+        CASE_FUSE(RISCV_FUSE_LUI_ADDI):
+            FUSE_NEXT_INSN();
+            val = (intx_t)((target_long)imm + insn_ptr->imm);
+#if XLEN >= 64
+            if ((insn_ptr->insn & 0x7f) == 0x1b)
+                val = (int32_t)val;
+#endif
+            s->reg[rd] = val;
+            NEXT_INSN;
+        CASE_FUSE(RISCV_FUSE_AUIPC_ADDI):
+            val = GET_PC() + imm;
+            FUSE_NEXT_INSN();
+            s->reg[rd] = (intx_t)(val + insn_ptr->imm);
+            NEXT_INSN;
+        CASE_FUSE(RISCV_FUSE_AUIPC_JALR):
+            val = (intx_t)(GET_PC() + imm);
+            s->reg[rd] = val;
+            FUSE_NEXT_INSN();
+            s->pc = (intx_t)(val + insn_ptr->imm) & ~1;
+            if (insn_ptr->rd != 0)
+                s->reg[insn_ptr->rd] = GET_PC() + insn_ptr->len;
+            goto chain_jump;
+        CASE_FUSE(RISCV_FUSE_AUIPC_LOAD):
+            val = (intx_t)(GET_PC() + imm);
+            s->reg[rd] = val;
+            FUSE_NEXT_INSN();
+            addr = val + insn_ptr->imm;
+#if XLEN >= 64
+            if (insn_ptr->op & (1 << 7)) {
+                uint64_t rval;
+                if (target_read_u64(s, &rval, addr))
+                    goto mmu_exception;
+                val = (int64_t)rval;
+            } else
+#endif
+            {
+                uint32_t rval;
+                if (target_read_u32(s, &rval, addr))
+                    goto mmu_exception;
+                val = (int32_t)rval;
+            }
+            if (insn_ptr->rd != 0)
+                s->reg[insn_ptr->rd] = val;
+            NEXT_INSN;
+        CASE_FUSE(RISCV_FUSE_SHIFT):
+            val = s->reg[rs1] << (imm & (XLEN - 1));
+            FUSE_NEXT_INSN();
+            imm = insn_ptr->imm;
+            if (imm & 0x400)
+                val = (intx_t)val >> (imm & (XLEN - 1));
+            else
+                val = (intx_t)((uintx_t)val >> (imm & (XLEN - 1)));
+            s->reg[rd] = val;
+            NEXT_INSN;
+        CASE_FUSE(RISCV_FUSE_ADDI_BRANCH):
+            s->reg[rd] = (intx_t)(s->reg[rs1] + imm);
+            FUSE_NEXT_INSN();
+            funct3 = (insn_ptr->insn >> 12) & 7;
+            val = s->reg[insn_ptr->rs1];
+            val2 = s->reg[insn_ptr->rs2];
+            switch(funct3 >> 1) {
+            case 0: /* beq/bne */
+                cond = (val == val2);
+                break;
+            case 2: /* blt/bge */
+                cond = ((target_long)val < (target_long)val2);
+                break;
+            default: /* bltu/bgeu */
+                cond = (val < val2);
+                break;
+            }
+            cond ^= (funct3 & 1);
+            if (cond) {
+                s->pc = (intx_t)(GET_PC() + insn_ptr->imm);
+                goto chain_jump;
+            }
+            NEXT_INSN;
+#ifdef CONFIG_EXT_V
+        CASE_OP(0x57): /* vector */
+            err = vector_exec(s, insn, &val);
+            if (err < 0)
+                goto illegal_insn;
+            if (err > 0 && rd != 0)
+                s->reg[rd] = (intx_t)val;
+            NEXT_INSN;
 #endif
         default:
             goto illegal_insn;
@@ -1711,9 +2080,51 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
         /* update PC for next instruction */
     jump_insn: ;
     } /* end of main loop */
+ chain_jump:
+    /* jump to s->pc. If the target is the last successor of the
+       block, the code TLB lookup is skipped when it is in the same
+       page and the block lookup is always skipped. */
+    s->n_cycles += INSN_REMAINING();
+    if (likely(tb && tb->jmp_gen == s->tb_jmp_gen && tb->jmp_tb[0] &&
+               s->n_cycles > 0 && (s->mip & s->mie) == 0)) {
+        target_ulong pc;
+        uint8_t *ptr, *ptr_end;
+        uint32_t tlb_idx;
+
+        pc = GET_PC();
+        if (((s->pc ^ pc) & ~(target_ulong)PG_MASK) == 0) {
+            ptr = code_ptr + (intptr_t)(s->pc - pc);
+            ptr_end = code_end;
+        } else {
+            tlb_idx = (s->pc >> PG_SHIFT) & (TLB_SIZE - 1);
+            if (s->tlb_code[tlb_idx].vaddr != (s->pc & ~PG_MASK))
+                goto chain_fail;
+            ptr = (uint8_t *)(s->tlb_code[tlb_idx].mem_addend +
+                              (uintptr_t)s->pc);
+            ptr_end = ptr + (PG_MASK - 1 - (s->pc & PG_MASK));
+        }
+        if (ptr == tb->jmp_tb[0]->code_ptr) {
+            code_ptr = ptr;
+            code_end = ptr_end;
+            code_to_pc_addend = s->pc - (uintptr_t)ptr;
+            tb = tb->jmp_tb[0];
+            goto enter_tb;
+        }
+    }
+ chain_fail:
+    code_ptr = NULL;
+    code_end = NULL;
+    code_to_pc_addend = s->pc;
+    insn_ptr = NULL;
+    insn_end = NULL;
+    goto jump_insn;
  illegal_insn:
     s->pending_exception = CAUSE_ILLEGAL_INSTRUCTION;
-    s->pending_tval = insn;
+    /* report the compressed instructions as they are encoded */
+    if (insn_ptr->len == 2)
+        s->pending_tval = *(uint16_t *)code_ptr;
+    else
+        s->pending_tval = insn;
  mmu_exception:
  exception:
     s->pc = GET_PC();
@@ -1724,8 +2135,11 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
     }
     /* we exit because XLEN may have changed */
  done_interp:
+    /* give back the instructions of the block which were not executed */
+    if (insn_ptr < insn_end)
+        s->n_cycles += INSN_REMAINING();
 the_end:
-    s->insn_counter = GET_INSN_COUNTER();
+    s->insn_counter = insn_counter_addend - s->n_cycles;
 #if 0
     printf("done interp %lx int=%x mstatus=%lx prv=%d\n",
            (uint64_t)s->insn_counter, s->mip & s->mie, (uint64_t)s->mstatus,
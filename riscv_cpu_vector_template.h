@@ -0,0 +1,1215 @@
+/*
+ * RISCV emulator: vector instructions of element width SEW
+ *
+ * Copyright (c) 2026 TinyEMU contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#if SEW == 8
+#define SEW_LOG2 0
+#define elem_t uint8_t
+#define selem_t int8_t
+#define welem_t uint16_t
+#define swelem_t int16_t
+#elif SEW == 16
+#define SEW_LOG2 1
+#define elem_t uint16_t
+#define selem_t int16_t
+#define welem_t uint32_t
+#define swelem_t int32_t
+#elif SEW == 32
+#define SEW_LOG2 2
+#define elem_t uint32_t
+#define selem_t int32_t
+#define welem_t uint64_t
+#define swelem_t int64_t
+#elif SEW == 64
+#define SEW_LOG2 3
+#define elem_t uint64_t
+#define selem_t int64_t
+#else
+#error unsupported SEW
+#endif
+
+#define SMIN ((selem_t)((elem_t)1 << (SEW - 1)))
+#define SMAX ((selem_t)(((elem_t)1 << (SEW - 1)) - 1))
+
+/* The element loops only touch the active body elements: the tail and
+   the inactive elements are left undisturbed, which is allowed for both
+   the agnostic and undisturbed policies. */
+#define VLOOP(body)                                             \
+    for(i = s->vstart; i < vl; i++) {                           \
+        if (!vm && !vmask_get(s, 0, i))                         \
+            continue;                                           \
+        body;                                                   \
+    }
+
+#if SEW == 64
+static inline uint64_t glue(vmulhu, SEW)(uint64_t a, uint64_t b)
+{
+    return vmulhu64_helper(a, b);
+}
+
+static inline uint64_t glue(vmulh, SEW)(int64_t a, int64_t b)
+{
+    uint64_t r = vmulhu64_helper(a, b);
+    if (a < 0)
+        r -= b;
+    if (b < 0)
+        r -= a;
+    return r;
+}
+
+static inline uint64_t glue(vmulhsu, SEW)(int64_t a, uint64_t b)
+{
+    uint64_t r = vmulhu64_helper(a, b);
+    if (a < 0)
+        r -= b;
+    return r;
+}
+#else
+static inline elem_t glue(vmulhu, SEW)(elem_t a, elem_t b)
+{
+    return ((welem_t)a * (welem_t)b) >> SEW;
+}
+
+static inline elem_t glue(vmulh, SEW)(selem_t a, selem_t b)
+{
+    return ((swelem_t)a * (swelem_t)b) >> SEW;
+}
+
+static inline elem_t glue(vmulhsu, SEW)(selem_t a, elem_t b)
+{
+    return ((swelem_t)a * (swelem_t)b) >> SEW;
+}
+#endif
+
+/* fixed point helpers. vxsat is set when the result saturates. */
+
+static inline elem_t glue(vsaddu, SEW)(RISCVCPUState *s, elem_t a, elem_t b)
+{
+    elem_t r = a + b;
+    if (r < a) {
+        r = -1;
+        s->vxsat = 1;
+    }
+    return r;
+}
+
+static inline elem_t glue(vsadd, SEW)(RISCVCPUState *s, elem_t a, elem_t b)
+{
+    elem_t r = a + b;
+    if ((elem_t)(~(a ^ b) & (a ^ r)) >> (SEW - 1)) {
+        r = (selem_t)a < 0 ? SMIN : SMAX;
+        s->vxsat = 1;
+    }
+    return r;
+}
+
+static inline elem_t glue(vssubu, SEW)(RISCVCPUState *s, elem_t a, elem_t b)
+{
+    if (a < b) {
+        s->vxsat = 1;
+        return 0;
+    }
+    return a - b;
+}
+
+static inline elem_t glue(vssub, SEW)(RISCVCPUState *s, elem_t a, elem_t b)
+{
+    elem_t r = a - b;
+    if ((elem_t)((a ^ b) & (a ^ r)) >> (SEW - 1)) {
+        r = (selem_t)a < 0 ? SMIN : SMAX;
+        s->vxsat = 1;
+    }
+    return r;
+}
+
+/* vaadd[u], vasub[u]: (a + b) >> 1 or (a - b) >> 1 computed with SEW + 1
+   bits. 'hi' is the bit SEW of the exact result. */
+static inline elem_t glue(vaverage, SEW)(RISCVCPUState *s, elem_t a, elem_t b,
+                                         BOOL is_sub, BOOL is_signed)
+{
+    elem_t r, hi;
+    if (is_sub) {
+        r = a - b;
+        if (is_signed)
+            hi = (elem_t)(((a ^ b) & (a ^ r)) ^ r) >> (SEW - 1);
+        else
+            hi = (a < b);
+    } else {
+        r = a + b;
+        if (is_signed)
+            hi = (elem_t)((~(a ^ b) & (a ^ r)) ^ r) >> (SEW - 1);
+        else
+            hi = (r < a);
+    }
+    return ((r >> 1) | (hi << (SEW - 1))) + vround_inc(s->vxrm, r, 1);
+}
+
+/* vsmul: (a * b) >> (SEW - 1) with rounding */
+static inline elem_t glue(vsmul, SEW)(RISCVCPUState *s, elem_t a, elem_t b)
+{
+    if (a == (elem_t)SMIN && b == (elem_t)SMIN) {
+        s->vxsat = 1;
+        return SMAX;
+    }
+#if SEW == 64
+    {
+        uint64_t lo = a * b;
+        return ((glue(vmulh, SEW)(a, b) << 1) | (lo >> 63)) +
+            vround_inc(s->vxrm, lo, 63);
+    }
+#else
+    {
+        int64_t p = (int64_t)(selem_t)a * (selem_t)b;
+        return (elem_t)(p >> (SEW - 1)) + vround_inc(s->vxrm, p, SEW - 1);
+    }
+#endif
+}
+
+static inline elem_t glue(vdiv, SEW)(selem_t a, selem_t b)
+{
+    if (b == 0)
+        return -1;
+    else if (a == SMIN && b == -1)
+        return a;
+    else
+        return a / b;
+}
+
+static inline elem_t glue(vrem, SEW)(selem_t a, selem_t b)
+{
+    if (b == 0)
+        return a;
+    else if (a == SMIN && b == -1)
+        return 0;
+    else
+        return a % b;
+}
+
+typedef elem_t glue(VecHost, SEW) __attribute__((vector_size(16)));
+typedef selem_t glue(SVecHost, SEW) __attribute__((vector_size(16)));
+
+#define VT glue(VecHost, SEW)
+#define SVT glue(SVecHost, SEW)
+
+/* The unmasked operations starting at element 0 are done 16 bytes at a
+   time with the host SIMD instructions. Only the body bytes of the last
+   block are stored. Return FALSE if the operation is not handled here. */
+static BOOL glue(vec_simd, SEW)(RISCVCPUState *s, BOOL is_opm, uint32_t funct6,
+                                int vd, int vs2, int vs1, uint64_t x,
+                                BOOL is_vv)
+{
+    uint8_t *d = (uint8_t *)s->vreg[vd];
+    uint8_t *a = (uint8_t *)s->vreg[vs2];
+    uint8_t *b = (uint8_t *)s->vreg[vs1];
+    uint32_t pos, len = s->vl * (SEW / 8);
+    VT va, vb, vc, vr, vx;
+
+    vx = (VT){ 0 } + (elem_t)x;
+#define SIMD_LOOP(expr) do {                                    \
+        for(pos = 0; pos < len; pos += 16) {                    \
+            memcpy(&va, a + pos, 16);                           \
+            if (is_vv)                                          \
+                memcpy(&vb, b + pos, 16);                       \
+            else                                                \
+                vb = vx;                                        \
+            memcpy(&vc, d + pos, 16);                           \
+            vr = expr;                                          \
+            memcpy(d + pos, &vr, min_int(len - pos, 16));       \
+        }                                                       \
+    } while (0)
+    if (is_opm) {
+        switch(funct6) {
+        case 0x25: /* vmul */
+            SIMD_LOOP(va * vb);
+            break;
+        case 0x29: /* vmadd */
+            SIMD_LOOP(vb * vc + va);
+            break;
+        case 0x2d: /* vmacc */
+            SIMD_LOOP(vb * va + vc);
+            break;
+        default:
+            return FALSE;
+        }
+    } else {
+        switch(funct6) {
+        case 0x00: /* vadd */
+            SIMD_LOOP(va + vb);
+            break;
+        case 0x02: /* vsub */
+            SIMD_LOOP(va - vb);
+            break;
+        case 0x03: /* vrsub */
+            if (is_vv)
+                return FALSE;
+            SIMD_LOOP(vb - va);
+            break;
+        case 0x04: /* vminu */
+            SIMD_LOOP(vb ^ ((va ^ vb) & (VT)(va < vb)));
+            break;
+        case 0x05: /* vmin */
+            SIMD_LOOP(vb ^ ((va ^ vb) & (VT)((SVT)va < (SVT)vb)));
+            break;
+        case 0x06: /* vmaxu */
+            SIMD_LOOP(vb ^ ((va ^ vb) & (VT)(va > vb)));
+            break;
+        case 0x07: /* vmax */
+            SIMD_LOOP(vb ^ ((va ^ vb) & (VT)((SVT)va > (SVT)vb)));
+            break;
+        case 0x09: /* vand */
+            SIMD_LOOP(va & vb);
+            break;
+        case 0x0a: /* vor */
+            SIMD_LOOP(va | vb);
+            break;
+        case 0x0b: /* vxor */
+            SIMD_LOOP(va ^ vb);
+            break;
+        case 0x17: /* vmv.v */
+            if (vs2 != 0)
+                return FALSE;
+            SIMD_LOOP(vb);
+            break;
+        case 0x25: /* vsll */
+            SIMD_LOOP(va << (vb & (SEW - 1)));
+            break;
+        case 0x28: /* vsrl */
+            SIMD_LOOP(va >> (vb & (SEW - 1)));
+            break;
+        case 0x29: /* vsra */
+            SIMD_LOOP((VT)((SVT)va >> (SVT)(vb & (SEW - 1))));
+            break;
+        default:
+            return FALSE;
+        }
+    }
+#undef SIMD_LOOP
+    return TRUE;
+}
+
+#undef VT
+#undef SVT
+
+/* OPIVV, OPIVX and OPIVI: 'x' is the scalar operand if !is_vv. Return
+   -1 if illegal instruction. */
+static int glue(vec_opi, SEW)(RISCVCPUState *s, uint32_t funct6, int vd,
+                              int vs2, int vs1, uint64_t x, BOOL is_vv,
+                              BOOL vm, uint32_t vlmax)
+{
+    elem_t *d = (elem_t *)s->vreg[vd];
+    elem_t *a = (elem_t *)s->vreg[vs2];
+    elem_t *b = (elem_t *)s->vreg[vs1];
+    elem_t bx = x;
+    uint32_t i, vl = s->vl, shift_mask = SEW - 1, sh;
+
+    if (vm && s->vstart == 0 &&
+        glue(vec_simd, SEW)(s, FALSE, funct6, vd, vs2, vs1, x, is_vv))
+        return 0;
+#define OP_B (is_vv ? b[i] : bx)
+    switch(funct6) {
+    case 0x00: /* vadd */
+        VLOOP(d[i] = a[i] + OP_B);
+        break;
+    case 0x02: /* vsub */
+        VLOOP(d[i] = a[i] - OP_B);
+        break;
+    case 0x03: /* vrsub */
+        if (is_vv)
+            return -1;
+        VLOOP(d[i] = bx - a[i]);
+        break;
+    case 0x04: /* vminu */
+        VLOOP(d[i] = a[i] < OP_B ? a[i] : OP_B);
+        break;
+    case 0x05: /* vmin */
+        VLOOP(d[i] = (selem_t)a[i] < (selem_t)OP_B ? a[i] : OP_B);
+        break;
+    case 0x06: /* vmaxu */
+        VLOOP(d[i] = a[i] > OP_B ? a[i] : OP_B);
+        break;
+    case 0x07: /* vmax */
+        VLOOP(d[i] = (selem_t)a[i] > (selem_t)OP_B ? a[i] : OP_B);
+        break;
+    case 0x09: /* vand */
+        VLOOP(d[i] = a[i] & OP_B);
+        break;
+    case 0x0a: /* vor */
+        VLOOP(d[i] = a[i] | OP_B);
+        break;
+    case 0x0b: /* vxor */
+        VLOOP(d[i] = a[i] ^ OP_B);
+        break;
+    case 0x0c: /* vrgather */
+        {
+            uint64_t idx;
+            VLOOP(idx = is_vv ? b[i] : x;
+                  d[i] = idx < vlmax ? a[idx] : 0);
+        }
+        break;
+    case 0x0e:
+        if (is_vv) {
+            /* vrgatherei16: the indexes have 16 bits */
+            uint16_t *idx = (uint16_t *)s->vreg[vs1];
+            VLOOP(d[i] = idx[i] < vlmax ? a[idx[i]] : 0);
+            break;
+        }
+        /* vslideup: the destination does not overlap the source */
+        if (x < vl) {
+            for(i = s->vstart > x ? s->vstart : x; i < vl; i++) {
+                if (vm || vmask_get(s, 0, i))
+                    d[i] = a[i - x];
+            }
+        }
+        break;
+    case 0x0f: /* vslidedown */
+        if (is_vv)
+            return -1;
+        VLOOP(d[i] = x < vlmax - i ? a[i + x] : 0);
+        break;
+    case 0x10: /* vadc */
+        for(i = s->vstart; i < vl; i++)
+            d[i] = a[i] + OP_B + vmask_get(s, 0, i);
+        break;
+    case 0x12: /* vsbc */
+        for(i = s->vstart; i < vl; i++)
+            d[i] = a[i] - OP_B - vmask_get(s, 0, i);
+        break;
+    case 0x17: /* vmerge, vmv.v */
+        if (vm) {
+            if (vs2 != 0)
+                return -1;
+            for(i = s->vstart; i < vl; i++)
+                d[i] = OP_B;
+        } else {
+            for(i = s->vstart; i < vl; i++)
+                d[i] = vmask_get(s, 0, i) ? OP_B : a[i];
+        }
+        break;
+    case 0x20: /* vsaddu */
+        VLOOP(d[i] = glue(vsaddu, SEW)(s, a[i], OP_B));
+        break;
+    case 0x21: /* vsadd */
+        VLOOP(d[i] = glue(vsadd, SEW)(s, a[i], OP_B));
+        break;
+    case 0x22: /* vssubu */
+        VLOOP(d[i] = glue(vssubu, SEW)(s, a[i], OP_B));
+        break;
+    case 0x23: /* vssub */
+        VLOOP(d[i] = glue(vssub, SEW)(s, a[i], OP_B));
+        break;
+    case 0x25: /* vsll */
+        VLOOP(d[i] = a[i] << (OP_B & shift_mask));
+        break;
+    case 0x27: /* vsmul */
+        VLOOP(d[i] = glue(vsmul, SEW)(s, a[i], OP_B));
+        break;
+    case 0x28: /* vsrl */
+        VLOOP(d[i] = a[i] >> (OP_B & shift_mask));
+        break;
+    case 0x29: /* vsra */
+        VLOOP(d[i] = (selem_t)a[i] >> (OP_B & shift_mask));
+        break;
+    case 0x2a: /* vssrl */
+        VLOOP(sh = OP_B & shift_mask;
+              d[i] = (a[i] >> sh) + vround_inc(s->vxrm, a[i], sh));
+        break;
+    case 0x2b: /* vssra */
+        VLOOP(sh = OP_B & shift_mask;
+              d[i] = ((selem_t)a[i] >> sh) + vround_inc(s->vxrm, a[i], sh));
+        break;
+    default:
+        return -1;
+    }
+#undef OP_B
+    return 0;
+}
+
+/* integer compares, vmadc and vmsbc: the result is written to the mask
+   register 'vd'. vmadc and vmsbc are never masked: 'vm' = 0 selects the
+   carry input from v0. */
+static int glue(vec_cmp, SEW)(RISCVCPUState *s, uint32_t funct6, int vd,
+                              int vs2, int vs1, uint64_t x, BOOL is_vv,
+                              BOOL vm)
+{
+    elem_t *a = (elem_t *)s->vreg[vs2];
+    elem_t *b = (elem_t *)s->vreg[vs1];
+    elem_t bx = x, r;
+    uint8_t m[VLENB];
+    uint32_t i, vl = s->vl;
+    BOOL res, c;
+
+    if (is_vv && (funct6 == 0x1e || funct6 == 0x1f))
+        return -1;
+    memcpy(m, s->vreg[vd], VLENB);
+#define OP_B (is_vv ? b[i] : bx)
+    for(i = s->vstart; i < vl; i++) {
+        c = !vm && vmask_get(s, 0, i);
+        if (!vm && !c && funct6 >= 0x18)
+            continue;
+        switch(funct6) {
+        case 0x11: /* vmadc */
+            r = a[i] + OP_B + c;
+            res = c ? (r <= a[i]) : (r < a[i]);
+            break;
+        case 0x13: /* vmsbc */
+            res = c ? (a[i] <= OP_B) : (a[i] < OP_B);
+            break;
+        case 0x18: /* vmseq */
+            res = (a[i] == OP_B);
+            break;
+        case 0x19: /* vmsne */
+            res = (a[i] != OP_B);
+            break;
+        case 0x1a: /* vmsltu */
+            res = (a[i] < OP_B);
+            break;
+        case 0x1b: /* vmslt */
+            res = ((selem_t)a[i] < (selem_t)OP_B);
+            break;
+        case 0x1c: /* vmsleu */
+            res = (a[i] <= OP_B);
+            break;
+        case 0x1d: /* vmsle */
+            res = ((selem_t)a[i] <= (selem_t)OP_B);
+            break;
+        case 0x1e: /* vmsgtu */
+            res = (a[i] > bx);
+            break;
+        default: /* vmsgt */
+            res = ((selem_t)a[i] > (selem_t)bx);
+            break;
+        }
+        m[i >> 3] = (m[i >> 3] & ~(1 << (i & 7))) | (res << (i & 7));
+    }
+#undef OP_B
+    memcpy(s->vreg[vd], m, VLENB);
+    return 0;
+}
+
+/* OPMVV and OPMVX with an element result */
+static int glue(vec_opm, SEW)(RISCVCPUState *s, uint32_t funct6, int vd,
+                              int vs2, int vs1, uint64_t x, BOOL is_vv,
+                              BOOL vm)
+{
+    elem_t *d = (elem_t *)s->vreg[vd];
+    elem_t *a = (elem_t *)s->vreg[vs2];
+    elem_t *b = (elem_t *)s->vreg[vs1];
+    elem_t bx = x, acc;
+    uint32_t i, j, vl = s->vl;
+    int src_log2;
+
+    if (vm && s->vstart == 0 &&
+        glue(vec_simd, SEW)(s, TRUE, funct6, vd, vs2, vs1, x, is_vv))
+        return 0;
+#define OP_B (is_vv ? b[i] : bx)
+    switch(funct6) {
+    case 0x00 ... 0x07: /* reductions */
+        if (!is_vv)
+            return -1;
+        if (s->vstart != 0)
+            return -1;
+        acc = b[0];
+        VLOOP(switch(funct6) {
+            case 0x00: acc += a[i]; break; /* vredsum */
+            case 0x01: acc &= a[i]; break; /* vredand */
+            case 0x02: acc |= a[i]; break; /* vredor */
+            case 0x03: acc ^= a[i]; break; /* vredxor */
+            case 0x04: if (a[i] < acc) acc = a[i]; break; /* vredminu */
+            case 0x05: if ((selem_t)a[i] < (selem_t)acc) acc = a[i]; break;
+            case 0x06: if (a[i] > acc) acc = a[i]; break; /* vredmaxu */
+            default: if ((selem_t)a[i] > (selem_t)acc) acc = a[i]; break;
+            });
+        if (vl > 0)
+            d[0] = acc;
+        break;
+    case 0x08: /* vaaddu */
+    case 0x09: /* vaadd */
+    case 0x0a: /* vasubu */
+    case 0x0b: /* vasub */
+        VLOOP(d[i] = glue(vaverage, SEW)(s, a[i], OP_B, funct6 & 2,
+                                         funct6 & 1));
+        break;
+    case 0x0e: /* vslide1up */
+        if (is_vv)
+            return -1;
+        VLOOP(d[i] = (i == 0) ? bx : a[i - 1]);
+        break;
+    case 0x0f: /* vslide1down */
+        if (is_vv)
+            return -1;
+        VLOOP(d[i] = (i == vl - 1) ? bx : a[i + 1]);
+        break;
+    case 0x10: /* vmv.s.x */
+        if (is_vv || vs2 != 0)
+            return -1;
+        if (s->vstart < vl)
+            d[0] = bx;
+        break;
+    case 0x12: /* vzext, vsext: the source elements have the width SEW / 2,
+                  SEW / 4 or SEW / 8 */
+        if (!is_vv || vs1 < 2 || vs1 > 7)
+            return -1;
+        src_log2 = SEW_LOG2 - (4 - (vs1 >> 1));
+        if (src_log2 < 0)
+            return -1;
+        VLOOP(d[i] = vec_read_elem(s, vs2, i, src_log2, vs1 & 1));
+        break;
+    case 0x14: /* viota, vid */
+        if (!is_vv)
+            return -1;
+        if (vs1 == 0x10) {
+            /* viota */
+            if (s->vstart != 0)
+                return -1;
+            acc = 0;
+            VLOOP(d[i] = acc; acc += vmask_get(s, vs2, i));
+        } else if (vs1 == 0x11) {
+            VLOOP(d[i] = i);
+        } else {
+            return -1;
+        }
+        break;
+    case 0x17: /* vcompress */
+        if (!is_vv || s->vstart != 0)
+            return -1;
+        j = 0;
+        for(i = 0; i < vl; i++) {
+            if (vmask_get(s, vs1, i))
+                d[j++] = a[i];
+        }
+        break;
+    case 0x20: /* vdivu */
+        VLOOP(d[i] = OP_B == 0 ? (elem_t)-1 : a[i] / OP_B);
+        break;
+    case 0x21: /* vdiv */
+        VLOOP(d[i] = glue(vdiv, SEW)(a[i], OP_B));
+        break;
+    case 0x22: /* vremu */
+        VLOOP(d[i] = OP_B == 0 ? a[i] : a[i] % OP_B);
+        break;
+    case 0x23: /* vrem */
+        VLOOP(d[i] = glue(vrem, SEW)(a[i], OP_B));
+        break;
+    case 0x24: /* vmulhu */
+        VLOOP(d[i] = glue(vmulhu, SEW)(a[i], OP_B));
+        break;
+    case 0x25: /* vmul */
+        VLOOP(d[i] = a[i] * OP_B);
+        break;
+    case 0x26: /* vmulhsu */
+        VLOOP(d[i] = glue(vmulhsu, SEW)(a[i], OP_B));
+        break;
+    case 0x27: /* vmulh */
+        VLOOP(d[i] = glue(vmulh, SEW)(a[i], OP_B));
+        break;
+    case 0x29: /* vmadd */
+        VLOOP(d[i] = OP_B * d[i] + a[i]);
+        break;
+    case 0x2b: /* vnmsub */
+        VLOOP(d[i] = -(OP_B * d[i]) + a[i]);
+        break;
+    case 0x2d: /* vmacc */
+        VLOOP(d[i] = OP_B * a[i] + d[i]);
+        break;
+    case 0x2f: /* vnmsac */
+        VLOOP(d[i] = -(OP_B * a[i]) + d[i]);
+        break;
+    default:
+        return -1;
+    }
+#undef OP_B
+    return 0;
+}
+
+#if SEW < 64
+#define WSMIN ((swelem_t)SMIN)
+
+/* widening OPMVV and OPMVX: the destination elements and the 'vs2'
+   elements of the .w forms have the width 2 * SEW */
+static int glue(vec_opw, SEW)(RISCVCPUState *s, uint32_t funct6, int vd,
+                              int vs2, int vs1, uint64_t x, BOOL is_vv,
+                              BOOL vm)
+{
+    welem_t *d = (welem_t *)s->vreg[vd];
+    elem_t *a = (elem_t *)s->vreg[vs2];
+    welem_t *aw = (welem_t *)s->vreg[vs2];
+    elem_t *b = (elem_t *)s->vreg[vs1];
+    elem_t bx = x;
+    uint32_t i, vl = s->vl;
+
+#define OP_B (is_vv ? b[i] : bx)
+    switch(funct6) {
+    case 0x30: /* vwaddu */
+        VLOOP(d[i] = (welem_t)a[i] + OP_B);
+        break;
+    case 0x31: /* vwadd */
+        VLOOP(d[i] = (swelem_t)(selem_t)a[i] + (selem_t)OP_B);
+        break;
+    case 0x32: /* vwsubu */
+        VLOOP(d[i] = (welem_t)a[i] - OP_B);
+        break;
+    case 0x33: /* vwsub */
+        VLOOP(d[i] = (swelem_t)(selem_t)a[i] - (selem_t)OP_B);
+        break;
+    case 0x34: /* vwaddu.w */
+        VLOOP(d[i] = aw[i] + OP_B);
+        break;
+    case 0x35: /* vwadd.w */
+        VLOOP(d[i] = aw[i] + (swelem_t)(selem_t)OP_B);
+        break;
+    case 0x36: /* vwsubu.w */
+        VLOOP(d[i] = aw[i] - OP_B);
+        break;
+    case 0x37: /* vwsub.w */
+        VLOOP(d[i] = aw[i] - (swelem_t)(selem_t)OP_B);
+        break;
+    case 0x38: /* vwmulu */
+        VLOOP(d[i] = (welem_t)a[i] * OP_B);
+        break;
+    case 0x3a: /* vwmulsu */
+        VLOOP(d[i] = (swelem_t)(selem_t)a[i] * (welem_t)OP_B);
+        break;
+    case 0x3b: /* vwmul */
+        VLOOP(d[i] = (swelem_t)(selem_t)a[i] * (selem_t)OP_B);
+        break;
+    case 0x3c: /* vwmaccu */
+        VLOOP(d[i] += (welem_t)OP_B * a[i]);
+        break;
+    case 0x3d: /* vwmacc */
+        VLOOP(d[i] += (swelem_t)(selem_t)OP_B * (selem_t)a[i]);
+        break;
+    case 0x3e: /* vwmaccus */
+        if (is_vv)
+            return -1;
+        VLOOP(d[i] += (welem_t)bx * (swelem_t)(selem_t)a[i]);
+        break;
+    case 0x3f: /* vwmaccsu */
+        VLOOP(d[i] += (swelem_t)(selem_t)OP_B * (welem_t)a[i]);
+        break;
+    default:
+        return -1;
+    }
+#undef OP_B
+    return 0;
+}
+
+/* vwredsumu, vwredsum */
+static int glue(vec_wredsum, SEW)(RISCVCPUState *s, BOOL is_signed, int vd,
+                                  int vs2, int vs1, BOOL vm)
+{
+    welem_t *d = (welem_t *)s->vreg[vd];
+    elem_t *a = (elem_t *)s->vreg[vs2];
+    welem_t *b = (welem_t *)s->vreg[vs1];
+    welem_t acc;
+    uint32_t i, vl = s->vl;
+
+    if (s->vstart != 0)
+        return -1;
+    acc = b[0];
+    VLOOP(acc += is_signed ? (welem_t)(selem_t)a[i] : a[i]);
+    if (vl > 0)
+        d[0] = acc;
+    return 0;
+}
+
+/* narrowing shifts and clips: the 'vs2' elements have the width 2 * SEW */
+static int glue(vec_opn, SEW)(RISCVCPUState *s, uint32_t funct6, int vd,
+                              int vs2, int vs1, uint64_t x, BOOL is_vv,
+                              BOOL vm)
+{
+    elem_t *d = (elem_t *)s->vreg[vd];
+    welem_t *a = (welem_t *)s->vreg[vs2];
+    elem_t *b = (elem_t *)s->vreg[vs1];
+    elem_t bx = x;
+    uint32_t i, vl = s->vl, shift_mask = 2 * SEW - 1, sh;
+    welem_t r;
+    swelem_t sr;
+
+#define OP_B (is_vv ? b[i] : bx)
+    switch(funct6) {
+    case 0x2c: /* vnsrl */
+        VLOOP(d[i] = a[i] >> (OP_B & shift_mask));
+        break;
+    case 0x2d: /* vnsra */
+        VLOOP(d[i] = (swelem_t)a[i] >> (OP_B & shift_mask));
+        break;
+    case 0x2e: /* vnclipu */
+        VLOOP(sh = OP_B & shift_mask;
+              r = (a[i] >> sh) + vround_inc(s->vxrm, a[i], sh);
+              if (r > (elem_t)-1) {
+                  r = (elem_t)-1;
+                  s->vxsat = 1;
+              }
+              d[i] = r);
+        break;
+    case 0x2f: /* vnclip */
+        VLOOP(sh = OP_B & shift_mask;
+              sr = ((swelem_t)a[i] >> sh) + vround_inc(s->vxrm, a[i], sh);
+              if (sr > SMAX) {
+                  sr = SMAX;
+                  s->vxsat = 1;
+              } else if (sr < WSMIN) {
+                  sr = WSMIN;
+                  s->vxsat = 1;
+              }
+              d[i] = sr);
+        break;
+    default:
+        return -1;
+    }
+#undef OP_B
+    return 0;
+}
+
+#if SEW >= 16
+/* widening and narrowing floating point conversions (VFUNARY0 with
+   vs1 = 0x08 to 0x17). Without half precision support, only the
+   conversions between 16 bit integers and f32 exist for SEW = 16. */
+static int glue(vec_fcvtw, SEW)(RISCVCPUState *s, uint32_t vs1, int vd,
+                                int vs2, BOOL vm, RoundingModeEnum rm)
+{
+    elem_t *a = (elem_t *)s->vreg[vs2];
+    welem_t *aw = (welem_t *)s->vreg[vs2];
+    welem_t *dw = (welem_t *)s->vreg[vd];
+    elem_t *d = (elem_t *)s->vreg[vd];
+    uint32_t i, vl = s->vl;
+    uint32_t *pf = &s->fflags;
+#if SEW == 32
+    uint32_t flags;
+#endif
+
+    switch(vs1) {
+#if SEW == 16
+    case 0x0a: /* vfwcvt.f.xu.v */
+        VLOOP(dw[i] = cvt_u32_sf32(a[i], rm, pf));
+        break;
+    case 0x0b: /* vfwcvt.f.x.v */
+        VLOOP(dw[i] = cvt_i32_sf32((selem_t)a[i], rm, pf));
+        break;
+    case 0x10: /* vfncvt.xu.f.w */
+        VLOOP(d[i] = vcvt_sf32_16(aw[i], rm, pf, FALSE));
+        break;
+    case 0x11: /* vfncvt.x.f.w */
+        VLOOP(d[i] = vcvt_sf32_16(aw[i], rm, pf, TRUE));
+        break;
+    case 0x16: /* vfncvt.rtz.xu.f.w */
+        VLOOP(d[i] = vcvt_sf32_16(aw[i], RM_RTZ, pf, FALSE));
+        break;
+    case 0x17: /* vfncvt.rtz.x.f.w */
+        VLOOP(d[i] = vcvt_sf32_16(aw[i], RM_RTZ, pf, TRUE));
+        break;
+#elif SEW == 32
+    case 0x08: /* vfwcvt.xu.f.v */
+        VLOOP(dw[i] = cvt_sf32_u64(a[i], rm, pf));
+        break;
+    case 0x09: /* vfwcvt.x.f.v */
+        VLOOP(dw[i] = cvt_sf32_i64(a[i], rm, pf));
+        break;
+    case 0x0a: /* vfwcvt.f.xu.v */
+        VLOOP(dw[i] = cvt_u32_sf64(a[i], rm, pf));
+        break;
+    case 0x0b: /* vfwcvt.f.x.v */
+        VLOOP(dw[i] = cvt_i32_sf64(a[i], rm, pf));
+        break;
+    case 0x0c: /* vfwcvt.f.f.v */
+        VLOOP(dw[i] = cvt_sf32_sf64(a[i], pf));
+        break;
+    case 0x0e: /* vfwcvt.rtz.xu.f.v */
+        VLOOP(dw[i] = cvt_sf32_u64(a[i], RM_RTZ, pf));
+        break;
+    case 0x0f: /* vfwcvt.rtz.x.f.v */
+        VLOOP(dw[i] = cvt_sf32_i64(a[i], RM_RTZ, pf));
+        break;
+    case 0x10: /* vfncvt.xu.f.w */
+        VLOOP(d[i] = cvt_sf64_u32(aw[i], rm, pf));
+        break;
+    case 0x11: /* vfncvt.x.f.w */
+        VLOOP(d[i] = cvt_sf64_i32(aw[i], rm, pf));
+        break;
+    case 0x12: /* vfncvt.f.xu.w */
+        VLOOP(d[i] = cvt_u64_sf32(aw[i], rm, pf));
+        break;
+    case 0x13: /* vfncvt.f.x.w */
+        VLOOP(d[i] = cvt_i64_sf32(aw[i], rm, pf));
+        break;
+    case 0x14: /* vfncvt.f.f.w */
+        VLOOP(d[i] = cvt_sf64_sf32(aw[i], rm, pf));
+        break;
+    case 0x15: /* vfncvt.rod.f.f.w: truncate, then set the LSB if inexact */
+        VLOOP(flags = 0;
+              d[i] = cvt_sf64_sf32(aw[i], RM_RTZ, &flags);
+              if (flags & FFLAG_INEXACT)
+                  d[i] |= 1;
+              *pf |= flags);
+        break;
+    case 0x16: /* vfncvt.rtz.xu.f.w */
+        VLOOP(d[i] = cvt_sf64_u32(aw[i], RM_RTZ, pf));
+        break;
+    case 0x17: /* vfncvt.rtz.x.f.w */
+        VLOOP(d[i] = cvt_sf64_i32(aw[i], RM_RTZ, pf));
+        break;
+#endif
+    default:
+        return -1;
+    }
+    return 0;
+}
+#endif /* SEW >= 16 */
+
+#undef WSMIN
+#endif /* SEW < 64 */
+
+static uint64_t glue(vec_get_elem, SEW)(RISCVCPUState *s, int r, uint32_t i)
+{
+    return (selem_t)((elem_t *)s->vreg[r])[i];
+}
+
+#if SEW >= 32
+#define F_SIZE SEW
+#if SEW == 32
+#define F_HIGH F32_HIGH
+#define F_EXP_SIZE 8
+#else
+#define F_HIGH F64_HIGH
+#define F_EXP_SIZE 11
+#endif
+#define FSIGN_MASK glue(FSIGN_MASK, F_SIZE)
+
+/* OPFVV and OPFVF. Return -1 if illegal instruction. */
+static int glue(vec_opf, SEW)(RISCVCPUState *s, uint32_t funct6, int vd,
+                              int vs2, int vs1, elem_t bx, BOOL is_vv,
+                              BOOL vm, RoundingModeEnum rm)
+{
+    elem_t *d = (elem_t *)s->vreg[vd];
+    elem_t *a = (elem_t *)s->vreg[vs2];
+    elem_t *b = (elem_t *)s->vreg[vs1];
+    elem_t acc;
+    uint8_t m[VLENB];
+    uint32_t i, vl = s->vl;
+    uint32_t *pf = &s->fflags;
+    BOOL res;
+
+#define OP_B (is_vv ? b[i] : bx)
+    switch(funct6) {
+    case 0x00: /* vfadd */
+        VLOOP(d[i] = glue(host_add_sf, F_SIZE)(a[i], OP_B, rm, pf));
+        break;
+    case 0x02: /* vfsub */
+        VLOOP(d[i] = glue(host_sub_sf, F_SIZE)(a[i], OP_B, rm, pf));
+        break;
+    case 0x27: /* vfrsub */
+        if (is_vv)
+            return -1;
+        VLOOP(d[i] = glue(host_sub_sf, F_SIZE)(bx, a[i], rm, pf));
+        break;
+    case 0x24: /* vfmul */
+        VLOOP(d[i] = glue(host_mul_sf, F_SIZE)(a[i], OP_B, rm, pf));
+        break;
+    case 0x20: /* vfdiv */
+        VLOOP(d[i] = glue(host_div_sf, F_SIZE)(a[i], OP_B, rm, pf));
+        break;
+    case 0x21: /* vfrdiv */
+        if (is_vv)
+            return -1;
+        VLOOP(d[i] = glue(host_div_sf, F_SIZE)(bx, a[i], rm, pf));
+        break;
+    case 0x04: /* vfmin */
+        VLOOP(d[i] = glue(min_sf, F_SIZE)(a[i], OP_B, pf,
+                                          FMINMAX_IEEE754_201X));
+        break;
+    case 0x06: /* vfmax */
+        VLOOP(d[i] = glue(max_sf, F_SIZE)(a[i], OP_B, pf,
+                                          FMINMAX_IEEE754_201X));
+        break;
+    case 0x08: /* vfsgnj */
+        VLOOP(d[i] = (a[i] & ~FSIGN_MASK) | (OP_B & FSIGN_MASK));
+        break;
+    case 0x09: /* vfsgnjn */
+        VLOOP(d[i] = (a[i] & ~FSIGN_MASK) | (~OP_B & FSIGN_MASK));
+        break;
+    case 0x0a: /* vfsgnjx */
+        VLOOP(d[i] = a[i] ^ (OP_B & FSIGN_MASK));
+        break;
+    case 0x01: /* vfredusum */
+    case 0x03: /* vfredosum */
+    case 0x05: /* vfredmin */
+    case 0x07: /* vfredmax */
+        if (!is_vv || s->vstart != 0)
+            return -1;
+        /* the unordered sum is done in order */
+        acc = b[0];
+        VLOOP(if (funct6 == 0x05)
+                  acc = glue(min_sf, F_SIZE)(acc, a[i], pf,
+                                             FMINMAX_IEEE754_201X);
+              else if (funct6 == 0x07)
+                  acc = glue(max_sf, F_SIZE)(acc, a[i], pf,
+                                             FMINMAX_IEEE754_201X);
+              else
+                  acc = glue(host_add_sf, F_SIZE)(acc, a[i], rm, pf));
+        if (vl > 0)
+            d[0] = acc;
+        break;
+    case 0x0e: /* vfslide1up */
+        if (is_vv)
+            return -1;
+        VLOOP(d[i] = (i == 0) ? bx : a[i - 1]);
+        break;
+    case 0x0f: /* vfslide1down */
+        if (is_vv)
+            return -1;
+        VLOOP(d[i] = (i == vl - 1) ? bx : a[i + 1]);
+        break;
+    case 0x10:
+        if (is_vv) {
+            /* vfmv.f.s */
+            if (vs1 != 0)
+                return -1;
+            s->fp_reg[vd] = a[0] | F_HIGH;
+        } else {
+            /* vfmv.s.f */
+            if (vs2 != 0)
+                return -1;
+            if (s->vstart < vl)
+                d[0] = bx;
+        }
+        break;
+    case 0x12: /* vfcvt */
+        if (!is_vv)
+            return -1;
+        switch(vs1) {
+        case 0x00: /* vfcvt.xu.f.v */
+            VLOOP(d[i] = glue(glue(cvt_sf, F_SIZE), glue(_u, SEW))(a[i], rm, pf));
+            break;
+        case 0x01: /* vfcvt.x.f.v */
+            VLOOP(d[i] = glue(glue(cvt_sf, F_SIZE), glue(_i, SEW))(a[i], rm, pf));
+            break;
+        case 0x02: /* vfcvt.f.xu.v */
+            VLOOP(d[i] = glue(glue(cvt_u, SEW), glue(_sf, F_SIZE))(a[i], rm, pf));
+            break;
+        case 0x03: /* vfcvt.f.x.v */
+            VLOOP(d[i] = glue(glue(cvt_i, SEW), glue(_sf, F_SIZE))(a[i], rm, pf));
+            break;
+        case 0x06: /* vfcvt.rtz.xu.f.v */
+            VLOOP(d[i] = glue(glue(cvt_sf, F_SIZE), glue(_u, SEW))(a[i], RM_RTZ, pf));
+            break;
+        case 0x07: /* vfcvt.rtz.x.f.v */
+            VLOOP(d[i] = glue(glue(cvt_sf, F_SIZE), glue(_i, SEW))(a[i], RM_RTZ, pf));
+            break;
+        default:
+            return -1;
+        }
+        break;
+    case 0x13:
+        if (!is_vv)
+            return -1;
+        if (vs1 == 0x00) {
+            /* vfsqrt */
+            VLOOP(d[i] = glue(host_sqrt_sf, F_SIZE)(a[i], rm, pf));
+        } else if (vs1 == 0x04) {
+            /* vfrsqrt7 */
+            VLOOP(d[i] = vfrsqrt7(a[i], F_EXP_SIZE, F_SIZE - 1 - F_EXP_SIZE,
+                                  pf));
+        } else if (vs1 == 0x05) {
+            /* vfrec7 */
+            VLOOP(d[i] = vfrec7(a[i], F_EXP_SIZE, F_SIZE - 1 - F_EXP_SIZE,
+                                rm, pf));
+        } else if (vs1 == 0x10) {
+            /* vfclass */
+            VLOOP(d[i] = glue(fclass_sf, F_SIZE)(a[i]));
+        } else {
+            return -1;
+        }
+        break;
+    case 0x17: /* vfmerge, vfmv.v.f */
+        if (is_vv)
+            return -1;
+        if (vm) {
+            if (vs2 != 0)
+                return -1;
+            for(i = s->vstart; i < vl; i++)
+                d[i] = bx;
+        } else {
+            for(i = s->vstart; i < vl; i++)
+                d[i] = vmask_get(s, 0, i) ? bx : a[i];
+        }
+        break;
+    case 0x18: /* vmfeq */
+    case 0x19: /* vmfle */
+    case 0x1b: /* vmflt */
+    case 0x1c: /* vmfne */
+    case 0x1d: /* vmfgt */
+    case 0x1f: /* vmfge */
+        if (is_vv && (funct6 == 0x1d || funct6 == 0x1f))
+            return -1;
+        memcpy(m, s->vreg[vd], VLENB);
+        for(i = s->vstart; i < vl; i++) {
+            if (!vm && !vmask_get(s, 0, i))
+                continue;
+            switch(funct6) {
+            case 0x18:
+                res = glue(eq_quiet_sf, F_SIZE)(a[i], OP_B, pf);
+                break;
+            case 0x19:
+                res = glue(le_sf, F_SIZE)(a[i], OP_B, pf);
+                break;
+            case 0x1b:
+                res = glue(lt_sf, F_SIZE)(a[i], OP_B, pf);
+                break;
+            case 0x1c:
+                res = !glue(eq_quiet_sf, F_SIZE)(a[i], OP_B, pf);
+                break;
+            case 0x1d:
+                res = glue(lt_sf, F_SIZE)(bx, a[i], pf);
+                break;
+            default:
+                res = glue(le_sf, F_SIZE)(bx, a[i], pf);
+                break;
+            }
+            m[i >> 3] = (m[i >> 3] & ~(1 << (i & 7))) | (res << (i & 7));
+        }
+        memcpy(s->vreg[vd], m, VLENB);
+        break;
+    case 0x28: /* vfmadd */
+        VLOOP(d[i] = glue(host_fma_sf, F_SIZE)(OP_B, d[i], a[i], rm, pf));
+        break;
+    case 0x29: /* vfnmadd */
+        VLOOP(d[i] = glue(host_fma_sf, F_SIZE)(OP_B ^ FSIGN_MASK, d[i],
+                                               a[i] ^ FSIGN_MASK, rm, pf));
+        break;
+    case 0x2a: /* vfmsub */
+        VLOOP(d[i] = glue(host_fma_sf, F_SIZE)(OP_B, d[i],
+                                               a[i] ^ FSIGN_MASK, rm, pf));
+        break;
+    case 0x2b: /* vfnmsub */
+        VLOOP(d[i] = glue(host_fma_sf, F_SIZE)(OP_B ^ FSIGN_MASK, d[i],
+                                               a[i], rm, pf));
+        break;
+    case 0x2c: /* vfmacc */
+        VLOOP(d[i] = glue(host_fma_sf, F_SIZE)(OP_B, a[i], d[i], rm, pf));
+        break;
+    case 0x2d: /* vfnmacc */
+        VLOOP(d[i] = glue(host_fma_sf, F_SIZE)(OP_B ^ FSIGN_MASK, a[i],
+                                               d[i] ^ FSIGN_MASK, rm, pf));
+        break;
+    case 0x2e: /* vfmsac */
+        VLOOP(d[i] = glue(host_fma_sf, F_SIZE)(OP_B, a[i],
+                                               d[i] ^ FSIGN_MASK, rm, pf));
+        break;
+    case 0x2f: /* vfnmsac */
+        VLOOP(d[i] = glue(host_fma_sf, F_SIZE)(OP_B ^ FSIGN_MASK, a[i],
+                                               d[i], rm, pf));
+        break;
+    default:
+        return -1;
+    }
+#undef OP_B
+    return 0;
+}
+
+#if SEW == 32
+/* widening OPFVV and OPFVF: the f32 operands are converted to f64 */
+static int glue(vec_opfw, SEW)(RISCVCPUState *s, uint32_t funct6, int vd,
+                               int vs2, int vs1, elem_t bx, BOOL is_vv,
+                               BOOL vm, RoundingModeEnum rm)
+{
+    welem_t *d = (welem_t *)s->vreg[vd];
+    elem_t *a = (elem_t *)s->vreg[vs2];
+    welem_t *aw = (welem_t *)s->vreg[vs2];
+    elem_t *b = (elem_t *)s->vreg[vs1];
+    welem_t *bw = (welem_t *)s->vreg[vs1];
+    welem_t va, vb, acc;
+    uint32_t i, vl = s->vl;
+    uint32_t *pf = &s->fflags;
+
+#define OP_B (is_vv ? b[i] : bx)
+    switch(funct6) {
+    case 0x30: /* vfwadd */
+        VLOOP(va = cvt_sf32_sf64(a[i], pf); vb = cvt_sf32_sf64(OP_B, pf);
+              d[i] = host_add_sf64(va, vb, rm, pf));
+        break;
+    case 0x32: /* vfwsub */
+        VLOOP(va = cvt_sf32_sf64(a[i], pf); vb = cvt_sf32_sf64(OP_B, pf);
+              d[i] = host_sub_sf64(va, vb, rm, pf));
+        break;
+    case 0x34: /* vfwadd.w */
+        VLOOP(vb = cvt_sf32_sf64(OP_B, pf);
+              d[i] = host_add_sf64(aw[i], vb, rm, pf));
+        break;
+    case 0x36: /* vfwsub.w */
+        VLOOP(vb = cvt_sf32_sf64(OP_B, pf);
+              d[i] = host_sub_sf64(aw[i], vb, rm, pf));
+        break;
+    case 0x38: /* vfwmul */
+        VLOOP(va = cvt_sf32_sf64(a[i], pf); vb = cvt_sf32_sf64(OP_B, pf);
+              d[i] = host_mul_sf64(va, vb, rm, pf));
+        break;
+    case 0x3c: /* vfwmacc */
+        VLOOP(va = cvt_sf32_sf64(a[i], pf); vb = cvt_sf32_sf64(OP_B, pf);
+              d[i] = host_fma_sf64(vb, va, d[i], rm, pf));
+        break;
+    case 0x3d: /* vfwnmacc */
+        VLOOP(va = cvt_sf32_sf64(a[i], pf); vb = cvt_sf32_sf64(OP_B, pf);
+              d[i] = host_fma_sf64(vb ^ FSIGN_MASK64, va,
+                                   d[i] ^ FSIGN_MASK64, rm, pf));
+        break;
+    case 0x3e: /* vfwmsac */
+        VLOOP(va = cvt_sf32_sf64(a[i], pf); vb = cvt_sf32_sf64(OP_B, pf);
+              d[i] = host_fma_sf64(vb, va, d[i] ^ FSIGN_MASK64, rm, pf));
+        break;
+    case 0x3f: /* vfwnmsac */
+        VLOOP(va = cvt_sf32_sf64(a[i], pf); vb = cvt_sf32_sf64(OP_B, pf);
+              d[i] = host_fma_sf64(vb ^ FSIGN_MASK64, va, d[i], rm, pf));
+        break;
+    case 0x31: /* vfwredusum */
+    case 0x33: /* vfwredosum */
+        if (!is_vv || s->vstart != 0)
+            return -1;
+        /* the unordered sum is done in order */
+        acc = bw[0];
+        VLOOP(va = cvt_sf32_sf64(a[i], pf);
+              acc = host_add_sf64(acc, va, rm, pf));
+        if (vl > 0)
+            d[0] = acc;
+        break;
+    default:
+        return -1;
+    }
+#undef OP_B
+    return 0;
+}
+#endif
+
+#undef F_SIZE
+#undef F_HIGH
+#undef F_EXP_SIZE
+#undef FSIGN_MASK
+#endif /* SEW >= 32 */
+
+#undef SEW
+#undef SEW_LOG2
+#undef elem_t
+#undef selem_t
+#undef welem_t
+#undef swelem_t
+#undef SMIN
+#undef SMAX
+#undef VLOOP
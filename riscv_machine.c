@@ -31,6 +31,9 @@
 #include <errno.h>
 #include <unistd.h>
 #include <time.h>
+#ifdef CONFIG_SMP
+#include <pthread.h>
+#endif
 
 #include "cutils.h"
 #include "iomem.h"
@@ -40,27 +43,65 @@
 
 /* RISCV machine */
 
-typedef struct RISCVMachine {
+#define RISCV_MAX_CPUS 32
+
+typedef struct RISCVMachine RISCVMachine;
+
+#ifdef CONFIG_SMP
+/* host RAM range of 'pr' whose write TLB entries must be flushed */
+typedef struct {
+    PhysMemoryRange *pr;
+    uint8_t *start, *end;
+} RISCVFlushRequest;
+
+typedef struct {
+    RISCVMachine *machine;
+    int hart_id;
+    pthread_t thread;
+    /* used to wait for an interrupt when the hart is powered down */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* write TLB flushes to be done by the hart, at most one per
+       range (protected by 'lock') */
+    BOOL flush_pending;
+    int n_flush, flush_size;
+    RISCVFlushRequest *flush_tab;
+} RISCVHart;
+#endif
+
+struct RISCVMachine {
     VirtMachine common;
     PhysMemoryMap *mem_map;
     int max_xlen;
-    RISCVCPUState *cpu_state;
+    int ncpus;
+    RISCVCPUState *cpu_state[RISCV_MAX_CPUS];
     uint64_t ram_size;
     /* RTC */
     BOOL rtc_real_time;
     uint64_t rtc_start_time;
-    uint64_t timecmp;
-    /* PLIC */
+    uint64_t timecmp[RISCV_MAX_CPUS];
+    int exec_rate; /* executed cycles per RTC tick, 8 bit fixed point */
+    /* PLIC: context 2 * n is the S mode context of hart n, context
+       2 * n + 1 its M mode context */
     uint32_t plic_pending_irq, plic_served_irq;
+    uint32_t plic_enable[2 * RISCV_MAX_CPUS];
     IRQSignal plic_irq[32]; /* IRQ 0 is not used */
     /* HTIF */
     uint64_t htif_tohost, htif_fromhost;
+    uint64_t fork_rtc_time; /* RTC time when the fork point was reached */
+    BOOL dump_stats;
 
     VIRTIODevice *keyboard_dev;
     VIRTIODevice *mouse_dev;
 
     int virtio_count;
-} RISCVMachine;
+    VIRTIODevice *virtio_dev[32];
+#ifdef CONFIG_SMP
+    RISCVHart harts[RISCV_MAX_CPUS];
+    BOOL harts_started;
+    pthread_mutex_t io_lock; /* serializes the device emulation */
+#endif
+};
 
 #define LOW_RAM_SIZE   0x00010000 /* 64KB */
 #define RAM_BASE_ADDR  0x80000000
@@ -79,6 +120,10 @@ typedef struct RISCVMachine {
 #define RTC_FREQ_DIV 16 /* arbitrary, relative to CPU freq to have a
                            10 MHz frequency */
 
+#define HART_EXEC_CYCLES 500000 /* cycles between two timer checks */
+#define EXEC_CYCLES_MIN 1000 /* smallest slice before a timer event */
+#define EXEC_RATE_MIN_TIME 100 /* in RTC ticks, to measure the speed */
+
 static uint64_t rtc_get_real_time(RISCVMachine *s)
 {
     struct timespec ts;
@@ -93,12 +138,110 @@ static uint64_t rtc_get_time(RISCVMachine *m)
     if (m->rtc_real_time) {
         val = rtc_get_real_time(m) - m->rtc_start_time;
     } else {
-        val = riscv_cpu_get_cycles(m->cpu_state) / RTC_FREQ_DIV;
+        val = riscv_cpu_get_cycles(m->cpu_state[0]) / RTC_FREQ_DIV;
     }
     //    printf("rtc_time=%" PRId64 "\n", val);
     return val;
 }
 
+/* 'time' CSR */
+static uint64_t riscv_machine_get_time(void *opaque)
+{
+    return rtc_get_time(opaque);
+}
+
+/* wake up the hart if it is waiting for an interrupt */
+static void hart_kick(RISCVMachine *m, int hart_id)
+{
+#ifdef CONFIG_SMP
+    RISCVHart *h;
+    if (m->harts_started) {
+        h = &m->harts[hart_id];
+        pthread_mutex_lock(&h->lock);
+        pthread_cond_signal(&h->cond);
+        pthread_mutex_unlock(&h->lock);
+    }
+#endif
+}
+
+static void hart_set_mip(RISCVMachine *m, int hart_id, uint32_t mask)
+{
+    riscv_cpu_set_mip(m->cpu_state[hart_id], mask);
+    hart_kick(m, hart_id);
+}
+
+/* raise the timer interrupts (mtimecmp and Sstc stimecmp) of the hart
+   if needed. Return the number of RTC ticks before the next one is
+   raised or -1 if none is waiting. */
+static int64_t hart_update_timer(RISCVMachine *m, int hart_id)
+{
+    RISCVCPUState *s = m->cpu_state[hart_id];
+    int64_t delay, delay1;
+    uint64_t now, stimecmp;
+    uint32_t mip;
+
+    mip = riscv_cpu_get_mip(s);
+    now = rtc_get_time(m);
+    delay = -1;
+    if (!(mip & MIP_MTIP)) {
+        delay = m->timecmp[hart_id] - now;
+        if (delay <= 0) {
+            riscv_cpu_set_mip(s, MIP_MTIP);
+            delay = 0;
+        }
+    }
+    stimecmp = riscv_cpu_get_stimecmp(s);
+    if (!(mip & MIP_STIP) && stimecmp != UINT64_MAX) {
+        delay1 = stimecmp - now;
+        if (delay1 <= 0) {
+            riscv_cpu_set_mip(s, MIP_STIP);
+            delay1 = 0;
+        }
+        if (delay < 0 || delay1 < delay)
+            delay = delay1;
+    }
+    return delay;
+}
+
+/* execute the hart until its next timer event with at most
+   'max_cycles' cycles. With a real time RTC, the number of cycles is
+   estimated from the measured execution speed. */
+static void hart_interp(RISCVMachine *m, int hart_id, int max_cycles)
+{
+    RISCVCPUState *s = m->cpu_state[hart_id];
+    int64_t delay, n, dt;
+    uint64_t start_time, start_cycles;
+    int rate, rate1;
+
+    delay = hart_update_timer(m, hart_id);
+    n = max_cycles;
+    if (delay >= 0) {
+        if (m->rtc_real_time)
+            rate = __atomic_load_n(&m->exec_rate, __ATOMIC_RELAXED);
+        else
+            rate = RTC_FREQ_DIV << 8;
+        delay = min_int64(delay, RTC_FREQ);
+        n = min_int64(n, max_int64((delay * rate) >> 8, EXEC_CYCLES_MIN));
+    }
+    if (!m->rtc_real_time) {
+        riscv_cpu_interp(s, n);
+        return;
+    }
+    start_time = rtc_get_real_time(m);
+    start_cycles = riscv_cpu_get_cycles(s);
+    riscv_cpu_interp(s, n);
+    dt = rtc_get_real_time(m) - start_time;
+    if (dt >= EXEC_RATE_MIN_TIME) {
+        /* moving average. The harts share it, so a lost update does
+           not matter. */
+        rate1 = min_int64(((riscv_cpu_get_cycles(s) - start_cycles) << 8) / dt,
+                          INT32_MAX / RTC_FREQ);
+        rate = __atomic_load_n(&m->exec_rate, __ATOMIC_RELAXED);
+        rate = max_int(rate + (rate1 - rate) / 8, 1);
+        __atomic_store_n(&m->exec_rate, rate, __ATOMIC_RELAXED);
+    }
+}
+
 static uint32_t htif_read(void *opaque, uint32_t offset,
                           int size_log2)
 {
@@ -126,6 +269,63 @@ static uint32_t htif_read(void *opaque, uint32_t offset,
     return val;
 }
 
+static void riscv_machine_dump_stats(RISCVMachine *s)
+{
+    const RISCVCPUStats *st;
+    int i;
+
+    for(i = 0; i < s->ncpus; i++) {
+        st = riscv_cpu_get_stats(s->cpu_state[i]);
+        fprintf(stderr, "hart %d:\n", i);
+        fprintf(stderr, "  read_slow=%" PRIu64 " write_slow=%" PRIu64
+                " code_slow=%" PRIu64 "\n",
+                st->read_slow, st->write_slow, st->code_slow);
+        fprintf(stderr, "  page_walks=%" PRIu64 " pte_reads=%" PRIu64
+                " ptw_hit=%" PRIu64 "\n",
+                st->page_walks, st->pte_reads, st->ptw_hit);
+        fprintf(stderr, "  sfence.vma: all=%" PRIu64 " asid=%" PRIu64
+                " vaddr=%" PRIu64 "\n",
+                st->tlb_flush_all, st->tlb_flush_asid, st->tlb_flush_vaddr);
+        fprintf(stderr, "  tlb: ctx_hit=%" PRIu64 " ctx_miss=%" PRIu64
+                " way_hit=%" PRIu64 " victim_hit=%" PRIu64
+                " sp_hit=%" PRIu64 " conflict=%" PRIu64 "\n",
+                st->tlb_ctx_hit, st->tlb_ctx_miss, st->tlb_way_hit,
+                st->tlb_victim_hit, st->tlb_sp_hit, st->tlb_conflict);
+        fprintf(stderr, "  fused (decoded): lui_addi=%" PRIu64 " auipc_addi=%" PRIu64
+                " auipc_jalr=%" PRIu64 " auipc_load=%" PRIu64
+                " shift=%" PRIu64 " addi_branch=%" PRIu64 "\n",
+                st->fuse_decoded[RISCV_FUSE_LUI_ADDI],
+                st->fuse_decoded[RISCV_FUSE_AUIPC_ADDI],
+                st->fuse_decoded[RISCV_FUSE_AUIPC_JALR],
+                st->fuse_decoded[RISCV_FUSE_AUIPC_LOAD],
+                st->fuse_decoded[RISCV_FUSE_SHIFT],
+                st->fuse_decoded[RISCV_FUSE_ADDI_BRANCH]);
+        fprintf(stderr, "  tb_chain=%" PRIu64 "\n", st->tb_chain);
+        fprintf(stderr, "  exceptions=%" PRIu64 " interrupts=%" PRIu64
+                " devio=%" PRIu64 "\n",
+                st->exceptions, st->interrupts, st->devio_count);
+    }
+}
+
+#define HTIF_DEV_FORK 2 /* cmd 0: wait at the fork point */
+/* cmd 0: end of the benchmark phase given in the low 32 bits, cmd 1:
+   end of the benchmark */
+#define HTIF_DEV_BENCH 3
+
+/* the child identifier (1 to N, 0 if there is no fork server) is
+   returned in fromhost */
+static void riscv_machine_resume_fork(VirtMachine *s1, uint32_t child_id)
+{
+    RISCVMachine *s = (RISCVMachine *)s1;
+
+    /* the guest time does not advance while the template is paused */
+    if (s->common.fork_pending && s->rtc_real_time)
+        s->rtc_start_time = rtc_get_real_time(s) - s->fork_rtc_time;
+    s->common.fork_pending = FALSE;
+    s->htif_tohost = 0;
+    s->htif_fromhost = ((uint64_t)HTIF_DEV_FORK << 56) | child_id;
+}
+
 static void htif_handle_cmd(RISCVMachine *s)
 {
     uint32_t device, cmd;
@@ -134,17 +334,38 @@ static void htif_handle_cmd(RISCVMachine *s)
     cmd = (s->htif_tohost >> 48) & 0xff;
     if (s->htif_tohost == 1) {
         /* shuthost */
+        if (s->common.bench_event)
+            s->common.bench_event(&s->common, BENCH_EVENT_POWER_OFF, 0);
         printf("\nPower off.\n");
+        if (s->dump_stats)
+            riscv_machine_dump_stats(s);
         exit(0);
     } else if (device == 1 && cmd == 1) {
         uint8_t buf[1];
         buf[0] = s->htif_tohost & 0xff;
-        s->common.console->write_data(s->common.console->opaque, buf, 1);
+        if (s->common.console)
+            s->common.console->write_data(s->common.console->opaque, buf, 1);
         s->htif_tohost = 0;
         s->htif_fromhost = ((uint64_t)device << 56) | ((uint64_t)cmd << 48);
     } else if (device == 1 && cmd == 0) {
         /* request keyboard interrupt */
         s->htif_tohost = 0;
+    } else if (device == HTIF_DEV_FORK && cmd == 0) {
+        /* the guest polls fromhost until it is resumed */
+        if (s->common.fork_server) {
+            s->common.fork_pending = TRUE;
+            s->fork_rtc_time = rtc_get_time(s);
+        } else {
+            riscv_machine_resume_fork(&s->common, 0);
+        }
+    } else if (device == HTIF_DEV_BENCH && cmd <= 1) {
+        uint32_t id = s->htif_tohost;
+        s->htif_tohost = 0;
+        s->htif_fromhost = ((uint64_t)device << 56) | ((uint64_t)cmd << 48);
+        if (s->common.bench_event) {
+            s->common.bench_event(&s->common, cmd == 0 ? BENCH_EVENT_PHASE :
+                                  BENCH_EVENT_STOP, id);
+        }
     } else {
         printf("HTIF: unsupported tohost=0x%016" PRIx64 "\n", s->htif_tohost);
     }
@@ -192,91 +413,147 @@ static void htif_poll(RISCVMachine *s)
 }
 #endif
 
+/* CLINT: msip at 0x0000 + 4 * hart, mtimecmp at 0x4000 + 8 * hart */
 static uint32_t clint_read(void *opaque, uint32_t offset, int size_log2)
 {
     RISCVMachine *m = opaque;
     uint32_t val;
+    int h;
 
     assert(size_log2 == 2);
-    switch(offset) {
-    case 0xbff8:
+    if (offset == 0xbff8) {
         val = rtc_get_time(m);
-        break;
-    case 0xbffc:
+    } else if (offset == 0xbffc) {
         val = rtc_get_time(m) >> 32;
-        break;
-    case 0x4000:
-        val = m->timecmp;
-        break;
-    case 0x4004:
-        val = m->timecmp >> 32;
-        break;
-    default:
+    } else if (offset >= 0x4000 && offset < 0x4000 + 8 * m->ncpus) {
+        h = (offset - 0x4000) >> 3;
+        if (offset & 4)
+            val = m->timecmp[h] >> 32;
+        else
+            val = m->timecmp[h];
+    } else if (offset < 4 * m->ncpus) {
+        h = offset >> 2;
+        val = (riscv_cpu_get_mip(m->cpu_state[h]) & MIP_MSIP) != 0;
+    } else {
         val = 0;
-        break;
     }
     return val;
 }
  
+/* mtime: the RTC can be read by any hart without the I/O lock */
+static uint32_t clint_mtime_read(void *opaque, uint32_t offset, int size_log2)
+{
+    RISCVMachine *m = opaque;
+    if (offset == 0xbff8)
+        return rtc_get_time(m);
+    else
+        return rtc_get_time(m) >> 32;
+}
+
 static void clint_write(void *opaque, uint32_t offset, uint32_t val,
                       int size_log2)
 {
     RISCVMachine *m = opaque;
+    int h;
 
     assert(size_log2 == 2);
-    switch(offset) {
-    case 0x4000:
-        m->timecmp = (m->timecmp & ~0xffffffff) | val;
-        riscv_cpu_reset_mip(m->cpu_state, MIP_MTIP);
-        break;
-    case 0x4004:
-        m->timecmp = (m->timecmp & 0xffffffff) | ((uint64_t)val << 32);
-        riscv_cpu_reset_mip(m->cpu_state, MIP_MTIP);
-        break;
-    default:
-        break;
+    if (offset >= 0x4000 && offset < 0x4000 + 8 * m->ncpus) {
+        h = (offset - 0x4000) >> 3;
+        if (offset & 4) {
+            m->timecmp[h] = (m->timecmp[h] & 0xffffffff) |
+                ((uint64_t)val << 32);
+        } else {
+            m->timecmp[h] = (m->timecmp[h] & ~0xffffffff) | val;
+        }
+        riscv_cpu_reset_mip(m->cpu_state[h], MIP_MTIP);
+        /* the hart may have to sleep less */
+        hart_kick(m, h);
+    } else if (offset < 4 * m->ncpus) {
+        h = offset >> 2;
+        if (val & 1)
+            hart_set_mip(m, h, MIP_MSIP);
+        else
+            riscv_cpu_reset_mip(m->cpu_state[h], MIP_MSIP);
     }
 }
 
 static void plic_update_mip(RISCVMachine *s)
 {
-    RISCVCPUState *cpu = s->cpu_state;
     uint32_t mask;
+    int i, ctx, mip_mask;
+
     mask = s->plic_pending_irq & ~s->plic_served_irq;
-    if (mask) {
-        riscv_cpu_set_mip(cpu, MIP_MEIP | MIP_SEIP);
-    } else {
-        riscv_cpu_reset_mip(cpu, MIP_MEIP | MIP_SEIP);
+    for(i = 0; i < s->ncpus; i++) {
+        for(ctx = 2 * i; ctx < 2 * i + 2; ctx++) {
+            mip_mask = (ctx & 1) ? MIP_MEIP : MIP_SEIP;
+            if (mask & s->plic_enable[ctx]) {
+                if (!(riscv_cpu_get_mip(s->cpu_state[i]) & mip_mask))
+                    hart_set_mip(s, i, mip_mask);
+            } else {
+                riscv_cpu_reset_mip(s->cpu_state[i], mip_mask);
+            }
+        }
     }
 }
 
+#define PLIC_ENABLE_BASE 0x2000
+#define PLIC_ENABLE_SIZE 0x80
 #define PLIC_HART_BASE 0x200000
 #define PLIC_HART_SIZE 0x1000
 
+/* claim and complete registers of the contexts (offset 4) */
+static uint32_t plic_claim_read(void *opaque, uint32_t offset, int size_log2)
+{
+    RISCVMachine *s = opaque;
+    uint32_t mask;
+    int i, ctx;
+
+    ctx = (offset - PLIC_HART_BASE) / PLIC_HART_SIZE;
+    mask = s->plic_pending_irq & ~s->plic_served_irq & s->plic_enable[ctx];
+    if (mask == 0)
+        return 0;
+    i = ctz32(mask);
+    s->plic_served_irq |= 1 << i;
+    plic_update_mip(s);
+    return i + 1;
+}
+
+static void plic_complete_write(void *opaque, uint32_t offset, uint32_t val,
+                                int size_log2)
+{
+    RISCVMachine *s = opaque;
+
+    val--;
+    if (val < 32) {
+        s->plic_served_irq &= ~(1 << val);
+        plic_update_mip(s);
+    }
+}
+
 static uint32_t plic_read(void *opaque, uint32_t offset, int size_log2)
 {
     RISCVMachine *s = opaque;
-    uint32_t val, mask;
-    int i;
+    uint32_t val;
+    int ctx;
     assert(size_log2 == 2);
-    switch(offset) {
-    case PLIC_HART_BASE:
-        val = 0;
-        break;
-    case PLIC_HART_BASE + 4:
-        mask = s->plic_pending_irq & ~s->plic_served_irq;
-        if (mask != 0) {
-            i = ctz32(mask);
-            s->plic_served_irq |= 1 << i;
-            plic_update_mip(s);
-            val = i + 1;
-        } else {
+    if (offset >= PLIC_HART_BASE &&
+        offset < PLIC_HART_BASE + 2 * s->ncpus * PLIC_HART_SIZE) {
+        switch(offset & (PLIC_HART_SIZE - 1)) {
+        case 4: /* claim */
+            val = plic_claim_read(s, offset, size_log2);
+            break;
+        default:
             val = 0;
+            break;
         }
-        break;
-    default:
+    } else if (offset >= PLIC_ENABLE_BASE &&
+               offset < PLIC_ENABLE_BASE + 2 * s->ncpus * PLIC_ENABLE_SIZE &&
+               (offset & (PLIC_ENABLE_SIZE - 1)) == 0) {
+        /* IRQ 1 to 31 are in the first word */
+        ctx = (offset - PLIC_ENABLE_BASE) / PLIC_ENABLE_SIZE;
+        val = s->plic_enable[ctx] << 1;
+    } else {
         val = 0;
-        break;
     }
     return val;
 }
@@ -285,18 +562,24 @@ static void plic_write(void *opaque, uint32_t offset, uint32_t val,
                        int size_log2)
 {
     RISCVMachine *s = opaque;
+    int ctx;
     
     assert(size_log2 == 2);
-    switch(offset) {
-    case PLIC_HART_BASE + 4:
-        val--;
-        if (val < 32) {
-            s->plic_served_irq &= ~(1 << val);
-            plic_update_mip(s);
+    if (offset >= PLIC_HART_BASE &&
+        offset < PLIC_HART_BASE + 2 * s->ncpus * PLIC_HART_SIZE) {
+        switch(offset & (PLIC_HART_SIZE - 1)) {
+        case 4: /* complete */
+            plic_complete_write(s, offset, val, size_log2);
+            break;
+        default:
+            break;
         }
-        break;
-    default:
-        break;
+    } else if (offset >= PLIC_ENABLE_BASE &&
+               offset < PLIC_ENABLE_BASE + 2 * s->ncpus * PLIC_ENABLE_SIZE &&
+               (offset & (PLIC_ENABLE_SIZE - 1)) == 0) {
+        ctx = (offset - PLIC_ENABLE_BASE) / PLIC_ENABLE_SIZE;
+        s->plic_enable[ctx] = val >> 1;
+        plic_update_mip(s);
     }
 }
 
@@ -590,10 +873,11 @@ static int riscv_build_fdt(RISCVMachine *m, uint8_t *dst,
                            const char *cmd_line)
 {
     FDTState *s;
-    int size, max_xlen, i, cur_phandle, intc_phandle, plic_phandle;
+    int size, max_xlen, i, cur_phandle, plic_phandle, h;
+    int intc_phandle[RISCV_MAX_CPUS];
     char isa_string[128], *q;
     uint32_t misa;
-    uint32_t tab[4];
+    uint32_t tab[4 * RISCV_MAX_CPUS];
     FBDevice *fb_dev;
     
     s = fdt_init();
@@ -612,36 +896,41 @@ static int riscv_build_fdt(RISCVMachine *m, uint8_t *dst,
     fdt_prop_u32(s, "#size-cells", 0);
     fdt_prop_u32(s, "timebase-frequency", RTC_FREQ);
 
-    /* cpu */
-    fdt_begin_node_num(s, "cpu", 0);
-    fdt_prop_str(s, "device_type", "cpu");
-    fdt_prop_u32(s, "reg", 0);
-    fdt_prop_str(s, "status", "okay");
-    fdt_prop_str(s, "compatible", "riscv");
-
     max_xlen = m->max_xlen;
-    misa = riscv_cpu_get_misa(m->cpu_state);
+    misa = riscv_cpu_get_misa(m->cpu_state[0]);
     q = isa_string;
     q += snprintf(isa_string, sizeof(isa_string), "rv%d", max_xlen);
     for(i = 0; i < 26; i++) {
         if (misa & (1 << i))
             *q++ = 'a' + i;
     }
-    *q = '\0';
-    fdt_prop_str(s, "riscv,isa", isa_string);
-    
-    fdt_prop_str(s, "mmu-type", max_xlen <= 32 ? "riscv,sv32" : "riscv,sv48");
-    fdt_prop_u32(s, "clock-frequency", 2000000000);
-
-    fdt_begin_node(s, "interrupt-controller");
-    fdt_prop_u32(s, "#interrupt-cells", 1);
-    fdt_prop(s, "interrupt-controller", NULL, 0);
-    fdt_prop_str(s, "compatible", "riscv,cpu-intc");
-    intc_phandle = cur_phandle++;
-    fdt_prop_u32(s, "phandle", intc_phandle);
-    fdt_end_node(s); /* interrupt-controller */
+    /* the cycle, time and instret CSRs are implemented */
+    pstrcpy(q, isa_string + sizeof(isa_string) - q, "_zicntr");
+    /* the bit manipulation instructions are not available in RV128 */
+    if (max_xlen <= 64)
+        pstrcat(isa_string, sizeof(isa_string), "_zba_zbb_zbs");
+    pstrcat(isa_string, sizeof(isa_string), "_sstc");
+
+    for(h = 0; h < m->ncpus; h++) {
+        fdt_begin_node_num(s, "cpu", h);
+        fdt_prop_str(s, "device_type", "cpu");
+        fdt_prop_u32(s, "reg", h);
+        fdt_prop_str(s, "status", "okay");
+        fdt_prop_str(s, "compatible", "riscv");
+        fdt_prop_str(s, "riscv,isa", isa_string);
+        fdt_prop_str(s, "mmu-type", max_xlen <= 32 ? "riscv,sv32" : "riscv,sv48");
+        fdt_prop_u32(s, "clock-frequency", 2000000000);
+
+        fdt_begin_node(s, "interrupt-controller");
+        fdt_prop_u32(s, "#interrupt-cells", 1);
+        fdt_prop(s, "interrupt-controller", NULL, 0);
+        fdt_prop_str(s, "compatible", "riscv,cpu-intc");
+        intc_phandle[h] = cur_phandle++;
+        fdt_prop_u32(s, "phandle", intc_phandle[h]);
+        fdt_end_node(s); /* interrupt-controller */
     
-    fdt_end_node(s); /* cpu */
+        fdt_end_node(s); /* cpu */
+    }
     
     fdt_end_node(s); /* cpus */
 
@@ -669,11 +958,13 @@ static int riscv_build_fdt(RISCVMachine *m, uint8_t *dst,
     fdt_begin_node_num(s, "clint", CLINT_BASE_ADDR);
     fdt_prop_str(s, "compatible", "riscv,clint0");
 
-    tab[0] = intc_phandle;
-    tab[1] = 3; /* M IPI irq */
-    tab[2] = intc_phandle;
-    tab[3] = 7; /* M timer irq */
-    fdt_prop_tab_u32(s, "interrupts-extended", tab, 4);
+    for(h = 0; h < m->ncpus; h++) {
+        tab[4 * h] = intc_phandle[h];
+        tab[4 * h + 1] = 3; /* M IPI irq */
+        tab[4 * h + 2] = intc_phandle[h];
+        tab[4 * h + 3] = 7; /* M timer irq */
+    }
+    fdt_prop_tab_u32(s, "interrupts-extended", tab, 4 * m->ncpus);
 
     fdt_prop_tab_u64_2(s, "reg", CLINT_BASE_ADDR, CLINT_SIZE);
     
@@ -686,11 +977,14 @@ static int riscv_build_fdt(RISCVMachine *m, uint8_t *dst,
     fdt_prop_u32(s, "riscv,ndev", 31);
     fdt_prop_tab_u64_2(s, "reg", PLIC_BASE_ADDR, PLIC_SIZE);
 
-    tab[0] = intc_phandle;
-    tab[1] = 9; /* S ext irq */
-    tab[2] = intc_phandle;
-    tab[3] = 11; /* M ext irq */
-    fdt_prop_tab_u32(s, "interrupts-extended", tab, 4);
+    /* context 2 * n: S mode of hart n, context 2 * n + 1: M mode */
+    for(h = 0; h < m->ncpus; h++) {
+        tab[4 * h] = intc_phandle[h];
+        tab[4 * h + 1] = 9; /* S ext irq */
+        tab[4 * h + 2] = intc_phandle[h];
+        tab[4 * h + 3] = 11; /* M ext irq */
+    }
+    fdt_prop_tab_u32(s, "interrupts-extended", tab, 4 * m->ncpus);
 
     plic_phandle = cur_phandle++;
     fdt_prop_u32(s, "phandle", plic_phandle);
@@ -815,13 +1109,156 @@ static void copy_bios(RISCVMachine *s, const uint8_t *buf, int buf_len,
     q[4] = 0x00028067; /* jalr zero, t0, jump_addr */
 }
 
-static void riscv_flush_tlb_write_range(void *opaque, uint8_t *ram_addr,
-                                        size_t ram_size)
+#ifdef CONFIG_SMP
+/* the TLBs of a hart can only be modified by its thread, so the flush
+   is done by the hart before executing more code */
+static void hart_request_flush(RISCVMachine *m, int hart_id,
+                               PhysMemoryRange *pr,
+                               uint8_t *start, uint8_t *end)
+{
+    RISCVHart *h = &m->harts[hart_id];
+    RISCVFlushRequest *f;
+    int i;
+
+    pthread_mutex_lock(&h->lock);
+    for(i = 0; i < h->n_flush; i++) {
+        f = &h->flush_tab[i];
+        if (f->pr == pr) {
+            if (f->start < start)
+                start = f->start;
+            if (f->end > end)
+                end = f->end;
+            goto found;
+        }
+    }
+    if (h->n_flush >= h->flush_size) {
+        h->flush_size = max_int(4, h->flush_size * 2);
+        h->flush_tab = realloc(h->flush_tab,
+                               h->flush_size * sizeof(h->flush_tab[0]));
+    }
+    f = &h->flush_tab[h->n_flush++];
+    f->pr = pr;
+ found:
+    f->start = start;
+    f->end = end;
+    __atomic_store_n(&h->flush_pending, TRUE, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&h->lock);
+}
+
+/* The dirty bits may have been read before the flush, so the pages
+   written thru the flushed entries are marked as dirty again. */
+static void hart_flush_tlb_write(RISCVHart *h)
+{
+    RISCVCPUState *s = h->machine->cpu_state[h->hart_id];
+    RISCVFlushRequest *f;
+    int i;
+
+    pthread_mutex_lock(&h->lock);
+    for(i = 0; i < h->n_flush; i++) {
+        f = &h->flush_tab[i];
+        riscv_cpu_flush_tlb_write_range_ram(s, f->pr, f->start,
+                                            f->end - f->start);
+    }
+    h->n_flush = 0;
+    __atomic_store_n(&h->flush_pending, FALSE, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&h->lock);
+}
+#endif
+
+static void riscv_flush_tlb_write_range(void *opaque, PhysMemoryRange *pr,
+                                        uint8_t *ram_addr, size_t ram_size)
+{
+    RISCVMachine *s = opaque;
+    int i;
+#ifdef CONFIG_SMP
+    if (s->harts_started) {
+        for(i = 0; i < s->ncpus; i++)
+            hart_request_flush(s, i, pr, ram_addr, ram_addr + ram_size);
+        return;
+    }
+#endif
+    for(i = 0; i < s->ncpus; i++)
+        riscv_cpu_flush_tlb_write_range_ram(s->cpu_state[i], NULL,
+                                            ram_addr, ram_size);
+}
+
+#ifdef CONFIG_SMP
+static void riscv_io_lock(void *opaque, BOOL lock)
 {
     RISCVMachine *s = opaque;
-    riscv_cpu_flush_tlb_write_range_ram(s->cpu_state, ram_addr, ram_size);
+    if (lock)
+        pthread_mutex_lock(&s->io_lock);
+    else
+        pthread_mutex_unlock(&s->io_lock);
 }
 
+static void *hart_thread(void *opaque)
+{
+    RISCVHart *h = opaque;
+    RISCVMachine *m = h->machine;
+    RISCVCPUState *s = m->cpu_state[h->hart_id];
+    struct timespec ts;
+    int64_t delay;
+
+    for(;;) {
+        /* a powered down hart does not write to the RAM, so the
+           flush can wait until it is woken up */
+        if (__atomic_load_n(&h->flush_pending, __ATOMIC_RELAXED))
+            hart_flush_tlb_write(h);
+        if (!riscv_cpu_get_power_down(s)) {
+            hart_interp(m, h->hart_id, HART_EXEC_CYCLES);
+            continue;
+        }
+        /* wait for an interrupt or for the timer */
+        pthread_mutex_lock(&h->lock);
+        while (riscv_cpu_get_power_down(s)) {
+            delay = hart_update_timer(m, h->hart_id);
+            if (!riscv_cpu_get_power_down(s))
+                break;
+            /* the interrupts and the timer updates wake up the hart */
+            if (delay < 0) {
+                pthread_cond_wait(&h->cond, &h->lock);
+                continue;
+            }
+            delay = min_int64(delay, (int64_t)3600 * RTC_FREQ);
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            delay = ts.tv_nsec + delay * (1000000000 / RTC_FREQ);
+            ts.tv_sec += delay / 1000000000;
+            ts.tv_nsec = delay % 1000000000;
+            pthread_cond_timedwait(&h->cond, &h->lock, &ts);
+        }
+        pthread_mutex_unlock(&h->lock);
+    }
+    return NULL;
+}
+
+static void harts_start(RISCVMachine *m)
+{
+    pthread_condattr_t attr;
+    RISCVHart *h;
+    int i;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    for(i = 0; i < m->ncpus; i++) {
+        h = &m->harts[i];
+        h->machine = m;
+        h->hart_id = i;
+        pthread_mutex_init(&h->lock, NULL);
+        pthread_cond_init(&h->cond, &attr);
+    }
+    pthread_condattr_destroy(&attr);
+    m->harts_started = TRUE;
+    for(i = 0; i < m->ncpus; i++) {
+        h = &m->harts[i];
+        if (pthread_create(&h->thread, NULL, hart_thread, h) != 0) {
+            vm_error("could not create the hart threads\n");
+            exit(1);
+        }
+    }
+}
+#endif
+
 static void riscv_machine_set_defaults(VirtMachineParams *p)
 {
 }
@@ -830,7 +1267,9 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
 {
     RISCVMachine *s;
     VIRTIODevice *blk_dev;
+    PhysMemoryRange *pr;
     int irq_num, i, max_xlen, ram_flags;
+    BOOL jit_enable;
     VIRTIOBusDef vbus_s, *vbus = &vbus_s;
 
 
@@ -845,37 +1284,83 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
         return NULL;
     }
     
+    if (p->cpu_count < 1 || p->cpu_count > RISCV_MAX_CPUS) {
+        vm_error("cpus must be between 1 and %d\n", RISCV_MAX_CPUS);
+        return NULL;
+    }
+#ifndef CONFIG_SMP
+    if (p->cpu_count > 1) {
+        vm_error("multiple cpus are not supported in this build\n");
+        return NULL;
+    }
+#endif
+    
     s = mallocz(sizeof(*s));
     s->common.vmc = p->vmc;
     s->ram_size = p->ram_size;
     s->max_xlen = max_xlen;
+    s->dump_stats = p->dump_stats;
+    s->ncpus = p->cpu_count;
     s->mem_map = phys_mem_map_init();
+    phys_mem_set_devio_profile(s->mem_map, p->devio_profile);
     /* needed to handle the RAM dirty bits */
     s->mem_map->opaque = s;
     s->mem_map->flush_tlb_write_range = riscv_flush_tlb_write_range;
+#ifdef CONFIG_SMP
+    if (s->ncpus > 1) {
+        pthread_mutex_init(&s->io_lock, NULL);
+        s->mem_map->io_lock = riscv_io_lock;
+    }
+#endif
 
-    s->cpu_state = riscv_cpu_init(s->mem_map, max_xlen);
-    if (!s->cpu_state) {
-        vm_error("unsupported max_xlen=%d\n", max_xlen);
-        /* XXX: should free resources */
-        return NULL;
+    jit_enable = p->jit_enable;
+    for(i = 0; i < s->ncpus; i++) {
+        s->cpu_state[i] = riscv_cpu_init(s->mem_map, max_xlen);
+        if (!s->cpu_state[i]) {
+            vm_error("unsupported max_xlen=%d\n", max_xlen);
+            /* XXX: should free resources */
+            return NULL;
+        }
+        riscv_cpu_set_hart_id(s->cpu_state[i], i);
+        riscv_cpu_set_time_func(s->cpu_state[i], riscv_machine_get_time, s);
+        if (jit_enable) {
+            if (riscv_cpu_set_jit(s->cpu_state[i], TRUE) < 0) {
+                vm_error("JIT not supported for this machine, using the interpreter\n");
+                jit_enable = FALSE;
+            }
+        }
     }
     /* RAM */
     ram_flags = 0;
+    if (p->huge_pages)
+        ram_flags |= DEVRAM_FLAG_HUGE_PAGES;
     cpu_register_ram(s->mem_map, RAM_BASE_ADDR, p->ram_size, ram_flags);
     cpu_register_ram(s->mem_map, 0x00000000, LOW_RAM_SIZE, 0);
-    s->rtc_real_time = p->rtc_real_time;
-    if (p->rtc_real_time) {
+    /* the cycle counters of the harts are not synchronized */
+    s->rtc_real_time = p->rtc_real_time || s->ncpus > 1;
+    if (s->rtc_real_time) {
         s->rtc_start_time = rtc_get_real_time(s);
     }
+    s->exec_rate = 16 << 8; /* first guess: 160 MIPS */
     
-    cpu_register_device(s->mem_map, CLINT_BASE_ADDR, CLINT_SIZE, s,
-                        clint_read, clint_write, DEVIO_SIZE32);
-    cpu_register_device(s->mem_map, PLIC_BASE_ADDR, PLIC_SIZE, s,
-                        plic_read, plic_write, DEVIO_SIZE32);
+    pr = cpu_register_device(s->mem_map, CLINT_BASE_ADDR, CLINT_SIZE, s,
+                             clint_read, clint_write, DEVIO_SIZE32);
+    cpu_register_device_reg(pr, 0xbff8, clint_mtime_read, NULL,
+                            DEVIO_SIZE32 | DEVIO_LOCKLESS);
+    cpu_register_device_reg(pr, 0xbffc, clint_mtime_read, NULL,
+                            DEVIO_SIZE32 | DEVIO_LOCKLESS);
+    pr = cpu_register_device(s->mem_map, PLIC_BASE_ADDR, PLIC_SIZE, s,
+                             plic_read, plic_write, DEVIO_SIZE32);
+    for(i = 0; i < 2 * s->ncpus; i++) {
+        cpu_register_device_reg(pr, PLIC_HART_BASE + i * PLIC_HART_SIZE + 4,
+                                plic_claim_read, plic_complete_write,
+                                DEVIO_SIZE32);
+    }
     for(i = 1; i < 32; i++) {
         irq_init(&s->plic_irq[i], plic_set_irq, s, i);
     }
+    for(i = 0; i < 2 * s->ncpus; i++)
+        s->plic_enable[i] = 0xffffffff;
 
     cpu_register_device(s->mem_map, HTIF_BASE_ADDR, 16,
                         s, htif_read, htif_write, DEVIO_SIZE32);
@@ -892,27 +1377,26 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
         s->common.console_dev = virtio_console_init(vbus, p->console);
         vbus->addr += VIRTIO_SIZE;
         irq_num++;
-        s->virtio_count++;
+        s->virtio_dev[s->virtio_count++] = s->common.console_dev;
     }
     
     /* virtio net device */
     for(i = 0; i < p->eth_count; i++) {
         vbus->irq = &s->plic_irq[irq_num];
-        virtio_net_init(vbus, p->tab_eth[i].net);
+        s->virtio_dev[s->virtio_count++] =
+            virtio_net_init(vbus, p->tab_eth[i].net);
         s->common.net = p->tab_eth[i].net;
         vbus->addr += VIRTIO_SIZE;
         irq_num++;
-        s->virtio_count++;
     }
 
     /* virtio block device */
     for(i = 0; i < p->drive_count; i++) {
         vbus->irq = &s->plic_irq[irq_num];
         blk_dev = virtio_block_init(vbus, p->tab_drive[i].block_dev);
-        (void)blk_dev;
         vbus->addr += VIRTIO_SIZE;
         irq_num++;
-        s->virtio_count++;
+        s->virtio_dev[s->virtio_count++] = blk_dev;
     }
 
     /* virtio filesystem */
@@ -921,11 +1405,10 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
         vbus->irq = &s->plic_irq[irq_num];
         fs_dev = virtio_9p_init(vbus, p->tab_fs[i].fs_dev,
                                 p->tab_fs[i].tag);
-        (void)fs_dev;
         //        virtio_set_debug(fs_dev, VIRTIO_DEBUG_9P);
         vbus->addr += VIRTIO_SIZE;
         irq_num++;
-        s->virtio_count++;
+        s->virtio_dev[s->virtio_count++] = fs_dev;
     }
 
     if (p->display_device) {
@@ -951,14 +1434,14 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
                                                 VIRTIO_INPUT_TYPE_KEYBOARD);
             vbus->addr += VIRTIO_SIZE;
             irq_num++;
-            s->virtio_count++;
+            s->virtio_dev[s->virtio_count++] = s->keyboard_dev;
 
             vbus->irq = &s->plic_irq[irq_num];
             s->mouse_dev = virtio_input_init(vbus,
                                              VIRTIO_INPUT_TYPE_TABLET);
             vbus->addr += VIRTIO_SIZE;
             irq_num++;
-            s->virtio_count++;
+            s->virtio_dev[s->virtio_count++] = s->mouse_dev;
         } else {
             vm_error("unsupported input device: %s\n", p->input_device);
             exit(1);
@@ -980,41 +1463,67 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
 static void riscv_machine_end(VirtMachine *s1)
 {
     RISCVMachine *s = (RISCVMachine *)s1;
+    int i;
     /* XXX: stop all */
-    riscv_cpu_end(s->cpu_state);
+    for(i = 0; i < s->ncpus; i++)
+        riscv_cpu_end(s->cpu_state[i]);
     phys_mem_map_end(s->mem_map);
     free(s);
 }
 
-/* in ms */
-static int riscv_machine_get_sleep_duration(VirtMachine *s1, int delay)
+/* return the time in ns until the next timer event (at most 'delay',
+   -1 meaning no limit), 0 if the CPU must run or -1 if there is no
+   timer event */
+static int64_t riscv_machine_get_sleep_duration(VirtMachine *s1,
+                                                int64_t delay)
 {
     RISCVMachine *m = (RISCVMachine *)s1;
-    RISCVCPUState *s = m->cpu_state;
+    RISCVCPUState *s = m->cpu_state[0];
     int64_t delay1;
     
-    /* wait for an event: the only asynchronous event is the RTC timer */
-    if (!(riscv_cpu_get_mip(s) & MIP_MTIP)) {
-        delay1 = m->timecmp - rtc_get_time(m);
-        if (delay1 <= 0) {
-            riscv_cpu_set_mip(s, MIP_MTIP);
-            delay = 0;
-        } else {
-            /* convert delay to ms */
-            delay1 = delay1 / (RTC_FREQ / 1000);
-            if (delay1 < delay)
-                delay = delay1;
-        }
+    /* the harts handle their timer in their own thread */
+    if (m->ncpus > 1) {
+#ifdef CONFIG_SMP
+        /* riscv_machine_interp() starts them */
+        if (!m->harts_started)
+            return 0;
+#endif
+        return delay;
     }
+    /* wait for an event: the only asynchronous event is the RTC timer */
+    delay1 = hart_update_timer(m, 0);
     if (!riscv_cpu_get_power_down(s))
-        delay = 0;
+        return 0;
+    if (delay1 >= 0) {
+        /* convert delay to ns */
+        delay1 = min_int64(delay1, (int64_t)3600 * RTC_FREQ) *
+            (1000000000 / RTC_FREQ);
+        if (delay < 0 || delay1 < delay)
+            delay = delay1;
+    }
     return delay;
 }
 
 static void riscv_machine_interp(VirtMachine *s1, int max_exec_cycle)
 {
     RISCVMachine *s = (RISCVMachine *)s1;
-    riscv_cpu_interp(s->cpu_state, max_exec_cycle);
+#ifdef CONFIG_SMP
+    if (s->ncpus > 1) {
+        if (!s->harts_started)
+            harts_start(s);
+        return;
+    }
+#endif
+    hart_interp(s, 0, max_exec_cycle);
+}
+
+static void riscv_machine_io_lock(VirtMachine *s1, BOOL lock)
+{
+#ifdef CONFIG_SMP
+    RISCVMachine *s = (RISCVMachine *)s1;
+    if (s->ncpus > 1)
+        riscv_io_lock(s, lock);
+#endif
 }
 
 static void riscv_vm_send_key_event(VirtMachine *s1, BOOL is_down,
@@ -1040,6 +1549,66 @@ static void riscv_vm_send_mouse_event(VirtMachine *s1, int dx, int dy, int dz,
     }
 }
 
+static void riscv_machine_get_stats(VirtMachine *s1, VirtMachineStats *st)
+{
+    RISCVMachine *s = (RISCVMachine *)s1;
+    const RISCVCPUStats *cst;
+    int i;
+
+    memset(st, 0, sizeof(*st));
+    for(i = 0; i < s->ncpus; i++) {
+        st->insn_counter += riscv_cpu_get_cycles(s->cpu_state[i]);
+        cst = riscv_cpu_get_stats(s->cpu_state[i]);
+        st->code_tlb_miss += cst->code_slow;
+        st->read_slow += cst->read_slow;
+        st->write_slow += cst->write_slow;
+        st->page_walks += cst->page_walks;
+        st->exceptions += cst->exceptions;
+        st->interrupts += cst->interrupts;
+        st->devio_count += cst->devio_count;
+        st->devio_time += cst->devio_time;
+    }
+}
+
+static void riscv_machine_snapshot(VirtMachine *s1, SnapshotFile *f)
+{
+    RISCVMachine *s = (RISCVMachine *)s1;
+    PhysMemoryMap *map = s->mem_map;
+    PhysMemoryRange *pr;
+    uint64_t rtc_time;
+    int i;
+
+    if (s->ncpus > 1) {
+        snapshot_error(f, "snapshots are not supported with several harts");
+        return;
+    }
+    snapshot_section(f, "machine");
+    snapshot_check(f, "max_xlen", s->max_xlen);
+    snapshot_check(f, "ncpus", s->ncpus);
+    snapshot_check(f, "ram_size", s->ram_size);
+    snapshot_check(f, "virtio_count", s->virtio_count);
+    for(i = 0; i < s->ncpus; i++)
+        riscv_cpu_snapshot(s->cpu_state[i], f);
+    rtc_time = rtc_get_time(s);
+    snapshot_var(f, rtc_time);
+    snapshot_var(f, s->timecmp);
+    snapshot_var(f, s->plic_pending_irq);
+    snapshot_var(f, s->plic_served_irq);
+    snapshot_var(f, s->plic_enable);
+    snapshot_var(f, s->htif_tohost);
+    snapshot_var(f, s->htif_fromhost);
+    for(i = 0; i < s->virtio_count; i++)
+        virtio_snapshot(s->virtio_dev[i], f);
+    for(i = 0; i < map->n_phys_mem_range; i++) {
+        pr = map->phys_mem_range[i];
+        if (pr->is_ram)
+            snapshot_ram(f, pr);
+    }
+    /* the real time clock continues from the saved time */
+    if (snapshot_is_load(f) && s->rtc_real_time)
+        s->rtc_start_time = rtc_get_real_time(s) - rtc_time;
+}
+
 const VirtMachineClass riscv_machine_class = {
     "riscv32,riscv64,riscv128",
     riscv_machine_set_defaults,
@@ -1050,4 +1619,8 @@ const VirtMachineClass riscv_machine_class = {
     riscv_vm_mouse_is_absolute,
     riscv_vm_send_mouse_event,
     riscv_vm_send_key_event,
+    riscv_machine_io_lock,
+    riscv_machine_snapshot,
+    riscv_machine_resume_fork,
+    riscv_machine_get_stats,
 };
@@ -19,6 +19,8 @@ void slirp_cleanup(Slirp *slirp);
 
 void slirp_select_fill(Slirp *slirp, int *pnfds,
                        fd_set *readfds, fd_set *writefds, fd_set *xfds);
+/* delay in ms before the timers must run, -1 if none */
+int slirp_get_timeout(Slirp *slirp);
 
 void slirp_select_poll(Slirp *slirp,
                        fd_set *readfds, fd_set *writefds, fd_set *xfds,
@@ -354,6 +354,17 @@ void slirp_select_fill(Slirp *slirp, int *pnfds,
         *pnfds = nfds;
 }
 
+/* valid after slirp_select_fill(). The timers are run by
+   slirp_select_poll(). */
+int slirp_get_timeout(Slirp *slirp)
+{
+    if (time_fasttimo)
+        return 2;
+    if (do_slowtimo)
+        return 500;
+    return -1;
+}
+
 void slirp_select_poll(Slirp *slirp,
                        fd_set *readfds, fd_set *writefds, fd_set *xfds,
                        int select_error)
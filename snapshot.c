@@ -0,0 +1,228 @@
+/*
+ * Machine snapshots
+ *
+ * Copyright (c) 2026 TinyEMU contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+#if !defined(_WIN32) && !defined(EMSCRIPTEN)
+#include <sys/mman.h>
+#define USE_MMAP
+#endif
+
+#include "cutils.h"
+#include "iomem.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "TEMUSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_NAME_LEN 8
+/* the RAM images are aligned so that they can be mapped with any host
+   page size */
+#define SNAPSHOT_RAM_ALIGN 65536
+
+struct SnapshotFile {
+    FILE *f;
+    BOOL is_load;
+    BOOL error;
+    char *filename;
+    char *tmp_filename; /* written then renamed when saving */
+};
+
+void snapshot_error(SnapshotFile *f, const char *fmt, ...)
+{
+    va_list ap;
+
+    /* only the first error is reported */
+    if (f->error)
+        return;
+    f->error = TRUE;
+    fprintf(stderr, "%s: ", f->filename);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+}
+
+BOOL snapshot_is_load(SnapshotFile *f)
+{
+    return f->is_load;
+}
+
+void snapshot_buf(SnapshotFile *f, void *buf, size_t len)
+{
+    if (f->error)
+        return;
+    if (f->is_load) {
+        if (fread(buf, 1, len, f->f) != len)
+            snapshot_error(f, "truncated file");
+    } else {
+        if (fwrite(buf, 1, len, f->f) != len)
+            snapshot_error(f, "write error");
+    }
+}
+
+/* the sections detect the files from another build or configuration
+   before loading garbage */
+void snapshot_section(SnapshotFile *f, const char *name)
+{
+    char buf[SNAPSHOT_NAME_LEN], name1[SNAPSHOT_NAME_LEN];
+
+    memset(name1, 0, sizeof(name1));
+    memcpy(name1, name, min_int(strlen(name), sizeof(name1)));
+    if (f->is_load) {
+        snapshot_buf(f, buf, sizeof(buf));
+        if (!f->error && memcmp(buf, name1, sizeof(buf)) != 0)
+            snapshot_error(f, "expecting section '%s'", name);
+    } else {
+        snapshot_buf(f, name1, sizeof(name1));
+    }
+}
+
+void snapshot_check(SnapshotFile *f, const char *name, uint64_t val)
+{
+    uint64_t val1;
+
+    val1 = val;
+    snapshot_var(f, val1);
+    if (!f->error && val1 != val) {
+        snapshot_error(f, "%s is %" PRIu64 " in the snapshot and %" PRIu64
+                       " in the machine", name, val1, val);
+    }
+}
+
+static BOOL is_zero_page(const uint8_t *ptr)
+{
+    const uint64_t *p = (const uint64_t *)ptr;
+    int i;
+    for(i = 0; i < DEVRAM_PAGE_SIZE / 8; i++) {
+        if (p[i] != 0)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+void snapshot_ram(SnapshotFile *f, PhysMemoryRange *pr)
+{
+    int64_t pos;
+    size_t size, i;
+
+    snapshot_section(f, "ram");
+    snapshot_check(f, "RAM address", pr->addr);
+    snapshot_check(f, "RAM size", pr->org_size);
+    if (f->error)
+        return;
+    size = pr->org_size;
+    pos = (ftello(f->f) + SNAPSHOT_RAM_ALIGN - 1) &
+        ~(int64_t)(SNAPSHOT_RAM_ALIGN - 1);
+    if (f->is_load) {
+#ifdef USE_MMAP
+        uint8_t *ptr;
+        /* the devices with dirty bits (frame buffers) keep a pointer
+           to their RAM, so it is loaded in place */
+        if (pr->devram_flags & DEVRAM_FLAG_DIRTY_BITS)
+            ptr = MAP_FAILED;
+        else
+            ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                       fileno(f->f), pos);
+        if (ptr != MAP_FAILED) {
+            pr->map->free_ram(pr->map, pr);
+            pr->phys_mem = ptr;
+            pr->devram_flags |= DEVRAM_FLAG_MMAP;
+        } else
+#endif
+        {
+            fseeko(f->f, pos, SEEK_SET);
+            snapshot_buf(f, pr->phys_mem, size);
+        }
+        /* the whole frame buffer must be redrawn */
+        if (pr->dirty_bits)
+            memset(pr->dirty_bits, 0xff, pr->dirty_bits_size);
+    } else {
+        /* the zero pages are left as holes in the file */
+        for(i = 0; i < size; i += DEVRAM_PAGE_SIZE) {
+            if (!is_zero_page(pr->phys_mem + i)) {
+                fseeko(f->f, pos + i, SEEK_SET);
+                snapshot_buf(f, pr->phys_mem + i, DEVRAM_PAGE_SIZE);
+            }
+        }
+    }
+    fseeko(f->f, pos + size, SEEK_SET);
+}
+
+SnapshotFile *snapshot_open(const char *filename, BOOL is_load)
+{
+    SnapshotFile *f;
+    char magic[8];
+
+    f = mallocz(sizeof(*f));
+    f->is_load = is_load;
+    f->filename = strdup(filename);
+    if (is_load) {
+        f->f = fopen(filename, "rb");
+    } else {
+        /* a running machine may have mapped the previous file */
+        f->tmp_filename = malloc(strlen(filename) + 5);
+        sprintf(f->tmp_filename, "%s.tmp", filename);
+        f->f = fopen(f->tmp_filename, "wb");
+    }
+    if (!f->f) {
+        perror(is_load ? filename : f->tmp_filename);
+        free(f->tmp_filename);
+        free(f->filename);
+        free(f);
+        return NULL;
+    }
+    memcpy(magic, SNAPSHOT_MAGIC, sizeof(magic));
+    snapshot_buf(f, magic, sizeof(magic));
+    if (!f->error && memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0)
+        snapshot_error(f, "not a snapshot file");
+    snapshot_check(f, "version", SNAPSHOT_VERSION);
+    return f;
+}
+
+int snapshot_close(SnapshotFile *f)
+{
+    int ret;
+
+    snapshot_section(f, "end");
+    if (!f->is_load && fflush(f->f) != 0)
+        snapshot_error(f, "write error");
+    /* the mapped RAM stays valid after the file is closed */
+    fclose(f->f);
+    if (!f->is_load) {
+        if (!f->error && rename(f->tmp_filename, f->filename) < 0) {
+            perror(f->filename);
+            f->error = TRUE;
+        }
+        if (f->error)
+            remove(f->tmp_filename);
+    }
+    ret = f->error ? -1 : 0;
+    free(f->tmp_filename);
+    free(f->filename);
+    free(f);
+    return ret;
+}
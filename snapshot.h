@@ -0,0 +1,51 @@
+/*
+ * Machine snapshots
+ *
+ * Copyright (c) 2026 TinyEMU contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "iomem.h"
+
+/* The same functions are used to save and to restore the state, so
+   that each device describes its state only once. The file is only
+   meant to be loaded by the same build with the same configuration. */
+
+typedef struct SnapshotFile SnapshotFile;
+
+SnapshotFile *snapshot_open(const char *filename, BOOL is_load);
+/* return -1 if an error occurred while saving or loading */
+int snapshot_close(SnapshotFile *f);
+BOOL snapshot_is_load(SnapshotFile *f);
+void __attribute__((format(printf, 2, 3))) snapshot_error(SnapshotFile *f,
+                                                          const char *fmt, ...);
+void snapshot_section(SnapshotFile *f, const char *name);
+void snapshot_buf(SnapshotFile *f, void *buf, size_t len);
+/* fail if 'val' is different from the saved value */
+void snapshot_check(SnapshotFile *f, const char *name, uint64_t val);
+/* the RAM is mapped copy on write from the file when loading, except
+   the device RAM with dirty bits */
+void snapshot_ram(SnapshotFile *f, PhysMemoryRange *pr);
+
+#define snapshot_var(f, v) snapshot_buf(f, &(v), sizeof(v))
+
+#endif /* SNAPSHOT_H */
@@ -29,29 +29,6 @@
 #include "cutils.h"
 #include "softfp.h"
 
-static inline int clz32(uint32_t a)
-{
-    int r;
-    if (a == 0) {
-        r = 32;
-    } else {
-        r = __builtin_clz(a);
-    }
-    return r;
-}
-
-static inline int clz64(uint64_t a)
-{
-    int r;
-    if (a == 0) {
-        r = 64;
-    } else 
-    {
-        r = __builtin_clzll(a);
-    }
-    return r;
-}
-
 #ifdef HAVE_INT128
 static inline int clz128(uint128_t a)
 {
@@ -37,6 +37,18 @@
 #include <sys/ioctl.h>
 #include <net/if.h>
 #include <linux/if_tun.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#ifdef CONFIG_IO_THREAD
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#if defined(__linux__)
+/* select() adds a slack of 0.1% to its timeout */
+#define USE_TIMERFD
+#include <sys/timerfd.h>
 #endif
 #include <sys/stat.h>
 #include <signal.h>
@@ -53,6 +65,9 @@
 #include "slirp/libslirp.h"
 #endif
 
+/* set by C-a s or SIGUSR1, handled between two runs of the machine */
+static volatile sig_atomic_t snapshot_requested;
+
 #ifndef _WIN32
 
 typedef struct {
@@ -64,6 +79,46 @@ typedef struct {
 static struct termios oldtty;
 static int old_fd0_flags;
 static STDIODevice *global_stdio_device;
+/* pipe used to wake up virt_machine_run() from the signal handlers and
+   from the I/O thread */
+static int wakeup_fds[2] = { -1, -1 };
+#ifdef USE_TIMERFD
+static int wakeup_timer_fd = -1; /* next timer event of the machine */
+#endif
+
+static void wakeup_init(void)
+{
+    int i;
+
+    for(i = 0; i < 2; i++) {
+        if (wakeup_fds[i] >= 0)
+            close(wakeup_fds[i]);
+    }
+    if (pipe(wakeup_fds) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    for(i = 0; i < 2; i++) {
+        fcntl(wakeup_fds[i], F_SETFL, O_NONBLOCK);
+        fcntl(wakeup_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+#ifdef USE_TIMERFD
+    /* a forked process must not share the timer */
+    if (wakeup_timer_fd >= 0)
+        close(wakeup_timer_fd);
+    wakeup_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                     TFD_NONBLOCK | TFD_CLOEXEC);
+#endif
+}
+
+/* can be called from a signal handler */
+static void machine_wakeup(void)
+{
+    uint8_t ch = 0;
+    int err = errno;
+    write(wakeup_fds[1], &ch, 1);
+    errno = err;
+}
 
 static void term_exit(void)
 {
@@ -102,25 +157,15 @@ static void console_write(void *opaque, const uint8_t *buf, int len)
     fflush(stdout);
 }
 
-static int console_read(void *opaque, uint8_t *buf, int len)
+/* handle the console escape keys in the 'len' bytes of 'buf' and
+   return the number of bytes to send to the guest */
+static int console_filter(STDIODevice *s, uint8_t *buf, int len)
 {
-    STDIODevice *s = opaque;
-    int ret, i, j;
+    int i, j;
     uint8_t ch;
-    
-    if (len <= 0)
-        return 0;
-
-    ret = read(s->stdin_fd, buf, len);
-    if (ret < 0)
-        return 0;
-    if (ret == 0) {
-        /* EOF */
-        exit(1);
-    }
 
     j = 0;
-    for(i = 0; i < ret; i++) {
+    for(i = 0; i < len; i++) {
         ch = buf[i];
         if (s->console_esc_state) {
             s->console_esc_state = 0;
@@ -132,9 +177,13 @@ static int console_read(void *opaque, uint8_t *buf, int len)
                 printf("\n"
                        "C-a h   print this help\n"
                        "C-a x   exit emulator\n"
+                       "C-a s   save a snapshot of the machine\n"
                        "C-a C-a send C-a\n"
                        );
                 break;
+            case 's':
+                snapshot_requested = 1;
+                break;
             case 1:
                 goto output_char;
             default:
@@ -152,10 +201,35 @@ static int console_read(void *opaque, uint8_t *buf, int len)
     return j;
 }
 
+static int console_read(void *opaque, uint8_t *buf, int len)
+{
+    STDIODevice *s = opaque;
+    int ret;
+    
+    if (len <= 0)
+        return 0;
+
+    ret = read(s->stdin_fd, buf, len);
+    if (ret < 0)
+        return 0;
+    if (ret == 0) {
+        /* EOF */
+        exit(1);
+    }
+    return console_filter(s, buf, ret);
+}
+
 static void term_resize_handler(int sig)
 {
     if (global_stdio_device)
         global_stdio_device->resize_pending = TRUE;
+    machine_wakeup();
+}
+
+static void snapshot_signal_handler(int sig)
+{
+    snapshot_requested = 1;
+    machine_wakeup();
 }
 
 static void console_get_size(STDIODevice *s, int *pw, int *ph)
@@ -219,8 +293,12 @@ typedef struct BlockDeviceFile {
     int64_t nb_sectors;
     BlockDeviceModeEnum mode;
     uint8_t **sector_table;
+    char *filename;
+    struct BlockDeviceFile *next;
 } BlockDeviceFile;
 
+static BlockDeviceFile *first_bf; /* list of the opened disk images */
+
 static int64_t bf_get_sector_count(BlockDevice *bs)
 {
     BlockDeviceFile *bf = bs->opaque;
@@ -304,6 +382,51 @@ static int bf_write_async(BlockDevice *bs,
     return ret;
 }
 
+/* the modified sectors of a disk in snapshot mode are part of the
+   machine state */
+static void bf_snapshot(BlockDevice *bs, SnapshotFile *f)
+{
+    BlockDeviceFile *bf = bs->opaque;
+    uint8_t buf[SECTOR_SIZE];
+    int64_t sector_num, count, i;
+
+    snapshot_section(f, "disk");
+    snapshot_check(f, "disk sector count", bf->nb_sectors);
+    count = 0;
+    if (bf->mode == BF_MODE_SNAPSHOT) {
+        for(i = 0; i < bf->nb_sectors; i++) {
+            if (bf->sector_table[i])
+                count++;
+        }
+    }
+    snapshot_var(f, count);
+    if (!snapshot_is_load(f)) {
+        for(i = 0; i < bf->nb_sectors && count != 0; i++) {
+            if (bf->sector_table[i]) {
+                sector_num = i;
+                snapshot_var(f, sector_num);
+                snapshot_buf(f, bf->sector_table[i], SECTOR_SIZE);
+            }
+        }
+        return;
+    }
+    if (count != 0 && bf->mode != BF_MODE_SNAPSHOT) {
+        snapshot_error(f, "the disk must be in snapshot mode");
+        return;
+    }
+    for(i = 0; i < count; i++) {
+        snapshot_var(f, sector_num);
+        snapshot_buf(f, buf, SECTOR_SIZE);
+        if (sector_num < 0 || sector_num >= bf->nb_sectors) {
+            snapshot_error(f, "invalid disk sector");
+            return;
+        }
+        if (!bf->sector_table[sector_num])
+            bf->sector_table[sector_num] = malloc(SECTOR_SIZE);
+        memcpy(bf->sector_table[sector_num], buf, SECTOR_SIZE);
+    }
+}
+
 static BlockDevice *block_device_init(const char *filename,
                                       BlockDeviceModeEnum mode)
 {
@@ -333,6 +456,9 @@ static BlockDevice *block_device_init(const char *filename,
     bf->mode = mode;
     bf->nb_sectors = file_size / 512;
     bf->f = f;
+    bf->filename = strdup(filename);
+    bf->next = first_bf;
+    first_bf = bf;
 
     if (mode == BF_MODE_SNAPSHOT) {
         bf->sector_table = mallocz(sizeof(bf->sector_table[0]) *
@@ -343,10 +469,28 @@ static BlockDevice *block_device_init(const char *filename,
     bs->get_sector_count = bf_get_sector_count;
     bs->read_async = bf_read_async;
     bs->write_async = bf_write_async;
+    bs->snapshot = bf_snapshot;
     return bs;
 }
 
 #ifndef _WIN32
+/* the forked children must not share the file offset of the disk
+   images with the other machines */
+static void block_device_reopen_all(void)
+{
+    BlockDeviceFile *bf;
+    FILE *f;
+
+    for(bf = first_bf; bf != NULL; bf = bf->next) {
+        f = fopen(bf->filename, bf->mode == BF_MODE_RW ? "r+b" : "rb");
+        if (!f) {
+            perror(bf->filename);
+            exit(1);
+        }
+        fclose(bf->f);
+        bf->f = f;
+    }
+}
 
 typedef struct {
     int fd;
@@ -483,7 +627,12 @@ static void slirp_select_fill1(EthernetDevice *net, int *pfd_max,
                                int *pdelay)
 {
     Slirp *slirp_state = net->opaque;
+    int delay;
+
     slirp_select_fill(slirp_state, pfd_max, rfds, wfds, efds);
+    delay = slirp_get_timeout(slirp_state);
+    if (delay >= 0 && (*pdelay < 0 || delay < *pdelay))
+        *pdelay = delay;
 }
 
 static void slirp_select_poll1(EthernetDevice *net, 
@@ -531,19 +680,304 @@ static EthernetDevice *slirp_open(void)
 
 #endif /* CONFIG_SLIRP */
 
+#ifdef CONFIG_IO_THREAD
+
+/*******************************************************/
+/* host I/O thread */
+
+/* The console input and the tap device are read by a separate thread
+   so that the CPU thread does not have to poll them. The data is
+   passed in single producer, single consumer queues. The other
+   backends (slirp, curl) are still polled with select() in
+   virt_machine_run(). */
+
+typedef enum {
+    IO_SRC_CONSOLE,
+    IO_SRC_NET,
+    IO_SRC_COUNT,
+} IOSourceEnum;
+
+#define IO_QUEUE_LEN 32 /* must be a power of two */
+#define IO_BUF_SIZE 2048
+
+typedef struct {
+    int len; /* 0 means end of file */
+    int pos; /* number of bytes already consumed */
+    uint8_t buf[IO_BUF_SIZE];
+} IOBuffer;
+
+typedef struct {
+    int fd; /* -1 if not used */
+    uint32_t head; /* written by the I/O thread */
+    uint32_t tail; /* written by the CPU thread */
+    IOBuffer tab[IO_QUEUE_LEN];
+} IOQueue;
+
+typedef struct {
+    int epoll_fd;
+    int rearm_fd; /* eventfd: a full queue has space again */
+    uint32_t paused_mask; /* sources which are not polled because their
+                             queue is full */
+    IOQueue queues[IO_SRC_COUNT];
+} IOThreadState;
+
+static IOThreadState *io_thread;
+
+static BOOL io_queue_is_full(IOQueue *q)
+{
+    return __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) + IO_QUEUE_LEN ==
+        q->head;
+}
+
+static void io_thread_arm(IOThreadState *s, int src)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.u32 = src;
+    epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, s->queues[src].fd, &ev);
+}
+
+/* read the data available from 'src'. The source stays disarmed while
+   its queue is full */
+static void io_thread_read(IOThreadState *s, int src)
+{
+    IOQueue *q = &s->queues[src];
+    IOBuffer *b;
+    int ret;
+
+    if (io_queue_is_full(q)) {
+        __atomic_fetch_or(&s->paused_mask, 1 << src, __ATOMIC_SEQ_CST);
+        /* the CPU thread may have emptied the queue in between */
+        if (io_queue_is_full(q))
+            return;
+        __atomic_fetch_and(&s->paused_mask, ~(1 << src), __ATOMIC_SEQ_CST);
+    }
+    b = &q->tab[q->head & (IO_QUEUE_LEN - 1)];
+    ret = read(q->fd, b->buf, IO_BUF_SIZE);
+    if (ret < 0) {
+        if (errno != EAGAIN && errno != EINTR)
+            return; /* the source is no longer polled */
+    } else {
+        if (ret == 0 && src != IO_SRC_CONSOLE)
+            return;
+        b->len = ret;
+        b->pos = 0;
+        __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+        machine_wakeup();
+        if (ret == 0)
+            return; /* end of file */
+    }
+    io_thread_arm(s, src);
+}
+
+static void *io_thread_func(void *opaque)
+{
+    IOThreadState *s = opaque;
+    struct epoll_event tab_ev[IO_SRC_COUNT + 1];
+    uint64_t val;
+    uint32_t mask;
+    int i, n, src;
+
+    for(;;) {
+        n = epoll_wait(s->epoll_fd, tab_ev, countof(tab_ev), -1);
+        for(i = 0; i < n; i++) {
+            src = tab_ev[i].data.u32;
+            if (src == IO_SRC_COUNT) {
+                read(s->rearm_fd, &val, sizeof(val));
+                mask = __atomic_exchange_n(&s->paused_mask, 0,
+                                           __ATOMIC_SEQ_CST);
+                for(src = 0; src < IO_SRC_COUNT; src++) {
+                    if (mask & (1 << src))
+                        io_thread_read(s, src);
+                }
+            } else {
+                io_thread_read(s, src);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void io_thread_start(VirtMachine *m)
+{
+    IOThreadState *s;
+    struct epoll_event ev;
+    pthread_t thread;
+    IOQueue *q;
+    int src;
+
+    s = mallocz(sizeof(*s));
+    s->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    s->rearm_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (s->epoll_fd < 0 || s->rearm_fd < 0) {
+        perror("epoll");
+        exit(1);
+    }
+    s->queues[IO_SRC_CONSOLE].fd = -1;
+    if (m->console_dev && m->console->read_data == console_read) {
+        STDIODevice *s1 = m->console->opaque;
+        s->queues[IO_SRC_CONSOLE].fd = s1->stdin_fd;
+    }
+    s->queues[IO_SRC_NET].fd = -1;
+    if (m->net && m->net->write_packet == tun_write_packet) {
+        TunState *s1 = m->net->opaque;
+        s->queues[IO_SRC_NET].fd = s1->fd;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u32 = IO_SRC_COUNT;
+    epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->rearm_fd, &ev);
+    for(src = 0; src < IO_SRC_COUNT; src++) {
+        q = &s->queues[src];
+        if (q->fd >= 0) {
+            ev.events = EPOLLIN | EPOLLONESHOT;
+            ev.data.u32 = src;
+            /* regular files cannot be polled: they stay in select() */
+            if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, q->fd, &ev) < 0)
+                q->fd = -1;
+        }
+    }
+    if (s->queues[IO_SRC_NET].fd >= 0) {
+        m->net->select_fill = NULL;
+        m->net->select_poll = NULL;
+    }
+    if (pthread_create(&thread, NULL, io_thread_func, s) != 0) {
+        fprintf(stderr, "could not create the I/O thread\n");
+        exit(1);
+    }
+    pthread_detach(thread);
+    io_thread = s;
+}
+
+/* the I/O thread does not exist in a forked child. The queued data
+   belongs to the parent and is dropped. */
+static void io_thread_restart(VirtMachine *m)
+{
+    IOThreadState *s = io_thread;
+    close(s->epoll_fd);
+    close(s->rearm_fd);
+    free(s);
+    io_thread_start(m);
+}
+
+/* pass the queued data to the devices. It stays queued while a
+   device cannot accept it. Return TRUE if data is still queued. */
+static BOOL io_thread_poll(VirtMachine *m)
+{
+    IOThreadState *s = io_thread;
+    IOQueue *q;
+    IOBuffer *b;
+    uint32_t head;
+    uint64_t val;
+    uint8_t *ptr;
+    BOOL freed;
+    int src, len;
+
+    freed = FALSE;
+    for(src = 0; src < IO_SRC_COUNT; src++) {
+        q = &s->queues[src];
+        head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        while (q->tail != head) {
+            b = &q->tab[q->tail & (IO_QUEUE_LEN - 1)];
+            if (src == IO_SRC_CONSOLE) {
+                if (!virtio_console_can_write_data(m->console_dev))
+                    break;
+                if (b->len == 0) {
+                    /* EOF */
+                    exit(1);
+                }
+                len = virtio_console_get_write_len(m->console_dev);
+                len = min_int(len, b->len - b->pos);
+                if (len <= 0)
+                    break;
+                ptr = b->buf + b->pos;
+                b->pos += len;
+                len = console_filter(m->console->opaque, ptr, len);
+                if (len > 0)
+                    virtio_console_write_data(m->console_dev, ptr, len);
+                if (b->pos < b->len)
+                    break;
+            } else {
+                if (!m->net->device_can_write_packet(m->net))
+                    break;
+                m->net->device_write_packet(m->net, b->buf, b->len);
+            }
+            __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+            freed = TRUE;
+        }
+    }
+    if (freed) {
+        /* the stores to 'tail' must be visible before 'paused_mask' is
+           read (see io_thread_read()) */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&s->paused_mask, __ATOMIC_SEQ_CST) != 0) {
+            val = 1;
+            write(s->rearm_fd, &val, sizeof(val));
+        }
+    }
+    for(src = 0; src < IO_SRC_COUNT; src++) {
+        q = &s->queues[src];
+        if (q->tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* return TRUE if some queued data can be passed to its device. The
+   guest makes room in the console receive queue without notification,
+   so it must be tested before sleeping. */
+static BOOL io_thread_can_deliver(VirtMachine *m)
+{
+    IOThreadState *s = io_thread;
+    IOQueue *q;
+    int src;
+
+    for(src = 0; src < IO_SRC_COUNT; src++) {
+        q = &s->queues[src];
+        if (q->tail == __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+            continue;
+        if (src == IO_SRC_CONSOLE) {
+            if (virtio_console_can_write_data(m->console_dev) &&
+                virtio_console_get_write_len(m->console_dev) > 0)
+                return TRUE;
+        } else {
+            if (m->net->device_can_write_packet(m->net))
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+#endif /* CONFIG_IO_THREAD */
+
 #define MAX_EXEC_CYCLE 500000
-#define MAX_SLEEP_TIME 10 /* in ms */
+#define IO_EXEC_CYCLE 20000 /* while input data is waiting */
+#define SDL_REFRESH_TIME 10 /* in ms */
 
 void virt_machine_run(VirtMachine *m)
 {
     fd_set rfds, wfds, efds;
-    int fd_max, ret, delay;
-    struct timeval tv;
+    int fd_max, ret, net_delay, max_exec_cycle;
+    int64_t delay; /* in ns, -1 if no timeout */
+    BOOL io_pending;
 #ifndef _WIN32
     int stdin_fd;
 #endif
     
-    delay = virt_machine_get_sleep_duration(m, MAX_SLEEP_TIME);
+    /* with several harts, the CPUs run in their own threads and the
+       device emulation is only done with the I/O lock held */
+    virt_machine_io_lock(m, TRUE);
+    delay = -1;
+#ifdef CONFIG_SDL
+    if (m->fb_dev)
+        delay = (int64_t)SDL_REFRESH_TIME * 1000000;
+#endif
+    delay = virt_machine_get_sleep_duration(m, delay);
+#ifdef CONFIG_IO_THREAD
+    if (io_thread_can_deliver(m))
+        delay = 0;
+#endif
     
     /* wait for an event */
     FD_ZERO(&rfds);
@@ -551,11 +985,18 @@ void virt_machine_run(VirtMachine *m)
     FD_ZERO(&efds);
     fd_max = -1;
 #ifndef _WIN32
-    if (m->console_dev && virtio_console_can_write_data(m->console_dev)) {
+    stdin_fd = -1;
+    if (m->console_dev && m->console->read_data == console_read &&
+        virtio_console_can_write_data(m->console_dev)) {
         STDIODevice *s = m->console->opaque;
-        stdin_fd = s->stdin_fd;
-        FD_SET(stdin_fd, &rfds);
-        fd_max = stdin_fd;
+#ifdef CONFIG_IO_THREAD
+        if (io_thread->queues[IO_SRC_CONSOLE].fd < 0)
+#endif
+        {
+            stdin_fd = s->stdin_fd;
+            FD_SET(stdin_fd, &rfds);
+            fd_max = stdin_fd;
+        }
 
         if (s->resize_pending) {
             int width, height;
@@ -565,21 +1006,66 @@ void virt_machine_run(VirtMachine *m)
         }
     }
 #endif
-    if (m->net) {
-        m->net->select_fill(m->net, &fd_max, &rfds, &wfds, &efds, &delay);
+    net_delay = -1;
+    if (m->net && m->net->select_fill) {
+        m->net->select_fill(m->net, &fd_max, &rfds, &wfds, &efds, &net_delay);
     }
 #ifdef CONFIG_FS_NET
-    fs_net_set_fdset(&fd_max, &rfds, &wfds, &efds, &delay);
+    fs_net_set_fdset(&fd_max, &rfds, &wfds, &efds, &net_delay);
+#endif
+    if (net_delay >= 0 &&
+        (delay < 0 || (int64_t)net_delay * 1000000 < delay))
+        delay = (int64_t)net_delay * 1000000;
+#ifndef _WIN32
+    /* the signal handlers and the I/O thread wake up the idle machine */
+    if (delay != 0) {
+        FD_SET(wakeup_fds[0], &rfds);
+        fd_max = max_int(fd_max, wakeup_fds[0]);
+    }
+#endif
+#ifdef USE_TIMERFD
+    if (delay > 0 && wakeup_timer_fd >= 0) {
+        struct itimerspec its;
+        clock_gettime(CLOCK_MONOTONIC, &its.it_value);
+        delay += its.it_value.tv_nsec;
+        its.it_value.tv_sec += delay / 1000000000;
+        its.it_value.tv_nsec = delay % 1000000000;
+        its.it_interval.tv_sec = 0;
+        its.it_interval.tv_nsec = 0;
+        timerfd_settime(wakeup_timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+        FD_SET(wakeup_timer_fd, &rfds);
+        fd_max = max_int(fd_max, wakeup_timer_fd);
+        delay = -1;
+    }
+#endif
+    virt_machine_io_lock(m, FALSE);
+    /* no system call while the guest is running if there is nothing
+       to poll */
+    if (fd_max < 0 && delay == 0) {
+        ret = 0;
+    } else {
+#ifdef _WIN32
+        struct timeval tv;
+        tv.tv_sec = delay / 1000000000;
+        tv.tv_usec = (delay % 1000000000) / 1000;
+        ret = select(fd_max + 1, &rfds, &wfds, &efds,
+                     delay < 0 ? NULL : &tv);
+#else
+        struct timespec ts;
+        ts.tv_sec = delay / 1000000000;
+        ts.tv_nsec = delay % 1000000000;
+        ret = pselect(fd_max + 1, &rfds, &wfds, &efds,
+                      delay < 0 ? NULL : &ts, NULL);
 #endif
-    tv.tv_sec = delay / 1000;
-    tv.tv_usec = (delay % 1000) * 1000;
-    ret = select(fd_max + 1, &rfds, &wfds, &efds, &tv);
-    if (m->net) {
+    }
+    virt_machine_io_lock(m, TRUE);
+    if (m->net && m->net->select_poll) {
         m->net->select_poll(m->net, &rfds, &wfds, &efds, ret);
     }
+    io_pending = FALSE;
     if (ret > 0) {
 #ifndef _WIN32
-        if (m->console_dev && FD_ISSET(stdin_fd, &rfds)) {
+        if (stdin_fd >= 0 && FD_ISSET(stdin_fd, &rfds)) {
             uint8_t buf[128];
             int ret, len;
             len = virtio_console_get_write_len(m->console_dev);
@@ -587,16 +1073,230 @@ void virt_machine_run(VirtMachine *m)
             ret = m->console->read_data(m->console->opaque, buf, len);
             if (ret > 0) {
                 virtio_console_write_data(m->console_dev, buf, ret);
+                io_pending = TRUE;
             }
         }
+        if (FD_ISSET(wakeup_fds[0], &rfds)) {
+            uint8_t buf[64];
+            while (read(wakeup_fds[0], buf, sizeof(buf)) > 0)
+                continue;
+        }
+#endif
+#ifdef USE_TIMERFD
+        if (wakeup_timer_fd >= 0 && FD_ISSET(wakeup_timer_fd, &rfds)) {
+            uint64_t val;
+            read(wakeup_timer_fd, &val, sizeof(val));
+        }
 #endif
     }
+#ifdef CONFIG_IO_THREAD
+    if (io_thread_poll(m))
+        io_pending = TRUE;
+#endif
 
 #ifdef CONFIG_SDL
     sdl_refresh(m);
 #endif
     
-    virt_machine_interp(m, MAX_EXEC_CYCLE);
+    /* shorter slices to pass the input data to the guest sooner */
+    max_exec_cycle = io_pending ? IO_EXEC_CYCLE : MAX_EXEC_CYCLE;
+    virt_machine_interp(m, max_exec_cycle);
+    virt_machine_io_lock(m, FALSE);
+}
+
+#ifndef _WIN32
+
+/* Wait for the connections on the Unix socket 'socket_path' and fork
+   a child for each of them. The child shares the guest RAM copy on
+   write with the template machine and returns with the connection as
+   console. The template machine never returns. */
+static void fork_server_run(VirtMachine *m, const char *socket_path)
+{
+    struct sockaddr_un addr;
+    int listen_fd, fd;
+    uint32_t child_id;
+    pid_t pid;
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        exit(1);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", socket_path);
+        exit(1);
+    }
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 64) < 0) {
+        perror(socket_path);
+        exit(1);
+    }
+    /* the children are not waited for */
+    signal(SIGCHLD, SIG_IGN);
+    fprintf(stderr, "Fork server ready on %s\n", socket_path);
+
+    child_id = 0;
+    for(;;) {
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            exit(1);
+        }
+        child_id++;
+        fflush(stdout);
+        fflush(stderr);
+        pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            close(fd);
+        } else if (pid == 0) {
+            close(listen_fd);
+            signal(SIGCHLD, SIG_DFL);
+            /* the connection replaces the console of the template */
+            dup2(fd, 0);
+            dup2(fd, 1);
+            close(fd);
+            fcntl(0, F_SETFL, O_NONBLOCK);
+            block_device_reopen_all();
+            if (global_stdio_device)
+                global_stdio_device->resize_pending = TRUE;
+            m->fork_server = FALSE;
+            wakeup_init();
+#ifdef CONFIG_IO_THREAD
+            io_thread_restart(m);
+#endif
+            virt_machine_resume_fork(m, child_id);
+            return;
+        } else {
+            close(fd);
+        }
+    }
+}
+
+#endif /* !_WIN32 */
+
+/*******************************************************/
+/* benchmark mode: the guest marks the end of its phases through HTIF
+   and the statistics are printed as JSON on stdout */
+
+typedef struct {
+    uint32_t id;
+    int64_t time; /* in ns */
+    VirtMachineStats st;
+} BenchPoint;
+
+static const char *bench_config;
+static BenchPoint bench_start;
+static BenchPoint *bench_points;
+static int bench_point_count, bench_point_size;
+
+static void null_console_write(void *opaque, const uint8_t *buf, int len)
+{
+}
+
+static int null_console_read(void *opaque, uint8_t *buf, int len)
+{
+    return 0;
+}
+
+/* the guest devices are kept but its output is discarded */
+static CharacterDevice *null_console_init(void)
+{
+    CharacterDevice *dev;
+    dev = mallocz(sizeof(*dev));
+    dev->write_data = null_console_write;
+    dev->read_data = null_console_read;
+    return dev;
+}
+
+static void bench_print_string(const char *str)
+{
+    const uint8_t *p;
+
+    putchar('\"');
+    for(p = (const uint8_t *)str; *p != '\0'; p++) {
+        if (*p == '\"' || *p == '\\')
+            printf("\\%c", *p);
+        else if (*p < 0x20)
+            printf("\\u%04x", *p);
+        else
+            putchar(*p);
+    }
+    putchar('\"');
+}
+
+static void bench_print_stats(const BenchPoint *p0, const BenchPoint *p1)
+{
+    const VirtMachineStats *st0 = &p0->st, *st1 = &p1->st;
+    uint64_t n;
+    int64_t t;
+
+    n = st1->insn_counter - st0->insn_counter;
+    t = p1->time - p0->time;
+    printf("\"insn_counter\": %" PRIu64 ", \"wall_time_ms\": %.3f, "
+           "\"mips\": %.1f, ",
+           n, t / 1e6, t > 0 ? n * 1e3 / t : 0.0);
+    printf("\"tlb\": { \"code_miss\": %" PRIu64 ", \"page_walks\": %" PRIu64
+           " }, ",
+           st1->code_tlb_miss - st0->code_tlb_miss,
+           st1->page_walks - st0->page_walks);
+    printf("\"slow_path\": { \"read\": %" PRIu64 ", \"write\": %" PRIu64
+           " }, ",
+           st1->read_slow - st0->read_slow,
+           st1->write_slow - st0->write_slow);
+    printf("\"exceptions\": %" PRIu64 ", \"interrupts\": %" PRIu64 ", ",
+           st1->exceptions - st0->exceptions,
+           st1->interrupts - st0->interrupts);
+    printf("\"device\": { \"accesses\": %" PRIu64 ", \"time_ms\": %.3f }",
+           st1->devio_count - st0->devio_count,
+           (st1->devio_time - st0->devio_time) / 1e6);
+}
+
+static void bench_get_point(VirtMachine *m, BenchPoint *p, uint32_t id)
+{
+    p->id = id;
+    p->time = get_time_ns();
+    virt_machine_get_stats(m, &p->st);
+}
+
+static void bench_event(VirtMachine *m, int event, uint32_t id)
+{
+    const BenchPoint *p0;
+    int i;
+
+    if (bench_point_count >= bench_point_size) {
+        bench_point_size = max_int(16, bench_point_size * 2);
+        bench_points = realloc(bench_points,
+                               bench_point_size * sizeof(bench_points[0]));
+    }
+    bench_get_point(m, &bench_points[bench_point_count++], id);
+    if (event == BENCH_EVENT_PHASE)
+        return;
+
+    /* the last point ends the benchmark and is not a phase */
+    printf("{\n  \"config\": ");
+    bench_print_string(bench_config);
+    printf(",\n  \"end\": \"%s\",\n  \"phases\": [",
+           event == BENCH_EVENT_STOP ? "stop" : "poweroff");
+    p0 = &bench_start;
+    for(i = 0; i < bench_point_count - 1; i++) {
+        printf("%s\n    { \"id\": %u, ", i == 0 ? "" : ",",
+               bench_points[i].id);
+        bench_print_stats(p0, &bench_points[i]);
+        printf(" }");
+        p0 = &bench_points[i];
+    }
+    printf("%s],\n  \"total\": { ", bench_point_count > 1 ? "\n  " : " ");
+    bench_print_stats(&bench_start, &bench_points[bench_point_count - 1]);
+    printf(" }\n}\n");
+    fflush(stdout);
+    exit(0);
 }
 
 /*******************************************************/
@@ -609,6 +1309,13 @@ static struct option options[] = {
     { "append", required_argument },
     { "no-accel", no_argument },
     { "build-preload", required_argument },
+    { "jit", no_argument },
+    { "stats", no_argument },
+    { "save-snapshot", required_argument },
+    { "load-snapshot", required_argument },
+    { "fork-server", required_argument },
+    { "hugepages", no_argument },
+    { "bench", no_argument },
     { NULL },
 };
 
@@ -623,9 +1330,19 @@ void help(void)
            "                  emulated software\n"
            "-append cmdline   append cmdline to the kernel command line\n"
            "-no-accel         disable VM acceleration (KVM, x86 machine only)\n"
+           "-jit              translate the RV64 guest code to x86_64 code\n"
+           "-stats            print the CPU statistics when the guest powers off\n"
+           "-save-snapshot file  file written by C-a s or SIGUSR1\n"
+           "-load-snapshot file  restore the machine state from file\n"
+           "-hugepages        back the guest RAM with the host transparent huge pages\n"
+           "-fork-server path  when the guest reaches the fork point, fork a copy of\n"
+           "                  the machine for each connection to the Unix socket path\n"
+           "-bench            run without console and display, then print the statistics\n"
+           "                  in JSON when the guest powers off or ends the benchmark\n"
            "\n"
            "Console keys:\n"
-           "Press C-a x to exit the emulator, C-a h to get some help.\n");
+           "Press C-a x to exit the emulator, C-a s to save a snapshot, C-a h to get\n"
+           "some help.\n");
     exit(1);
 }
 
@@ -648,8 +1365,9 @@ int main(int argc, char **argv)
 {
     VirtMachine *s;
     const char *path, *cmdline, *build_preload_file;
+    const char *save_snapshot_file, *load_snapshot_file, *fork_server_path;
     int c, option_index, i, ram_size, accel_enable;
-    BOOL allow_ctrlc;
+    BOOL allow_ctrlc, jit_enable, dump_stats, huge_pages, bench_mode;
     BlockDeviceModeEnum drive_mode;
     VirtMachineParams p_s, *p = &p_s;
 
@@ -658,8 +1376,15 @@ int main(int argc, char **argv)
     (void)allow_ctrlc;
     drive_mode = BF_MODE_SNAPSHOT;
     accel_enable = -1;
+    jit_enable = FALSE;
+    dump_stats = FALSE;
+    huge_pages = FALSE;
+    bench_mode = FALSE;
     cmdline = NULL;
     build_preload_file = NULL;
+    save_snapshot_file = NULL;
+    load_snapshot_file = NULL;
+    fork_server_path = NULL;
     for(;;) {
         c = getopt_long_only(argc, argv, "hm:", options, &option_index);
         if (c == -1)
@@ -685,6 +1410,29 @@ int main(int argc, char **argv)
             case 6: /* build-preload */
                 build_preload_file = optarg;
                 break;
+            case 7: /* jit */
+                jit_enable = TRUE;
+                break;
+            case 8: /* stats */
+                dump_stats = TRUE;
+                break;
+            case 9: /* save-snapshot */
+                save_snapshot_file = optarg;
+                break;
+            case 10: /* load-snapshot */
+                load_snapshot_file = optarg;
+                break;
+#ifndef _WIN32
+            case 11: /* fork-server */
+                fork_server_path = optarg;
+                break;
+#endif
+            case 12: /* hugepages */
+                huge_pages = TRUE;
+                break;
+            case 13: /* bench */
+                bench_mode = TRUE;
+                break;
             default:
                 fprintf(stderr, "unknown option index: %d\n", option_index);
                 exit(1);
@@ -723,9 +1471,41 @@ int main(int argc, char **argv)
     }
     if (accel_enable != -1)
         p->accel_enable = accel_enable;
+    if (jit_enable)
+        p->jit_enable = TRUE;
+    if (dump_stats)
+        p->dump_stats = TRUE;
+    if (huge_pages)
+        p->huge_pages = TRUE;
     if (cmdline) {
         vm_add_cmdline(p, cmdline);
     }
+    if (fork_server_path) {
+        /* the children must not share a backend with the template */
+        if (p->cpu_count > 1) {
+            fprintf(stderr, "The fork server supports a single hart\n");
+            exit(1);
+        }
+        if (drive_mode == BF_MODE_RW) {
+            fprintf(stderr, "The fork server requires the snapshot disk mode\n");
+            exit(1);
+        }
+        for(i = 0; i < p->eth_count; i++) {
+            if (strcmp(p->tab_eth[i].driver, "user") != 0) {
+                fprintf(stderr, "The fork server only supports the user network driver\n");
+                exit(1);
+            }
+        }
+    }
+    if (bench_mode) {
+        if (!p->vmc->virt_machine_get_stats) {
+            fprintf(stderr, "-bench is not supported by this machine\n");
+            exit(1);
+        }
+        p->devio_profile = TRUE;
+        free(p->display_device);
+        p->display_device = NULL;
+    }
     
     /* open the files & devices */
     for(i = 0; i < p->drive_count; i++) {
@@ -802,6 +1582,13 @@ int main(int argc, char **argv)
         }
     }
     
+#ifndef _WIN32
+    wakeup_init();
+#endif
+    if (bench_mode) {
+        /* stdout only gets the results */
+        p->console = null_console_init();
+    } else
 #ifdef CONFIG_SDL
     if (p->display_device) {
         sdl_init(p->width, p->height);
@@ -823,12 +1610,42 @@ int main(int argc, char **argv)
     
     virt_machine_free_config(p);
 
+    if (load_snapshot_file) {
+        if (virt_machine_load_snapshot(s, load_snapshot_file) < 0)
+            exit(1);
+    }
+#ifndef _WIN32
+    signal(SIGUSR1, snapshot_signal_handler);
+#endif
+
     if (s->net) {
         s->net->device_set_carrier(s->net, TRUE);
     }
+    if (fork_server_path)
+        s->fork_server = TRUE;
+#ifdef CONFIG_IO_THREAD
+    io_thread_start(s);
+#endif
+    if (bench_mode) {
+        bench_config = path;
+        bench_get_point(s, &bench_start, 0);
+        s->bench_event = bench_event;
+    }
     
     for(;;) {
         virt_machine_run(s);
+#ifndef _WIN32
+        if (s->fork_pending)
+            fork_server_run(s, fork_server_path);
+#endif
+        if (snapshot_requested) {
+            snapshot_requested = 0;
+            if (!save_snapshot_file) {
+                fprintf(stderr, "No snapshot file (use -save-snapshot)\n");
+            } else if (virt_machine_save_snapshot(s, save_snapshot_file) == 0) {
+                fprintf(stderr, "Snapshot saved to %s\n", save_snapshot_file);
+            }
+        }
     }
     virt_machine_end(s);
     return 0;
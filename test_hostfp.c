@@ -0,0 +1,311 @@
+/*
+ * Differential test of the host FPU fast path against softfp
+ *
+ * Copyright (c) 2026 TinyEMU contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "cutils.h"
+#include "softfp.h"
+
+/* Must be built with the same flags as riscv_cpu.c (in particular
+   -ffp-contract=off) so that the tested code is the one used by the
+   emulator. Every result and every exception flag must be identical
+   to softfp. */
+
+#ifdef CONFIG_HOST_FPU
+#include <math.h>
+#include <float.h>
+#if FLT_EVAL_METHOD != 0
+#undef CONFIG_HOST_FPU
+#endif
+#endif
+
+#define F_SIZE 32
+#include "riscv_cpu_hostfp_template.h"
+#define F_SIZE 64
+#include "riscv_cpu_hostfp_template.h"
+
+typedef enum {
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_SQRT,
+    OP_FMA,
+    OP_COUNT,
+} OpEnum;
+
+static const char *op_names[OP_COUNT] = {
+    "add", "sub", "mul", "div", "sqrt", "fma",
+};
+
+typedef struct {
+    int f_size;
+    int mant_size;
+    uint32_t exp_mask;
+    uint64_t (*host_op)(OpEnum op, uint64_t a, uint64_t b, uint64_t c,
+                        uint32_t *pfflags);
+    uint64_t (*soft_op)(OpEnum op, uint64_t a, uint64_t b, uint64_t c,
+                        uint32_t *pfflags);
+} FloatFormat;
+
+static uint64_t host_op32(OpEnum op, uint64_t a, uint64_t b, uint64_t c,
+                          uint32_t *pfflags)
+{
+    switch(op) {
+    case OP_ADD:
+        return host_add_sf32(a, b, RM_RNE, pfflags);
+    case OP_SUB:
+        return host_sub_sf32(a, b, RM_RNE, pfflags);
+    case OP_MUL:
+        return host_mul_sf32(a, b, RM_RNE, pfflags);
+    case OP_DIV:
+        return host_div_sf32(a, b, RM_RNE, pfflags);
+    case OP_SQRT:
+        return host_sqrt_sf32(a, RM_RNE, pfflags);
+    case OP_FMA:
+        return host_fma_sf32(a, b, c, RM_RNE, pfflags);
+    default:
+        abort();
+    }
+}
+
+static uint64_t soft_op32(OpEnum op, uint64_t a, uint64_t b, uint64_t c,
+                          uint32_t *pfflags)
+{
+    switch(op) {
+    case OP_ADD:
+        return add_sf32(a, b, RM_RNE, pfflags);
+    case OP_SUB:
+        return sub_sf32(a, b, RM_RNE, pfflags);
+    case OP_MUL:
+        return mul_sf32(a, b, RM_RNE, pfflags);
+    case OP_DIV:
+        return div_sf32(a, b, RM_RNE, pfflags);
+    case OP_SQRT:
+        return sqrt_sf32(a, RM_RNE, pfflags);
+    case OP_FMA:
+        return fma_sf32(a, b, c, RM_RNE, pfflags);
+    default:
+        abort();
+    }
+}
+
+static uint64_t host_op64(OpEnum op, uint64_t a, uint64_t b, uint64_t c,
+                          uint32_t *pfflags)
+{
+    switch(op) {
+    case OP_ADD:
+        return host_add_sf64(a, b, RM_RNE, pfflags);
+    case OP_SUB:
+        return host_sub_sf64(a, b, RM_RNE, pfflags);
+    case OP_MUL:
+        return host_mul_sf64(a, b, RM_RNE, pfflags);
+    case OP_DIV:
+        return host_div_sf64(a, b, RM_RNE, pfflags);
+    case OP_SQRT:
+        return host_sqrt_sf64(a, RM_RNE, pfflags);
+    case OP_FMA:
+        return host_fma_sf64(a, b, c, RM_RNE, pfflags);
+    default:
+        abort();
+    }
+}
+
+static uint64_t soft_op64(OpEnum op, uint64_t a, uint64_t b, uint64_t c,
+                          uint32_t *pfflags)
+{
+    switch(op) {
+    case OP_ADD:
+        return add_sf64(a, b, RM_RNE, pfflags);
+    case OP_SUB:
+        return sub_sf64(a, b, RM_RNE, pfflags);
+    case OP_MUL:
+        return mul_sf64(a, b, RM_RNE, pfflags);
+    case OP_DIV:
+        return div_sf64(a, b, RM_RNE, pfflags);
+    case OP_SQRT:
+        return sqrt_sf64(a, RM_RNE, pfflags);
+    case OP_FMA:
+        return fma_sf64(a, b, c, RM_RNE, pfflags);
+    default:
+        abort();
+    }
+}
+
+static const FloatFormat formats[] = {
+    { 32, 23, 0xff, host_op32, soft_op32 },
+    { 64, 52, 0x7ff, host_op64, soft_op64 },
+};
+
+static uint64_t rand_state = 1;
+
+/* xorshift64* */
+static uint64_t rand64(void)
+{
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return rand_state * 0x2545f4914f6cdd1dULL;
+}
+
+static uint64_t make_float(const FloatFormat *f, uint32_t sign, uint32_t e,
+                           uint64_t m)
+{
+    return ((uint64_t)sign << (f->f_size - 1)) |
+        ((uint64_t)e << f->mant_size) |
+        (m & (((uint64_t)1 << f->mant_size) - 1));
+}
+
+/* exponents around the limits of the fast path */
+static uint32_t rand_exp(const FloatFormat *f)
+{
+    uint32_t r = rand64() % 8;
+    int d = (int)(rand64() % 5) - 2;
+    int e;
+    switch(r) {
+    case 0:
+        e = 0;
+        break;
+    case 1:
+        e = f->exp_mask;
+        break;
+    case 2:
+        e = 1 + d;
+        break;
+    case 3:
+        e = f->mant_size + 2 + d;
+        break;
+    case 4:
+        e = f->exp_mask - 1 + d;
+        break;
+    case 5:
+        e = (f->exp_mask >> 1) + d; /* close to 1.0 */
+        break;
+    default:
+        e = rand64() % (f->exp_mask + 1);
+        break;
+    }
+    if (e < 0)
+        e = 0;
+    else if (e > f->exp_mask)
+        e = f->exp_mask;
+    return e;
+}
+
+/* few significant bits so that exact results are frequent */
+static uint64_t rand_mant(const FloatFormat *f)
+{
+    uint64_t m = rand64();
+    switch(rand64() % 4) {
+    case 0:
+        m &= (uint64_t)-1 << (f->mant_size - 3);
+        break;
+    case 1:
+        m = 0;
+        break;
+    default:
+        break;
+    }
+    return m;
+}
+
+static uint64_t rand_float(const FloatFormat *f)
+{
+    if (rand64() % 4 == 0)
+        return rand64() >> (64 - f->f_size);
+    return make_float(f, rand64() & 1, rand_exp(f), rand_mant(f));
+}
+
+/* operand close to 'a' to test the cancellations */
+static uint64_t rand_near(const FloatFormat *f, uint64_t a)
+{
+    a += (int64_t)(rand64() % 16) - 8;
+    if (rand64() & 1)
+        a ^= (uint64_t)1 << (f->f_size - 1);
+    return a & ((uint64_t)-1 >> (64 - f->f_size));
+}
+
+static int test_format(const FloatFormat *f, long n_iter)
+{
+    uint64_t a, b, c, r1, r2;
+    uint32_t fflags1, fflags2;
+    int op;
+    long i;
+
+    for(op = 0; op < OP_COUNT; op++) {
+        for(i = 0; i < n_iter; i++) {
+            a = rand_float(f);
+            b = rand_float(f);
+            c = rand_float(f);
+            switch(rand64() % 4) {
+            case 0:
+                b = rand_near(f, a);
+                break;
+            case 1:
+                /* c close to -a*b */
+                fflags1 = 0;
+                c = rand_near(f, f->soft_op(OP_MUL, a, b, 0, &fflags1));
+                break;
+            default:
+                break;
+            }
+            fflags1 = 0;
+            fflags2 = 0;
+            r1 = f->host_op(op, a, b, c, &fflags1);
+            r2 = f->soft_op(op, a, b, c, &fflags2);
+            if (r1 != r2 || fflags1 != fflags2) {
+                printf("%s_sf%d(0x%" PRIx64 ", 0x%" PRIx64 ", 0x%" PRIx64 "): "
+                       "host=0x%" PRIx64 " fflags=0x%x "
+                       "softfp=0x%" PRIx64 " fflags=0x%x\n",
+                       op_names[op], f->f_size, a, b, c,
+                       r1, fflags1, r2, fflags2);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    long n_iter;
+    int i;
+
+    n_iter = 1000000;
+    if (argc >= 2)
+        n_iter = strtol(argv[1], NULL, 0);
+    if (argc >= 3)
+        rand_state = strtoull(argv[2], NULL, 0) | 1;
+#ifndef CONFIG_HOST_FPU
+    printf("warning: the host FPU fast path is disabled\n");
+#endif
+    for(i = 0; i < countof(formats); i++) {
+        if (test_format(&formats[i], n_iter) < 0)
+            return 1;
+    }
+    printf("OK (%ld tests per operation)\n", n_iter);
+    return 0;
+}
@@ -0,0 +1,1203 @@
+/*
+ * Test of the RISC-V vector extension
+ *
+ * Copyright (c) 2026 TinyEMU contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include "cutils.h"
+#include "iomem.h"
+#include "riscv_cpu.h"
+
+/* The test programs are generated here so that no RISC-V toolchain is
+   needed. They run on a RV64 CPU linked with this program, the results
+   being stored in RAM and compared with a model of the instructions.
+
+   The trap handler runs in M mode. It records the trap and either
+   skips the instruction or maps a page and executes the instruction
+   again, which resumes it from vstart. The programs must not use s10
+   and s11 which are reserved for it. */
+
+/* must be built with the same TLB geometry as riscv_cpu.c */
+#ifndef TLB_SIZE
+#define TLB_SIZE 256
+#endif
+#ifndef TLB_WAYS
+#define TLB_WAYS 2
+#endif
+
+#define VLENB 16
+
+#define RAM_SIZE (4 << 20)
+#define CODE_ADDR 0x1000 /* reset address */
+#define REC_ADDR 0x20000 /* trap record */
+#define DATA_ADDR 0x30000 /* initial vector registers */
+#define OUT_ADDR 0x31000 /* final vector registers and CSRs */
+#define RES_ADDR 0x32000 /* values stored by the programs */
+#define PT_ADDR 0x100000 /* page tables */
+#define PT_PAGES 64
+#define TEST_PADDR 0x200000 /* RAM mapped at TEST_VADDR */
+#define TEST_VADDR 0x40000000
+
+/* trap record */
+#define REC_COUNT 0
+#define REC_CAUSE 8
+#define REC_TVAL 16
+#define REC_VSTART 24
+#define REC_VL 32
+#define REC_ACTION 64 /* 0 = skip, 1 = store the PTE and restart */
+#define REC_PTE_ADDR 72
+#define REC_PTE_VAL 80
+
+#define CAUSE_ILLEGAL_INSTRUCTION 2
+#define CAUSE_LOAD_PAGE_FAULT 13
+#define CAUSE_STORE_PAGE_FAULT 15
+
+#define PTE_V (1 << 0)
+#define PTE_R (1 << 1)
+#define PTE_W (1 << 2)
+#define PTE_X (1 << 3)
+#define PTE_A (1 << 6)
+#define PTE_D (1 << 7)
+
+enum {
+    R_ZERO = 0,
+    R_T0 = 5,
+    R_T1 = 6,
+    R_T2 = 7,
+    R_A0 = 10,
+    R_A1 = 11,
+    R_S10 = 26,
+    R_S11 = 27,
+};
+
+/* CSRs */
+#define CSR_VSTART 0x008
+#define CSR_VXSAT 0x009
+#define CSR_MSTATUS 0x300
+#define CSR_MTVEC 0x305
+#define CSR_MEPC 0x341
+#define CSR_MCAUSE 0x342
+#define CSR_MTVAL 0x343
+#define CSR_SATP 0x180
+#define CSR_VL 0xc20
+#define CSR_VTYPE 0xc21
+#define CSR_VLENB 0xc22
+
+#define MSTATUS_VS_INITIAL (1 << 9)
+#define MSTATUS_VS (3 << 9)
+#define MSTATUS_MPP (3 << 11)
+#define MSTATUS_MPP_S (1 << 11)
+
+/* OP-V funct3 */
+#define OPIVV 0
+#define OPMVV 2
+
+#define VTYPE_VILL_BIT (1 << 8) /* reserved vtype bit in vsetvli */
+
+#define CODE_SIZE_MAX 4096
+
+static uint32_t code_buf[CODE_SIZE_MAX];
+static int code_len;
+
+static PhysMemoryMap *mem_map;
+static uint8_t *ram;
+static RISCVCPUStats cpu_stats; /* of the last program */
+static int n_tests;
+
+static void emit(uint32_t insn)
+{
+    assert(code_len < CODE_SIZE_MAX);
+    code_buf[code_len++] = insn;
+}
+
+static void emit_lui(int rd, uint32_t imm)
+{
+    emit((imm & 0xfffff000) | (rd << 7) | 0x37);
+}
+
+static void emit_addi(int rd, int rs1, int imm)
+{
+    emit(((imm & 0xfff) << 20) | (rs1 << 15) | (rd << 7) | 0x13);
+}
+
+static void emit_auipc(int rd, uint32_t imm)
+{
+    emit((imm & 0xfffff000) | (rd << 7) | 0x17);
+}
+
+/* only positive 31 bit values */
+static void emit_li(int rd, uint32_t val)
+{
+    assert(val < 0x80000000);
+    if ((val + 0x800) >> 12 != 0) {
+        emit_lui(rd, (val + 0x800) & 0xfffff000);
+        emit_addi(rd, rd, (int32_t)(val << 20) >> 20);
+    } else {
+        emit_addi(rd, R_ZERO, val);
+    }
+}
+
+static void emit_slli(int rd, int rs1, int shift)
+{
+    emit((shift << 20) | (rs1 << 15) | (1 << 12) | (rd << 7) | 0x13);
+}
+
+static void emit_or(int rd, int rs1, int rs2)
+{
+    emit((rs2 << 20) | (rs1 << 15) | (6 << 12) | (rd << 7) | 0x33);
+}
+
+static void emit_load(int funct3, int rd, int rs1, int imm)
+{
+    emit(((imm & 0xfff) << 20) | (rs1 << 15) | (funct3 << 12) |
+         (rd << 7) | 0x03);
+}
+
+static void emit_store(int funct3, int rs2, int rs1, int imm)
+{
+    emit(((imm >> 5) << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) |
+         ((imm & 0x1f) << 7) | 0x23);
+}
+
+/* 'target' is an index in code_buf[] */
+static void emit_bne(int rs1, int rs2, int target)
+{
+    int imm = (target - code_len) * 4;
+    emit((((imm >> 12) & 1) << 31) | (((imm >> 5) & 0x3f) << 25) |
+         (rs2 << 20) | (rs1 << 15) | (1 << 12) |
+         (((imm >> 1) & 0xf) << 8) | (((imm >> 11) & 1) << 7) | 0x63);
+}
+
+static uint32_t jal_insn(int rd, int imm)
+{
+    return (((imm >> 20) & 1) << 31) | (((imm >> 1) & 0x3ff) << 21) |
+        (((imm >> 11) & 1) << 20) | (((imm >> 12) & 0xff) << 12) |
+        (rd << 7) | 0x6f;
+}
+
+/* funct3: 1 = csrrw, 2 = csrrs, 3 = csrrc */
+static void emit_csr(int funct3, int rd, int csr, int rs1)
+{
+    emit((csr << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | 0x73);
+}
+
+static void emit_csrr(int rd, int csr)
+{
+    emit_csr(2, rd, csr, R_ZERO);
+}
+
+static void emit_csrw(int csr, int rs1)
+{
+    emit_csr(1, R_ZERO, csr, rs1);
+}
+
+static uint32_t vtype_val(int sew_log2, int lmul_log2)
+{
+    return (sew_log2 << 3) | (lmul_log2 & 7);
+}
+
+static uint32_t vsetvli_insn(int rd, int rs1, uint32_t vtype)
+{
+    return ((vtype & 0x7ff) << 20) | (rs1 << 15) | (7 << 12) | (rd << 7) |
+        0x57;
+}
+
+static void emit_vsetvli(int rd, int rs1, uint32_t vtype)
+{
+    emit(vsetvli_insn(rd, rs1, vtype));
+}
+
+static void emit_vsetivli(int rd, int uimm, uint32_t vtype)
+{
+    emit((3 << 30) | ((vtype & 0x3ff) << 20) | (uimm << 15) | (7 << 12) |
+         (rd << 7) | 0x57);
+}
+
+static void emit_vsetvl(int rd, int rs1, int rs2)
+{
+    emit((0x40 << 25) | (rs2 << 20) | (rs1 << 15) | (7 << 12) | (rd << 7) |
+         0x57);
+}
+
+#define VOP_INSN(funct6, funct3, vm, vd, vs2, vs1)                      \
+    (((uint32_t)(funct6) << 26) | ((vm) << 25) | ((vs2) << 20) |        \
+     ((vs1) << 15) | ((funct3) << 12) | ((vd) << 7) | 0x57)
+
+#define VMEM_WIDTH(eew) \
+    ((eew) == 8 ? 0 : (eew) == 16 ? 5 : (eew) == 32 ? 6 : 7)
+
+/* vector load (is_store = 0) or store. 'lumop' is the rs2 field. */
+#define VMEM_INSN(is_store, nf, mop, vm, lumop, rs1, eew, vd)            \
+    (((uint32_t)((nf) - 1) << 29) | ((mop) << 26) | ((vm) << 25) |     \
+     ((lumop) << 20) | ((rs1) << 15) | (VMEM_WIDTH(eew) << 12) |        \
+     ((vd) << 7) | ((is_store) ? 0x27 : 0x07))
+
+/* vle<eew>.v or vse<eew>.v */
+static void emit_vle(int is_store, int eew, int vd, int rs1)
+{
+    emit(VMEM_INSN(is_store, 1, 0, 1, 0, rs1, eew, vd));
+}
+
+/* vl8re8.v or vs8r.v of the 32 registers at 'addr' */
+static void emit_vregs(int is_store, uint32_t addr)
+{
+    int i;
+    emit_li(R_T0, addr);
+    for(i = 0; i < 32; i += 8) {
+        emit(VMEM_INSN(is_store, 8, 0, 1, 8, R_T0, 8, i));
+        emit_addi(R_T0, R_T0, 8 * VLENB);
+    }
+}
+
+/* store the vector registers and CSRs to OUT_ADDR */
+static void emit_dump(void)
+{
+    static const int csr_tab[4] = { CSR_VL, CSR_VTYPE, CSR_VSTART,
+                                    CSR_VXSAT };
+    int i;
+    emit_vregs(1, OUT_ADDR);
+    for(i = 0; i < 4; i++) {
+        emit_csrr(R_T1, csr_tab[i]);
+        emit_store(3, R_T1, R_T0, i * 8);
+    }
+}
+
+/* store 'reg' at RES_ADDR + 8 * idx */
+static void emit_result(int reg, int idx)
+{
+    emit_li(R_T2, RES_ADDR);
+    emit_store(3, reg, R_T2, idx * 8);
+}
+
+static void emit_trap_handler(void)
+{
+    int map_label;
+
+    /* the vector CSRs are read even if the vector unit was off */
+    emit_li(R_S11, MSTATUS_VS_INITIAL);
+    emit_csr(2, R_ZERO, CSR_MSTATUS, R_S11);
+    emit_li(R_S10, REC_ADDR);
+    emit_load(3, R_S11, R_S10, REC_COUNT);
+    emit_addi(R_S11, R_S11, 1);
+    emit_store(3, R_S11, R_S10, REC_COUNT);
+    emit_csrr(R_S11, CSR_MCAUSE);
+    emit_store(3, R_S11, R_S10, REC_CAUSE);
+    emit_csrr(R_S11, CSR_MTVAL);
+    emit_store(3, R_S11, R_S10, REC_TVAL);
+    emit_csrr(R_S11, CSR_VSTART);
+    emit_store(3, R_S11, R_S10, REC_VSTART);
+    emit_csrr(R_S11, CSR_VL);
+    emit_store(3, R_S11, R_S10, REC_VL);
+    emit_load(3, R_S11, R_S10, REC_ACTION);
+    map_label = code_len + 5;
+    emit_bne(R_S11, R_ZERO, map_label);
+    /* skip the instruction */
+    emit_csrr(R_S11, CSR_MEPC);
+    emit_addi(R_S11, R_S11, 4);
+    emit_csrw(CSR_MEPC, R_S11);
+    emit(0x30200073); /* mret */
+    assert(code_len == map_label);
+    /* map the page once and restart the instruction */
+    emit_store(3, R_ZERO, R_S10, REC_ACTION);
+    emit_load(3, R_S11, R_S10, REC_PTE_VAL);
+    emit_load(3, R_S10, R_S10, REC_PTE_ADDR);
+    emit_store(3, R_S11, R_S10, 0);
+    emit(0x12000073); /* sfence.vma */
+    emit(0x30200073); /* mret */
+}
+
+/* start a program in M mode or in S mode with the page tables */
+static void prog_begin(BOOL s_mode)
+{
+    int start;
+
+    code_len = 0;
+    emit(0); /* jump to 'start' */
+    emit_trap_handler();
+    start = code_len;
+    code_buf[0] = jal_insn(R_ZERO, start * 4);
+
+    memset(ram + REC_ADDR, 0, 4096);
+    memset(ram + OUT_ADDR, 0, 4096);
+    memset(ram + RES_ADDR, 0, 4096);
+    emit_li(R_T0, CODE_ADDR + 4);
+    emit_csrw(CSR_MTVEC, R_T0);
+    emit_li(R_T0, MSTATUS_VS_INITIAL);
+    emit_csr(2, R_ZERO, CSR_MSTATUS, R_T0);
+    if (s_mode) {
+        /* sv39 */
+        emit_li(R_T0, 8);
+        emit_slli(R_T0, R_T0, 60);
+        emit_li(R_T1, PT_ADDR >> 12);
+        emit_or(R_T0, R_T0, R_T1);
+        emit_csrw(CSR_SATP, R_T0);
+        emit_li(R_T0, MSTATUS_MPP);
+        emit_csr(3, R_ZERO, CSR_MSTATUS, R_T0);
+        emit_li(R_T0, MSTATUS_MPP_S);
+        emit_csr(2, R_ZERO, CSR_MSTATUS, R_T0);
+        emit_auipc(R_T0, 0);
+        emit_addi(R_T0, R_T0, 16);
+        emit_csrw(CSR_MEPC, R_T0);
+        emit(0x30200073); /* mret */
+    }
+}
+
+/* run the program. Return -1 if it did not terminate. */
+static int prog_run(void)
+{
+    RISCVCPUState *s;
+    int i, ret;
+
+    emit(0x10500073); /* wfi: stops the CPU */
+    memcpy(ram + CODE_ADDR, code_buf, code_len * 4);
+    s = riscv_cpu_init(mem_map, 64);
+    for(i = 0; i < 100 && !riscv_cpu_get_power_down(s); i++)
+        riscv_cpu_interp(s, 100000);
+    ret = riscv_cpu_get_power_down(s) ? 0 : -1;
+    if (ret < 0)
+        printf("the program did not terminate\n");
+    cpu_stats = *riscv_cpu_get_stats(s);
+    riscv_cpu_end(s);
+    n_tests++;
+    return ret;
+}
+
+static uint64_t ram_ld(uint32_t addr)
+{
+    uint64_t v;
+    memcpy(&v, ram + addr, 8);
+    return v;
+}
+
+static void ram_sd(uint32_t addr, uint64_t v)
+{
+    memcpy(ram + addr, &v, 8);
+}
+
+static uint64_t rand_state = 1;
+
+/* xorshift64* */
+static uint64_t rand64(void)
+{
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return rand_state * 0x2545f4914f6cdd1dULL;
+}
+
+static void rand_bytes(uint8_t *buf, int len)
+{
+    int i;
+    for(i = 0; i < len; i++)
+        buf[i] = rand64() >> 56;
+}
+
+/* page tables: the first GB is identity mapped with a gigapage */
+
+static int pt_pages;
+
+static void pt_init(void)
+{
+    memset(ram + PT_ADDR, 0, PT_PAGES << 12);
+    pt_pages = 1;
+    ram_sd(PT_ADDR, PTE_V | PTE_R | PTE_W | PTE_X | PTE_A | PTE_D);
+}
+
+/* return the address of the PTE of 'vaddr' */
+static uint32_t pt_get_pte(uint32_t vaddr)
+{
+    uint32_t table, pte_addr;
+    uint64_t pte;
+    int level;
+
+    table = PT_ADDR;
+    for(level = 2; level > 0; level--) {
+        pte_addr = table + ((vaddr >> (12 + 9 * level)) & 511) * 8;
+        pte = ram_ld(pte_addr);
+        if (!(pte & PTE_V)) {
+            assert(pt_pages < PT_PAGES);
+            pte = ((uint64_t)(PT_ADDR >> 12) + pt_pages++) << 10 | PTE_V;
+            ram_sd(pte_addr, pte);
+        }
+        table = (pte >> 10) << 12;
+    }
+    return table + ((vaddr >> 12) & 511) * 8;
+}
+
+static uint64_t pte_val(uint32_t paddr)
+{
+    return ((uint64_t)(paddr >> 12) << 10) | PTE_V | PTE_R | PTE_W |
+        PTE_A | PTE_D;
+}
+
+static void pt_map(uint32_t vaddr, uint32_t paddr)
+{
+    ram_sd(pt_get_pte(vaddr), pte_val(paddr));
+}
+
+/* model of the vector registers */
+
+static uint8_t vreg_ref[32 * VLENB];
+
+static uint64_t vget(int reg, int i, int sew_log2)
+{
+    uint64_t v = 0;
+    memcpy(&v, vreg_ref + reg * VLENB + (i << sew_log2), 1 << sew_log2);
+    return v;
+}
+
+static void vset(int reg, int i, int sew_log2, uint64_t v)
+{
+    memcpy(vreg_ref + reg * VLENB + (i << sew_log2), &v, 1 << sew_log2);
+}
+
+static int vmask_bit(int i)
+{
+    return (vreg_ref[i >> 3] >> (i & 7)) & 1;
+}
+
+/* random initial registers in vreg_ref and in RAM */
+static void vregs_init(void)
+{
+    rand_bytes(vreg_ref, sizeof(vreg_ref));
+    memcpy(ram + DATA_ADDR, vreg_ref, sizeof(vreg_ref));
+}
+
+static int vregs_check(const char *name)
+{
+    int r, i;
+    if (!memcmp(ram + OUT_ADDR, vreg_ref, sizeof(vreg_ref)))
+        return 0;
+    for(r = 0; r < 32; r++) {
+        if (memcmp(ram + OUT_ADDR + r * VLENB, vreg_ref + r * VLENB, VLENB)) {
+            printf("%s: v%d=", name, r);
+            for(i = VLENB - 1; i >= 0; i--)
+                printf("%02x", ram[OUT_ADDR + r * VLENB + i]);
+            printf(" expected=");
+            for(i = VLENB - 1; i >= 0; i--)
+                printf("%02x", vreg_ref[r * VLENB + i]);
+            printf("\n");
+            break;
+        }
+    }
+    return -1;
+}
+
+static int check_val(const char *name, const char *what, uint64_t val,
+                     uint64_t expected)
+{
+    if (val == expected)
+        return 0;
+    printf("%s: %s=0x%" PRIx64 " expected=0x%" PRIx64 "\n",
+           name, what, val, expected);
+    return -1;
+}
+
+static uint32_t get_vlmax(int sew_log2, int lmul_log2)
+{
+    return (VLENB << 3) >> (3 + sew_log2 - lmul_log2);
+}
+
+/* vsetvli, vsetivli and vsetvl with all the vtype values */
+static int test_vsetvl(void)
+{
+    static const uint32_t avl_tab[] = { 0, 1, 3, 15, 16, 17, 31, 1000 };
+    uint32_t vtype, vlmax, avl, vl;
+    int sew_log2, lmul_code, lmul_log2, i, n, valid, k;
+    char name[64];
+
+    prog_begin(FALSE);
+    emit_csrr(R_T1, CSR_VLENB);
+    emit_result(R_T1, 0);
+    if (prog_run() < 0 || check_val("vlenb", "vlenb", ram_ld(RES_ADDR),
+                                    VLENB))
+        return -1;
+
+    for(sew_log2 = 0; sew_log2 < 8; sew_log2++) {
+        for(lmul_code = 0; lmul_code < 8; lmul_code++) {
+            lmul_log2 = (lmul_code << 29) >> 29;
+            valid = sew_log2 <= 3 && lmul_code != 4 &&
+                sew_log2 <= lmul_log2 + 3;
+            vlmax = valid ? get_vlmax(sew_log2, lmul_log2) : 0;
+            snprintf(name, sizeof(name), "vsetvl e%d lmul_code=%d",
+                     8 << sew_log2, lmul_code);
+            prog_begin(FALSE);
+            n = 0;
+            for(k = 0; k < 4; k++) {
+                /* the tail and mask policies do not change vl */
+                vtype = vtype_val(sew_log2, lmul_code) | (k << 6);
+                for(i = 0; i < countof(avl_tab); i++) {
+                    emit_li(R_T0, avl_tab[i]);
+                    emit_vsetvli(R_A0, R_T0, vtype);
+                    emit_result(R_A0, n++);
+                    emit_csrr(R_T1, CSR_VTYPE);
+                    emit_result(R_T1, n++);
+                }
+                /* rs1 = x0: vl = VLMAX */
+                emit_vsetvli(R_A0, R_ZERO, vtype);
+                emit_result(R_A0, n++);
+                emit_vsetivli(R_A0, 17, vtype);
+                emit_result(R_A0, n++);
+                emit_li(R_T0, 5);
+                emit_li(R_T1, vtype);
+                emit_vsetvl(R_A0, R_T0, R_T1);
+                emit_result(R_A0, n++);
+            }
+            if (prog_run() < 0)
+                return -1;
+            n = 0;
+            for(k = 0; k < 4; k++) {
+                vtype = vtype_val(sew_log2, lmul_code) | (k << 6);
+                for(i = 0; i < countof(avl_tab); i++) {
+                    avl = avl_tab[i];
+                    vl = avl < vlmax ? avl : vlmax;
+                    if (check_val(name, "vl", ram_ld(RES_ADDR + n++ * 8), vl) ||
+                        check_val(name, "vtype", ram_ld(RES_ADDR + n++ * 8),
+                                  valid ? vtype : (uint64_t)1 << 63))
+                        return -1;
+                }
+                if (check_val(name, "vl(x0)", ram_ld(RES_ADDR + n++ * 8),
+                              vlmax) ||
+                    check_val(name, "vl(vsetivli)",
+                              ram_ld(RES_ADDR + n++ * 8), min_int(17, vlmax)) ||
+                    check_val(name, "vl(vsetvl)", ram_ld(RES_ADDR + n++ * 8),
+                              min_int(5, vlmax)))
+                    return -1;
+            }
+        }
+    }
+    /* vsetvli with a reserved vtype bit and with rd = rs1 = x0 */
+    prog_begin(FALSE);
+    emit_li(R_T0, 7);
+    emit_vsetvli(R_ZERO, R_T0, vtype_val(0, 0));
+    emit_vsetvli(R_ZERO, R_ZERO, vtype_val(1, 1)); /* same VLMAX */
+    emit_csrr(R_T1, CSR_VL);
+    emit_result(R_T1, 0);
+    emit_vsetvli(R_A0, R_T0, vtype_val(0, 0) | VTYPE_VILL_BIT);
+    emit_result(R_A0, 1);
+    emit_csrr(R_T1, CSR_VTYPE);
+    emit_result(R_T1, 2);
+    if (prog_run() < 0 ||
+        check_val("vsetvli x0, x0", "vl", ram_ld(RES_ADDR), 7) ||
+        check_val("vsetvli vill", "vl", ram_ld(RES_ADDR + 8), 0) ||
+        check_val("vsetvli vill", "vtype", ram_ld(RES_ADDR + 16),
+                  (uint64_t)1 << 63))
+        return -1;
+    return 0;
+}
+
+/* single width integer operations: vd = vs2 op vs1 */
+
+typedef enum {
+    VOP_ADD,
+    VOP_SUB,
+    VOP_MINU,
+    VOP_MIN,
+    VOP_MAXU,
+    VOP_MAX,
+    VOP_AND,
+    VOP_OR,
+    VOP_XOR,
+    VOP_SADDU,
+    VOP_SADD,
+    VOP_SSUBU,
+    VOP_SSUB,
+    VOP_SLL,
+    VOP_SRL,
+    VOP_SRA,
+    VOP_MUL,
+    VOP_MULH,
+    VOP_MULHU,
+    VOP_DIVU,
+    VOP_DIV,
+    VOP_REMU,
+    VOP_REM,
+} VOpEnum;
+
+typedef struct {
+    const char *name;
+    VOpEnum op;
+    uint8_t funct3;
+    uint8_t funct6;
+} VOpDef;
+
+static const VOpDef vop_defs[] = {
+    { "vadd", VOP_ADD, OPIVV, 0x00 },
+    { "vsub", VOP_SUB, OPIVV, 0x02 },
+    { "vminu", VOP_MINU, OPIVV, 0x04 },
+    { "vmin", VOP_MIN, OPIVV, 0x05 },
+    { "vmaxu", VOP_MAXU, OPIVV, 0x06 },
+    { "vmax", VOP_MAX, OPIVV, 0x07 },
+    { "vand", VOP_AND, OPIVV, 0x09 },
+    { "vor", VOP_OR, OPIVV, 0x0a },
+    { "vxor", VOP_XOR, OPIVV, 0x0b },
+    { "vsaddu", VOP_SADDU, OPIVV, 0x20 },
+    { "vsadd", VOP_SADD, OPIVV, 0x21 },
+    { "vssubu", VOP_SSUBU, OPIVV, 0x22 },
+    { "vssub", VOP_SSUB, OPIVV, 0x23 },
+    { "vsll", VOP_SLL, OPIVV, 0x25 },
+    { "vsrl", VOP_SRL, OPIVV, 0x28 },
+    { "vsra", VOP_SRA, OPIVV, 0x29 },
+    { "vmul", VOP_MUL, OPMVV, 0x25 },
+    { "vmulh", VOP_MULH, OPMVV, 0x27 },
+    { "vmulhu", VOP_MULHU, OPMVV, 0x24 },
+    { "vdivu", VOP_DIVU, OPMVV, 0x20 },
+    { "vdiv", VOP_DIV, OPMVV, 0x21 },
+    { "vremu", VOP_REMU, OPMVV, 0x22 },
+    { "vrem", VOP_REM, OPMVV, 0x23 },
+};
+
+static uint64_t mulhu64(uint64_t a, uint64_t b)
+{
+    uint64_t a0 = (uint32_t)a, a1 = a >> 32, b0 = (uint32_t)b, b1 = b >> 32;
+    uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+    return p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+}
+
+static int64_t sext(uint64_t a, int sew)
+{
+    return (int64_t)(a << (64 - sew)) >> (64 - sew);
+}
+
+/* the operands are zero extended, the result is truncated by the
+   caller */
+static uint64_t vop_ref(VOpEnum op, uint64_t a, uint64_t b, int sew,
+                        int *psat)
+{
+    uint64_t umax = (uint64_t)-1 >> (64 - sew);
+    int64_t smin = -((int64_t)1 << (sew - 1)) , smax = umax >> 1;
+    int64_t sa = sext(a, sew), sb = sext(b, sew), r;
+    uint64_t h;
+
+    switch(op) {
+    case VOP_ADD:
+        return a + b;
+    case VOP_SUB:
+        return a - b;
+    case VOP_MINU:
+        return a < b ? a : b;
+    case VOP_MIN:
+        return sa < sb ? a : b;
+    case VOP_MAXU:
+        return a > b ? a : b;
+    case VOP_MAX:
+        return sa > sb ? a : b;
+    case VOP_AND:
+        return a & b;
+    case VOP_OR:
+        return a | b;
+    case VOP_XOR:
+        return a ^ b;
+    case VOP_SADDU:
+        if (((a + b) & umax) < a) {
+            *psat = 1;
+            return umax;
+        }
+        return a + b;
+    case VOP_SSUBU:
+        if (a < b) {
+            *psat = 1;
+            return 0;
+        }
+        return a - b;
+    case VOP_SADD:
+    case VOP_SSUB:
+        r = sext(op == VOP_SADD ? a + b : a - b, sew);
+        /* overflow if the result has the wrong sign */
+        if (op == VOP_SADD ? (sa >= 0) == (sb >= 0) && (r >= 0) != (sa >= 0) :
+            (sa >= 0) != (sb >= 0) && (r >= 0) != (sa >= 0)) {
+            *psat = 1;
+            return sa < 0 ? smin : smax;
+        }
+        return r;
+    case VOP_SLL:
+        return a << (b & (sew - 1));
+    case VOP_SRL:
+        return a >> (b & (sew - 1));
+    case VOP_SRA:
+        return sa >> (b & (sew - 1));
+    case VOP_MUL:
+        return a * b;
+    case VOP_MULHU:
+        if (sew == 64)
+            return mulhu64(a, b);
+        return (a * b) >> sew;
+    case VOP_MULH:
+        if (sew == 64) {
+            h = mulhu64(a, b);
+            if (sa < 0)
+                h -= b;
+            if (sb < 0)
+                h -= a;
+            return h;
+        }
+        return (uint64_t)((sa * sb) >> sew);
+    case VOP_DIVU:
+        return b == 0 ? umax : a / b;
+    case VOP_REMU:
+        return b == 0 ? a : a % b;
+    case VOP_DIV:
+        if (b == 0)
+            return -1;
+        if (sa == smin && sb == -1)
+            return a;
+        return sa / sb;
+    case VOP_REM:
+        if (b == 0)
+            return a;
+        if (sa == smin && sb == -1)
+            return 0;
+        return sa % sb;
+    default:
+        abort();
+    }
+}
+
+/* each operation with all the SEW and LMUL values, masked or not */
+static int test_vop(const VOpDef *d)
+{
+    uint32_t vlmax, vl;
+    int sew_log2, lmul_log2, vm, i, j, sew, nregs, sat;
+    uint64_t a, b;
+    char name[64];
+
+    for(sew_log2 = 0; sew_log2 <= 3; sew_log2++) {
+        for(lmul_log2 = sew_log2 - 3; lmul_log2 <= 3; lmul_log2++) {
+            for(vm = 0; vm <= 1; vm++) {
+                sew = 8 << sew_log2;
+                snprintf(name, sizeof(name), "%s.vv e%d lmul_log2=%d vm=%d",
+                         d->name, sew, lmul_log2, vm);
+                vregs_init();
+                /* small values to test the division by zero and the
+                   overflows */
+                nregs = lmul_log2 > 0 ? 1 << lmul_log2 : 1;
+                for(i = 0; i < nregs * VLENB; i++) {
+                    if (rand64() % 4 == 0)
+                        vreg_ref[24 * VLENB + i] = rand64() % 2 ? 0 : 0xff;
+                    if (rand64() % 4 == 0)
+                        vreg_ref[16 * VLENB + i] = rand64() % 2 ? 0x80 : 0;
+                }
+                memcpy(ram + DATA_ADDR, vreg_ref, sizeof(vreg_ref));
+                vlmax = get_vlmax(sew_log2, lmul_log2);
+                vl = 1 + rand64() % vlmax;
+
+                prog_begin(FALSE);
+                emit_vregs(0, DATA_ADDR);
+                emit_li(R_T0, vl);
+                emit_vsetvli(R_ZERO, R_T0, vtype_val(sew_log2, lmul_log2));
+                emit(VOP_INSN(d->funct6, d->funct3, vm, 8, 16, 24));
+                emit_dump();
+                if (prog_run() < 0)
+                    return -1;
+
+                sat = 0;
+                for(j = 0; j < vl; j++) {
+                    if (!vm && !vmask_bit(j))
+                        continue;
+                    /* the element j of the groups v8, v16 and v24 */
+                    a = vget(16, j, sew_log2);
+                    b = vget(24, j, sew_log2);
+                    vset(8, j, sew_log2, vop_ref(d->op, a, b, sew, &sat));
+                }
+                if (vregs_check(name) ||
+                    check_val(name, "vl", ram_ld(OUT_ADDR + 512), vl) ||
+                    check_val(name, "vxsat", ram_ld(OUT_ADDR + 536), sat))
+                    return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* register group constraints */
+
+typedef struct {
+    const char *name;
+    int sew_log2;
+    int lmul_log2;
+    uint32_t insn;
+    BOOL illegal;
+} IllegalDef;
+
+#define VADD(vd, vs2, vs1, vm) VOP_INSN(0x00, OPIVV, vm, vd, vs2, vs1)
+#define VWADDU(vd, vs2, vs1) VOP_INSN(0x30, OPMVV, 1, vd, vs2, vs1)
+#define VNSRL(vd, vs2, vs1) VOP_INSN(0x2c, OPIVV, 1, vd, vs2, vs1)
+#define VRGATHER(vd, vs2, vs1) VOP_INSN(0x0c, OPIVV, 1, vd, vs2, vs1)
+#define VCOMPRESS(vd, vs2, vs1) VOP_INSN(0x17, OPMVV, 1, vd, vs2, vs1)
+/* vs1 = 6: vzext.vf2, 4: vzext.vf4 */
+#define VZEXT(vd, vs2, vf) VOP_INSN(0x12, OPMVV, 1, vd, vs2, vf)
+/* the address is in a0 */
+#define VLE(eew, vd, vm) VMEM_INSN(0, 1, 0, vm, 0, R_A0, eew, vd)
+#define VLSEG(nf, vd) VMEM_INSN(0, nf, 0, 1, 0, R_A0, 8, vd)
+#define VLRE8(nregs, vd) VMEM_INSN(0, nregs, 0, 1, 8, R_A0, 8, vd)
+
+static const IllegalDef illegal_defs[] = {
+    { "vadd.vv v8, v16, v24 (m8)", 0, 3, VADD(8, 16, 24, 1), FALSE },
+    { "vadd.vv v1, v16, v24 (m2)", 0, 1, VADD(1, 16, 24, 1), TRUE },
+    { "vadd.vv v8, v18, v24 (m4)", 1, 2, VADD(8, 18, 24, 1), TRUE },
+    { "vadd.vv v8, v16, v25 (m2)", 2, 1, VADD(8, 16, 25, 1), TRUE },
+    { "vadd.vv v8, v16, v20 (m8)", 3, 3, VADD(8, 16, 20, 1), TRUE },
+    { "vadd.vv v0, v16, v24, v0.t", 0, 0, VADD(0, 16, 24, 0), TRUE },
+    { "vadd.vv v0, v16, v24", 0, 0, VADD(0, 16, 24, 1), FALSE },
+    /* widening: the source may only overlap the highest part of the
+       destination if its EMUL >= 1 */
+    { "vwaddu.vv v2, v3, v8 (m1)", 0, 0, VWADDU(2, 3, 8), FALSE },
+    { "vwaddu.vv v2, v2, v8 (m1)", 0, 0, VWADDU(2, 2, 8), TRUE },
+    { "vwaddu.vv v2, v8, v2 (m1)", 0, 0, VWADDU(2, 8, 2), TRUE },
+    { "vwaddu.vv v2, v2, v8 (mf2)", 0, -1, VWADDU(2, 2, 8), TRUE },
+    { "vwaddu.vv v3, v16, v24 (m1)", 0, 0, VWADDU(3, 16, 24), TRUE },
+    { "vwaddu.vv v8, v16, v24 (m8)", 0, 3, VWADDU(8, 16, 24), TRUE },
+    { "vwaddu.vv v8, v16, v24 (e64)", 3, 0, VWADDU(8, 16, 24), TRUE },
+    /* narrowing: the destination may only overlap the lowest part of
+       the source */
+    { "vnsrl.wv v2, v2, v8 (m1)", 0, 0, VNSRL(2, 2, 8), FALSE },
+    { "vnsrl.wv v3, v2, v8 (m1)", 0, 0, VNSRL(3, 2, 8), TRUE },
+    { "vnsrl.wv v8, v3, v16 (m1)", 0, 0, VNSRL(8, 3, 16), TRUE },
+    { "vnsrl.wv v8, v16, v8 (m1)", 0, 0, VNSRL(8, 16, 8), FALSE },
+    { "vrgather.vv v8, v16, v24", 0, 0, VRGATHER(8, 16, 24), FALSE },
+    { "vrgather.vv v8, v8, v16", 0, 0, VRGATHER(8, 8, 16), TRUE },
+    { "vrgather.vv v8, v16, v8", 0, 0, VRGATHER(8, 16, 8), TRUE },
+    { "vcompress.vm v8, v8, v0", 0, 0, VCOMPRESS(8, 8, 0), TRUE },
+    { "vcompress.vm v8, v16, v8", 0, 0, VCOMPRESS(8, 16, 8), TRUE },
+    { "vzext.vf2 v8, v9 (e16 m2)", 1, 1, VZEXT(8, 9, 6), FALSE },
+    { "vzext.vf2 v8, v8 (e16 m2)", 1, 1, VZEXT(8, 8, 6), TRUE },
+    { "vzext.vf4 v8, v16 (e16)", 1, 0, VZEXT(8, 16, 4), TRUE },
+    /* loads: EMUL = EEW / SEW * LMUL */
+    { "vle32.v v4 (e8 m1)", 0, 0, VLE(32, 4, 1), FALSE },
+    { "vle32.v v2 (e8 m1)", 0, 0, VLE(32, 2, 1), TRUE },
+    { "vle64.v v8 (e8 m1)", 0, 0, VLE(64, 8, 1), FALSE },
+    { "vle64.v v4 (e8 m1)", 0, 0, VLE(64, 4, 1), TRUE },
+    { "vle8.v v1 (e8 m2)", 0, 1, VLE(8, 1, 1), TRUE },
+    { "vle8.v v0, v0.t", 0, 0, VLE(8, 0, 0), TRUE },
+    { "vl2re8.v v2", 0, 0, VLRE8(2, 2), FALSE },
+    { "vl2re8.v v1", 0, 0, VLRE8(2, 1), TRUE },
+    { "vl3re8.v v3", 0, 0, VLRE8(3, 3), TRUE },
+    { "vlseg4e8.v v8 (m2)", 0, 1, VLSEG(4, 8), FALSE },
+    { "vlseg4e8.v v28 (m2)", 0, 1, VLSEG(4, 28), TRUE },
+    { "vlseg8e8.v v8 (m2)", 0, 1, VLSEG(8, 8), TRUE },
+};
+
+static int run_illegal(const char *name, uint32_t insn, BOOL illegal,
+                       int sew_log2, int lmul_log2, int setup)
+{
+    prog_begin(FALSE);
+    emit_li(R_A0, DATA_ADDR);
+    emit_li(R_T0, 1000);
+    if (setup == 1) {
+        /* reserved vtype */
+        emit_vsetvli(R_ZERO, R_T0, VTYPE_VILL_BIT);
+    } else {
+        emit_vsetvli(R_ZERO, R_T0, vtype_val(sew_log2, lmul_log2));
+    }
+    if (setup == 2) {
+        /* vector unit off */
+        emit_li(R_T0, MSTATUS_VS);
+        emit_csr(3, R_ZERO, CSR_MSTATUS, R_T0);
+    }
+    emit(insn);
+    if (prog_run() < 0 ||
+        check_val(name, "traps", ram_ld(REC_ADDR + REC_COUNT), illegal))
+        return -1;
+    if (illegal &&
+        check_val(name, "mcause", ram_ld(REC_ADDR + REC_CAUSE),
+                  CAUSE_ILLEGAL_INSTRUCTION))
+        return -1;
+    return 0;
+}
+
+static int test_illegal(void)
+{
+    const IllegalDef *d;
+    int i;
+
+    for(i = 0; i < countof(illegal_defs); i++) {
+        d = &illegal_defs[i];
+        if (run_illegal(d->name, d->insn, d->illegal, d->sew_log2,
+                        d->lmul_log2, 0))
+            return -1;
+    }
+    if (run_illegal("vadd.vv with vill", VADD(8, 16, 24, 1), TRUE, 0, 0, 1) ||
+        run_illegal("vadd.vv with VS off", VADD(8, 16, 24, 1), TRUE,
+                    0, 0, 2) ||
+        run_illegal("vsetvli with VS off",
+                    vsetvli_insn(R_ZERO, R_T0, vtype_val(0, 0)), TRUE, 0, 0, 2) ||
+        run_illegal("vl1re8.v with vill", VLRE8(1, 8), FALSE, 0, 0, 1))
+        return -1;
+    return 0;
+}
+
+/* memory accesses with page faults. TEST_VADDR + i * 4 KB is mapped to
+   TEST_PADDR + i * 4 KB for the even values of i, the odd pages are
+   not mapped. */
+
+#define PAGE(i) (TEST_VADDR + (i) * 4096)
+#define PPAGE(i) (TEST_PADDR + (i) * 4096)
+
+static void mem_init(void)
+{
+    int i;
+    pt_init();
+    rand_bytes(ram + TEST_PADDR, 8 * 4096);
+    for(i = 0; i < 8; i += 2)
+        pt_map(PAGE(i), PPAGE(i));
+    /* allocate the tables of the odd pages */
+    for(i = 1; i < 8; i += 2)
+        pt_get_pte(PAGE(i));
+}
+
+/* map the page 'i' and restart the instruction at the next fault */
+static void mem_map_on_fault(int i)
+{
+    ram_sd(REC_ADDR + REC_ACTION, 1);
+    ram_sd(REC_ADDR + REC_PTE_ADDR, pt_get_pte(PAGE(i)));
+    ram_sd(REC_ADDR + REC_PTE_VAL, pte_val(PPAGE(i)));
+}
+
+static int check_trap(const char *name, int cause, uint64_t tval,
+                      uint64_t vstart)
+{
+    if (check_val(name, "traps", ram_ld(REC_ADDR + REC_COUNT), 1) ||
+        check_val(name, "mcause", ram_ld(REC_ADDR + REC_CAUSE), cause) ||
+        check_val(name, "mtval", ram_ld(REC_ADDR + REC_TVAL), tval) ||
+        check_val(name, "vstart", ram_ld(REC_ADDR + REC_VSTART), vstart))
+        return -1;
+    return 0;
+}
+
+/* fault-only-first loads: vl is reduced if an element i > 0 faults */
+static int test_fof(void)
+{
+    const char *name = "vle8ff.v";
+
+    vregs_init();
+    mem_init();
+    prog_begin(TRUE);
+    emit_vregs(0, DATA_ADDR);
+    /* fault at element 5 */
+    emit_li(R_T0, 16);
+    emit_vsetvli(R_ZERO, R_T0, vtype_val(0, 0));
+    emit_li(R_A0, PAGE(1) - 5);
+    emit(VMEM_INSN(0, 1, 0, 1, 0x10, R_A0, 8, 8));
+    emit_csrr(R_T1, CSR_VL);
+    emit_result(R_T1, 0);
+    /* fault at element 2 with EEW = 32 */
+    emit_li(R_T0, 4);
+    emit_vsetvli(R_ZERO, R_T0, vtype_val(2, 0));
+    emit_li(R_A0, PAGE(3) - 8);
+    emit(VMEM_INSN(0, 1, 0, 1, 0x10, R_A0, 32, 9));
+    emit_csrr(R_T1, CSR_VL);
+    emit_result(R_T1, 1);
+    /* no fault */
+    emit_li(R_T0, 16);
+    emit_vsetvli(R_ZERO, R_T0, vtype_val(0, 0));
+    emit_li(R_A0, PAGE(4) + 100);
+    emit(VMEM_INSN(0, 1, 0, 1, 0x10, R_A0, 8, 10));
+    emit_csrr(R_T1, CSR_VL);
+    emit_result(R_T1, 2);
+    /* fault at element 0: trap and vl is unchanged */
+    emit_li(R_A0, PAGE(5));
+    emit(VMEM_INSN(0, 1, 0, 1, 0x10, R_A0, 8, 11));
+    emit_csrr(R_T1, CSR_VL);
+    emit_result(R_T1, 3);
+    emit_dump();
+    if (prog_run() < 0)
+        return -1;
+
+    memcpy(vreg_ref + 8 * VLENB, ram + PPAGE(1) - 5, 5);
+    memcpy(vreg_ref + 9 * VLENB, ram + PPAGE(3) - 8, 8);
+    memcpy(vreg_ref + 10 * VLENB, ram + PPAGE(4) + 100, 16);
+    if (check_val(name, "vl", ram_ld(RES_ADDR), 5) ||
+        check_val(name, "vl(eew=32)", ram_ld(RES_ADDR + 8), 2) ||
+        check_val(name, "vl(no fault)", ram_ld(RES_ADDR + 16), 16) ||
+        check_val(name, "vl(element 0)", ram_ld(RES_ADDR + 24), 16) ||
+        check_trap(name, CAUSE_LOAD_PAGE_FAULT, PAGE(5), 0) ||
+        vregs_check(name))
+        return -1;
+    return 0;
+}
+
+/* a faulting access sets vstart. The instruction is resumed from
+   vstart once the page is mapped. */
+static int test_resume(void)
+{
+    const char *name;
+
+    /* load from the middle of a page into the next one */
+    name = "vle8.v resume";
+    vregs_init();
+    mem_init();
+    prog_begin(TRUE);
+    mem_map_on_fault(1);
+    emit_vregs(0, DATA_ADDR);
+    emit_li(R_T0, 128);
+    emit_vsetvli(R_ZERO, R_T0, vtype_val(0, 3));
+    emit_li(R_A0, PAGE(1) - 48);
+    emit_vle(0, 8, 8, R_A0);
+    emit_dump();
+    if (prog_run() < 0)
+        return -1;
+    memcpy(vreg_ref + 8 * VLENB, ram + PPAGE(1) - 48, 128);
+    if (check_trap(name, CAUSE_LOAD_PAGE_FAULT, PAGE(1), 48) ||
+        vregs_check(name) ||
+        check_val(name, "final vstart", ram_ld(OUT_ADDR + 528), 0))
+        return -1;
+
+    /* store */
+    name = "vse8.v resume";
+    vregs_init();
+    mem_init();
+    prog_begin(TRUE);
+    mem_map_on_fault(3);
+    emit_vregs(0, DATA_ADDR);
+    emit_li(R_T0, 128);
+    emit_vsetvli(R_ZERO, R_T0, vtype_val(0, 3));
+    emit_li(R_A0, PAGE(3) - 80);
+    emit_vle(1, 8, 16, R_A0);
+    emit_dump();
+    if (prog_run() < 0)
+        return -1;
+    if (check_trap(name, CAUSE_STORE_PAGE_FAULT, PAGE(3), 80) ||
+        vregs_check(name))
+        return -1;
+    if (memcmp(ram + PPAGE(3) - 80, vreg_ref + 16 * VLENB, 128)) {
+        printf("%s: bad memory contents\n", name);
+        return -1;
+    }
+
+    /* the element 3 crosses the page boundary, so the instruction is
+       resumed in the middle of the first page */
+    name = "vle32.v resume";
+    vregs_init();
+    mem_init();
+    prog_begin(TRUE);
+    mem_map_on_fault(5);
+    emit_vregs(0, DATA_ADDR);
+    emit_li(R_T0, 16);
+    emit_vsetvli(R_ZERO, R_T0, vtype_val(2, 2));
+    emit_li(R_A0, PAGE(5) - 14);
+    emit_vle(0, 32, 4, R_A0);
+    emit_dump();
+    if (prog_run() < 0)
+        return -1;
+    memcpy(vreg_ref + 4 * VLENB, ram + PPAGE(5) - 14, 64);
+    if (check_val(name, "traps", ram_ld(REC_ADDR + REC_COUNT), 1) ||
+        check_val(name, "vstart", ram_ld(REC_ADDR + REC_VSTART), 3) ||
+        vregs_check(name))
+        return -1;
+    return 0;
+}
+
+/* The unit stride accesses copy a page at once when it is in the TLB.
+   The pages are accessed so that their entries are in the last way
+   and in the victim buffer: the copies must use them instead of the
+   slow path. */
+#define ALIAS_PAGE(i) (TEST_VADDR + (i) * TLB_SIZE * 4096)
+#define ALIAS_PPAGE(i) (TEST_PADDR + (i) * 4096)
+#define ALIAS_COUNT (TLB_WAYS + 1)
+
+static int test_tlb_ways(void)
+{
+    const char *name = "vle8.v/vse8.v TLB ways";
+    int i, dst;
+
+    pt_init();
+    rand_bytes(ram + TEST_PADDR, 2 * ALIAS_COUNT * 4096);
+    for(i = 0; i < 2 * ALIAS_COUNT; i++)
+        pt_map(ALIAS_PAGE(i), ALIAS_PPAGE(i));
+
+    prog_begin(TRUE);
+    /* the pages 0 to ALIAS_COUNT - 1 are read and the next ones are
+       written. The first one ends in the victim buffer, the second
+       one in the last way. */
+    for(i = 0; i < ALIAS_COUNT; i++) {
+        emit_li(R_A0, ALIAS_PAGE(i));
+        emit_load(3, R_T1, R_A0, 0);
+        emit_li(R_A0, ALIAS_PAGE(ALIAS_COUNT + i));
+        emit_store(3, R_ZERO, R_A0, 1024);
+    }
+    emit_li(R_T0, 16);
+    emit_vsetvli(R_ZERO, R_T0, vtype_val(0, 0));
+    for(i = TLB_WAYS > 1 ? 1 : 0; i >= 0; i--) {
+        emit_li(R_A0, ALIAS_PAGE(i));
+        emit_vle(0, 8, 8, R_A0);
+        emit_li(R_A0, ALIAS_PAGE(ALIAS_COUNT + i));
+        emit_vle(1, 8, 8, R_A0);
+    }
+    if (prog_run() < 0)
+        return -1;
+
+    for(i = TLB_WAYS > 1 ? 1 : 0; i >= 0; i--) {
+        dst = ALIAS_COUNT + i;
+        if (memcmp(ram + ALIAS_PPAGE(dst), ram + ALIAS_PPAGE(i), 16)) {
+            printf("%s: bad memory contents\n", name);
+            return -1;
+        }
+    }
+    if (check_val(name, "traps", ram_ld(REC_ADDR + REC_COUNT), 0) ||
+        check_val(name, "read_slow", cpu_stats.read_slow, ALIAS_COUNT) ||
+        check_val(name, "write_slow", cpu_stats.write_slow, ALIAS_COUNT) ||
+        check_val(name, "tlb_way_hit", cpu_stats.tlb_way_hit,
+                  TLB_WAYS > 1 ? 2 : 0) ||
+        check_val(name, "tlb_victim_hit", cpu_stats.tlb_victim_hit, 2))
+        return -1;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    PhysMemoryRange *pr;
+    RISCVCPUState *s;
+    int i;
+
+    if (argc >= 2)
+        rand_state = strtoull(argv[1], NULL, 0) | 1;
+    mem_map = phys_mem_map_init();
+    pr = cpu_register_ram(mem_map, 0, RAM_SIZE, 0);
+    ram = pr->phys_mem;
+
+    s = riscv_cpu_init(mem_map, 64);
+    if (!(riscv_cpu_get_misa(s) & (1 << ('V' - 'A')))) {
+        printf("warning: the vector extension is disabled\n");
+        return 0;
+    }
+    riscv_cpu_end(s);
+
+    if (test_vsetvl() < 0)
+        return 1;
+    for(i = 0; i < countof(vop_defs); i++) {
+        if (test_vop(&vop_defs[i]) < 0)
+            return 1;
+    }
+    if (test_illegal() < 0 ||
+        test_fof() < 0 ||
+        test_resume() < 0 ||
+        test_tlb_ways() < 0)
+        return 1;
+    phys_mem_map_end(mem_map);
+    printf("OK (%d programs)\n", n_tests);
+    return 0;
+}
@@ -148,6 +148,7 @@ struct VIRTIODevice {
     VIRTIODeviceRecvFunc *device_recv;
     void (*config_write)(VIRTIODevice *s); /* called after the config
                                               is written */
+    void (*device_snapshot)(VIRTIODevice *s, SnapshotFile *f);
     uint32_t config_space_size; /* in bytes, must be multiple of 4 */
     uint8_t config_space[MAX_CONFIG_SPACE_SIZE];
 };
@@ -155,6 +156,8 @@ struct VIRTIODevice {
 static uint32_t virtio_mmio_read(void *opaque, uint32_t offset1, int size_log2);
 static void virtio_mmio_write(void *opaque, uint32_t offset,
                               uint32_t val, int size_log2);
+static void virtio_mmio_notify_write(void *opaque, uint32_t offset,
+                                     uint32_t val, int size_log2);
 static uint32_t virtio_pci_read(void *opaque, uint32_t offset, int size_log2);
 static void virtio_pci_write(void *opaque, uint32_t offset,
                              uint32_t val, int size_log2);
@@ -285,6 +288,8 @@ static void virtio_init(VIRTIODevice *s, VIRTIOBusDef *bus,
         s->mem_range = cpu_register_device(s->mem_map, bus->addr, VIRTIO_PAGE_SIZE,
                                            s, virtio_mmio_read, virtio_mmio_write,
                                            DEVIO_SIZE8 | DEVIO_SIZE16 | DEVIO_SIZE32);
+        cpu_register_device_reg(s->mem_range, VIRTIO_MMIO_QUEUE_NOTIFY,
+                                NULL, virtio_mmio_notify_write, DEVIO_SIZE32);
         s->get_ram_ptr = virtio_mmio_get_ram_ptr;
     }
 
@@ -716,6 +721,15 @@ static void set_low32(virtio_phys_addr_t *paddr, uint32_t val)
 }
 #endif
 
+/* QueueNotify is written by the driver for each request */
+static void virtio_mmio_notify_write(void *opaque, uint32_t offset,
+                                     uint32_t val, int size_log2)
+{
+    VIRTIODevice *s = opaque;
+    if (val < MAX_QUEUE)
+        queue_notify(s, val);
+}
+
 static void virtio_mmio_write(void *opaque, uint32_t offset,
                               uint32_t val, int size_log2)
 {
@@ -970,6 +984,23 @@ void virtio_set_debug(VIRTIODevice *s, int debug)
     s->debug = debug;
 }
 
+/* the queues are in the guest RAM, so only their configuration is
+   saved */
+void virtio_snapshot(VIRTIODevice *s, SnapshotFile *f)
+{
+    snapshot_section(f, "virtio");
+    snapshot_check(f, "virtio device_id", s->device_id);
+    snapshot_check(f, "virtio config size", s->config_space_size);
+    snapshot_var(f, s->int_status);
+    snapshot_var(f, s->status);
+    snapshot_var(f, s->device_features_sel);
+    snapshot_var(f, s->queue_sel);
+    snapshot_var(f, s->queue);
+    snapshot_var(f, s->config_space);
+    if (s->device_snapshot)
+        s->device_snapshot(s, f);
+}
+
 static void virtio_config_change_notify(VIRTIODevice *s)
 {
     /* INT_CONFIG interrupt */
@@ -1114,6 +1145,18 @@ static int virtio_block_recv_request(VIRTIODevice *s, int queue_idx,
     return 0;
 }
 
+static void virtio_block_snapshot(VIRTIODevice *s1, SnapshotFile *f)
+{
+    VIRTIOBlockDevice *s = (VIRTIOBlockDevice *)s1;
+
+    if (s->req_in_progress) {
+        snapshot_error(f, "a block request is in progress");
+        return;
+    }
+    if (s->bs->snapshot)
+        s->bs->snapshot(s->bs, f);
+}
+
 VIRTIODevice *virtio_block_init(VIRTIOBusDef *bus, BlockDevice *bs)
 {
     VIRTIOBlockDevice *s;
@@ -1122,6 +1165,7 @@ VIRTIODevice *virtio_block_init(VIRTIOBusDef *bus, BlockDevice *bs)
     s = mallocz(sizeof(*s));
     virtio_init(&s->common, bus,
                 2, 8, virtio_block_recv_request);
+    s->common.device_snapshot = virtio_block_snapshot;
     s->bs = bs;
     
     nb_sectors = bs->get_sector_count(bs);
@@ -1232,6 +1276,12 @@ static void virtio_net_set_carrier(EthernetDevice *es, BOOL carrier_state)
 #endif
 }
 
+static void virtio_net_snapshot(VIRTIODevice *s1, SnapshotFile *f)
+{
+    VIRTIONetDevice *s = (VIRTIONetDevice *)s1;
+    snapshot_var(f, s->header_size);
+}
+
 VIRTIODevice *virtio_net_init(VIRTIOBusDef *bus, EthernetDevice *es)
 {
     VIRTIONetDevice *s;
@@ -1242,6 +1292,7 @@ VIRTIODevice *virtio_net_init(VIRTIOBusDef *bus, EthernetDevice *es)
     /* VIRTIO_NET_F_MAC, VIRTIO_NET_F_STATUS */
     s->common.device_features = (1 << 5) /* | (1 << 16) */;
     s->common.queue[0].manual_recv = TRUE;
+    s->common.device_snapshot = virtio_net_snapshot;
     s->es = es;
     memcpy(s->common.config_space, es->mac_addr, 6);
     /* status */
@@ -1629,6 +1680,12 @@ static void virtio_input_config_write(VIRTIODevice *s)
     }
 }
 
+static void virtio_input_snapshot(VIRTIODevice *s1, SnapshotFile *f)
+{
+    VIRTIOInputDevice *s = (VIRTIOInputDevice *)s1;
+    snapshot_var(f, s->buttons_state);
+}
+
 VIRTIODevice *virtio_input_init(VIRTIOBusDef *bus, VirtioInputTypeEnum type)
 {
     VIRTIOInputDevice *s;
@@ -1639,6 +1696,7 @@ VIRTIODevice *virtio_input_init(VIRTIOBusDef *bus, VirtioInputTypeEnum type)
     s->common.queue[0].manual_recv = TRUE;
     s->common.device_features = 0;
     s->common.config_write = virtio_input_config_write;
+    s->common.device_snapshot = virtio_input_snapshot;
     s->type = type;
     return (VIRTIODevice *)s;
 }
@@ -2621,6 +2679,18 @@ static int virtio_9p_recv_request(VIRTIODevice *s1, int queue_idx,
     goto error;
 }
 
+/* the open files of the host cannot be saved */
+static void virtio_9p_snapshot(VIRTIODevice *s1, SnapshotFile *f)
+{
+    VIRTIO9PDevice *s = (VIRTIO9PDevice *)s1;
+
+    if (s->req_in_progress || !list_empty(&s->fid_list)) {
+        snapshot_error(f, "the 9p filesystem is in use");
+        return;
+    }
+    snapshot_var(f, s->msize);
+}
+
 VIRTIODevice *virtio_9p_init(VIRTIOBusDef *bus, FSDevice *fs,
                              const char *mount_tag)
 
@@ -2634,6 +2704,7 @@ VIRTIODevice *virtio_9p_init(VIRTIOBusDef *bus, FSDevice *fs,
     virtio_init(&s->common, bus,
                 9, 2 + len, virtio_9p_recv_request);
     s->common.device_features = 1 << 0;
+    s->common.device_snapshot = virtio_9p_snapshot;
 
     /* set the mount tag */
     cfg = s->common.config_space;
@@ -28,6 +28,7 @@
 
 #include "iomem.h"
 #include "pci.h"
+#include "snapshot.h"
 
 #define VIRTIO_PAGE_SIZE 4096
 
@@ -58,6 +59,7 @@ typedef struct VIRTIODevice VIRTIODevice;
 #define VIRTIO_DEBUG_9P (1 << 1)
 
 void virtio_set_debug(VIRTIODevice *s, int debug_flags);
+void virtio_snapshot(VIRTIODevice *s, SnapshotFile *f);
 
 /* block device */
 
@@ -73,6 +75,9 @@ struct BlockDevice {
     int (*write_async)(BlockDevice *bs,
                        uint64_t sector_num, const uint8_t *buf, int n,
                        BlockDeviceCompletionFunc *cb, void *opaque);
+    /* optional: saves or restores the modified sectors which are not
+       written to the image */
+    void (*snapshot)(BlockDevice *bs, SnapshotFile *f);
     void *opaque;
 };
 
@@ -88,6 +93,7 @@ struct EthernetDevice {
                          const uint8_t *buf, int len);
     void *opaque;
 #if !defined(EMSCRIPTEN)
+    /* '*pdelay' is in ms, -1 meaning no timeout */
     void (*select_fill)(EthernetDevice *net, int *pfd_max,
                         fd_set *rfds, fd_set *wfds, fd_set *efds,
                         int *pdelay);
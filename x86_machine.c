@@ -1552,7 +1552,7 @@ static void kvm_map_ram(PhysMemoryMap *mem_map, PhysMemoryRange *pr)
     struct kvm_userspace_memory_region region;
     int flags;
 
-    region.slot = pr - mem_map->phys_mem_range;
+    region.slot = pr->index;
     flags = 0;
     if (pr->devram_flags & DEVRAM_FLAG_ROM)
         flags |= KVM_MEM_READONLY;
@@ -1628,7 +1628,7 @@ static const uint32_t *kvm_get_dirty_bits(PhysMemoryMap *mem_map,
         /* not mapped: we assume no modification was made */
         memset(pr->dirty_bits, 0, pr->dirty_bits_size);
     } else {
-        dlog.slot = pr - mem_map->phys_mem_range;
+        dlog.slot = pr->index;
         dlog.dirty_bitmap = pr->dirty_bits;
         if (ioctl(s->vm_fd, KVM_GET_DIRTY_LOG, &dlog) < 0) {
             perror("KVM_GET_DIRTY_LOG");
@@ -1950,8 +1950,8 @@ static uint64_t cpu_get_tsc(void *opaque)
 }
 #endif
 
-static void pc_flush_tlb_write_range(void *opaque, uint8_t *ram_addr,
-                                     size_t ram_size)
+static void pc_flush_tlb_write_range(void *opaque, PhysMemoryRange *pr,
+                                     uint8_t *ram_addr, size_t ram_size)
 {
     PCMachine *s = opaque;
     x86_cpu_flush_tlb_write_range_ram(s->cpu_state, ram_addr, ram_size);
@@ -2522,11 +2522,15 @@ static void copy_kernel(PCMachine *s, const uint8_t *buf, int buf_len,
     }
 }
 
-/* in ms */
-static int pc_machine_get_sleep_duration(VirtMachine *s1, int delay)
+/* the CMOS and PIT timers are polled at least every MAX_SLEEP_TIME ms */
+#define MAX_SLEEP_TIME 10
+
+static int64_t pc_machine_get_sleep_duration(VirtMachine *s1, int64_t delay1)
 {
     PCMachine *s = (PCMachine *)s1;
+    int delay; /* in ms */
 
+    delay = MAX_SLEEP_TIME;
 #ifdef USE_KVM
     if (s->kvm_enabled) {
         /* XXX: improve */
@@ -2540,7 +2544,9 @@ static int pc_machine_get_sleep_duration(VirtMachine *s1, int delay)
         if (!x86_cpu_get_power_down(s->cpu_state))
             delay = 0;
     }
-    return delay;
+    if (delay1 < 0 || delay1 > (int64_t)delay * 1000000)
+        delay1 = (int64_t)delay * 1000000;
+    return delay1;
 }
 
 static void pc_machine_interp(VirtMachine *s1, int max_exec_cycles)